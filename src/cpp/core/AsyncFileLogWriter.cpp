@@ -0,0 +1,408 @@
+/*
+ * AsyncFileLogWriter.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include <core/AsyncFileLogWriter.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+
+#include <core/FileSerializer.hpp>
+#include <core/SafeConvert.hpp>
+#include <core/system/System.hpp>
+
+// NOTE: none of the code in this file can log errors (it would re-enter
+// the log writer) so errors are swallowed
+
+namespace core {
+
+namespace {
+
+// writer whose pending entries are written when the process exits
+AsyncFileLogWriter* s_pExitWriter = NULL;
+
+void flushAtExit()
+{
+   if (s_pExitWriter)
+      s_pExitWriter->flush();
+}
+
+} // anonymous namespace
+
+AsyncFileLogWriter::AsyncFileLogWriter(const std::string& programIdentity,
+                                       int logLevel,
+                                       const FilePath& logDir,
+                                       const AsyncLogOptions& options)
+   : programIdentity_(programIdentity),
+     logLevel_(logLevel),
+     options_(options),
+     pid_(::getpid()),
+     pending_(std::max(options.maxPendingEntries, std::size_t(1))),
+     pendingStart_(0),
+     pendingCount_(0),
+     dropped_(0),
+     droppedErrors_(0),
+     tokens_(options.maxBurstEntries),
+     errorTokens_(options.maxBurstErrors),
+     lastRefill_(boost::posix_time::microsec_clock::universal_time()),
+     threadStarted_(false),
+     stopping_(false),
+     fd_(-1),
+     fileSize_(0),
+     fileOpened_(0)
+{
+   logDir.ensureDirectory();
+
+   logFile_ = logDir.childPath(programIdentity + ".log");
+
+   if (!logFile_.exists())
+   {
+      // swallow errors -- we can't log so it doesn't matter
+      core::appendToFile(logFile_, "");
+   }
+
+   static bool s_registeredAtExit = false;
+   if (!s_registeredAtExit)
+   {
+      ::atexit(flushAtExit);
+      s_registeredAtExit = true;
+   }
+   s_pExitWriter = this;
+}
+
+AsyncFileLogWriter::~AsyncFileLogWriter()
+{
+   try
+   {
+      if (s_pExitWriter == this)
+         s_pExitWriter = NULL;
+
+      // let the writer thread write what's left and exit
+      if (threadStarted_)
+      {
+         {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            stopping_ = true;
+         }
+         pendingCondition_.notify_all();
+         thread_.join();
+      }
+
+      flush();
+      closeLogFile();
+   }
+   catch(...)
+   {
+   }
+}
+
+void AsyncFileLogWriter::log(core::system::LogLevel logLevel,
+                             const std::string& message)
+{
+   if (logLevel > logLevel_)
+      return;
+
+   // in a forked child (which doesn't have our thread and might have
+   // copied our mutexes in a locked state) just append to the file
+   if (::getpid() != pid_)
+   {
+      core::appendToFile(logFile_, formatLogEntry(programIdentity_, message));
+      return;
+   }
+
+   bool isError = (logLevel == core::system::kLogLevelError);
+   if (!admitEntry(isError))
+      return;
+
+   std::string entry = formatLogEntry(programIdentity_, message);
+
+   bool startThread = false;
+   {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+
+      if (pendingCount_ < pending_.size())
+      {
+         std::size_t index = (pendingStart_ + pendingCount_) % pending_.size();
+         pending_[index].swap(entry);
+         pendingCount_++;
+      }
+      else if (isError)
+      {
+         droppedErrors_++;
+      }
+      else
+      {
+         dropped_++;
+      }
+
+      if (!threadStarted_)
+      {
+         threadStarted_ = true;
+         startThread = true;
+      }
+   }
+
+   if (startThread)
+   {
+      try
+      {
+         // block all signals so the thread never receives them (note we
+         // can't use safeLaunchThread as it logs errors)
+         core::system::SignalBlocker signalBlocker;
+         Error error = signalBlocker.blockAll();
+
+         boost::thread t(boost::bind(&AsyncFileLogWriter::writerThreadMain,
+                                     this));
+         thread_ = t.move();
+      }
+      catch(const boost::thread_resource_error&)
+      {
+         boost::lock_guard<boost::mutex> lock(mutex_);
+         threadStarted_ = false;
+      }
+   }
+
+   pendingCondition_.notify_all();
+
+   // write synchronously if we couldn't start the thread
+   if (startThread && !threadStarted_)
+      flush();
+}
+
+void AsyncFileLogWriter::flush()
+{
+   try
+   {
+      writePending();
+   }
+   catch(...)
+   {
+   }
+}
+
+bool AsyncFileLogWriter::admitEntry(bool isError)
+{
+   using namespace boost::posix_time;
+
+   boost::lock_guard<boost::mutex> lock(mutex_);
+
+   // refill the token buckets for the time since we last did
+   ptime now = microsec_clock::universal_time();
+   double seconds = (now - lastRefill_).total_microseconds() / 1000000.0;
+   if (seconds > 0)
+   {
+      tokens_ = std::min(options_.maxBurstEntries,
+                         tokens_ + (seconds * options_.maxEntriesPerSecond));
+      errorTokens_ = std::min(options_.maxBurstErrors,
+                              errorTokens_ +
+                                 (seconds * options_.maxErrorsPerSecond));
+      lastRefill_ = now;
+   }
+
+   double& tokens = isError ? errorTokens_ : tokens_;
+   if (tokens >= 1)
+   {
+      tokens -= 1;
+      return true;
+   }
+   else
+   {
+      if (isError)
+         droppedErrors_++;
+      else
+         dropped_++;
+      return false;
+   }
+}
+
+void AsyncFileLogWriter::writerThreadMain()
+{
+   try
+   {
+      while (true)
+      {
+         {
+            // wait for entries (waking up periodically to report any
+            // which were dropped)
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            if (pendingCount_ == 0 && dropped_ == 0 && droppedErrors_ == 0 &&
+                !stopping_)
+            {
+               pendingCondition_.timed_wait(lock,
+                                            boost::posix_time::seconds(1));
+            }
+
+            if (pendingCount_ == 0 && stopping_)
+               break;
+         }
+
+         writePending();
+      }
+   }
+   catch(...)
+   {
+   }
+}
+
+void AsyncFileLogWriter::writePending()
+{
+   boost::lock_guard<boost::mutex> writeLock(writeMutex_);
+
+   std::vector<std::string> entries;
+   std::size_t dropped = 0;
+   std::size_t droppedErrors = 0;
+   {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+
+      entries.resize(pendingCount_);
+      for (std::size_t i = 0; i < pendingCount_; i++)
+         entries[i].swap(pending_[(pendingStart_ + i) % pending_.size()]);
+      pendingStart_ = 0;
+      pendingCount_ = 0;
+
+      std::swap(dropped, dropped_);
+      std::swap(droppedErrors, droppedErrors_);
+   }
+
+   if (entries.empty() && dropped == 0 && droppedErrors == 0)
+      return;
+
+   std::string batch;
+   if (dropped > 0)
+   {
+      boost::format fmt("%1% log entries were dropped (more than %2% "
+                        "per second)");
+      batch.append(formatLogEntry(
+            programIdentity_,
+            boost::str(fmt % dropped % options_.maxEntriesPerSecond)));
+   }
+   if (droppedErrors > 0)
+   {
+      boost::format fmt("%1% log errors were dropped (more than %2% "
+                        "per second)");
+      batch.append(formatLogEntry(
+            programIdentity_,
+            boost::str(fmt % droppedErrors % options_.maxErrorsPerSecond)));
+   }
+   for (std::vector<std::string>::const_iterator it = entries.begin();
+        it != entries.end();
+        ++it)
+   {
+      batch.append(*it);
+   }
+
+   writeEntries(batch);
+}
+
+void AsyncFileLogWriter::writeEntries(const std::string& entries)
+{
+   // if another process rotated the log then start writing to the new one
+   if (fd_ != -1)
+   {
+      struct stat fdInfo, pathInfo;
+      if (::fstat(fd_, &fdInfo) != 0 ||
+          ::stat(logFile_.absolutePath().c_str(), &pathInfo) != 0 ||
+          fdInfo.st_ino != pathInfo.st_ino ||
+          fdInfo.st_dev != pathInfo.st_dev)
+      {
+         closeLogFile();
+      }
+      else
+      {
+         fileSize_ = fdInfo.st_size;
+      }
+   }
+
+   if (fd_ == -1)
+      openLogFile();
+
+   if (fd_ != -1 && fileSize_ > 0 &&
+       (fileSize_ + entries.size() > options_.maxFileSize ||
+        std::time(NULL) - fileOpened_ > options_.maxFileAgeSeconds))
+   {
+      rotateLogFile();
+      openLogFile();
+   }
+
+   if (fd_ == -1)
+      return;
+
+   const char* pos = entries.data();
+   std::size_t remaining = entries.size();
+   while (remaining > 0)
+   {
+      ssize_t written = ::write(fd_, pos, remaining);
+      if (written == -1)
+      {
+         if (errno == EINTR)
+            continue;
+         break;
+      }
+      pos += written;
+      remaining -= written;
+      fileSize_ += written;
+   }
+}
+
+void AsyncFileLogWriter::openLogFile()
+{
+   fd_ = ::open(logFile_.absolutePath().c_str(),
+                O_WRONLY | O_CREAT | O_APPEND,
+                0666);
+   if (fd_ == -1)
+      return;
+
+   // don't leak the file into child processes
+   ::fcntl(fd_, F_SETFD, FD_CLOEXEC);
+
+   struct stat info;
+   fileSize_ = (::fstat(fd_, &info) == 0) ? info.st_size : 0;
+   fileOpened_ = std::time(NULL);
+}
+
+void AsyncFileLogWriter::closeLogFile()
+{
+   if (fd_ != -1)
+   {
+      ::close(fd_);
+      fd_ = -1;
+   }
+}
+
+void AsyncFileLogWriter::rotateLogFile()
+{
+   closeLogFile();
+
+   // shift the retained logs up a generation (dropping the oldest)
+   std::string path = logFile_.absolutePath();
+   for (int i = options_.generations - 1; i >= 1; i--)
+   {
+      std::string from = path + "." + safe_convert::numberToString(i);
+      std::string to = path + "." + safe_convert::numberToString(i + 1);
+      ::rename(from.c_str(), to.c_str());
+   }
+
+   if (options_.generations > 0)
+      ::rename(path.c_str(), (path + ".1").c_str());
+   else
+      ::unlink(path.c_str());
+}
+
+} // namespace core
@@ -0,0 +1,175 @@
+/*
+ * AsyncFileLogWriterTests.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include <core/AsyncFileLogWriter.hpp>
+
+#include <stdlib.h>
+
+#include <iostream>
+
+#include <boost/assert.hpp>
+#include <boost/format.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <core/FileLogWriter.hpp>
+#include <core/FileSerializer.hpp>
+#include <core/SafeConvert.hpp>
+
+namespace core {
+
+namespace {
+
+const int kEntries = 100000;
+
+std::string entry(int i)
+{
+   return "log storm entry " + safe_convert::numberToString(i) +
+          " (Input/output error)";
+}
+
+// errors have their own budget (so they aren't crowded out by a storm of
+// warnings) and are in the file once the writer is flushed
+bool verifyErrors(const FilePath& logDir)
+{
+   AsyncLogOptions options;
+   options.maxEntriesPerSecond = 10;
+   options.maxBurstEntries = 100;
+   options.maxErrorsPerSecond = 10;
+   options.maxBurstErrors = 1000;
+   AsyncFileLogWriter writer("errors", system::kLogLevelDebug,
+                             logDir, options);
+   for (int i = 0; i < 1000; i++)
+      writer.log(system::kLogLevelWarning, entry(i));
+   for (int i = 0; i < 1000; i++)
+      writer.log(system::kLogLevelError, entry(i));
+   writer.flush();
+
+   std::vector<std::string> lines;
+   Error error = readStringVectorFromFile(logDir.childPath("errors.log"),
+                                          &lines);
+   if (error)
+      return false;
+   std::size_t entryLines = 0;
+   for (std::size_t i = 0; i < lines.size(); i++)
+   {
+      if (boost::algorithm::contains(lines[i], "entry ") &&
+          !boost::algorithm::contains(lines[i], "were dropped"))
+      {
+         entryLines++;
+      }
+   }
+
+   // the first 100 warnings (the burst) and then all of the errors
+   return entryLines >= 1100 && entryLines < 1200;
+}
+
+// other entries are limited to the burst plus the sustained rate and the
+// number dropped is reported
+void verifyRateLimit(const FilePath& logDir)
+{
+   AsyncLogOptions options;
+   options.maxEntriesPerSecond = 10;
+   options.maxBurstEntries = 100;
+   {
+      AsyncFileLogWriter writer("ratelimit", system::kLogLevelDebug,
+                                logDir, options);
+      for (int i = 0; i < 1000; i++)
+         writer.log(system::kLogLevelWarning, entry(i));
+   }
+
+   std::vector<std::string> lines;
+   Error error = readStringVectorFromFile(logDir.childPath("ratelimit.log"),
+                                          &lines);
+   BOOST_ASSERT(!error);
+   std::size_t droppedLines = 0;
+   for (std::size_t i = 0; i < lines.size(); i++)
+   {
+      if (boost::algorithm::contains(lines[i], "were dropped"))
+         droppedLines++;
+   }
+   BOOST_ASSERT(droppedLines > 0);
+   BOOST_ASSERT(lines.size() - droppedLines >= 100);
+   BOOST_ASSERT(lines.size() - droppedLines < 200);
+}
+
+// the log is rotated at maxFileSize and generations are retained
+void verifyRotation(const FilePath& logDir)
+{
+   AsyncLogOptions options;
+   options.maxEntriesPerSecond = 1000000;
+   options.maxBurstEntries = 1000000;
+   options.maxPendingEntries = 1000000;
+   options.maxFileSize = 64 * 1024;
+   options.generations = 2;
+   {
+      AsyncFileLogWriter writer("rotation", system::kLogLevelDebug,
+                                logDir, options);
+      for (int i = 0; i < 10000; i++)
+      {
+         writer.log(system::kLogLevelWarning, entry(i));
+
+         // write in several batches
+         if (i % 1000 == 0)
+            writer.flush();
+      }
+   }
+
+   BOOST_ASSERT(logDir.childPath("rotation.log").exists());
+   BOOST_ASSERT(logDir.childPath("rotation.log.1").exists());
+   BOOST_ASSERT(logDir.childPath("rotation.log.2").exists());
+   BOOST_ASSERT(!logDir.childPath("rotation.log.3").exists());
+}
+
+double benchmark(LogWriter* pWriter)
+{
+   using namespace boost::posix_time;
+
+   ptime start = microsec_clock::universal_time();
+   for (int i = 0; i < kEntries; i++)
+      pWriter->log(system::kLogLevelWarning, entry(i));
+   ptime end = microsec_clock::universal_time();
+
+   return (end - start).total_microseconds() / 1000000.0;
+}
+
+} // anonymous namespace
+
+
+void runAsyncFileLogWriterTests()
+{
+   char dirTemplate[] = "/tmp/rs-async-log-XXXXXX";
+   if (::mkdtemp(dirTemplate) == NULL)
+      return;
+   FilePath logDir(dirTemplate);
+
+   bool errors = verifyErrors(logDir);
+   BOOST_ASSERT(errors);
+   verifyRateLimit(logDir);
+   verifyRotation(logDir);
+
+   // time to log a storm of warnings (the default rate limit applies)
+   AsyncFileLogWriter writer("benchmark", system::kLogLevelDebug, logDir);
+   double seconds = benchmark(&writer);
+   FileLogWriter fileWriter("benchmark-sync", system::kLogLevelDebug, logDir);
+   double fileSeconds = benchmark(&fileWriter);
+   std::cout << boost::format("errors %1%; logged %2% entries in "
+                              "%3%s (FileLogWriter %4%s)")
+                  % (errors ? "ok" : "FAILED")
+                  % kEntries % seconds % fileSeconds
+             << std::endl;
+
+   logDir.remove();
+}
+
+} // namespace core
@@ -0,0 +1,632 @@
+/*
+ * CompactFileTree.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include <core/CompactFileTree.hpp>
+
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace core {
+
+namespace {
+
+// marks a slot of the names or children table whose entry was released
+const uint32_t kReleasedSlot = 0xFFFFFFFE;
+
+// don't bother compacting small arenas
+const std::size_t kMinCompactBytes = 64 * 1024;
+
+std::string lastComponent(const std::string& path)
+{
+   std::string::size_type pos = path.find_last_of('/');
+   if (pos == std::string::npos)
+      return path;
+   else
+      return path.substr(pos + 1);
+}
+
+typedef std::pair<FileInfo, CompactFileTree::NodeId> Child;
+
+bool childLessThan(const Child& a, const Child& b)
+{
+   return fileInfoPathLessThan(a.first, b.first);
+}
+
+} // anonymous namespace
+
+const CompactFileTree::NodeId CompactFileTree::kNoNode;
+const uint32_t CompactFileTree::Names::kNoName;
+
+
+uint32_t CompactFileTree::Names::intern(const std::string& name)
+{
+   uint32_t id = lookup(name);
+   if (id != kNoName)
+   {
+      refs_[id]++;
+      return id;
+   }
+
+   // keep the table at most half full (including released slots)
+   if ((tableUsed_ + 1) * 2 > table_.size())
+      rehash(std::max<std::size_t>(64, (offsets_.size() + 1) * 4));
+
+   if (!freeIds_.empty())
+   {
+      id = freeIds_.back();
+      freeIds_.pop_back();
+   }
+   else
+   {
+      id = offsets_.size();
+      offsets_.push_back(0);
+      refs_.push_back(0);
+   }
+
+   offsets_[id] = arena_.size();
+   refs_[id] = 1;
+   arena_.insert(arena_.end(), name.begin(), name.end());
+   arena_.push_back('\0');
+   liveBytes_ += name.size() + 1;
+
+   std::size_t mask = table_.size() - 1;
+   std::size_t slot = hash(name.c_str(), name.size()) & mask;
+   while (table_[slot] != kNoName && table_[slot] != kReleasedSlot)
+      slot = (slot + 1) & mask;
+   if (table_[slot] == kNoName)
+      tableUsed_++;
+   table_[slot] = id;
+
+   return id;
+}
+
+uint32_t CompactFileTree::Names::lookup(const std::string& name) const
+{
+   if (table_.empty())
+      return kNoName;
+
+   std::size_t slot = findSlot(name, hash(name.c_str(), name.size()));
+   return table_[slot];
+}
+
+void CompactFileTree::Names::release(uint32_t id)
+{
+   if (--refs_[id] > 0)
+      return;
+
+   std::string name(get(id));
+   std::size_t slot = findSlot(name, hash(name.c_str(), name.size()));
+   table_[slot] = kReleasedSlot;
+
+   liveBytes_ -= name.size() + 1;
+   offsets_[id] = kNoName;
+   freeIds_.push_back(id);
+
+   if (arena_.size() > kMinCompactBytes && liveBytes_ * 2 < arena_.size())
+      compact();
+}
+
+void CompactFileTree::Names::clear()
+{
+   arena_.clear();
+   offsets_.clear();
+   refs_.clear();
+   freeIds_.clear();
+   table_.clear();
+   liveBytes_ = 0;
+   tableUsed_ = 0;
+}
+
+std::size_t CompactFileTree::Names::memoryUsage() const
+{
+   return arena_.capacity() +
+          (offsets_.capacity() + refs_.capacity() + freeIds_.capacity() +
+           table_.capacity()) * sizeof(uint32_t);
+}
+
+// FNV-1a
+uint32_t CompactFileTree::Names::hash(const char* pName, std::size_t length)
+{
+   uint32_t hash = 2166136261U;
+   for (std::size_t i = 0; i < length; i++)
+   {
+      hash ^= static_cast<unsigned char>(pName[i]);
+      hash *= 16777619U;
+   }
+   return hash;
+}
+
+// slot holding the name or the empty slot which ends its probe sequence
+std::size_t CompactFileTree::Names::findSlot(const std::string& name,
+                                             uint32_t hash) const
+{
+   std::size_t mask = table_.size() - 1;
+   std::size_t slot = hash & mask;
+   while (true)
+   {
+      uint32_t id = table_[slot];
+      if (id == kNoName)
+         return slot;
+      if (id != kReleasedSlot && ::strcmp(get(id), name.c_str()) == 0)
+         return slot;
+      slot = (slot + 1) & mask;
+   }
+}
+
+void CompactFileTree::Names::rehash(std::size_t minSize)
+{
+   std::size_t tableSize = 64;
+   while (tableSize < minSize)
+      tableSize *= 2;
+
+   table_.assign(tableSize, kNoName);
+   tableUsed_ = 0;
+
+   std::size_t mask = tableSize - 1;
+   for (uint32_t id = 0; id < offsets_.size(); id++)
+   {
+      if (offsets_[id] == kNoName)
+         continue;
+
+      const char* pName = get(id);
+      std::size_t slot = hash(pName, ::strlen(pName)) & mask;
+      while (table_[slot] != kNoName)
+         slot = (slot + 1) & mask;
+      table_[slot] = id;
+      tableUsed_++;
+   }
+}
+
+// drop the released names from the arena (ids are unchanged)
+void CompactFileTree::Names::compact()
+{
+   std::vector<char> arena;
+   arena.reserve(liveBytes_);
+   for (uint32_t id = 0; id < offsets_.size(); id++)
+   {
+      if (offsets_[id] == kNoName)
+         continue;
+
+      const char* pName = get(id);
+      std::size_t offset = arena.size();
+      arena.insert(arena.end(), pName, pName + ::strlen(pName) + 1);
+      offsets_[id] = offset;
+   }
+   arena_.swap(arena);
+}
+
+
+CompactFileTree::CompactFileTree()
+   : childTableUsed_(0), root_(kNoNode), size_(0)
+{
+}
+
+CompactFileTree::CompactFileTree(const tree<FileInfo>& fileTree)
+   : childTableUsed_(0), root_(kNoNode), size_(0)
+{
+   assign(fileTree);
+}
+
+void CompactFileTree::assign(const tree<FileInfo>& fileTree)
+{
+   clear();
+   if (fileTree.empty())
+      return;
+
+   nodes_.reserve(fileTree.size());
+   rehashChildren(fileTree.size() * 2);
+   tree<FileInfo>::iterator rootIt = fileTree.begin();
+   root_ = allocateNode(names_.intern(rootIt->absolutePath()), kNoNode);
+   setFileInfo(root_, *rootIt);
+   addSubtreeChildren(root_, rootIt);
+}
+
+void CompactFileTree::assign(const FileInfo& root)
+{
+   clear();
+   root_ = allocateNode(names_.intern(root.absolutePath()), kNoNode);
+   setFileInfo(root_, root);
+}
+
+void CompactFileTree::clear()
+{
+   nodes_.clear();
+   freeNodes_.clear();
+   childTable_.clear();
+   childTableUsed_ = 0;
+   names_.clear();
+   root_ = kNoNode;
+   size_ = 0;
+}
+
+std::size_t CompactFileTree::memoryUsage() const
+{
+   return nodes_.capacity() * sizeof(Node) +
+          (freeNodes_.capacity() + childTable_.capacity()) * sizeof(NodeId) +
+          names_.memoryUsage();
+}
+
+CompactFileTree::NodeId CompactFileTree::next(NodeId id) const
+{
+   if (nodes_[id].firstChild != kNoNode)
+      return nodes_[id].firstChild;
+
+   while (id != kNoNode)
+   {
+      if (nodes_[id].nextSibling != kNoNode)
+         return nodes_[id].nextSibling;
+      id = nodes_[id].parent;
+   }
+
+   return kNoNode;
+}
+
+CompactFileTree::NodeId CompactFileTree::find(
+                                       const std::string& absolutePath) const
+{
+   if (root_ == kNoNode)
+      return kNoNode;
+
+   const char* pRootPath = names_.get(nodes_[root_].name);
+   std::size_t rootLength = ::strlen(pRootPath);
+   if (absolutePath.compare(0, rootLength, pRootPath) != 0)
+      return kNoNode;
+   if (absolutePath.size() == rootLength)
+      return root_;
+   if (rootLength > 0 &&
+       pRootPath[rootLength - 1] != '/' &&
+       absolutePath[rootLength] != '/')
+   {
+      return kNoNode;
+   }
+
+   // walk down the tree a component at a time
+   NodeId id = root_;
+   std::string::size_type begin = rootLength;
+   while (id != kNoNode && begin < absolutePath.size())
+   {
+      std::string::size_type end = absolutePath.find('/', begin);
+      if (end == std::string::npos)
+         end = absolutePath.size();
+      if (end > begin)
+         id = findChild(id, absolutePath.substr(begin, end - begin));
+      begin = end + 1;
+   }
+
+   return id;
+}
+
+CompactFileTree::NodeId CompactFileTree::findChild(
+                                             NodeId parentId,
+                                             const std::string& name) const
+{
+   uint32_t nameId = names_.lookup(name);
+   if (nameId == Names::kNoName || childTable_.empty())
+      return kNoNode;
+
+   return childTable_[findChildSlot(parentId, nameId)];
+}
+
+std::string CompactFileTree::name(NodeId id) const
+{
+   return names_.get(nodes_[id].name);
+}
+
+std::string CompactFileTree::absolutePath(NodeId id) const
+{
+   std::vector<NodeId> ancestors;
+   for (NodeId ancestorId = id;
+        ancestorId != kNoNode;
+        ancestorId = nodes_[ancestorId].parent)
+   {
+      ancestors.push_back(ancestorId);
+   }
+
+   std::string path;
+   for (std::vector<NodeId>::reverse_iterator it = ancestors.rbegin();
+        it != ancestors.rend();
+        ++it)
+   {
+      if (!path.empty() && path[path.size() - 1] != '/')
+         path.append(1, '/');
+      path.append(names_.get(nodes_[*it].name));
+   }
+
+   return path;
+}
+
+bool CompactFileTree::isDirectory(NodeId id) const
+{
+   return (nodes_[id].flags & kDirectory) != 0;
+}
+
+FileInfo CompactFileTree::fileInfo(NodeId id) const
+{
+   const Node& node = nodes_[id];
+   return FileInfo(absolutePath(id),
+                   (node.flags & kDirectory) != 0,
+                   node.size,
+                   node.lastWriteTime,
+                   (node.flags & kSymlink) != 0);
+}
+
+void CompactFileTree::toTree(NodeId id, tree<FileInfo>* pTree) const
+{
+   pTree->clear();
+   if (id == kNoNode)
+      return;
+
+   tree<FileInfo>::iterator it = pTree->set_head(fileInfo(id));
+   toTreeChildren(id, it, pTree);
+}
+
+CompactFileTree::NodeId CompactFileTree::addChild(NodeId parentId,
+                                                  const FileInfo& fileInfo)
+{
+   std::string childName = lastComponent(fileInfo.absolutePath());
+   NodeId id = findChild(parentId, childName);
+   if (id == kNoNode)
+      id = allocateNode(names_.intern(childName), parentId);
+
+   setFileInfo(id, fileInfo);
+   return id;
+}
+
+CompactFileTree::NodeId CompactFileTree::addSubtree(
+                              NodeId parentId,
+                              const tree<FileInfo>::iterator_base& subtreeIt)
+{
+   NodeId id = addChild(parentId, *subtreeIt);
+   addSubtreeChildren(id, subtreeIt);
+   return id;
+}
+
+CompactFileTree::NodeId CompactFileTree::insert(const FileInfo& fileInfo)
+{
+   if (root_ == kNoNode)
+      return kNoNode;
+
+   std::string path = fileInfo.absolutePath();
+   NodeId id = find(path);
+   if (id != kNoNode)
+   {
+      setFileInfo(id, fileInfo);
+      return id;
+   }
+
+   // find (or add) the parent. we run out of parents if the path isn't
+   // below the root
+   std::string::size_type pos = path.find_last_of('/');
+   if (pos == std::string::npos)
+      return kNoNode;
+   std::string parentPath = path.substr(0, pos == 0 ? 1 : pos);
+   if (parentPath.size() >= path.size())
+      return kNoNode;
+
+   NodeId parentId = find(parentPath);
+   if (parentId == kNoNode)
+      parentId = insert(FileInfo(parentPath, true));
+   if (parentId == kNoNode)
+      return kNoNode;
+
+   return addChild(parentId, fileInfo);
+}
+
+void CompactFileTree::update(NodeId id, const FileInfo& fileInfo)
+{
+   setFileInfo(id, fileInfo);
+}
+
+void CompactFileTree::remove(NodeId id)
+{
+   if (id == root_)
+   {
+      clear();
+      return;
+   }
+
+   removeChildren(id);
+
+   // unlink from the parent
+   removeFromChildTable(id);
+   Node& node = nodes_[id];
+   if (node.prevSibling != kNoNode)
+      nodes_[node.prevSibling].nextSibling = node.nextSibling;
+   else
+      nodes_[node.parent].firstChild = node.nextSibling;
+   if (node.nextSibling != kNoNode)
+      nodes_[node.nextSibling].prevSibling = node.prevSibling;
+
+   freeNode(id);
+}
+
+CompactFileTree::NodeId CompactFileTree::allocateNode(uint32_t name,
+                                                      NodeId parentId)
+{
+   // keep the children table at most half full (including released slots)
+   if (parentId != kNoNode && (childTableUsed_ + 1) * 2 > childTable_.size())
+      rehashChildren((size_ + 1) * 4);
+
+   NodeId id;
+   if (!freeNodes_.empty())
+   {
+      id = freeNodes_.back();
+      freeNodes_.pop_back();
+   }
+   else
+   {
+      id = nodes_.size();
+      nodes_.push_back(Node());
+   }
+
+   Node& node = nodes_[id];
+   node.name = name;
+   node.parent = parentId;
+   node.firstChild = kNoNode;
+   node.prevSibling = kNoNode;
+   node.nextSibling = kNoNode;
+   node.flags = 0;
+   node.size = 0;
+   node.lastWriteTime = 0;
+
+   // link as the first child of the parent
+   if (parentId != kNoNode)
+   {
+      Node& parent = nodes_[parentId];
+      node.nextSibling = parent.firstChild;
+      if (parent.firstChild != kNoNode)
+         nodes_[parent.firstChild].prevSibling = id;
+      parent.firstChild = id;
+      addToChildTable(id);
+   }
+
+   size_++;
+   return id;
+}
+
+void CompactFileTree::setFileInfo(NodeId id, const FileInfo& fileInfo)
+{
+   Node& node = nodes_[id];
+   node.flags = (fileInfo.isDirectory() ? kDirectory : 0) |
+                (fileInfo.isSymlink() ? kSymlink : 0);
+   node.size = fileInfo.size();
+   node.lastWriteTime = fileInfo.lastWriteTime();
+}
+
+void CompactFileTree::removeChildren(NodeId id)
+{
+   NodeId childId = nodes_[id].firstChild;
+   while (childId != kNoNode)
+   {
+      NodeId nextId = nodes_[childId].nextSibling;
+      removeChildren(childId);
+      removeFromChildTable(childId);
+      freeNode(childId);
+      childId = nextId;
+   }
+   nodes_[id].firstChild = kNoNode;
+}
+
+void CompactFileTree::freeNode(NodeId id)
+{
+   names_.release(nodes_[id].name);
+   nodes_[id].name = Names::kNoName;
+   freeNodes_.push_back(id);
+   size_--;
+}
+
+// hash of a (parent, name) pair (the finalizer of MurmurHash3)
+uint32_t CompactFileTree::childHash(NodeId parentId, uint32_t name)
+{
+   uint64_t key = (static_cast<uint64_t>(parentId) << 32) | name;
+   key ^= key >> 33;
+   key *= 0xff51afd7ed558ccdULL;
+   key ^= key >> 33;
+   key *= 0xc4ceb9fe1a85ec53ULL;
+   key ^= key >> 33;
+   return static_cast<uint32_t>(key);
+}
+
+// slot holding the child or the empty slot which ends its probe sequence
+std::size_t CompactFileTree::findChildSlot(NodeId parentId,
+                                           uint32_t name) const
+{
+   std::size_t mask = childTable_.size() - 1;
+   std::size_t slot = childHash(parentId, name) & mask;
+   while (true)
+   {
+      NodeId id = childTable_[slot];
+      if (id == kNoNode)
+         return slot;
+      if (id != kReleasedSlot &&
+          nodes_[id].parent == parentId &&
+          nodes_[id].name == name)
+      {
+         return slot;
+      }
+      slot = (slot + 1) & mask;
+   }
+}
+
+void CompactFileTree::addToChildTable(NodeId id)
+{
+   std::size_t mask = childTable_.size() - 1;
+   std::size_t slot = childHash(nodes_[id].parent, nodes_[id].name) & mask;
+   while (childTable_[slot] != kNoNode && childTable_[slot] != kReleasedSlot)
+      slot = (slot + 1) & mask;
+   if (childTable_[slot] == kNoNode)
+      childTableUsed_++;
+   childTable_[slot] = id;
+}
+
+void CompactFileTree::removeFromChildTable(NodeId id)
+{
+   std::size_t slot = findChildSlot(nodes_[id].parent, nodes_[id].name);
+   childTable_[slot] = kReleasedSlot;
+}
+
+void CompactFileTree::rehashChildren(std::size_t minSize)
+{
+   std::size_t tableSize = 64;
+   while (tableSize < minSize)
+      tableSize *= 2;
+
+   childTable_.assign(tableSize, kNoNode);
+   childTableUsed_ = 0;
+
+   // free nodes have no name
+   for (NodeId id = 0; id < nodes_.size(); id++)
+   {
+      if (nodes_[id].parent != kNoNode && nodes_[id].name != Names::kNoName)
+         addToChildTable(id);
+   }
+}
+
+void CompactFileTree::addSubtreeChildren(
+                              NodeId id,
+                              const tree<FileInfo>::iterator_base& subtreeIt)
+{
+   for (tree<FileInfo>::sibling_iterator it = subtreeIt.begin();
+        it != subtreeIt.end();
+        ++it)
+   {
+      addSubtree(id, it);
+   }
+}
+
+void CompactFileTree::toTreeChildren(NodeId id,
+                                     const tree<FileInfo>::iterator& it,
+                                     tree<FileInfo>* pTree) const
+{
+   std::vector<Child> children;
+   for (NodeId childId = nodes_[id].firstChild;
+        childId != kNoNode;
+        childId = nodes_[childId].nextSibling)
+   {
+      children.push_back(std::make_pair(fileInfo(childId), childId));
+   }
+   std::sort(children.begin(), children.end(), childLessThan);
+
+   for (std::vector<Child>::const_iterator childIt = children.begin();
+        childIt != children.end();
+        ++childIt)
+   {
+      tree<FileInfo>::iterator addedIt = pTree->append_child(it,
+                                                             childIt->first);
+      toTreeChildren(childIt->second, addedIt, pTree);
+   }
+}
+
+} // namespace core
@@ -0,0 +1,157 @@
+/*
+ * ThreadTests.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include <core/Thread.hpp>
+
+#include <iostream>
+#include <vector>
+
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace core {
+namespace thread {
+
+namespace {
+
+const std::size_t kProducers = 4;
+const std::size_t kValuesPerProducer = 250000;
+const std::size_t kRingCapacity = 4096;
+
+// values encode their producer and sequence so the consumer can check
+// that nothing is lost or reordered
+std::size_t encode(std::size_t producer, std::size_t i)
+{
+   return (i * kProducers) + producer + 1;
+}
+
+void produceToRing(BoundedRing<std::size_t>* pRing, std::size_t producer)
+{
+   for (std::size_t i = 0; i < kValuesPerProducer; i++)
+   {
+      while (!pRing->enqueue(encode(producer, i)))
+         boost::this_thread::yield();
+   }
+}
+
+void produceToQueue(ThreadsafeQueue<std::size_t>* pQueue, std::size_t producer)
+{
+   for (std::size_t i = 0; i < kValuesPerProducer; i++)
+      pQueue->enque(encode(producer, i));
+}
+
+// returns true if each producer's values arrived complete and in order
+bool consume(const boost::function<bool(std::size_t*)>& dequeue)
+{
+   std::vector<std::size_t> nextIndex(kProducers, 0);
+   std::size_t remaining = kProducers * kValuesPerProducer;
+   while (remaining > 0)
+   {
+      std::size_t value;
+      if (!dequeue(&value))
+      {
+         boost::this_thread::yield();
+         continue;
+      }
+
+      std::size_t producer = (value - 1) % kProducers;
+      std::size_t index = (value - 1) / kProducers;
+      if (index != nextIndex[producer])
+         return false;
+      nextIndex[producer]++;
+      remaining--;
+   }
+
+   return true;
+}
+
+bool dequeueFromRing(BoundedRing<std::size_t>* pRing, std::size_t* pValue)
+{
+   return pRing->dequeue(pValue);
+}
+
+bool dequeueFromQueue(ThreadsafeQueue<std::size_t>* pQueue,
+                      std::size_t* pValue)
+{
+   return pQueue->deque(pValue);
+}
+
+// run the producers against a single consumer. returns the number of
+// seconds taken (negative if the values didn't arrive intact)
+double transfer(const boost::function<void(std::size_t)>& produce,
+                const boost::function<bool(std::size_t*)>& dequeue)
+{
+   using namespace boost::posix_time;
+
+   ptime start = microsec_clock::universal_time();
+   boost::thread_group producers;
+   for (std::size_t i = 0; i < kProducers; i++)
+      producers.create_thread(boost::bind(produce, i));
+   bool intact = consume(dequeue);
+   producers.join_all();
+   ptime end = microsec_clock::universal_time();
+
+   double seconds = (end - start).total_microseconds() / 1000000.0;
+   return intact ? seconds : -seconds;
+}
+
+// a small ring is frequently full and empty (exercises wrap around)
+bool verifyWrapAround()
+{
+   BoundedRing<std::size_t> ring(2);
+   std::size_t value = 0;
+   if (!ring.isEmpty() || !ring.enqueue(1) || !ring.enqueue(2))
+      return false;
+   if (ring.enqueue(3))
+      return false;
+   if (!ring.dequeue(&value) || value != 1 || !ring.enqueue(3))
+      return false;
+   if (!ring.dequeue(&value) || value != 2)
+      return false;
+   if (!ring.dequeue(&value) || value != 3)
+      return false;
+   return !ring.dequeue(&value) && ring.isEmpty();
+}
+
+} // anonymous namespace
+
+
+void runThreadTests()
+{
+   bool wrapAround = verifyWrapAround();
+   BOOST_ASSERT(wrapAround);
+
+   // many producers to one consumer through the ring and (for comparison)
+   // through a mutex protected queue
+   BoundedRing<std::size_t> ring(kRingCapacity);
+   double ringSeconds = transfer(boost::bind(produceToRing, &ring, _1),
+                                 boost::bind(dequeueFromRing, &ring, _1));
+   BOOST_ASSERT(ringSeconds >= 0);
+
+   ThreadsafeQueue<std::size_t> queue(true);
+   double queueSeconds = transfer(boost::bind(produceToQueue, &queue, _1),
+                                  boost::bind(dequeueFromQueue, &queue, _1));
+   BOOST_ASSERT(queueSeconds >= 0);
+
+   std::cout << boost::format("wrap around %1%; %2% producers enqueued "
+                              "%3% values in %4%s (ThreadsafeQueue %5%s)")
+                  % (wrapAround ? "ok" : "FAILED")
+                  % kProducers % (kProducers * kValuesPerProducer)
+                  % ringSeconds % queueSeconds
+             << std::endl;
+}
+
+} // namespace thread
+} // namespace core
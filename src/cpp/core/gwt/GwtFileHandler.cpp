@@ -13,18 +13,246 @@
 
 #include <core/gwt/GwtFileHandler.hpp>
 
+#include <map>
+
 #include <boost/regex.hpp>
+#include <boost/utility.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <boost/iostreams/device/back_inserter.hpp>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
 
+#include <core/FileInfo.hpp>
 #include <core/FilePath.hpp>
+#include <core/FileSerializer.hpp>
+#include <core/Hash.hpp>
+#include <core/Thread.hpp>
 #include <core/system/System.hpp>
 #include <core/http/Request.hpp>
 #include <core/http/Response.hpp>
+#include <core/http/Util.hpp>
 
 
 namespace core {
 namespace gwt {   
    
 namespace {
+
+// files larger than this are always served from disk
+const uintmax_t kMaxCachedFileSize = 4 * 1024 * 1024;
+
+// in-memory copy of a static file. we keep both the identity and gzip
+// encoded content so that serving a cached file never requires reading
+// from disk or compressing. each encoding has its own ETag (the two
+// bodies are different representations of the file)
+struct CachedFile
+{
+   std::time_t lastWriteTime;
+   uintmax_t size;
+   std::string contentType;
+   std::string eTag;
+   std::string content;
+   std::string gzipETag;
+   std::string gzipContent;
+};
+
+// status of a requested file (with a single stat call). returns an empty
+// FileInfo if the file doesn't exist
+FileInfo fileStatus(const FilePath& filePath)
+{
+#ifndef _WIN32
+   struct stat st;
+   if (::stat(filePath.absolutePath().c_str(), &st) != 0)
+      return FileInfo();
+
+   return FileInfo(filePath.absolutePath(),
+                   S_ISDIR(st.st_mode),
+                   st.st_size,
+                   st.st_mtime);
+#else
+   if (!filePath.exists())
+      return FileInfo();
+
+   return FileInfo(filePath);
+#endif
+}
+
+#ifndef _WIN32
+Error gzipContent(const std::string& content, std::string* pGzipContent)
+{
+   try
+   {
+      boost::iostreams::filtering_ostream gzipStream;
+      gzipStream.push(boost::iostreams::gzip_compressor());
+      gzipStream.push(boost::iostreams::back_inserter(*pGzipContent));
+      gzipStream.write(content.data(), content.size());
+      gzipStream.reset(); // flushes and closes the compressor
+      return Success();
+   }
+   catch(const std::exception& e)
+   {
+      Error error = systemError(boost::system::errc::io_error,
+                                ERROR_LOCATION);
+      error.addProperty("what", e.what());
+      return error;
+   }
+}
+#endif
+
+// cache of static files keyed by (real) path. files are loaded on first
+// request (so processes only hold what they actually serve) and entries
+// are invalidated when the file's modification time or size changes
+class FileCache : boost::noncopyable
+{
+public:
+   // get the cached file for the specified path (loading it into the
+   // cache if necessary). returns NULL if the file can't be cached
+   boost::shared_ptr<const CachedFile> get(const FilePath& filePath,
+                                           const FileInfo& fileInfo)
+   {
+      std::time_t lastWriteTime = fileInfo.lastWriteTime();
+      uintmax_t size = fileInfo.size();
+      if (fileInfo.isDirectory() || size > kMaxCachedFileSize)
+         return boost::shared_ptr<const CachedFile>();
+
+      LOCK_MUTEX(mutex_)
+      {
+         Files::const_iterator it = files_.find(filePath.absolutePath());
+         if (it != files_.end() &&
+             it->second->lastWriteTime == lastWriteTime &&
+             it->second->size == size)
+         {
+            return it->second;
+         }
+      }
+      END_LOCK_MUTEX
+
+      // load outside of the lock (concurrent loads of the same file
+      // are harmless, the last one in wins)
+      boost::shared_ptr<CachedFile> pFile(new CachedFile());
+      pFile->lastWriteTime = lastWriteTime;
+      pFile->size = size;
+      pFile->contentType = filePath.mimeContentType();
+      Error error = readStringFromFile(filePath, &pFile->content);
+      if (error)
+      {
+         LOG_ERROR(error);
+         return boost::shared_ptr<const CachedFile>();
+      }
+      pFile->eTag = core::hash::crc32Hash(pFile->content);
+#ifndef _WIN32
+      pFile->gzipETag = pFile->eTag + "-gzip";
+      error = gzipContent(pFile->content, &pFile->gzipContent);
+      if (error)
+      {
+         LOG_ERROR(error);
+         return boost::shared_ptr<const CachedFile>();
+      }
+#endif
+
+      LOCK_MUTEX(mutex_)
+      {
+         files_[filePath.absolutePath()] = pFile;
+      }
+      END_LOCK_MUTEX
+
+      return pFile;
+   }
+
+private:
+   boost::mutex mutex_;
+   typedef std::map<std::string,boost::shared_ptr<const CachedFile> > Files;
+   Files files_;
+};
+
+FileCache& fileCache()
+{
+   static FileCache instance;
+   return instance;
+}
+
+bool sendGzipContent(const CachedFile& file, const http::Request& request)
+{
+   return !file.gzipContent.empty() &&
+          request.acceptsEncoding(http::kGzipEncoding);
+}
+
+const std::string& eTagFor(const CachedFile& file,
+                           const http::Request& request)
+{
+   return sendGzipContent(file, request) ? file.gzipETag : file.eTag;
+}
+
+void setCachedFile(const CachedFile& file,
+                   const http::Request& request,
+                   http::Response* pResponse)
+{
+   pResponse->setContentType(file.contentType);
+   pResponse->setHeader("ETag", eTagFor(file, request));
+   pResponse->setHeader("Vary", "Accept-Encoding");
+
+   if (sendGzipContent(file, request))
+   {
+      // the body is already encoded so set it directly
+      pResponse->setBodyUnencoded(file.gzipContent);
+      pResponse->setContentEncoding(http::kGzipEncoding);
+   }
+   else
+   {
+      pResponse->setBodyUnencoded(file.content);
+   }
+}
+
+void setFile(const FilePath& filePath,
+             const FileInfo& fileInfo,
+             const http::Request& request,
+             http::Response* pResponse)
+{
+   boost::shared_ptr<const CachedFile> pFile = fileCache().get(filePath,
+                                                               fileInfo);
+   if (pFile)
+      setCachedFile(*pFile, request, pResponse);
+   else
+      pResponse->setFile(filePath, request);
+}
+
+void setCacheableFile(const FilePath& filePath,
+                      const FileInfo& fileInfo,
+                      const http::Request& request,
+                      http::Response* pResponse)
+{
+   boost::shared_ptr<const CachedFile> pFile = fileCache().get(filePath,
+                                                               fileInfo);
+   if (!pFile)
+   {
+      pResponse->setCacheableFile(filePath, request);
+      return;
+   }
+
+   // set Last-Modified
+   using namespace boost::posix_time;
+   ptime lastModifiedDate = from_time_t(pFile->lastWriteTime);
+   pResponse->setHeader("Last-Modified", http::util::httpDate(lastModifiedDate));
+
+   // compare to If-Modified-Since and If-None-Match
+   const std::string& eTag = eTagFor(*pFile, request);
+   if (lastModifiedDate == request.ifModifiedSince() ||
+       eTag == request.headerValue("If-None-Match"))
+   {
+      pResponse->removeHeader("Content-Type"); // upstream code may have set this
+      pResponse->setHeader("ETag", eTag);
+      pResponse->setHeader("Vary", "Accept-Encoding");
+      pResponse->setStatusCode(http::status::NotModified);
+      pResponse->setContentLength(0);
+   }
+   else
+   {
+      setCachedFile(*pFile, request, pResponse);
+   }
+}
    
 FilePath requestedFile(const std::string& wwwLocalPath,
                        const std::string& relativePath)
@@ -137,7 +365,12 @@ void handleFileRequest(const std::string& wwwLocalPath,
    // get the requested file 
    std::string relativePath = uri.substr(baseUri.length());
    FilePath filePath = requestedFile(wwwLocalPath, relativePath);
-   if (filePath.empty())
+   FileInfo fileInfo;
+   if (!filePath.empty())
+      fileInfo = fileStatus(filePath);
+
+   // directories aren't served (they are just not found)
+   if (fileInfo.empty() || fileInfo.isDirectory())
    {
       pResponse->setError(http::status::NotFound, 
                           request.uri() + " not found");
@@ -148,14 +381,14 @@ void handleFileRequest(const std::string& wwwLocalPath,
    if (regex_match(uri, boost::regex(".*\\.cache\\..*")))
    {
       pResponse->setCacheForeverHeaders();
-      pResponse->setFile(filePath, request);
+      setFile(filePath, fileInfo, request, pResponse);
    }
    
    // case: files designated to never be cached 
    else if (regex_match(uri, boost::regex(".*\\.nocache\\..*")))
    {
       pResponse->setNoCacheHeaders();
-      pResponse->setFile(filePath, request);
+      setFile(filePath, fileInfo, request, pResponse);
    }
    
    // case: normal cacheable file
@@ -163,7 +396,7 @@ void handleFileRequest(const std::string& wwwLocalPath,
    {
       // since these are application components we force revalidation
       pResponse->setCacheWithRevalidationHeaders();
-      pResponse->setCacheableFile(filePath, request);
+      setCacheableFile(filePath, fileInfo, request, pResponse);
    }
   
 }
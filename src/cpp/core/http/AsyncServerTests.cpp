@@ -0,0 +1,247 @@
+/*
+ * AsyncServerTests.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include <core/http/TcpIpAsyncServer.hpp>
+
+#include <iostream>
+
+#include <boost/assert.hpp>
+#include <boost/format.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <core/Error.hpp>
+#include <core/SafeConvert.hpp>
+
+#include <core/http/Request.hpp>
+#include <core/http/Response.hpp>
+
+namespace core {
+namespace http {
+
+namespace {
+
+const std::size_t kMaxRequestsPerConnection = 100;
+
+using boost::asio::ip::tcp;
+
+class TestServer : public TcpIpAsyncServer
+{
+public:
+   TestServer() : TcpIpAsyncServer("Test Server") {}
+
+   unsigned short port()
+   {
+      return acceptorService().acceptor().local_endpoint().port();
+   }
+};
+
+// respond with the uri of the request
+void echoUri(const Request& request,
+             const UriHandlerFunctionContinuation& cont)
+{
+   Response response;
+   response.setContentType("text/plain");
+   response.setBodyUnencoded(request.uri());
+   cont(&response);
+}
+
+std::string request(const std::string& uri, bool keepAlive)
+{
+   return "GET " + uri + " HTTP/1.1\r\n"
+          "Host: localhost\r\n"
+          "Connection: " + (keepAlive ? "keep-alive" : "close") + "\r\n"
+          "\r\n";
+}
+
+struct TestResponse
+{
+   TestResponse() : keepAlive(false) {}
+   std::string body;
+   bool keepAlive;
+};
+
+// read a response (delimited by its Content-Length) from the socket.
+// the buffer holds anything read beyond the response
+TestResponse readResponse(tcp::socket* pSocket, boost::asio::streambuf* pBuffer)
+{
+   std::size_t headerBytes = boost::asio::read_until(*pSocket,
+                                                     *pBuffer,
+                                                     "\r\n\r\n");
+   std::string headers(boost::asio::buffers_begin(pBuffer->data()),
+                       boost::asio::buffers_begin(pBuffer->data()) +
+                                                               headerBytes);
+   pBuffer->consume(headerBytes);
+
+   TestResponse response;
+   response.keepAlive = boost::algorithm::icontains(headers,
+                                                   "Connection: keep-alive");
+
+   std::string::size_type pos = headers.find("Content-Length: ");
+   BOOST_ASSERT(pos != std::string::npos);
+   std::size_t contentLength = safe_convert::stringTo<std::size_t>(
+      headers.substr(pos + 16, headers.find("\r\n", pos) - (pos + 16)), 0);
+
+   if (pBuffer->size() < contentLength)
+   {
+      boost::asio::read(*pSocket,
+                        *pBuffer,
+                        boost::asio::transfer_at_least(
+                                       contentLength - pBuffer->size()));
+   }
+   response.body.assign(boost::asio::buffers_begin(pBuffer->data()),
+                        boost::asio::buffers_begin(pBuffer->data()) +
+                                                               contentLength);
+   pBuffer->consume(contentLength);
+   return response;
+}
+
+void connect(unsigned short port, tcp::socket* pSocket)
+{
+   pSocket->connect(tcp::endpoint(
+                  boost::asio::ip::address::from_string("127.0.0.1"), port));
+}
+
+std::string uri(int i)
+{
+   return "/request/" + safe_convert::numberToString(i);
+}
+
+// requests on a kept alive connection are answered in turn until the
+// maximum number of requests (the last response closes the connection)
+bool verifyKeepAlive(unsigned short port)
+{
+   boost::asio::io_service ioService;
+   tcp::socket socket(ioService);
+   connect(port, &socket);
+
+   boost::asio::streambuf buffer;
+   for (std::size_t i = 0; i < kMaxRequestsPerConnection; i++)
+   {
+      boost::asio::write(socket, boost::asio::buffer(request(uri(i), true)));
+      TestResponse response = readResponse(&socket, &buffer);
+      if (response.body != uri(i))
+         return false;
+
+      bool last = (i == kMaxRequestsPerConnection - 1);
+      if (response.keepAlive == last)
+         return false;
+   }
+
+   // the server then closes the connection
+   boost::system::error_code ec;
+   boost::asio::read(socket, buffer, boost::asio::transfer_at_least(1), ec);
+   return ec == boost::asio::error::eof;
+}
+
+// pipelined requests (all written before any response is read) are
+// answered in order
+bool verifyPipelining(unsigned short port)
+{
+   const int kPipelined = 20;
+
+   boost::asio::io_service ioService;
+   tcp::socket socket(ioService);
+   connect(port, &socket);
+
+   std::string requests;
+   for (int i = 0; i < kPipelined; i++)
+      requests.append(request(uri(i), i < kPipelined - 1));
+   boost::asio::write(socket, boost::asio::buffer(requests));
+
+   boost::asio::streambuf buffer;
+   for (int i = 0; i < kPipelined; i++)
+   {
+      if (readResponse(&socket, &buffer).body != uri(i))
+         return false;
+   }
+
+   return true;
+}
+
+// requests per second made over a kept alive connection or with a new
+// connection per request
+double requestsPerSecond(unsigned short port, int requests, bool keepAlive)
+{
+   using namespace boost::posix_time;
+
+   boost::asio::io_service ioService;
+   boost::shared_ptr<tcp::socket> pSocket;
+   boost::asio::streambuf buffer;
+   std::size_t connectionRequests = 0;
+
+   ptime start = microsec_clock::universal_time();
+   for (int i = 0; i < requests; i++)
+   {
+      if (!pSocket || !keepAlive ||
+          connectionRequests == kMaxRequestsPerConnection)
+      {
+         pSocket.reset(new tcp::socket(ioService));
+         connect(port, pSocket.get());
+         buffer.consume(buffer.size());
+         connectionRequests = 0;
+      }
+
+      boost::asio::write(*pSocket,
+                         boost::asio::buffer(request(uri(i), keepAlive)));
+      TestResponse response = readResponse(pSocket.get(), &buffer);
+      BOOST_ASSERT(response.body == uri(i));
+      connectionRequests++;
+   }
+   ptime end = microsec_clock::universal_time();
+
+   return requests / ((end - start).total_microseconds() / 1000000.0);
+}
+
+} // anonymous namespace
+
+
+void runAsyncServerTests()
+{
+   TestServer server;
+   Error error = server.init("127.0.0.1", "0");
+   BOOST_ASSERT(!error);
+   server.setKeepAlive(kMaxRequestsPerConnection,
+                       boost::posix_time::seconds(5));
+   server.setBlockingDefaultHandler(echoUri);
+   error = server.run(2);
+   BOOST_ASSERT(!error);
+
+   bool keepAlive = verifyKeepAlive(server.port());
+   bool pipelining = verifyPipelining(server.port());
+
+   const int kRequests = 5000;
+   std::cout << boost::format("keep-alive %1%, pipelining %2%; "
+                              "requests/sec: kept alive %3%, "
+                              "connection per request %4%")
+                  % (keepAlive ? "ok" : "FAILED")
+                  % (pipelining ? "ok" : "FAILED")
+                  % static_cast<int>(requestsPerSecond(server.port(),
+                                                       kRequests,
+                                                       true))
+                  % static_cast<int>(requestsPerSecond(server.port(),
+                                                       kRequests,
+                                                       false))
+             << std::endl;
+
+   server.stop();
+   server.waitUntilStopped();
+}
+
+} // namespace http
+} // namespace core
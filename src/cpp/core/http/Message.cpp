@@ -17,6 +17,7 @@
 
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string/trim.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/function.hpp>
 #include <boost/asio/buffer.hpp>
 
@@ -49,6 +50,17 @@ void Message::setContentLength(int contentLength)
    setHeader("Content-Length", contentLength);
 }
    
+bool Message::keepAlive() const
+{
+   std::string connection = headerValue("Connection");
+   if (boost::algorithm::icontains(connection, "close"))
+      return false;
+   else if (isHttp10())
+      return boost::algorithm::icontains(connection, "keep-alive");
+   else
+      return true;
+}
+   
 void Message::addHeader(const std::string& name, const std::string& value) 
 {
    Header header ;
@@ -175,6 +175,7 @@ void Request::resetMembers()
    cookies_.clear() ;
    parsedFormFields_ = false ;
    formFields_.clear() ;
+   files_.clear();
    parsedQueryParams_ = false;
    queryParams_.clear();
 }
@@ -29,7 +29,12 @@ namespace core {
 namespace http {
 
 Response::Response() 
-   : Message(), statusCode_(status::Ok) 
+   : Message(),
+     statusCode_(status::Ok),
+     streamFileSize_(0),
+     streamRemaining_(0),
+     chunked_(false),
+     streamComplete_(false)
 {
 }   
    
@@ -133,6 +138,99 @@ void Response::setDynamicHtml(const std::string& html,
    setBody(html);
 }
    
+Error Response::setStreamFile(const FilePath& filePath)
+{
+   if (!filePath.exists())
+      return systemError(boost::system::errc::no_such_file_or_directory,
+                         ERROR_LOCATION);
+
+   removeHeader("Content-Encoding");
+   removeHeader("Transfer-Encoding");
+   body_.clear();
+   streamFile_ = filePath;
+   streamFileSize_ = filePath.size();
+   streamRemaining_ = streamFileSize_;
+   pStreamBody_.reset();
+   chunked_ = false;
+   streamComplete_ = false;
+   setHeader("Content-Length", safe_convert::numberToString(streamFileSize_));
+   return Success();
+}
+
+void Response::setStreamBody(boost::shared_ptr<std::istream> pStream)
+{
+   removeHeader("Content-Encoding");
+   removeHeader("Content-Length");
+   setHeader("Transfer-Encoding", "chunked");
+   body_.clear();
+   streamFile_ = FilePath();
+   streamFileSize_ = 0;
+   streamRemaining_ = 0;
+   pStreamBody_ = pStream;
+   chunked_ = true;
+   streamComplete_ = false;
+}
+
+Error Response::readStreamBlock(std::string* pBlock) const
+{
+   pBlock->clear();
+   if (streamComplete_ || !isStreamResponse())
+      return Success();
+
+   // open file streams on demand
+   if (!pStreamBody_)
+   {
+      Error error = streamFile_.open_r(&pStreamBody_);
+      if (error)
+         return error;
+   }
+
+   // read the next block (files are never read beyond the Content-Length
+   // we advertised for them)
+   std::size_t blockSize = kStreamBlockSize;
+   if (!chunked_)
+      blockSize = std::min<uintmax_t>(blockSize, streamRemaining_);
+   std::vector<char> buffer(std::max<std::size_t>(blockSize, 1));
+   std::streamsize count = 0;
+   if (blockSize > 0)
+   {
+      pStreamBody_->read(&buffer[0], blockSize);
+      count = pStreamBody_->gcount();
+   }
+
+   // a file which has been truncated can't fill out its Content-Length
+   if (pStreamBody_->bad() ||
+       (!chunked_ && blockSize > 0 && count == 0))
+   {
+      Error error = systemError(boost::system::errc::io_error, ERROR_LOCATION);
+      if (!streamFile_.empty())
+         error.addProperty("path", streamFile_.absolutePath());
+      return error;
+   }
+
+   // frame it if we are chunked (a zero length chunk terminates the body)
+   if (chunked_)
+   {
+      std::ostringstream chunkHeader;
+      chunkHeader << std::hex << count << "\r\n";
+      pBlock->append(chunkHeader.str());
+      if (count > 0)
+         pBlock->append(&buffer[0], count);
+      else
+         streamComplete_ = true;
+      pBlock->append("\r\n");
+   }
+   else
+   {
+      pBlock->append(&buffer[0], count);
+      streamRemaining_ -= count;
+      if (count == 0)
+         streamComplete_ = true;
+   }
+
+   return Success();
+}
+
 void Response::setBodyUnencoded(const std::string& body)
 {
    removeHeader("Content-Encoding");
@@ -192,6 +290,12 @@ void Response::resetMembers()
 	statusCode_ = status::Ok ;
 	statusCodeStr_.clear() ;
 	statusMessage_.clear() ;
+   streamFile_ = FilePath();
+   streamFileSize_ = 0;
+   streamRemaining_ = 0;
+   pStreamBody_.reset();
+   chunked_ = false;
+   streamComplete_ = false;
 }
    
 void Response::removeCachingHeaders()
@@ -230,6 +334,7 @@ namespace status {
 namespace Message {
 	const char * const Ok = "OK" ;
    const char * const Created = "Created";
+   const char * const NoContent = "No Content";
 	const char * const MovedPermanently = "Moved Permanently" ;
 	const char * const MovedTemporarily = "Moved Temporarily" ;
 	const char * const SeeOther = "See Other" ;
@@ -262,6 +367,10 @@ void Response::ensureStatusMessage() const
 
          case Created:
             statusMessage_ = status::Message::Created;
+            break;
+
+         case NoContent:
+            statusMessage_ = status::Message::NoContent;
             break;
 
 			case MovedPermanently:
@@ -0,0 +1,126 @@
+/*
+ * AsyncFileLogWriter.hpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#ifndef ASYNC_FILE_LOG_WRITER_HPP
+#define ASYNC_FILE_LOG_WRITER_HPP
+
+#include <sys/types.h>
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <boost/utility.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <core/BoostThread.hpp>
+#include <core/FilePath.hpp>
+#include <core/LogWriter.hpp>
+
+namespace core {
+
+struct AsyncLogOptions
+{
+   AsyncLogOptions()
+      : maxPendingEntries(4096),
+        maxEntriesPerSecond(100),
+        maxBurstEntries(1000),
+        maxErrorsPerSecond(100),
+        maxBurstErrors(1000),
+        maxFileSize(4096*1024),
+        maxFileAgeSeconds(24*60*60),
+        generations(3)
+   {
+   }
+
+   // entries waiting to be written (beyond this entries are dropped)
+   std::size_t maxPendingEntries;
+
+   // sustained rate and burst size of entries other than errors (beyond
+   // these entries are dropped, the number dropped is written to the log)
+   double maxEntriesPerSecond;
+   double maxBurstEntries;
+
+   // errors have their own budget (so a storm of warnings can't crowd
+   // them out) which is applied in the same way
+   double maxErrorsPerSecond;
+   double maxBurstErrors;
+
+   // the log is rotated when it reaches this size or age and this
+   // many rotated logs (.1, .2, etc.) are retained
+   std::size_t maxFileSize;
+   std::time_t maxFileAgeSeconds;
+   int generations;
+};
+
+// log writer which queues entries and writes them to the log file in
+// batches on a background thread (the file is kept open between batches).
+// queued entries are written by flush, which is also called at exit and
+// by core::system::abort so errors logged just before either aren't lost
+class AsyncFileLogWriter : public LogWriter, boost::noncopyable
+{
+public:
+    AsyncFileLogWriter(const std::string& programIdentity,
+                       int logLevel,
+                       const FilePath& logDir,
+                       const AsyncLogOptions& options = AsyncLogOptions());
+    virtual ~AsyncFileLogWriter();
+
+    virtual void log(core::system::LogLevel level,
+                     const std::string& message);
+
+    // write all entries queued so far
+    virtual void flush();
+
+private:
+    bool admitEntry(bool isError);
+    void writerThreadMain();
+    void writePending();
+    void writeEntries(const std::string& entries);
+    void openLogFile();
+    void closeLogFile();
+    void rotateLogFile();
+
+    std::string programIdentity_;
+    int logLevel_;
+    FilePath logFile_;
+    AsyncLogOptions options_;
+    pid_t pid_;
+
+    // pending entries (a ring of maxPendingEntries) along with the
+    // rate limiting state, guarded by mutex_
+    boost::mutex mutex_;
+    boost::condition_variable pendingCondition_;
+    std::vector<std::string> pending_;
+    std::size_t pendingStart_;
+    std::size_t pendingCount_;
+    std::size_t dropped_;
+    std::size_t droppedErrors_;
+    double tokens_;
+    double errorTokens_;
+    boost::posix_time::ptime lastRefill_;
+    bool threadStarted_;
+    bool stopping_;
+    boost::thread thread_;
+
+    // log file state, guarded by writeMutex_ (which is always acquired
+    // before mutex_ so batches are written in order)
+    boost::mutex writeMutex_;
+    int fd_;
+    std::size_t fileSize_;
+    std::time_t fileOpened_;
+};
+
+} // namespace core
+
+#endif // ASYNC_FILE_LOG_WRITER_HPP
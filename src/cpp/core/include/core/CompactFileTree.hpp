@@ -0,0 +1,177 @@
+/*
+ * CompactFileTree.hpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#ifndef CORE_COMPACT_FILE_TREE_HPP
+#define CORE_COMPACT_FILE_TREE_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <core/FileInfo.hpp>
+#include <core/collection/Tree.hpp>
+
+namespace core {
+
+// A tree of files which stores only the name of each file along with its
+// size, write time and links to its parent, children and siblings (a
+// tree<FileInfo> stores the full path of every file). Names are interned so
+// names shared by many files (e.g. R, DESCRIPTION) are stored once. Full
+// paths and FileInfo are materialized on demand.
+//
+// Nodes are identified by a NodeId which remains valid until the node is
+// removed (ids of removed nodes are reused). Children are not ordered.
+class CompactFileTree
+{
+public:
+   typedef uint32_t NodeId;
+   static const NodeId kNoNode = 0xFFFFFFFF;
+
+public:
+   CompactFileTree();
+   explicit CompactFileTree(const tree<FileInfo>& fileTree);
+
+   // COPYING: via compiler (copyable members)
+
+   // replace the contents with a copy of a tree<FileInfo> (e.g. as produced
+   // by scanFiles) or with just a root
+   void assign(const tree<FileInfo>& fileTree);
+   void assign(const FileInfo& root);
+   void clear();
+
+   bool empty() const { return size_ == 0; }
+   std::size_t size() const { return size_; }
+
+   // approximate number of bytes allocated by the tree
+   std::size_t memoryUsage() const;
+
+   // navigation (kNoNode where there is no such node). next is the
+   // successor of the node in a pre-order traversal of the tree
+   NodeId root() const { return root_; }
+   NodeId parent(NodeId id) const { return nodes_[id].parent; }
+   NodeId firstChild(NodeId id) const { return nodes_[id].firstChild; }
+   NodeId nextSibling(NodeId id) const { return nodes_[id].nextSibling; }
+   NodeId next(NodeId id) const;
+
+   // lookup (kNoNode if there is no such node)
+   NodeId find(const std::string& absolutePath) const;
+   NodeId findChild(NodeId parentId, const std::string& name) const;
+
+   // node data (the root's name is its absolute path)
+   std::string name(NodeId id) const;
+   std::string absolutePath(NodeId id) const;
+   bool isDirectory(NodeId id) const;
+   FileInfo fileInfo(NodeId id) const;
+
+   // materialize the subtree rooted at a node (children are ordered by
+   // fileInfoPathLessThan, as they are by scanFiles)
+   void toTree(NodeId id, tree<FileInfo>* pTree) const;
+
+   // add a child (or update it if the parent has a child with its name)
+   NodeId addChild(NodeId parentId, const FileInfo& fileInfo);
+
+   // add a child along with its descendents
+   NodeId addSubtree(NodeId parentId,
+                     const tree<FileInfo>::iterator_base& subtreeIt);
+
+   // add a file below the root, adding any missing parent directories (the
+   // file is updated if it exists). returns kNoNode if the file isn't
+   // below the root
+   NodeId insert(const FileInfo& fileInfo);
+
+   // update the size, write time and type of a node
+   void update(NodeId id, const FileInfo& fileInfo);
+
+   // remove a node and its descendents
+   void remove(NodeId id);
+
+private:
+   enum
+   {
+      kDirectory = 1,
+      kSymlink = 2
+   };
+
+   struct Node
+   {
+      uint32_t name;
+      NodeId parent;
+      NodeId firstChild;
+      NodeId nextSibling;
+      NodeId prevSibling;
+      uint32_t flags;
+      uint64_t size;
+      int64_t lastWriteTime;
+   };
+
+   // interned names. ids index offsets into the arena (which holds the null
+   // terminated names) and the table is an open addressed hash of the ids
+   class Names
+   {
+   public:
+      static const uint32_t kNoName = 0xFFFFFFFF;
+
+      Names() : liveBytes_(0), tableUsed_(0) {}
+
+      uint32_t intern(const std::string& name);
+      uint32_t lookup(const std::string& name) const;
+      void release(uint32_t id);
+      const char* get(uint32_t id) const { return &arena_[offsets_[id]]; }
+      void clear();
+      std::size_t memoryUsage() const;
+
+   private:
+      static uint32_t hash(const char* pName, std::size_t length);
+      std::size_t findSlot(const std::string& name, uint32_t hash) const;
+      void rehash(std::size_t tableSize);
+      void compact();
+
+      std::vector<char> arena_;
+      std::vector<uint32_t> offsets_;
+      std::vector<uint32_t> refs_;
+      std::vector<uint32_t> freeIds_;
+      std::vector<uint32_t> table_;
+      std::size_t liveBytes_;
+      std::size_t tableUsed_;
+   };
+
+   static uint32_t childHash(NodeId parentId, uint32_t name);
+   std::size_t findChildSlot(NodeId parentId, uint32_t name) const;
+   void addToChildTable(NodeId id);
+   void removeFromChildTable(NodeId id);
+   void rehashChildren(std::size_t minSize);
+
+   NodeId allocateNode(uint32_t name, NodeId parentId);
+   void setFileInfo(NodeId id, const FileInfo& fileInfo);
+   void removeChildren(NodeId id);
+   void freeNode(NodeId id);
+   void addSubtreeChildren(NodeId id,
+                           const tree<FileInfo>::iterator_base& subtreeIt);
+   void toTreeChildren(NodeId id,
+                       const tree<FileInfo>::iterator& it,
+                       tree<FileInfo>* pTree) const;
+
+   std::vector<Node> nodes_;
+   std::vector<NodeId> freeNodes_;
+   // open addressed hash of the (non-root) nodes by parent and name
+   std::vector<NodeId> childTable_;
+   std::size_t childTableUsed_;
+   Names names_;
+   NodeId root_;
+   std::size_t size_;
+};
+
+} // namespace core
+
+#endif // CORE_COMPACT_FILE_TREE_HPP
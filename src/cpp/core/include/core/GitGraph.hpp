@@ -66,6 +66,11 @@ public:
    GitGraph() : nextColumnId_(0)
    {}
 
+   // Start numbering columns at firstColumnId (e.g. to lay out commits
+   // whose columns mustn't share ids with those of an existing graph).
+   explicit GitGraph(int firstColumnId) : nextColumnId_(firstColumnId)
+   {}
+
    // Call addCommit to yield the next line of the graph.
    // Note that GitGraph is stateful; each call to addCommit
    // builds on the state of previous calls to addCommit.
@@ -74,6 +79,11 @@ public:
    Line addCommit(const std::string& commit,
                   const std::vector<std::string>& parents);
 
+   // The columns leading into the next commit (their preCommit is the
+   // commit each one points to) and the id the next new column will get.
+   const Line& pendingLine() const { return pendingLine_; }
+   int nextColumnId() const { return nextColumnId_; }
+
 private:
    int nextColumnId_;
    Line pendingLine_;
@@ -26,6 +26,9 @@ public:
    virtual void log(core::system::LogLevel level,
                     const std::string& message) = 0;
 
+   // write any buffered entries (e.g. before aborting)
+   virtual void flush() {}
+
 protected:
    std::string formatLogEntry(const std::string& programIdentify,
                               const std::string& message);
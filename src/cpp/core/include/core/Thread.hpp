@@ -204,6 +204,131 @@ private:
    std::queue<T> queue_;
 };
 
+// bounded queue which any number of threads can add to without locking
+// (see Dmitry Vyukov's bounded MPMC queue). values are removed by a single
+// consumer at a time (callers must serialize calls to dequeue). T should
+// be cheap to copy (typically a pointer). the counters are size_t so the
+// builtins used are lock free on both 32 and 64 bit targets
+template <typename T>
+class BoundedRing : boost::noncopyable
+{
+public:
+   // capacity must be a power of 2
+   explicit BoundedRing(std::size_t capacity)
+      : pSlots_(new Slot[capacity]),
+        mask_(capacity - 1),
+        enqueuePos_(0),
+        dequeuePos_(0)
+   {
+      for (std::size_t i = 0; i < capacity; i++)
+         pSlots_[i].sequence = i;
+   }
+
+   virtual ~BoundedRing()
+   {
+      try
+      {
+         delete [] pSlots_;
+      }
+      catch(...)
+      {
+      }
+   }
+
+   // COPYING: boost::noncopyable
+
+public:
+
+   // returns false if the ring is full
+   bool enqueue(const T& val)
+   {
+      std::size_t pos = load(&enqueuePos_);
+      Slot* pSlot;
+      for (;;)
+      {
+         pSlot = &pSlots_[pos & mask_];
+         std::ptrdiff_t diff = difference(load(&pSlot->sequence), pos);
+         if (diff == 0)
+         {
+            std::size_t prev = __sync_val_compare_and_swap(&enqueuePos_,
+                                                           pos,
+                                                           pos + 1);
+            if (prev == pos)
+               break;
+            pos = prev;
+         }
+         else if (diff < 0)
+         {
+            return false;
+         }
+         else
+         {
+            pos = load(&enqueuePos_);
+         }
+      }
+
+      // publish the value
+      pSlot->value = val;
+      store(&pSlot->sequence, pos + 1);
+      return true;
+   }
+
+   // returns false if the ring is empty
+   bool dequeue(T* pVal)
+   {
+      Slot* pSlot = &pSlots_[dequeuePos_ & mask_];
+      if (difference(load(&pSlot->sequence), dequeuePos_ + 1) < 0)
+         return false;
+
+      *pVal = pSlot->value;
+      pSlot->value = T();
+      store(&pSlot->sequence, dequeuePos_ + mask_ + 1);
+      dequeuePos_++;
+      return true;
+   }
+
+   // may be called from any thread (the answer is immediately stale if
+   // producers are active)
+   bool isEmpty()
+   {
+      Slot* pSlot = &pSlots_[load(&dequeuePos_) & mask_];
+      return difference(load(&pSlot->sequence), load(&dequeuePos_) + 1) < 0;
+   }
+
+private:
+   struct Slot
+   {
+      Slot() : sequence(0), value() {}
+      volatile std::size_t sequence;
+      T value;
+   };
+
+   // full memory barriers around the sequence numbers
+   static std::size_t load(volatile std::size_t* pValue)
+   {
+      std::size_t value = *pValue;
+      __sync_synchronize();
+      return value;
+   }
+
+   static void store(volatile std::size_t* pValue, std::size_t value)
+   {
+      __sync_synchronize();
+      *pValue = value;
+   }
+
+   static std::ptrdiff_t difference(std::size_t a, std::size_t b)
+   {
+      return static_cast<std::ptrdiff_t>(a - b);
+   }
+
+private:
+   Slot* pSlots_;
+   const std::size_t mask_;
+   volatile std::size_t enqueuePos_;
+   volatile std::size_t dequeuePos_;
+};
+
 void safeLaunchThread(boost::function<void()> threadMain,
                       boost::thread* pThread = NULL);
       
@@ -14,6 +14,13 @@
 #ifndef CORE_HTTP_ASYNC_CLIENT_HPP
 #define CORE_HTTP_ASYNC_CLIENT_HPP
 
+#ifndef _WIN32
+#include <errno.h>
+#include <sys/socket.h>
+#endif
+
+#include <algorithm>
+
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
 #include <boost/enable_shared_from_this.hpp>
@@ -25,9 +32,11 @@
 #include <boost/asio/read.hpp>
 #include <boost/asio/read_until.hpp>
 #include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/buffers_iterator.hpp>
 
 #include <core/Error.hpp>
 #include <core/Log.hpp>
+#include <core/SafeConvert.hpp>
 
 #include <core/http/Request.hpp>
 #include <core/http/Response.hpp>
@@ -54,6 +63,11 @@ namespace http {
 typedef boost::function<void(const http::Response&)> ResponseHandler;
 typedef boost::function<void(const core::Error&)> ErrorHandler;
 
+// receives the next block of a streamed response body (an empty block
+// indicates that the body is complete)
+typedef boost::function<void(const core::Error&,
+                             const std::string&)> BodyBlockHandler;
+
 
 template <typename SocketService>
 class AsyncClient :
@@ -63,7 +77,13 @@ class AsyncClient :
 public:
    AsyncClient(boost::asio::io_service& ioService)
       : ioService_(ioService),
-        connectionRetryContext_(ioService)
+        connectionRetryContext_(ioService),
+        keepAlive_(false),
+        reusable_(false),
+        reusedConnection_(false),
+        readToEof_(true),
+        contentLength_(0),
+        bodyBytesRead_(0)
    {
    }
 
@@ -82,21 +102,93 @@ public:
       connectionRetryContext_.profile = connectionRetryProfile;
    }
 
+   // request that the connection be kept open after the response is
+   // read so that the client can be executed again. must do this prior
+   // to calling execute
+   void setKeepAlive(bool keepAlive)
+   {
+      keepAlive_ = keepAlive;
+   }
+
    // execute the async client
    void execute(const ResponseHandler& responseHandler,
                 const ErrorHandler& errorHandler)
+   {
+      execute(responseHandler, ResponseHandler(), errorHandler);
+   }
+
+   // execute the async client, streaming the response body if it is large
+   // (or chunked) rather than buffering it. in that case the
+   // streamingResponseHandler is called (instead of the responseHandler)
+   // with the headers and the part of the body read so far, and the rest
+   // of the body must then be read by calling readBodyBlock
+   void execute(const ResponseHandler& responseHandler,
+                const ResponseHandler& streamingResponseHandler,
+                const ErrorHandler& errorHandler)
    {
       // set handlers
       responseHandler_ = responseHandler;
+      streamingResponseHandler_ = streamingResponseHandler;
       errorHandler_ = errorHandler;
 
-      // connect and write request (implmented in a protocol
-      // specific manner by subclassees)
-      connectAndWriteRequest();
+      // reset response state (a kept alive client is executed many times)
+      response_.reset();
+      responseBuffer_.consume(responseBuffer_.size());
+      connectionRetryContext_.stopTryingTime = boost::posix_time::not_a_date_time;
+
+      // if we have a kept alive connection (which the server hasn't closed
+      // while it was idle) then write the request directly to it, otherwise
+      // connect and write request (implmented in a protocol specific manner
+      // by subclassees)
+      if (isReusable() && !peerClosed())
+      {
+         reusable_ = false;
+         reusedConnection_ = true;
+         writeRequest();
+      }
+      else
+      {
+         reusable_ = false;
+         reusedConnection_ = false;
+         connectAndWriteRequest();
+      }
+   }
+
+   // read the next block of a streamed response body. the handler is
+   // called with an empty block once the body is complete (at which
+   // point a kept alive connection becomes reusable)
+   void readBodyBlock(const BodyBlockHandler& handler)
+   {
+      bodyBlockHandler_ = handler;
+
+      if (!readToEof_ && bodyBytesRead_ >= contentLength_)
+      {
+         reusable_ = true;
+         handleBodyBlock(Success(), std::string());
+      }
+      else
+      {
+         boost::asio::async_read(
+            socket(),
+            responseBuffer_,
+            boost::asio::transfer_at_least(1),
+            boost::bind(&AsyncClient<SocketService>::handleReadBodyBlock,
+                        AsyncClient<SocketService>::shared_from_this(),
+                        boost::asio::placeholders::error));
+      }
+   }
+
+   // is the connection still open and available for another request
+   // (only ever true when keep alive was requested and the server agreed)
+   bool isReusable()
+   {
+      return keepAlive_ && reusable_ && socket().lowest_layer().is_open();
    }
 
    void close()
    {
+      reusable_ = false;
+
       Error error = closeSocket(socket().lowest_layer());
       if (error)
          LOG_ERROR(error);
@@ -124,7 +216,8 @@ protected:
       // write
       boost::asio::async_write(
           socket(),
-          request_.toBuffers(Header::connectionClose()),
+          request_.toBuffers(keepAlive_ ? Header::connectionKeepAlive() :
+                                          Header::connectionClose()),
           boost::bind(
                &AsyncClient<SocketService>::handleWrite,
                AsyncClient<SocketService>::shared_from_this(),
@@ -137,8 +230,12 @@ protected:
       // close the socket
       close();
 
-      if (errorHandler_)
-         errorHandler_(error);
+      // release the handlers before calling (they frequently
+      // hold references which would otherwise outlive the request)
+      ErrorHandler errorHandler = errorHandler_;
+      clearHandlers();
+      if (errorHandler)
+         errorHandler(error);
    }
 
    void handleErrorCode(const boost::system::error_code& ec,
@@ -160,6 +257,53 @@ private:
 
    virtual void connectAndWriteRequest() = 0;
 
+   void clearHandlers()
+   {
+      responseHandler_ = ResponseHandler();
+      streamingResponseHandler_ = ResponseHandler();
+      errorHandler_ = ErrorHandler();
+   }
+
+   // has the server closed our idle kept alive connection (checked before
+   // reusing it so we don't write the request to a dead connection). an
+   // idle connection with data waiting to be read (e.g. a timeout response
+   // the server sent before closing) can't be reused either
+   bool peerClosed()
+   {
+#ifndef _WIN32
+      char ch;
+      ssize_t result = ::recv(socket().lowest_layer().native(),
+                              &ch,
+                              1,
+                              MSG_PEEK | MSG_DONTWAIT);
+      return result >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+#else
+      return false;
+#endif
+   }
+
+   // a kept alive connection may also be closed by the server just as we
+   // reuse it. in that case we find out when the write fails or when we
+   // get eof instead of a status line -- transparently retry the request
+   // on a fresh connection (returns false if no retry was attempted). we
+   // do this for any request (including rpc POSTs) as long as no byte of
+   // the response arrived: a server closes an idle connection rather than
+   // one it's handling a request on, so the request wasn't acted on
+   bool retryStaleConnection()
+   {
+      if (reusedConnection_ && responseBuffer_.size() == 0)
+      {
+         reusedConnection_ = false;
+         close();
+         connectAndWriteRequest();
+         return true;
+      }
+      else
+      {
+         return false;
+      }
+   }
+
 
    bool retryConnectionIfRequired(const Error& connectionError)
    {
@@ -259,7 +403,7 @@ private:
                           AsyncClient<SocketService>::shared_from_this(),
                           boost::asio::placeholders::error));
          }
-         else
+         else if (!retryStaleConnection())
          {
             handleErrorCode(ec, ERROR_LOCATION);
          }
@@ -273,6 +417,9 @@ private:
       {
          if (!ec)
          {
+            // the server is responding so a retry is no longer possible
+            reusedConnection_ = false;
+
             // parase status line
             Error error = ResponseParser::parseStatusLine(&responseBuffer_,
                                                           &response_);
@@ -292,7 +439,7 @@ private:
                              boost::asio::placeholders::error));
             }
          }
-         else
+         else if (!retryStaleConnection())
          {
             handleErrorCode(ec, ERROR_LOCATION);
          }
@@ -320,12 +467,35 @@ private:
             // parse headers
             ResponseParser::parseHeaders(&responseBuffer_, &response_);
 
+            // if we asked for keep alive and the server agreed then the
+            // end of the response is marked by its content length rather
+            // than by the server closing the connection. 1xx, 204 and 304
+            // responses never have a body
+            int status = response_.statusCode();
+            bool bodyless = (status >= 100 && status < 200) ||
+                            status == status::NoContent ||
+                            status == status::NotModified;
+            readToEof_ = true;
+            if (keepAlive_ && response_.keepAlive() &&
+                (bodyless || response_.containsHeader("Content-Length")))
+            {
+               contentLength_ = bodyless ? 0 :
+                  safe_convert::stringTo<std::size_t>(
+                                 response_.headerValue("Content-Length"), 0);
+               readToEof_ = false;
+            }
+
             // append any lefover buffer contents to the body
             if (responseBuffer_.size() > 0)
                ResponseParser::appendToBody(&responseBuffer_, &response_);
 
-            // start reading content
-            readSomeContent();
+            // start reading content (unless we already have all of it)
+            if (!readToEof_ && response_.body().size() >= contentLength_)
+               handleKeepAliveResponse();
+            else if (shouldStreamBody())
+               handleStreamingResponse();
+            else
+               readSomeContent();
          }
          else
          {
@@ -344,16 +514,23 @@ private:
             // copy content
             ResponseParser::appendToBody(&responseBuffer_, &response_);
 
-            // continue reading content
-            readSomeContent();
+            // continue reading content (unless we have all of it)
+            if (!readToEof_ && response_.body().size() >= contentLength_)
+               handleKeepAliveResponse();
+            else if (shouldStreamBody())
+               handleStreamingResponse();
+            else
+               readSomeContent();
          }
-         else if (ec == boost::asio::error::eof ||
-                  isShutdownError(ec))
+         else if (readToEof_ &&
+                  (ec == boost::asio::error::eof || isShutdownError(ec)))
          {
             close();
 
-            if (responseHandler_)
-               responseHandler_(response_);
+            ResponseHandler responseHandler = responseHandler_;
+            clearHandlers();
+            if (responseHandler)
+               responseHandler(response_);
          }
          else
          {
@@ -363,6 +540,88 @@ private:
       CATCH_UNEXPECTED_ASYNC_CLIENT_EXCEPTION
    }
 
+   void handleKeepAliveResponse()
+   {
+      // leave the connection open and mark it as available for reuse
+      // (this must occur before calling the handler so that it can return
+      // the client to a pool)
+      reusable_ = true;
+
+      ResponseHandler responseHandler = responseHandler_;
+      clearHandlers();
+      if (responseHandler)
+         responseHandler(response_);
+   }
+
+   // stream rather than buffer the rest of the body if the caller can
+   // handle that and the body is large or of unknown length
+   bool shouldStreamBody()
+   {
+      return streamingResponseHandler_ &&
+             (response_.body().size() >= kStreamBlockSize ||
+              response_.containsHeader("Transfer-Encoding"));
+   }
+
+   void handleStreamingResponse()
+   {
+      bodyBytesRead_ = response_.body().size();
+
+      ResponseHandler streamingResponseHandler = streamingResponseHandler_;
+      clearHandlers();
+      streamingResponseHandler(response_);
+   }
+
+   void handleReadBodyBlock(const boost::system::error_code& ec)
+   {
+      try
+      {
+         if (!ec)
+         {
+            // take the block (never beyond the end of the response)
+            std::size_t size = responseBuffer_.size();
+            if (!readToEof_)
+               size = std::min(size, contentLength_ - bodyBytesRead_);
+            std::string block(
+                  boost::asio::buffers_begin(responseBuffer_.data()),
+                  boost::asio::buffers_begin(responseBuffer_.data()) + size);
+            responseBuffer_.consume(size);
+            bodyBytesRead_ += size;
+
+            handleBodyBlock(Success(), block);
+         }
+         else if (readToEof_ &&
+                  (ec == boost::asio::error::eof || isShutdownError(ec)))
+         {
+            close();
+            handleBodyBlock(Success(), std::string());
+         }
+         else
+         {
+            close();
+            handleBodyBlock(Error(ec, ERROR_LOCATION), std::string());
+         }
+      }
+      catch(const std::exception& e)
+      {
+         close();
+         handleBodyBlock(systemError(boost::system::errc::state_not_recoverable,
+                                     std::string("Unexpected exception: ") +
+                                     e.what(),
+                                     ERROR_LOCATION),
+                         std::string());
+      }
+   }
+
+   void handleBodyBlock(const Error& error, const std::string& block)
+   {
+      // release the handler before calling (it will usually read the next
+      // block which sets it again)
+      BodyBlockHandler bodyBlockHandler = bodyBlockHandler_;
+      bodyBlockHandler_ = BodyBlockHandler();
+      if (bodyBlockHandler)
+         bodyBlockHandler(error, block);
+   }
+
    virtual bool isShutdownError(const boost::system::error_code& ec)
    {
       return false;
@@ -387,10 +646,22 @@ private:
    boost::asio::io_service& ioService_;
    ConnectionRetryContext connectionRetryContext_;
    ResponseHandler responseHandler_;
+   ResponseHandler streamingResponseHandler_;
    ErrorHandler errorHandler_;
+   BodyBlockHandler bodyBlockHandler_;
    http::Request request_;
    boost::asio::streambuf responseBuffer_;
    http::Response response_;
+
+   // keep alive state
+   bool keepAlive_;
+   bool reusable_;
+   bool reusedConnection_;
+   bool readToEof_;
+   std::size_t contentLength_;
+
+   // bytes of a streamed body read so far
+   std::size_t bodyBytesRead_;
 };
    
 
@@ -14,6 +14,9 @@
 #ifndef CORE_HTTP_ASYNC_CONNECTION_HPP
 #define CORE_HTTP_ASYNC_CONNECTION_HPP
 
+#include <string>
+
+#include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/asio/io_service.hpp>
 
@@ -45,6 +48,19 @@ public:
    // simple wrappers for writing an existing response or error
    virtual void writeResponse(const http::Response& response) = 0;
    virtual void writeError(const Error& error) = 0;
+
+   // relay a response whose body arrives incrementally (e.g. from another
+   // server): write the response (headers and the body received so far),
+   // then each further block of the body, then call writeBodyComplete. each
+   // write calls its handler once done. if the body can't be completed
+   // call close instead
+   typedef boost::function<void(const Error&)> WriteHandler;
+   virtual void writeStreamingResponse(const http::Response& response,
+                                       const WriteHandler& handler) = 0;
+   virtual void writeBodyBlock(const std::string& block,
+                               const WriteHandler& handler) = 0;
+   virtual void writeBodyComplete() = 0;
+   virtual void close() = 0;
 };
 
 } // namespace http
@@ -21,7 +21,9 @@
 
 #include <boost/asio/write.hpp>
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/strand.hpp>
 #include <boost/asio/placeholders.hpp>
+#include <boost/asio/deadline_timer.hpp>
 
 #include <core/Error.hpp>
 #include <core/Log.hpp>
@@ -49,14 +51,28 @@ public:
    typedef boost::function<void(http::Response*)> ResponseFilter;
 
 public:
+   // maxRequests is the number of requests which can be served before the
+   // connection is closed (values <= 1 disable keep alive). idleTimeout is
+   // how long to wait for a subsequent request on a kept alive connection
    AsyncConnectionImpl(boost::asio::io_service& ioService,
                        const Handler& handler,
-                       const ResponseFilter& responseFilter =ResponseFilter())
+                       const ResponseFilter& responseFilter =ResponseFilter(),
+                       std::size_t maxRequests = 1,
+                       const boost::posix_time::time_duration& idleTimeout =
+                                          boost::posix_time::seconds(15))
       : ioService_(ioService),
         socket_(ioService),
+        strand_(ioService),
+        idleTimer_(ioService),
         handler_(handler),
-        responseFilter_(responseFilter)
-        
+        responseFilter_(responseFilter),
+        maxRequests_(maxRequests),
+        idleTimeout_(idleTimeout),
+        requestCount_(0),
+        keepAlive_(false),
+        closeAfterResponse_(false),
+        pendingBegin_(0),
+        pendingEnd_(0)
    {
    }
    
@@ -87,22 +103,40 @@ public:
 
    virtual void writeResponse()
    {
+      // determine whether we will keep the connection alive
+      requestCount_++;
+      keepAlive_ = !closeAfterResponse_ &&
+                   requestCount_ < maxRequests_ &&
+                   request_.keepAlive();
+
       // add extra response headers
       response_.setHeader("Date", util::httpDate());
-      response_.setHeader("Connection", "close");
+      response_.setHeader("Connection", keepAlive_ ? "keep-alive" : "close");
+
+      // kept alive connections require a content length to delimit the
+      // response (not modified responses never have a body and streamed
+      // responses establish their own length or are chunked)
+      if (keepAlive_ &&
+          response_.statusCode() != http::status::NotModified &&
+          !response_.isStreamResponse() &&
+          !response_.containsHeader("Content-Length"))
+      {
+         response_.setContentLength(response_.body().length());
+      }
 
       // call the response filter if we have one
       if (responseFilter_)
          responseFilter_(&response_);
 
-      // write
+      // write (completions run through the strand along with the reads
+      // and idle timeouts, so a connection's handlers never run concurrently)
       boost::asio::async_write(
           socket_,
           response_.toBuffers(),
-          boost::bind(
+          strand_.wrap(boost::bind(
                &AsyncConnectionImpl<ProtocolType>::handleWrite,
                AsyncConnectionImpl<ProtocolType>::shared_from_this(),
-               boost::asio::placeholders::error)
+               boost::asio::placeholders::error))
       );
    }
 
@@ -117,8 +151,88 @@ public:
       response_.setError(error);
       writeResponse();
    }
+
+   virtual void writeStreamingResponse(const http::Response& response,
+                                       const WriteHandler& handler)
+   {
+      response_.assign(response);
+
+      // the relayed body can only be followed by another response if its
+      // end is marked by a content length or chunked encoding
+      requestCount_++;
+      keepAlive_ = !closeAfterResponse_ &&
+                   requestCount_ < maxRequests_ &&
+                   request_.keepAlive() &&
+                   (response_.containsHeader("Content-Length") ||
+                    response_.containsHeader("Transfer-Encoding"));
+
+      response_.setHeader("Date", util::httpDate());
+      response_.setHeader("Connection", keepAlive_ ? "keep-alive" : "close");
+
+      if (responseFilter_)
+         responseFilter_(&response_);
+
+      boost::asio::async_write(
+          socket_,
+          response_.toBuffers(),
+          strand_.wrap(boost::bind(
+               &AsyncConnectionImpl<ProtocolType>::handleStreamingWrite,
+               AsyncConnectionImpl<ProtocolType>::shared_from_this(),
+               boost::asio::placeholders::error,
+               handler))
+      );
+   }
+
+   virtual void writeBodyBlock(const std::string& block,
+                               const WriteHandler& handler)
+   {
+      streamBlock_ = block;
+      boost::asio::async_write(
+          socket_,
+          boost::asio::buffer(streamBlock_),
+          strand_.wrap(boost::bind(
+               &AsyncConnectionImpl<ProtocolType>::handleStreamingWrite,
+               AsyncConnectionImpl<ProtocolType>::shared_from_this(),
+               boost::asio::placeholders::error,
+               handler))
+      );
+   }
+
+   virtual void writeBodyComplete()
+   {
+      // everything is written so either re-arm or close the connection
+      // (on the strand, as this is called by whoever relayed the body)
+      strand_.dispatch(boost::bind(
+            &AsyncConnectionImpl<ProtocolType>::handleWrite,
+            AsyncConnectionImpl<ProtocolType>::shared_from_this(),
+            boost::system::error_code()));
+   }
+
+   virtual void close()
+   {
+      Error error = closeSocket(socket_);
+      if (error)
+         LOG_ERROR(error);
+   }
    
 private:
+
+   void handleStreamingWrite(const boost::system::error_code& e,
+                             const WriteHandler& handler)
+   {
+      Error error;
+      if (e)
+      {
+         error = Error(e, ERROR_LOCATION);
+         keepAlive_ = false;
+      }
+
+      try
+      {
+         handler(error);
+      }
+      CATCH_UNEXPECTED_EXCEPTION
+   }
    
    void handleRead(const boost::system::error_code& e,
                    std::size_t bytesTransferred)
@@ -127,34 +241,21 @@ private:
       {
          if (!e)
          {
-            // parse next chunk
-            RequestParser::status status = requestParser_.parse(
-                                             request_,
-                                             buffer_.data(), 
-                                             buffer_.data() + bytesTransferred);
-            
-            // error - return bad request
-            if (status == RequestParser::error)
-            {
-               response_.setStatusCode(http::status::BadRequest);
-               writeResponse();
-            }
-            
-            // incomplete -- keep reading
-            else if (status == RequestParser::incomplete)
-            {
-               readSome();
-            }
-            
-            // got valid request -- handle it 
-            else
-            {
-               handler_(AsyncConnectionImpl<ProtocolType>::shared_from_this(),
-                        &request_);
-            }
+            // no longer idle
+            boost::system::error_code ec;
+            idleTimer_.cancel(ec);
+
+            // parse the data we just read
+            pendingBegin_ = 0;
+            pendingEnd_ = bytesTransferred;
+            parsePendingInput();
          }
          else // error reading
          {
+            // an idle kept alive connection timed out (already closed)
+            if (e == boost::asio::error::operation_aborted)
+               return;
+
             // log the error if it wasn't connection terminated
             Error error(e, ERROR_LOCATION);
             if (!isConnectionTerminatedError(error))
@@ -175,6 +276,38 @@ private:
    }
    
 
+   void parsePendingInput()
+   {
+      // parse as much of the pending input as is required for a request
+      char* begin = buffer_.data() + pendingBegin_;
+      char* end = buffer_.data() + pendingEnd_;
+      RequestParser::status status = requestParser_.parse_some(request_,
+                                                               begin,
+                                                               end);
+      pendingBegin_ = begin - buffer_.data();
+
+      // error - return bad request
+      if (status == RequestParser::error)
+      {
+         closeAfterResponse_ = true;
+         response_.setStatusCode(http::status::BadRequest);
+         writeResponse();
+      }
+
+      // incomplete -- keep reading
+      else if (status == RequestParser::incomplete)
+      {
+         readSome();
+      }
+
+      // got valid request -- handle it
+      else
+      {
+         handler_(AsyncConnectionImpl<ProtocolType>::shared_from_this(),
+                  &request_);
+      }
+   }
+
    void handleWrite(const boost::system::error_code& e)
    {
       try
@@ -186,6 +319,35 @@ private:
             if (!http::isConnectionTerminatedError(error))
                LOG_ERROR(error);
          }
+         else if (response_.isStreamResponse() && writeNextStreamBlock())
+         {
+            // more of the body remains to be written
+            return;
+         }
+         else if (keepAlive_)
+         {
+            // re-arm the connection for the next request
+            requestParser_.reset();
+            request_.reset();
+            response_.reset();
+
+            // pipelined requests may already be in our buffer (we only
+            // ever parse them after responding to the previous request
+            // so they are always answered in order)
+            if (pendingBegin_ < pendingEnd_)
+            {
+               strand_.post(boost::bind(
+                  &AsyncConnectionImpl<ProtocolType>::handlePendingInput,
+                  AsyncConnectionImpl<ProtocolType>::shared_from_this()));
+            }
+            else
+            {
+               waitForIdleTimeout();
+               readSome();
+            }
+
+            return;
+         }
          
          // close the socket
          Error error = closeSocket(socket_);
@@ -200,27 +362,120 @@ private:
       CATCH_UNEXPECTED_EXCEPTION
    }
    
+   // write the next block of a streamed response body. returns false if
+   // there is nothing more to write (the body is complete or an error
+   // occurred reading it)
+   bool writeNextStreamBlock()
+   {
+      Error error = response_.readStreamBlock(&streamBlock_);
+      if (error)
+      {
+         // the response is truncated so we can't re-use the connection
+         LOG_ERROR(error);
+         keepAlive_ = false;
+         return false;
+      }
+
+      if (streamBlock_.empty())
+         return false;
+
+      boost::asio::async_write(
+          socket_,
+          boost::asio::buffer(streamBlock_),
+          strand_.wrap(boost::bind(
+               &AsyncConnectionImpl<ProtocolType>::handleWrite,
+               AsyncConnectionImpl<ProtocolType>::shared_from_this(),
+               boost::asio::placeholders::error))
+      );
+
+      return true;
+   }
+
+   void handlePendingInput()
+   {
+      try
+      {
+         parsePendingInput();
+      }
+      CATCH_UNEXPECTED_EXCEPTION
+   }
+
    void readSome()
    {
+      // reads, writes and idle timeouts run through a strand so they are
+      // never handled concurrently by the server's thread pool
       socket_.async_read_some(
          boost::asio::buffer(buffer_),
-         boost::bind(
+         strand_.wrap(boost::bind(
                &AsyncConnectionImpl<ProtocolType>::handleRead,
                AsyncConnectionImpl<ProtocolType>::shared_from_this(),
                boost::asio::placeholders::error,
-               boost::asio::placeholders::bytes_transferred)
+               boost::asio::placeholders::bytes_transferred))
       );
    }
 
+   void waitForIdleTimeout()
+   {
+      boost::system::error_code ec;
+      idleTimer_.expires_from_now(idleTimeout_, ec);
+      if (!ec)
+      {
+         idleTimer_.async_wait(strand_.wrap(boost::bind(
+               &AsyncConnectionImpl<ProtocolType>::handleIdleTimeout,
+               AsyncConnectionImpl<ProtocolType>::shared_from_this(),
+               boost::asio::placeholders::error)));
+      }
+      else
+      {
+         LOG_ERROR(Error(ec, ERROR_LOCATION));
+      }
+   }
+
+   void handleIdleTimeout(const boost::system::error_code& ec)
+   {
+      try
+      {
+         // if the timer was cancelled or re-armed then we got a request
+         if (ec == boost::asio::error::operation_aborted ||
+             idleTimer_.expires_at() >
+                  boost::asio::deadline_timer::traits_type::now())
+         {
+            return;
+         }
+
+         // close the socket (aborts the pending read)
+         Error error = closeSocket(socket_);
+         if (error)
+            LOG_ERROR(error);
+      }
+      CATCH_UNEXPECTED_EXCEPTION
+   }
+
 private:
    boost::asio::io_service& ioService_;
    typename ProtocolType::socket socket_;
+   boost::asio::io_service::strand strand_;
+   boost::asio::deadline_timer idleTimer_;
    Handler handler_;
    ResponseFilter responseFilter_;
    boost::array<char, 8192> buffer_ ;
    RequestParser requestParser_ ;
    http::Request request_;
    http::Response response_;
+
+   // block of a streamed response body currently being written
+   std::string streamBlock_;
+
+   // keep alive state
+   std::size_t maxRequests_;
+   boost::posix_time::time_duration idleTimeout_;
+   std::size_t requestCount_;
+   bool keepAlive_;
+   bool closeAfterResponse_;
+
+   // range of buffer_ which has been read but not yet parsed
+   std::size_t pendingBegin_;
+   std::size_t pendingEnd_;
 };
    
 
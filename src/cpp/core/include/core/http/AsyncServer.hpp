@@ -51,6 +51,8 @@ public:
    AsyncServer(const std::string& serverName,
                const std::string& baseUri = std::string())
       : abortOnResourceError_(false),
+        maxRequestsPerConnection_(1),
+        keepAliveTimeout_(boost::posix_time::seconds(15)),
         serverName_(serverName),
         baseUri_(baseUri),
         acceptorService_(),
@@ -69,6 +71,16 @@ public:
       abortOnResourceError_ = abortOnResourceError;
    }
    
+   // keep connections open to serve up to maxRequestsPerConnection
+   // requests (waiting at most idleTimeout between requests)
+   void setKeepAlive(std::size_t maxRequestsPerConnection,
+                     const boost::posix_time::time_duration& idleTimeout)
+   {
+      BOOST_ASSERT(!running_);
+      maxRequestsPerConnection_ = maxRequestsPerConnection;
+      keepAliveTimeout_ = idleTimeout;
+   }
+
    void addHandler(const std::string& prefix,
                    const AsyncUriHandlerFunction& handler)
    {
@@ -196,7 +208,11 @@ private:
 
          // response filter
          boost::bind(&AsyncServer<ProtocolType>::connectionResponseFilter,
-                     this, _1)
+                     this, _1),
+
+         // keep alive
+         maxRequestsPerConnection_,
+         keepAliveTimeout_
       ));
       
       // wait for next connection
@@ -413,6 +429,8 @@ private:
 
 private:
    bool abortOnResourceError_;
+   std::size_t maxRequestsPerConnection_;
+   boost::posix_time::time_duration keepAliveTimeout_;
    std::string serverName_;
    std::string baseUri_;
    boost::shared_ptr<AsyncConnectionImpl<ProtocolType> > ptrNextConnection_;
@@ -33,6 +33,10 @@ struct Header
    bool empty() const { return name.empty(); }
    
    static Header connectionClose() { return Header("Connection", "close"); }
+   static Header connectionKeepAlive()
+   {
+      return Header("Connection", "keep-alive");
+   }
 };
    
 typedef std::vector<Header> Headers ;
@@ -60,6 +60,10 @@ public:
    void setContentType(const std::string& contentType) ;
    
    void setContentLength(int contentLength);
+
+   // does the message indicate the connection should be kept open
+   // after it is processed (default for HTTP/1.1, opt-in for HTTP/1.0)
+   bool keepAlive() const;
   
    bool containsHeader(const std::string& name) const ;
    std::string headerValue(const std::string& name) const ;
@@ -40,6 +40,14 @@ public:
 
   template <typename InputIterator>
   status parse(Request& req, InputIterator begin, InputIterator end)
+  {
+    return parse_some(req, begin, end);
+  }
+
+  /// Parse some data, leaving begin at the first character which wasn't
+  /// consumed (allows pipelined requests to be parsed from a single buffer).
+  template <typename InputIterator>
+  status parse_some(Request& req, InputIterator& begin, InputIterator end)
   {
     while (begin != end)
     {
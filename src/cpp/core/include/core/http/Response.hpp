@@ -44,6 +44,7 @@ namespace status {
 enum Code {
    Ok = 200,
    Created = 201,
+   NoContent = 204,
    MovedPermanently = 301,
    MovedTemporarily = 302,
    SeeOther = 303,
@@ -74,6 +75,9 @@ public:
    }   
 };     
    
+// size of the blocks used to write streamed response bodies
+const std::size_t kStreamBlockSize = 65536;
+
 class Response : public Message
 {
 public:
@@ -88,6 +92,12 @@ public:
       statusCode_ = response.statusCode_;
       statusCodeStr_ = response.statusCodeStr_;
       statusMessage_ = response.statusMessage_;
+      streamFile_ = response.streamFile_;
+      streamFileSize_ = response.streamFileSize_;
+      streamRemaining_ = response.streamRemaining_;
+      pStreamBody_ = response.pStreamBody_;
+      chunked_ = response.chunked_;
+      streamComplete_ = response.streamComplete_;
    }
 
 public:   
@@ -131,6 +141,7 @@ public:
       {
          removeHeader("Content-Type"); // upstream code may have set this
          setStatusCode(status::NotModified);
+         setContentLength(0);
          return Success();
       }
       else
@@ -297,6 +308,7 @@ public:
       {
          removeHeader("Content-Type"); // upstream code may have set this
          setStatusCode(status::NotModified);
+         setContentLength(0);
       }
       else
       {
@@ -304,6 +316,26 @@ public:
       }
    }
    
+   // stream the body from a file rather than reading it into memory. the
+   // file is sent as-is (no gzip) which allows connections to use sendfile
+   Error setStreamFile(const FilePath& filePath);
+
+   // stream the body from an input stream using chunked transfer encoding
+   // (for large generated content which shouldn't be buffered in memory)
+   void setStreamBody(boost::shared_ptr<std::istream> pStream);
+
+   bool isStreamResponse() const { return pStreamBody_ || !streamFile_.empty(); }
+
+   // file being streamed (empty if the stream body isn't from a file) and
+   // its size when the response was created (this is the Content-Length
+   // so no more than this is ever sent even if the file has since grown)
+   const FilePath& streamFile() const { return streamFile_; }
+   uintmax_t streamFileSize() const { return streamFileSize_; }
+
+   // read the next block of a streamed body (chunk framed if we are using
+   // chunked transfer encoding). an empty block indicates the body is done
+   Error readStreamBlock(std::string* pBlock) const;
+
    // these calls do no stream io or encoding so don't return errors
    void setBodyUnencoded(const std::string& body);
    void setError(int statusCode, const std::string& message);
@@ -334,6 +366,14 @@ private:
    int statusCode_ ;
    mutable std::string statusMessage_ ;
 
+   // streamed body (read incrementally by the connection)
+   FilePath streamFile_;
+   uintmax_t streamFileSize_;
+   mutable uintmax_t streamRemaining_;
+   mutable boost::shared_ptr<std::istream> pStreamBody_;
+   bool chunked_;
+   mutable bool streamComplete_;
+
    // string storage for integer members (need for toBuffers)
    mutable std::string statusCodeStr_ ;
 };
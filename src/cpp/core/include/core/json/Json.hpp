@@ -18,6 +18,7 @@
 #include <vector>
 #include <iosfwd>
 
+#include <boost/cstdint.hpp>
 #include <boost/type_traits/is_same.hpp>
 
 #include <core/json/spirit/json_spirit_value.h>
@@ -77,10 +78,36 @@ json::Array toJsonArray(const std::vector<T>& val)
    return results;
 }
 
+// parse json (parsing is reentrant so may be done on any thread)
 bool parse(const std::string& input, Value* pValue);
 
+// handler for event based parsing (useful for large payloads which
+// needn't be held in memory as a Value). handlers return false to
+// stop parsing (parse then returns false)
+class ParseHandler
+{
+public:
+   virtual ~ParseHandler() {}
+   virtual bool onObjectBegin() = 0;
+   virtual bool onObjectEnd() = 0;
+   virtual bool onArrayBegin() = 0;
+   virtual bool onArrayEnd() = 0;
+   virtual bool onMemberName(const std::string& name) = 0;
+   virtual bool onString(const std::string& value) = 0;
+   virtual bool onInteger(boost::int64_t value) = 0;
+   virtual bool onUnsignedInteger(boost::uint64_t value) = 0;
+   virtual bool onReal(double value) = 0;
+   virtual bool onBoolean(bool value) = 0;
+   virtual bool onNull() = 0;
+};
+
+bool parse(const std::string& input, ParseHandler* pHandler);
+
+// write json (the string versions append to the passed string)
 void write(const Value& value, std::ostream& os);
+void write(const Value& value, std::string* pOutput);
 void writeFormatted(const Value& value, std::ostream& os);
+void writeFormatted(const Value& value, std::string* pOutput);
    
 } // namespace json
 } // namespace core
@@ -0,0 +1,86 @@
+/*
+ * HunspellCompiledDictionary.hpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#ifndef CORE_SPELLING_HUNSPELL_COMPILED_DICTIONARY_HPP
+#define CORE_SPELLING_HUNSPELL_COMPILED_DICTIONARY_HPP
+
+#include <string>
+#include <vector>
+
+#include <boost/utility.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <core/spelling/HunspellSpellingEngine.hpp>
+
+namespace core {
+
+class Error;
+class FilePath;
+
+namespace spelling {
+
+// word added to a dictionary, optionally taking the affixes of an
+// example word which is already in it
+struct DictionaryWord
+{
+   DictionaryWord(const std::string& word, const std::string& example)
+      : word(word), example(example)
+   {
+   }
+
+   std::string word;
+   std::string example;
+};
+
+// read-only list of the words of a hunspell dictionary along with their
+// affixed forms (each verified by hunspell), the dictionary encoding and
+// its word characters. the list is memory mapped so a single copy of it
+// is shared by all of the processes which use the dictionary (whereas
+// hunspell builds its tables on the heap of each process). note that
+// compound words aren't in the list
+class HunspellCompiledDictionary : boost::noncopyable
+{
+public:
+   // compile a dictionary (plus extra words, in UTF-8) to a file. the key
+   // identifies the version of the dictionary and must be passed to open
+   static core::Error compile(const HunspellDictionary& dictionary,
+                              const std::vector<DictionaryWord>& extraWords,
+                              const IconvstrFunction& iconvstrFunction,
+                              const std::string& key,
+                              const core::FilePath& targetPath);
+
+public:
+   HunspellCompiledDictionary();
+   virtual ~HunspellCompiledDictionary();
+
+   // COPYING: boost::noncopyable
+
+   // fails if the file doesn't exist or was compiled for another key
+   core::Error open(const core::FilePath& filePath, const std::string& key);
+
+   const std::string& encoding() const;
+   const std::wstring& wordChars() const;
+
+   // word is in the dictionary encoding
+   bool contains(const std::string& word) const;
+
+private:
+   struct Impl;
+   boost::scoped_ptr<Impl> pImpl_;
+};
+
+} // namespace spelling
+} // namespace core
+
+
+#endif // CORE_SPELLING_HUNSPELL_COMPILED_DICTIONARY_HPP
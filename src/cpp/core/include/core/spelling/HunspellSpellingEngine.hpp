@@ -17,14 +17,14 @@
 #include <boost/scoped_ptr.hpp>
 #include <boost/function.hpp>
 
+#include <core/FilePath.hpp>
+
 #include <core/spelling/SpellingEngine.hpp>
 
 #include <core/spelling/HunspellDictionaryManager.hpp>
 
 namespace core {
 
-class FilePath;
-
 namespace spelling {
 
 typedef boost::function<core::Error(const std::string&,
@@ -33,12 +33,18 @@ typedef boost::function<core::Error(const std::string&,
                                     bool,
                                     std::string*)> IconvstrFunction;
 
+// dictionaries are compiled into compiledDictionariesDir (if provided) so
+// that processes which use the same dictionary share a single copy of it
+// (see HunspellCompiledDictionary). compiling happens in the background,
+// hunspell is used until it is done (and after that only for words which
+// aren't in the compiled dictionary and for suggestions)
 class HunspellSpellingEngine : public SpellingEngine
 {
 public:
    HunspellSpellingEngine(const std::string& langId,
                           const HunspellDictionaryManager& dictionaryManager,
-                          const IconvstrFunction& iconvstrFunction);
+                          const IconvstrFunction& iconvstrFunction,
+                          const FilePath& compiledDictionariesDir = FilePath());
 
 public:
 
@@ -47,6 +53,9 @@ public:
    Error checkSpelling(const std::string& word,
                        bool *pCorrect);
 
+   Error checkSpelling(const std::vector<std::string>& words,
+                       std::vector<bool>* pCorrect);
+
    Error suggestionList(const std::string& word,
                         std::vector<std::string>* pSugs);
 
@@ -19,8 +19,10 @@
 #include <vector>
 
 #include <boost/function.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 #include <core/FilePath.hpp>
+#include <core/CompactFileTree.hpp>
 #include <core/collection/Tree.hpp>
 
 #include <core/system/System.hpp>
@@ -84,7 +86,7 @@ struct Callbacks
 {
    // callback which occurs after a successful registration (includes an initial
    // listing of all of the files in the directory)
-   boost::function<void(Handle, const tree<FileInfo>&)> onRegistered;
+   boost::function<void(Handle, const CompactFileTree&)> onRegistered;
 
    // callback which occurs if a registration error occurs
    boost::function<void(const core::Error&)> onRegistrationError;
@@ -93,7 +95,8 @@ struct Callbacks
    // monitor is automatically unregistered if a monitoring error occurs)
    boost::function<void(const core::Error&)> onMonitoringError;
 
-   // callback which occurs when files change
+   // callback which occurs when files change (changes are delivered in
+   // batches, see setBatchPeriod below)
    boost::function<void(const std::vector<FileChangeEvent>&)> onFilesChanged;
 
    // callback which occurs when the monitor is fully unregistered. note that
@@ -125,6 +128,15 @@ void registerMonitor(const core::FilePath& filePath,
 void unregisterMonitor(Handle handle);
 
 
+// file changes are held until none have occurred for quietPeriod (or the
+// first has been held for maxDelay) and then delivered to onFilesChanged as
+// a single batch. the changes to each path within a batch are merged into
+// their net effect (e.g. a file which is added then removed is omitted).
+// the defaults are 100ms and 1s, a quietPeriod of zero delivers changes on
+// the next call to checkForChanges
+void setBatchPeriod(const boost::posix_time::time_duration& quietPeriod,
+                    const boost::posix_time::time_duration& maxDelay);
+
 // check for changes (will cause onRegistered, onRegistrationError,
 // onMonitoringError, onFilesChanged, and onUnregistered calls to occur
 // on the same thread that calls checkForChanges)
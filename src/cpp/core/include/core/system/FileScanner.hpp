@@ -36,12 +36,20 @@ namespace system {
 struct FileScannerOptions
 {
    FileScannerOptions()
-      : recursive(false), yield(false)
+      : recursive(false), yield(false), parallel(false)
    {
    }
 
    bool recursive;
    bool yield;
+
+   // scan subdirectories of recursive scans on a small pool of threads
+   // (the resulting tree is identical to a serial scan). the filter and
+   // onBeforeScanDir callbacks are then invoked from the pool's threads,
+   // though never concurrently. yield is ignored for parallel scans and
+   // scans are always serial on win32.
+   bool parallel;
+
    boost::function<bool(const FileInfo&)> filter;
    boost::function<Error(const FileInfo&)> onBeforeScanDir;
 };
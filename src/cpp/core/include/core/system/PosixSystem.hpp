@@ -24,6 +24,7 @@ typedef rlim_t RLimitType;
 
 namespace core {
    class Error;
+   class FilePath;
 }
 
 namespace core {
@@ -103,6 +104,14 @@ core::Error userBelongsToGroup(const std::string& username,
                                const std::string& groupName,
                                bool* pBelongs);
 
+// write the first length bytes of a file to a socket (uses sendfile to avoid
+// copying the file through user space where it is available). returns an
+// error if the file is shorter than length. the socket may be in
+// non-blocking mode
+core::Error sendFile(int socketFd,
+                     const core::FilePath& filePath,
+                     uintmax_t length);
+
 // query priv state
 bool realUserIsRoot();
 bool effectiveUserIsRoot();
@@ -169,6 +169,14 @@ Error runCommand(const std::string& command,
                  const ProcessOptions& options,
                  ProcessResult* pResult);
 
+#ifndef _WIN32
+// Start a small helper process which creates the child processes that
+// can't be created with posix_spawn (e.g. those attached to a
+// pseudoterminal) so that this process never needs to fork once it has
+// grown large. Call early in main (before any threads are created).
+Error startChildProcessLauncher();
+#endif
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -298,6 +306,13 @@ public:
             const boost::function<void(const ProcessResult&)>& onCompleted);
 
 
+   // Set a handler to be called (on a background thread) when one of the
+   // children has output or has exited, so that poll can be called right
+   // away rather than at the next polling interval. Note that it is only
+   // called on linux (on other platforms children only make progress when
+   // poll is called) and that it applies to children run after it is set.
+   void setActivityHandler(const boost::function<void()>& activityHandler);
+
    // Check whether any children are currently active
    bool hasRunningChildren();
 
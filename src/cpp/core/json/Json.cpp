@@ -13,16 +13,15 @@
 
 #include <core/json/Json.hpp>
 
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
-#include <sstream>
-
-#include <boost/format.hpp>
-#include <boost/scoped_array.hpp>
+#include <cstring>
+#include <ostream>
+#include <vector>
 
+#include <core/Error.hpp>
 #include <core/Log.hpp>
-#include <core/Thread.hpp>
-
-#include "spirit/json_spirit.h"
 
 namespace core {
 namespace json {
@@ -35,6 +34,708 @@ json_spirit::Value_type IntegerType = json_spirit::int_type;
 json_spirit::Value_type RealType = json_spirit::real_type;
 json_spirit::Value_type NullType = json_spirit::null_type;
 
+namespace {
+
+// NOTE: the parser and writer below replace the json_spirit reader and
+// writer (the spirit based reader wasn't safe to use from multiple
+// threads). they accept and produce the same json as json_spirit did,
+// with the exception that \u escapes outside of ASCII are now decoded
+// to UTF-8 rather than truncated to a single byte
+
+bool isWhitespace(char ch)
+{
+   return ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t' ||
+          ch == '\f' || ch == '\v';
+}
+
+int hexValue(char ch)
+{
+   if (ch >= '0' && ch <= '9')
+      return ch - '0';
+   else if (ch >= 'a' && ch <= 'f')
+      return ch - 'a' + 10;
+   else if (ch >= 'A' && ch <= 'F')
+      return ch - 'A' + 10;
+   else
+      return -1;
+}
+
+void appendUtf8(boost::uint32_t codepoint, std::string* pStr)
+{
+   if (codepoint < 0x80)
+   {
+      pStr->push_back(static_cast<char>(codepoint));
+   }
+   else if (codepoint < 0x800)
+   {
+      pStr->push_back(static_cast<char>(0xC0 | (codepoint >> 6)));
+      pStr->push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+   }
+   else if (codepoint < 0x10000)
+   {
+      pStr->push_back(static_cast<char>(0xE0 | (codepoint >> 12)));
+      pStr->push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+      pStr->push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+   }
+   else
+   {
+      pStr->push_back(static_cast<char>(0xF0 | (codepoint >> 18)));
+      pStr->push_back(static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F)));
+      pStr->push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+      pStr->push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+   }
+}
+
+// single pass recursive descent parser which reports what it finds to
+// a handler (the handler type is a template parameter so that building
+// Values needn't go through virtual calls)
+template <typename Handler>
+class Parser
+{
+public:
+   Parser(const std::string& input, Handler* pHandler)
+      : pos_(input.c_str()),
+        end_(input.c_str() + input.length()),
+        pHandler_(pHandler)
+   {
+   }
+
+   // COPYING: prohibited
+private:
+   Parser(const Parser&);
+   Parser& operator=(const Parser&);
+
+public:
+   bool parse()
+   {
+      // as with json_spirit, anything following the value is ignored
+      skipWhitespace();
+      return parseValue();
+   }
+
+private:
+   void skipWhitespace()
+   {
+      while (pos_ != end_ && isWhitespace(*pos_))
+         ++pos_;
+   }
+
+   bool parseValue()
+   {
+      if (pos_ == end_)
+         return false;
+
+      switch (*pos_)
+      {
+         case '{':
+            return parseObject();
+         case '[':
+            return parseArray();
+         case '"':
+            return parseString(&string_) && pHandler_->onString(string_);
+         case 't':
+            return parseLiteral("true") && pHandler_->onBoolean(true);
+         case 'f':
+            return parseLiteral("false") && pHandler_->onBoolean(false);
+         case 'n':
+            return parseLiteral("null") && pHandler_->onNull();
+         default:
+            return parseNumber();
+      }
+   }
+
+   bool parseObject()
+   {
+      ++pos_;
+      if (!pHandler_->onObjectBegin())
+         return false;
+
+      skipWhitespace();
+      if (pos_ != end_ && *pos_ == '}')
+      {
+         ++pos_;
+         return pHandler_->onObjectEnd();
+      }
+
+      while (true)
+      {
+         // name
+         if (pos_ == end_ || *pos_ != '"')
+            return false;
+         if (!parseString(&string_) || !pHandler_->onMemberName(string_))
+            return false;
+
+         // separator
+         skipWhitespace();
+         if (pos_ == end_ || *pos_ != ':')
+            return false;
+         ++pos_;
+
+         // value
+         skipWhitespace();
+         if (!parseValue())
+            return false;
+
+         // next member or end of object
+         skipWhitespace();
+         if (pos_ == end_)
+            return false;
+         else if (*pos_ == ',')
+            ++pos_;
+         else if (*pos_ == '}')
+            break;
+         else
+            return false;
+
+         skipWhitespace();
+      }
+
+      ++pos_;
+      return pHandler_->onObjectEnd();
+   }
+
+   bool parseArray()
+   {
+      ++pos_;
+      if (!pHandler_->onArrayBegin())
+         return false;
+
+      skipWhitespace();
+      if (pos_ != end_ && *pos_ == ']')
+      {
+         ++pos_;
+         return pHandler_->onArrayEnd();
+      }
+
+      while (true)
+      {
+         if (!parseValue())
+            return false;
+
+         // next element or end of array
+         skipWhitespace();
+         if (pos_ == end_)
+            return false;
+         else if (*pos_ == ',')
+            ++pos_;
+         else if (*pos_ == ']')
+            break;
+         else
+            return false;
+
+         skipWhitespace();
+      }
+
+      ++pos_;
+      return pHandler_->onArrayEnd();
+   }
+
+   bool parseString(std::string* pStr)
+   {
+      pStr->clear();
+
+      // copy runs of unescaped characters in one go
+      const char* run = ++pos_;
+      while (pos_ != end_)
+      {
+         char ch = *pos_;
+         if (ch == '"')
+         {
+            pStr->append(run, pos_);
+            ++pos_;
+            return true;
+         }
+         else if (ch == '\\')
+         {
+            pStr->append(run, pos_);
+            ++pos_;
+            if (!parseEscape(pStr))
+               return false;
+            run = pos_;
+         }
+         else
+         {
+            ++pos_;
+         }
+      }
+
+      // unterminated
+      return false;
+   }
+
+   // parse the escape at pos_ (just past the backslash)
+   bool parseEscape(std::string* pStr)
+   {
+      if (pos_ == end_)
+         return false;
+
+      char ch = *pos_++;
+      switch (ch)
+      {
+         case '"':  pStr->push_back('"');  break;
+         case '\\': pStr->push_back('\\'); break;
+         case '/':  pStr->push_back('/');  break;
+         case 'b':  pStr->push_back('\b'); break;
+         case 'f':  pStr->push_back('\f'); break;
+         case 'n':  pStr->push_back('\n'); break;
+         case 'r':  pStr->push_back('\r'); break;
+         case 't':  pStr->push_back('\t'); break;
+         case 'x':
+         {
+            int value;
+            if (!parseHex(2, &value))
+               return false;
+            pStr->push_back(static_cast<char>(value));
+            break;
+         }
+         case 'u':
+         {
+            int value;
+            if (!parseHex(4, &value))
+               return false;
+
+            // combine surrogate pairs
+            boost::uint32_t codepoint = value;
+            if (value >= 0xD800 && value <= 0xDBFF &&
+                (end_ - pos_) >= 6 && pos_[0] == '\\' && pos_[1] == 'u')
+            {
+               const char* lowPos = pos_;
+               pos_ += 2;
+               int low;
+               if (parseHex(4, &low) && low >= 0xDC00 && low <= 0xDFFF)
+                  codepoint = 0x10000 + ((value - 0xD800) << 10) +
+                              (low - 0xDC00);
+               else
+                  pos_ = lowPos;
+            }
+
+            appendUtf8(codepoint, pStr);
+            break;
+         }
+         default:
+            // unknown escapes are dropped (as with json_spirit)
+            break;
+      }
+
+      return true;
+   }
+
+   bool parseHex(int digits, int* pValue)
+   {
+      if ((end_ - pos_) < digits)
+         return false;
+
+      int value = 0;
+      for (int i = 0; i < digits; i++)
+      {
+         int digit = hexValue(*pos_++);
+         if (digit < 0)
+            return false;
+         value = (value << 4) + digit;
+      }
+
+      *pValue = value;
+      return true;
+   }
+
+   bool parseLiteral(const char* literal)
+   {
+      std::size_t length = std::strlen(literal);
+      if (static_cast<std::size_t>(end_ - pos_) < length ||
+          std::memcmp(pos_, literal, length) != 0)
+      {
+         return false;
+      }
+
+      pos_ += length;
+      return true;
+   }
+
+   bool parseNumber()
+   {
+      // scan the number (reals have a fraction and/or exponent)
+      const char* begin = pos_;
+      bool negative = false;
+      if (*pos_ == '-' || *pos_ == '+')
+         negative = (*pos_++ == '-');
+
+      const char* digits = pos_;
+      skipDigits();
+      bool hasDigits = pos_ != digits;
+      bool isReal = false;
+
+      if (pos_ != end_ && *pos_ == '.')
+      {
+         isReal = true;
+         const char* fraction = ++pos_;
+         skipDigits();
+         hasDigits = hasDigits || pos_ != fraction;
+      }
+
+      if (!hasDigits)
+         return false;
+
+      if (pos_ != end_ && (*pos_ == 'e' || *pos_ == 'E'))
+      {
+         const char* exponent = pos_++;
+         if (pos_ != end_ && (*pos_ == '-' || *pos_ == '+'))
+            ++pos_;
+         const char* exponentDigits = pos_;
+         skipDigits();
+
+         // not actually an exponent
+         if (pos_ == exponentDigits)
+            pos_ = exponent;
+         else
+            isReal = true;
+      }
+
+      // integers (falling back to a real if they're out of range)
+      if (!isReal)
+      {
+         boost::uint64_t value = 0;
+         bool overflow = false;
+         for (const char* it = digits; it != pos_; ++it)
+         {
+            boost::uint64_t digit = *it - '0';
+            if (value > (~boost::uint64_t(0) - digit) / 10)
+            {
+               overflow = true;
+               break;
+            }
+            value = value * 10 + digit;
+         }
+
+         const boost::uint64_t kMaxInt64 = 0x7FFFFFFFFFFFFFFFULL;
+         if (!overflow)
+         {
+            if (!negative && value <= kMaxInt64)
+               return pHandler_->onInteger(static_cast<boost::int64_t>(value));
+            else if (!negative)
+               return pHandler_->onUnsignedInteger(value);
+            else if (value <= kMaxInt64 + 1)
+               return pHandler_->onInteger(
+                           static_cast<boost::int64_t>(0 - value));
+         }
+      }
+
+      // reals (copy the number so strtod can't read past it)
+      char buffer[64];
+      std::size_t length = pos_ - begin;
+      std::vector<char> largeBuffer;
+      char* number = buffer;
+      if (length >= sizeof(buffer))
+      {
+         largeBuffer.resize(length + 1);
+         number = &largeBuffer[0];
+      }
+      std::memcpy(number, begin, length);
+      number[length] = '\0';
+
+      return pHandler_->onReal(std::strtod(number, NULL));
+   }
+
+   void skipDigits()
+   {
+      while (pos_ != end_ && *pos_ >= '0' && *pos_ <= '9')
+         ++pos_;
+   }
+
+private:
+   const char* pos_;
+   const char* end_;
+   Handler* pHandler_;
+   std::string string_;
+};
+
+// builds a Value from parse events (values are constructed in place
+// within their parent)
+class ValueBuilder
+{
+public:
+   explicit ValueBuilder(Value* pRoot)
+      : pRoot_(pRoot)
+   {
+   }
+
+   bool onObjectBegin()
+   {
+      stack_.push_back(add(Value(Object())));
+      return true;
+   }
+
+   bool onObjectEnd()
+   {
+      stack_.pop_back();
+      return true;
+   }
+
+   bool onArrayBegin()
+   {
+      stack_.push_back(add(Value(Array())));
+      return true;
+   }
+
+   bool onArrayEnd()
+   {
+      stack_.pop_back();
+      return true;
+   }
+
+   bool onMemberName(const std::string& name)
+   {
+      name_ = name;
+      return true;
+   }
+
+   bool onString(const std::string& value)
+   {
+      add(Value(value));
+      return true;
+   }
+
+   bool onInteger(boost::int64_t value)
+   {
+      add(Value(value));
+      return true;
+   }
+
+   bool onUnsignedInteger(boost::uint64_t value)
+   {
+      add(Value(value));
+      return true;
+   }
+
+   bool onReal(double value)
+   {
+      add(Value(value));
+      return true;
+   }
+
+   bool onBoolean(bool value)
+   {
+      add(Value(value));
+      return true;
+   }
+
+   bool onNull()
+   {
+      add(Value());
+      return true;
+   }
+
+private:
+   Value* add(const Value& value)
+   {
+      if (stack_.empty())
+      {
+         *pRoot_ = value;
+         return pRoot_;
+      }
+
+      Value* pParent = stack_.back();
+      if (pParent->type() == ArrayType)
+      {
+         Array& array = pParent->get_array();
+         array.push_back(value);
+         return &array.back();
+      }
+      else
+      {
+         // later duplicate names replace earlier ones
+         Value& member = pParent->get_obj()[name_];
+         member = value;
+         return &member;
+      }
+   }
+
+private:
+   Value* pRoot_;
+   std::vector<Value*> stack_;
+   std::string name_;
+};
+
+// writes json straight into an output string
+class Writer
+{
+public:
+   Writer(bool pretty, std::string* pOutput)
+      : pretty_(pretty), indent_(0), pOutput_(pOutput)
+   {
+   }
+
+   // COPYING: prohibited
+private:
+   Writer(const Writer&);
+   Writer& operator=(const Writer&);
+
+public:
+   void write(const Value& value)
+   {
+      switch (value.type())
+      {
+         case json_spirit::obj_type:
+            writeObject(value.get_obj());
+            break;
+         case json_spirit::array_type:
+            writeArray(value.get_array());
+            break;
+         case json_spirit::str_type:
+            writeString(value.get_str());
+            break;
+         case json_spirit::bool_type:
+            pOutput_->append(value.get_bool() ? "true" : "false");
+            break;
+         case json_spirit::int_type:
+            if (value.is_uint64())
+               writeUnsigned(value.get_uint64());
+            else
+               writeInteger(value.get_int64());
+            break;
+         case json_spirit::real_type:
+            writeReal(value.get_real());
+            break;
+         case json_spirit::null_type:
+            pOutput_->append("null");
+            break;
+      }
+   }
+
+private:
+   void writeObject(const Object& object)
+   {
+      pOutput_->push_back('{');
+      newLine();
+      indent_++;
+      for (Object::const_iterator it = object.begin(); it != object.end(); )
+      {
+         indent();
+         writeString(it->first);
+         space();
+         pOutput_->push_back(':');
+         space();
+         write(it->second);
+         if (++it != object.end())
+            pOutput_->push_back(',');
+         newLine();
+      }
+      indent_--;
+      indent();
+      pOutput_->push_back('}');
+   }
+
+   void writeArray(const Array& array)
+   {
+      pOutput_->push_back('[');
+      newLine();
+      indent_++;
+      for (Array::const_iterator it = array.begin(); it != array.end(); )
+      {
+         indent();
+         write(*it);
+         if (++it != array.end())
+            pOutput_->push_back(',');
+         newLine();
+      }
+      indent_--;
+      indent();
+      pOutput_->push_back(']');
+   }
+
+   void writeString(const std::string& str)
+   {
+      pOutput_->push_back('"');
+
+      // copy runs of characters which needn't be escaped in one go
+      const char* run = str.data();
+      const char* end = str.data() + str.length();
+      for (const char* it = run; it != end; ++it)
+      {
+         const char* escape = NULL;
+         switch (*it)
+         {
+            case '"':  escape = "\\\""; break;
+            case '\\': escape = "\\\\"; break;
+            case '\b': escape = "\\b";  break;
+            case '\f': escape = "\\f";  break;
+            case '\n': escape = "\\n";  break;
+            case '\r': escape = "\\r";  break;
+            case '\t': escape = "\\t";  break;
+         }
+
+         if (escape != NULL)
+         {
+            pOutput_->append(run, it);
+            pOutput_->append(escape);
+            run = it + 1;
+         }
+      }
+      pOutput_->append(run, end);
+
+      pOutput_->push_back('"');
+   }
+
+   void writeUnsigned(boost::uint64_t value)
+   {
+      char buffer[24];
+      char* pos = buffer + sizeof(buffer);
+      do
+      {
+         *--pos = static_cast<char>('0' + (value % 10));
+         value /= 10;
+      } while (value != 0);
+      pOutput_->append(pos, buffer + sizeof(buffer));
+   }
+
+   void writeInteger(boost::int64_t value)
+   {
+      if (value < 0)
+      {
+         pOutput_->push_back('-');
+         writeUnsigned(0 - static_cast<boost::uint64_t>(value));
+      }
+      else
+      {
+         writeUnsigned(static_cast<boost::uint64_t>(value));
+      }
+   }
+
+   void writeReal(double value)
+   {
+      // equivalent to json_spirit's std::showpoint/std::setprecision(16)
+      char buffer[64];
+      int length = ::snprintf(buffer, sizeof(buffer), "%#.16g", value);
+      if (length > 0)
+         pOutput_->append(buffer, std::min<std::size_t>(length,
+                                                        sizeof(buffer) - 1));
+   }
+
+   void indent()
+   {
+      if (pretty_)
+         pOutput_->append(indent_ * 4, ' ');
+   }
+
+   void space()
+   {
+      if (pretty_)
+         pOutput_->push_back(' ');
+   }
+
+   void newLine()
+   {
+      if (pretty_)
+         pOutput_->push_back('\n');
+   }
+
+private:
+   bool pretty_;
+   int indent_;
+   std::string* pOutput_;
+};
+
+} // anonymous namespace
+
 json::Value toJsonString(const std::string& val)
 {
    return json::Value(val);
@@ -42,36 +743,51 @@ json::Value toJsonString(const std::string& val)
 
 bool parse(const std::string& input, Value* pValue)
 {
-   // two threads simultaneously using the json parser has been observed
-   // to crash the process. protect it globally with a mutex. note this was
-   // probably a result of not defining BOOST_SPIRIT_THREADSAFE (which we
-   // have subsequently defined) however since there isn't much documentation 
-   // on the behavior of boost spirit w/ threads and the specific behavior
-   // of this constant we leave in mutex just to be sure   
-      
-   static boost::mutex s_spiritMutex ;
-   LOCK_MUTEX(s_spiritMutex)
-   {
-      return json_spirit::read(input, *pValue);
-   }
-   END_LOCK_MUTEX
-   
-   // mutex related error
-   return false;
+   try
+   {
+      ValueBuilder builder(pValue);
+      Parser<ValueBuilder> parser(input, &builder);
+      return parser.parse();
+   }
+   catch(const std::exception& e)
+   {
+      LOG_ERROR_MESSAGE("Error parsing json: " + std::string(e.what()));
+      return false;
+   }
+}
+
+bool parse(const std::string& input, ParseHandler* pHandler)
+{
+   Parser<ParseHandler> parser(input, pHandler);
+   return parser.parse();
 }
 
 void write(const Value& value, std::ostream& os)
 {
-   json_spirit::write(value, os);
+   std::string output;
+   write(value, &output);
+   os << output;
+}
+
+void write(const Value& value, std::string* pOutput)
+{
+   Writer writer(false, pOutput);
+   writer.write(value);
 }
 
 void writeFormatted(const Value& value, std::ostream& os)
 {
-   json_spirit::write_formatted(value, os);
-}   
+   std::string output;
+   writeFormatted(value, &output);
+   os << output;
+}
+
+void writeFormatted(const Value& value, std::string* pOutput)
+{
+   Writer writer(true, pOutput);
+   writer.write(value);
+}
    
 } // namespace json
 } // namespace core
 
-
-
@@ -173,6 +173,11 @@ void JsonRpcResponse::write(std::ostream& os) const
 {
    json::write(response_, os);
 }
+
+void JsonRpcResponse::write(std::string* pOutput) const
+{
+   json::write(response_, pOutput);
+}
    
 void JsonRpcResponse::setError(const Error& error, const json::Value& clientInfo)
 {
@@ -253,10 +258,20 @@ void setJsonRpcResponse(const core::json::JsonRpcResponse& jsonRpcResponse,
    if (pResponse->contentType().empty())
        pResponse->setContentType(kJsonContentType) ; 
    
-   // set body 
-   std::stringstream responseStream ;
-   jsonRpcResponse.write(responseStream);
-   Error error = pResponse->setBody(responseStream);
+   // set body (written straight into a string, which can be used as-is
+   // unless the body needs to be compressed)
+   std::string responseBody;
+   jsonRpcResponse.write(&responseBody);
+   Error error;
+   if (pResponse->contentEncoding() == http::kGzipEncoding)
+   {
+      std::istringstream responseStream(responseBody);
+      error = pResponse->setBody(responseStream);
+   }
+   else
+   {
+      pResponse->setBodyUnencoded(responseBody);
+   }
    
    // report error to client if one occurred
    if (error)
@@ -0,0 +1,242 @@
+/*
+ * JsonTests.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include <core/json/Json.hpp>
+
+#include <iostream>
+#include <sstream>
+
+#include <boost/assert.hpp>
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "spirit/json_spirit.h"
+
+namespace core {
+namespace json {
+
+namespace {
+
+// typical rpc traffic (requests, responses, and events)
+const char * const kSamples[] =
+{
+   "{\"method\":\"console_input\",\"params\":[\"print(1:10)\"],"
+      "\"clientId\":\"33e600bb-c1b1-46bf-b562-ab5cba070b0e\"}",
+
+   "{\"result\":{\"contents\":\"x <- c(1, 2, 3)\\nplot(x)\\n\","
+      "\"dirty\":false,\"encoding\":\"UTF-8\",\"folds\":\"\","
+      "\"id\":\"5A6E1B2C\",\"path\":\"~/analysis/plot.R\","
+      "\"properties\":{\"cursorPosition\":\"2,7\",\"scrollLine\":\"0\"},"
+      "\"relative_order\":1,\"source_on_save\":false,"
+      "\"type\":\"r_source\"}}",
+
+   "[{\"type\":10,\"data\":{\"output\":\"[1]  1  2  3  4  5  6  7  8  9 10\\n\","
+      "\"error\":false}},{\"type\":11,\"data\":{\"prompt\":\"> \","
+      "\"history\":true,\"addToHistory\":true}}]",
+
+   "{\"error\":{\"code\":2,\"message\":\"Execution error\","
+      "\"error\":{\"code\":5,\"category\":\"system\","
+      "\"message\":\"Input/output error\"}}}",
+
+   "{\"numbers\":[0,-1,9223372036854775807,-9223372036854775808,"
+      "18446744073709551615,1.5,-0.25,6.02e23,1E-7,3.0],"
+      "\"escapes\":\"tab\\tquote\\\"slash\\/back\\\\slash\\u0041\","
+      "\"utf8\":\"caf\xC3\xA9\",\"literals\":[true,false,null],"
+      "\"empty\":{\"object\":{},\"array\":[],\"string\":\"\"}}",
+
+   "  {\"trailing\" : [ 1 , 2 ] , \"whitespace\" : { } }  ",
+
+   "{\"duplicate\":1,\"duplicate\":2}",
+};
+
+const int kIterations = 20000;
+
+std::string writeString(const Value& value, bool formatted)
+{
+   std::string output;
+   if (formatted)
+      writeFormatted(value, &output);
+   else
+      write(value, &output);
+   return output;
+}
+
+std::string writeSpirit(const Value& value, bool formatted)
+{
+   std::ostringstream ostr;
+   if (formatted)
+      json_spirit::write_formatted(value, ostr);
+   else
+      json_spirit::write(value, ostr);
+   return ostr.str();
+}
+
+// values and output must match json_spirit exactly
+bool verifyParity(const std::string& input)
+{
+   Value value, spiritValue;
+   if (!parse(input, &value) || !json_spirit::read(input, spiritValue))
+      return false;
+   if (!(value == spiritValue))
+      return false;
+
+   return writeString(value, false) == writeSpirit(value, false) &&
+          writeString(value, true) == writeSpirit(value, true);
+}
+
+bool verifyParseErrors()
+{
+   const char * const kInvalid[] =
+   {
+      "", "   ", "{", "[1,2", "{\"a\" 1}", "{\"a\":}", "[1,]",
+      "\"unterminated", "tru", "-", "{a:1}", "\"\\u12\""
+   };
+
+   for (std::size_t i = 0; i < sizeof(kInvalid) / sizeof(kInvalid[0]); i++)
+   {
+      Value value;
+      if (parse(kInvalid[i], &value))
+         return false;
+   }
+
+   return true;
+}
+
+bool verifyUnicodeEscapes()
+{
+   Value value;
+   if (!parse("[\"\\u00e9\\u20ac\\ud83d\\ude00\"]", &value))
+      return false;
+   return value.get_array()[0].get_str() ==
+          "\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80";
+}
+
+// counts events (verifies that the handler sees the whole document)
+class CountingHandler : public ParseHandler
+{
+public:
+   CountingHandler() : containers(0), scalars(0) {}
+
+   virtual bool onObjectBegin() { containers++; return true; }
+   virtual bool onObjectEnd() { return true; }
+   virtual bool onArrayBegin() { containers++; return true; }
+   virtual bool onArrayEnd() { return true; }
+   virtual bool onMemberName(const std::string&) { return true; }
+   virtual bool onString(const std::string&) { scalars++; return true; }
+   virtual bool onInteger(boost::int64_t) { scalars++; return true; }
+   virtual bool onUnsignedInteger(boost::uint64_t) { scalars++; return true; }
+   virtual bool onReal(double) { scalars++; return true; }
+   virtual bool onBoolean(bool) { scalars++; return true; }
+   virtual bool onNull() { scalars++; return true; }
+
+   int containers;
+   int scalars;
+};
+
+bool verifyParseHandler()
+{
+   CountingHandler handler;
+   if (!parse("{\"a\":[1,2.5,\"x\",true,null],\"b\":{}}", &handler))
+      return false;
+   return handler.containers == 3 && handler.scalars == 5;
+}
+
+double elapsedSeconds(const boost::posix_time::ptime& start)
+{
+   boost::posix_time::ptime end =
+                        boost::posix_time::microsec_clock::universal_time();
+   return (end - start).total_microseconds() / 1000000.0;
+}
+
+void benchmark(const std::vector<std::string>& samples)
+{
+   using namespace boost::posix_time;
+
+   std::vector<Value> values(samples.size());
+
+   ptime start = microsec_clock::universal_time();
+   for (int i = 0; i < kIterations; i++)
+   {
+      for (std::size_t j = 0; j < samples.size(); j++)
+         parse(samples[j], &values[j]);
+   }
+   double parseSeconds = elapsedSeconds(start);
+
+   start = microsec_clock::universal_time();
+   for (int i = 0; i < kIterations; i++)
+   {
+      for (std::size_t j = 0; j < samples.size(); j++)
+         json_spirit::read(samples[j], values[j]);
+   }
+   double spiritParseSeconds = elapsedSeconds(start);
+
+   start = microsec_clock::universal_time();
+   for (int i = 0; i < kIterations; i++)
+   {
+      for (std::size_t j = 0; j < values.size(); j++)
+         writeString(values[j], false);
+   }
+   double writeSeconds = elapsedSeconds(start);
+
+   start = microsec_clock::universal_time();
+   for (int i = 0; i < kIterations; i++)
+   {
+      for (std::size_t j = 0; j < values.size(); j++)
+         writeSpirit(values[j], false);
+   }
+   double spiritWriteSeconds = elapsedSeconds(start);
+
+   std::cout << boost::format("json parse: %1%s (json_spirit %2%s), "
+                              "write: %3%s (json_spirit %4%s)")
+                  % parseSeconds
+                  % spiritParseSeconds
+                  % writeSeconds
+                  % spiritWriteSeconds
+             << std::endl;
+}
+
+} // anonymous namespace
+
+
+void runJsonTests()
+{
+   std::vector<std::string> samples;
+   bool parity = true;
+   for (std::size_t i = 0; i < sizeof(kSamples) / sizeof(kSamples[0]); i++)
+   {
+      samples.push_back(kSamples[i]);
+      parity = verifyParity(kSamples[i]) && parity;
+   }
+   BOOST_ASSERT(parity);
+
+   bool parseErrors = verifyParseErrors();
+   BOOST_ASSERT(parseErrors);
+   bool unicodeEscapes = verifyUnicodeEscapes();
+   BOOST_ASSERT(unicodeEscapes);
+   bool parseHandler = verifyParseHandler();
+   BOOST_ASSERT(parseHandler);
+
+   std::cout << boost::format("json_spirit parity %1%, parse errors %2%, "
+                              "unicode escapes %3%, parse handler %4%")
+                  % (parity ? "ok" : "FAILED")
+                  % (parseErrors ? "ok" : "FAILED")
+                  % (unicodeEscapes ? "ok" : "FAILED")
+                  % (parseHandler ? "ok" : "FAILED")
+             << std::endl;
+
+   benchmark(samples);
+}
+
+
+} // namespace json
+} // namespace core
@@ -0,0 +1,562 @@
+/*
+ * HunspellCompiledDictionary.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include <core/spelling/HunspellCompiledDictionary.hpp>
+
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <set>
+
+#include <boost/cstdint.hpp>
+#include <boost/foreach.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include <core/Error.hpp>
+#include <core/FilePath.hpp>
+#include <core/FileSerializer.hpp>
+#include <core/StringUtils.hpp>
+#include <core/system/System.hpp>
+
+// see note in HunspellSpellingEngine.cpp
+#if defined(near)
+#undef near
+#endif
+#include "hunspell/hunspell.hxx"
+
+namespace core {
+namespace spelling {
+
+namespace {
+
+// file format: header followed by the key, encoding and word characters
+// (UTF-16) records, the number of words, the offsets of the words (one
+// more than the number of words) and then the sorted words themselves
+// (without separators). records are
+//
+//    <length:uint32> <value:length bytes>
+//
+// (all in native byte order)
+const char kFileHeader[] = "RSDICT01";
+const std::size_t kFileHeaderSize = sizeof(kFileHeader) - 1;
+
+void appendUInt32(boost::uint32_t value, std::string* pContents)
+{
+   pContents->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void appendRecord(const std::string& value, std::string* pContents)
+{
+   appendUInt32(static_cast<boost::uint32_t>(value.length()), pContents);
+   pContents->append(value);
+}
+
+boost::uint32_t uint32At(const char* pos)
+{
+   boost::uint32_t value;
+   std::memcpy(&value, pos, sizeof(value));
+   return value;
+}
+
+bool readUInt32(const char** ppPos, const char* end, boost::uint32_t* pValue)
+{
+   if (static_cast<std::size_t>(end - *ppPos) < sizeof(*pValue))
+      return false;
+   *pValue = uint32At(*ppPos);
+   *ppPos += sizeof(*pValue);
+   return true;
+}
+
+bool readRecord(const char** ppPos, const char* end, std::string* pValue)
+{
+   boost::uint32_t length;
+   if (!readUInt32(ppPos, end, &length))
+      return false;
+
+   if (static_cast<std::size_t>(end - *ppPos) < length)
+      return false;
+   pValue->assign(*ppPos, *ppPos + length);
+   *ppPos += length;
+   return true;
+}
+
+Error invalidFileError(const FilePath& filePath, const ErrorLocation& location)
+{
+   Error error = systemError(boost::system::errc::invalid_argument, location);
+   error.addProperty("path", filePath.absolutePath());
+   return error;
+}
+
+// prefix or suffix rule from the .aff file. conditions are sequences of
+// characters, '.' and bracketed sets (e.g. [^aeiou]) which the start
+// (prefixes) or end (suffixes) of the root word must match
+struct AffixRule
+{
+   bool prefix;
+   bool crossProduct;
+   std::string strip;
+   std::string affix;
+   std::vector<std::string> condition;
+};
+
+typedef std::map<unsigned short, std::vector<AffixRule> > AffixRules;
+
+bool parseCondition(const std::string& condition,
+                    std::vector<std::string>* pClasses)
+{
+   if (condition == ".")
+      return true;
+
+   for (std::size_t i = 0; i < condition.size(); i++)
+   {
+      // we only generate forms for conditions which don't involve
+      // multibyte characters (words we don't generate are left to hunspell)
+      if (static_cast<unsigned char>(condition[i]) > 127)
+         return false;
+
+      if (condition[i] == '[')
+      {
+         std::size_t end = condition.find(']', i);
+         if (end == std::string::npos)
+            return false;
+         pClasses->push_back(condition.substr(i + 1, end - i - 1));
+         i = end;
+      }
+      else
+      {
+         pClasses->push_back(std::string(1, condition[i]));
+      }
+   }
+
+   return true;
+}
+
+bool matchesClass(const std::string& charClass, char ch)
+{
+   if (charClass == ".")
+      return true;
+   else if (!charClass.empty() && charClass[0] == '^')
+      return charClass.find(ch, 1) == std::string::npos;
+   else
+      return charClass.find(ch) != std::string::npos;
+}
+
+bool appliesTo(const AffixRule& rule, const std::string& word)
+{
+   const std::vector<std::string>& condition = rule.condition;
+   if (word.size() < condition.size() || word.size() <= rule.strip.size())
+      return false;
+
+   std::size_t start = rule.prefix ? 0 : word.size() - condition.size();
+   for (std::size_t i = 0; i < condition.size(); i++)
+   {
+      if (!matchesClass(condition[i], word[start + i]))
+         return false;
+   }
+
+   if (rule.prefix)
+      return boost::algorithm::starts_with(word, rule.strip);
+   else
+      return boost::algorithm::ends_with(word, rule.strip);
+}
+
+std::string applyTo(const AffixRule& rule, const std::string& word)
+{
+   if (rule.prefix)
+      return rule.affix + word.substr(rule.strip.size());
+   else
+      return word.substr(0, word.size() - rule.strip.size()) + rule.affix;
+}
+
+Error readAffixRules(const FilePath& affPath,
+                     const HashMgr& hashMgr,
+                     AffixRules* pRules)
+{
+   std::string contents;
+   Error error = core::readStringFromFile(affPath, &contents);
+   if (error)
+      return error;
+
+   // the first line for each prefix or suffix flag is a header which says
+   // whether the rules can be combined with rules of the other kind
+   std::map<std::string, bool> crossProduct;
+
+   std::vector<std::string> lines;
+   boost::algorithm::split(lines, contents, boost::algorithm::is_any_of("\n"));
+   BOOST_FOREACH(const std::string& line, lines)
+   {
+      std::vector<std::string> fields;
+      std::string trimmed = boost::algorithm::trim_copy(line);
+      boost::algorithm::split(fields,
+                              trimmed,
+                              boost::algorithm::is_any_of(" \t"),
+                              boost::algorithm::token_compress_on);
+      if (fields.size() < 4 || (fields[0] != "PFX" && fields[0] != "SFX"))
+         continue;
+
+      std::string flagKey = fields[0] + fields[1];
+      if (crossProduct.find(flagKey) == crossProduct.end())
+      {
+         crossProduct[flagKey] = (fields[2] == "Y");
+         continue;
+      }
+
+      AffixRule rule;
+      rule.prefix = (fields[0] == "PFX");
+      rule.crossProduct = crossProduct[flagKey];
+      rule.strip = (fields[2] == "0") ? std::string() : fields[2];
+      // (drop any continuation flags, forms they allow are left to hunspell)
+      rule.affix = fields[3].substr(0, fields[3].find('/'));
+      if (rule.affix == "0")
+         rule.affix.clear();
+      std::string condition = fields.size() > 4 ? fields[4] : ".";
+      if (!parseCondition(condition, &rule.condition))
+         continue;
+
+      unsigned short flag = const_cast<HashMgr&>(hashMgr).decode_flag(
+                                                         fields[1].c_str());
+      (*pRules)[flag].push_back(rule);
+   }
+
+   return Success();
+}
+
+// generate the word and its affixed forms
+void expandWord(const std::string& word,
+                const unsigned short* flags,
+                int flagCount,
+                const AffixRules& rules,
+                std::vector<std::string>* pForms)
+{
+   pForms->push_back(word);
+
+   std::vector<const AffixRule*> prefixes, suffixes;
+   for (int i = 0; i < flagCount; i++)
+   {
+      AffixRules::const_iterator it = rules.find(flags[i]);
+      if (it == rules.end())
+         continue;
+
+      BOOST_FOREACH(const AffixRule& rule, it->second)
+      {
+         if (appliesTo(rule, word))
+            (rule.prefix ? prefixes : suffixes).push_back(&rule);
+      }
+   }
+
+   std::vector<std::string> crossSuffixed;
+   BOOST_FOREACH(const AffixRule* pRule, suffixes)
+   {
+      pForms->push_back(applyTo(*pRule, word));
+      if (pRule->crossProduct)
+         crossSuffixed.push_back(pForms->back());
+   }
+
+   BOOST_FOREACH(const AffixRule* pRule, prefixes)
+   {
+      pForms->push_back(applyTo(*pRule, word));
+      if (!pRule->crossProduct)
+         continue;
+
+      BOOST_FOREACH(const std::string& suffixed, crossSuffixed)
+      {
+         if (boost::algorithm::starts_with(suffixed, pRule->strip))
+            pForms->push_back(applyTo(*pRule, suffixed));
+      }
+   }
+}
+
+int compareWord(const char* word, std::size_t length, const std::string& other)
+{
+   int result = std::memcmp(word, other.data(), std::min(length, other.size()));
+   if (result != 0)
+      return result;
+   else if (length < other.size())
+      return -1;
+   else if (length > other.size())
+      return 1;
+   else
+      return 0;
+}
+
+} // anonymous namespace
+
+Error HunspellCompiledDictionary::compile(
+                              const HunspellDictionary& dictionary,
+                              const std::vector<DictionaryWord>& extraWords,
+                              const IconvstrFunction& iconvstrFunction,
+                              const std::string& key,
+                              const FilePath& targetPath)
+{
+   // validate that dictionaries exist
+   if (!dictionary.affPath().exists())
+      return core::fileNotFoundError(dictionary.affPath(), ERROR_LOCATION);
+   if (!dictionary.dicPath().exists())
+      return core::fileNotFoundError(dictionary.dicPath(), ERROR_LOCATION);
+
+   // convert paths to system encoding before sending to external API
+   std::string systemAffPath = string_utils::utf8ToSystem(
+                                 dictionary.affPath().absolutePath());
+   std::string systemDicPath = string_utils::utf8ToSystem(
+                                 dictionary.dicPath().absolutePath());
+
+   // hunspell verifies the forms we generate and the hash manager provides
+   // the words along with their (decoded) affix flags
+   Hunspell hunspell(systemAffPath.c_str(), systemDicPath.c_str());
+   HashMgr hashMgr(systemDicPath.c_str(), systemAffPath.c_str());
+   std::string encoding = hunspell.get_dic_encoding();
+
+   BOOST_FOREACH(const DictionaryWord& extraWord, extraWords)
+   {
+      std::string word, example;
+      Error error = iconvstrFunction(extraWord.word, "UTF-8", encoding,
+                                     false, &word);
+      if (!error && !extraWord.example.empty())
+      {
+         error = iconvstrFunction(extraWord.example, "UTF-8", encoding,
+                                  false, &example);
+      }
+      if (error)
+      {
+         LOG_ERROR(error);
+         continue;
+      }
+
+      if (example.empty())
+      {
+         hunspell.add(word.c_str());
+         hashMgr.add(word.c_str());
+      }
+      else
+      {
+         hunspell.add_with_affix(word.c_str(), example.c_str());
+         hashMgr.add_with_affix(word.c_str(), example.c_str());
+      }
+   }
+
+   AffixRules rules;
+   Error error = readAffixRules(dictionary.affPath(), hashMgr, &rules);
+   if (error)
+      return error;
+
+   // collect the forms hunspell accepts (along with their capitalized
+   // versions, which are as common as the forms themselves)
+   std::vector<std::string> words, forms;
+   int col = -1;
+   for (struct hentry* pEntry = hashMgr.walk_hashtable(col, NULL);
+        pEntry != NULL;
+        pEntry = hashMgr.walk_hashtable(col, pEntry))
+   {
+      forms.clear();
+      expandWord(std::string(pEntry->word, pEntry->blen),
+                 pEntry->astr,
+                 pEntry->alen,
+                 rules,
+                 &forms);
+
+      BOOST_FOREACH(std::string& form, forms)
+      {
+         if (!hunspell.spell(form.c_str()))
+            continue;
+         words.push_back(form);
+
+         if (form[0] >= 'a' && form[0] <= 'z')
+         {
+            form[0] = form[0] - 'a' + 'A';
+            if (hunspell.spell(form.c_str()))
+               words.push_back(form);
+         }
+      }
+   }
+   std::sort(words.begin(), words.end());
+   words.erase(std::unique(words.begin(), words.end()), words.end());
+
+   // word characters
+   int wordCharsLength = 0;
+   unsigned short* pWordChars = hunspell.get_wordchars_utf16(&wordCharsLength);
+   std::string wordChars;
+   if (pWordChars && wordCharsLength > 0)
+   {
+      wordChars.assign(reinterpret_cast<const char*>(pWordChars),
+                       wordCharsLength * sizeof(unsigned short));
+   }
+
+   // write the file
+   std::string contents(kFileHeader, kFileHeaderSize);
+   appendRecord(key, &contents);
+   appendRecord(encoding, &contents);
+   appendRecord(wordChars, &contents);
+   appendUInt32(static_cast<boost::uint32_t>(words.size()), &contents);
+   boost::uint32_t offset = 0;
+   BOOST_FOREACH(const std::string& word, words)
+   {
+      appendUInt32(offset, &contents);
+      offset += static_cast<boost::uint32_t>(word.size());
+   }
+   appendUInt32(offset, &contents);
+   BOOST_FOREACH(const std::string& word, words)
+   {
+      contents.append(word);
+   }
+
+   // (write to a temporary file and then move it into place so other
+   // processes never see a partially written file)
+   FilePath tempPath = targetPath.parent().childPath(
+            targetPath.filename() + "." + core::system::generateUuid(false));
+   error = writeStringToFile(tempPath, contents);
+   if (error)
+      return error;
+
+   error = tempPath.move(targetPath);
+   if (error)
+   {
+      Error removeError = tempPath.removeIfExists();
+      if (removeError)
+         LOG_ERROR(removeError);
+      return error;
+   }
+
+   return Success();
+}
+
+struct HunspellCompiledDictionary::Impl
+{
+   Impl() : wordCount(0), pOffsets(NULL), pWords(NULL) {}
+
+   boost::iostreams::mapped_file_source file;
+   std::string encoding;
+   std::wstring wordChars;
+   boost::uint32_t wordCount;
+   const char* pOffsets;
+   const char* pWords;
+};
+
+HunspellCompiledDictionary::HunspellCompiledDictionary()
+   : pImpl_(new Impl())
+{
+}
+
+HunspellCompiledDictionary::~HunspellCompiledDictionary()
+{
+   try
+   {
+      pImpl_.reset();
+   }
+   catch(...)
+   {
+   }
+}
+
+Error HunspellCompiledDictionary::open(const FilePath& filePath,
+                                       const std::string& key)
+{
+   if (!filePath.exists())
+      return core::fileNotFoundError(filePath, ERROR_LOCATION);
+
+   boost::scoped_ptr<Impl> pImpl(new Impl());
+   try
+   {
+      pImpl->file.open(filePath.absolutePath());
+   }
+   catch(const std::exception& e)
+   {
+      Error error = systemError(boost::system::errc::io_error,
+                                ERROR_LOCATION);
+      error.addProperty("what", e.what());
+      error.addProperty("path", filePath.absolutePath());
+      return error;
+   }
+
+   const char* pos = pImpl->file.data();
+   const char* end = pos + pImpl->file.size();
+   if (pImpl->file.size() < kFileHeaderSize ||
+       std::memcmp(pos, kFileHeader, kFileHeaderSize) != 0)
+   {
+      return invalidFileError(filePath, ERROR_LOCATION);
+   }
+   pos += kFileHeaderSize;
+
+   std::string fileKey, wordChars;
+   if (!readRecord(&pos, end, &fileKey) ||
+       !readRecord(&pos, end, &pImpl->encoding) ||
+       !readRecord(&pos, end, &wordChars) ||
+       !readUInt32(&pos, end, &pImpl->wordCount) ||
+       fileKey != key)
+   {
+      return invalidFileError(filePath, ERROR_LOCATION);
+   }
+
+   for (std::size_t i = 0; i + 1 < wordChars.size(); i += 2)
+   {
+      unsigned short ch;
+      std::memcpy(&ch, wordChars.data() + i, sizeof(ch));
+      pImpl->wordChars.push_back(ch);
+   }
+
+   // validate the offsets so that lookups never leave the file
+   std::size_t offsetsSize = (pImpl->wordCount + 1) * sizeof(boost::uint32_t);
+   if (static_cast<std::size_t>(end - pos) < offsetsSize)
+      return invalidFileError(filePath, ERROR_LOCATION);
+   pImpl->pOffsets = pos;
+   pImpl->pWords = pos + offsetsSize;
+
+   boost::uint32_t previous = 0;
+   for (boost::uint32_t i = 0; i <= pImpl->wordCount; i++)
+   {
+      boost::uint32_t offset = uint32At(pImpl->pOffsets + i * sizeof(offset));
+      if (offset < previous)
+         return invalidFileError(filePath, ERROR_LOCATION);
+      previous = offset;
+   }
+   if (static_cast<std::size_t>(end - pImpl->pWords) != previous)
+      return invalidFileError(filePath, ERROR_LOCATION);
+
+   pImpl_.swap(pImpl);
+   return Success();
+}
+
+const std::string& HunspellCompiledDictionary::encoding() const
+{
+   return pImpl_->encoding;
+}
+
+const std::wstring& HunspellCompiledDictionary::wordChars() const
+{
+   return pImpl_->wordChars;
+}
+
+bool HunspellCompiledDictionary::contains(const std::string& word) const
+{
+   const char* pOffsets = pImpl_->pOffsets;
+   std::size_t low = 0, high = pImpl_->wordCount;
+   while (low < high)
+   {
+      std::size_t mid = low + (high - low) / 2;
+      boost::uint32_t start = uint32At(pOffsets + mid * sizeof(start));
+      boost::uint32_t end = uint32At(pOffsets + (mid + 1) * sizeof(end));
+
+      int result = compareWord(pImpl_->pWords + start, end - start, word);
+      if (result < 0)
+         low = mid + 1;
+      else if (result > 0)
+         high = mid;
+      else
+         return true;
+   }
+
+   return false;
+}
+
+} // namespace spelling
+} // namespace core
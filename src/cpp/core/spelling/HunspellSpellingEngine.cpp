@@ -13,15 +13,27 @@
 
 #include <core/spelling/HunspellSpellingEngine.hpp>
 
+#include <cctype>
+#include <ctime>
+#include <list>
+#include <set>
+
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/algorithm/string.hpp>
 
 #include <core/Error.hpp>
 #include <core/FilePath.hpp>
+#include <core/Hash.hpp>
+#include <core/SafeConvert.hpp>
 #include <core/StringUtils.hpp>
+#include <core/Thread.hpp>
 #include <core/FileSerializer.hpp>
 
 #include <core/spelling/HunspellDictionaryManager.hpp>
+#include <core/spelling/HunspellCompiledDictionary.hpp>
 
 // Including the hunspell headers caused compilation errors for Windows 64-bit
 // builds. The trouble seemd to be a 'near' macro defined somewhere in the
@@ -104,6 +116,51 @@ std::string exampleWordForEnglishAffix(const std::string& affix)
       return std::string();
 }
 
+FilePath dicDeltaPath(const HunspellDictionary& dictionary)
+{
+   FilePath dicPath = dictionary.dicPath();
+   return dicPath.parent().childPath(dicPath.stem() + ".dic_delta");
+}
+
+Error readDicDeltaFile(const FilePath& dicDeltaPath,
+                       std::vector<DictionaryWord>* pWords)
+{
+   // determine whether we are going to support affixes -- we do this for
+   // english only right now because we can correctly (by inspection) map
+   // the chromium numeric affix indicators (6 and 7) to the right
+   // hunspell example words. it's worth investigating whether we can do
+   // this for other languages as well
+   bool addAffixes = boost::algorithm::starts_with(dicDeltaPath.stem(),
+                                                   "en_");
+
+   // read the file and strip the BOM
+   std::string contents;
+   Error error = core::readStringFromFile(dicDeltaPath, &contents);
+   if (error)
+      return error;
+   core::stripBOM(&contents);
+
+   // split into lines
+   std::vector<std::string> lines;
+   boost::algorithm::split(lines,
+                           contents,
+                           boost::algorithm::is_any_of("\n"));
+
+   // parse lines for words
+   std::string word, affix, example;
+   BOOST_FOREACH(const std::string& line, lines)
+   {
+      if (parseDicDeltaLine(line, &word, &affix))
+      {
+         example = addAffixes ? exampleWordForEnglishAffix(affix)
+                              : std::string();
+         pWords->push_back(DictionaryWord(word, example));
+      }
+   }
+
+   return Success();
+}
+
 class SpellChecker : boost::noncopyable
 {
 public:
@@ -175,12 +232,10 @@ public:
       encoding_ = pHunspell_->get_dic_encoding();
 
       // add words from dic_delta if available
-      FilePath dicPath = dictionary.dicPath();
-      FilePath dicDeltaPath = dicPath.parent().childPath(
-                                                dicPath.stem() + ".dic_delta");
-      if (dicDeltaPath.exists())
+      FilePath deltaPath = dicDeltaPath(dictionary);
+      if (deltaPath.exists())
       {
-         Error error = mergeDicDeltaFile(dicDeltaPath);
+         Error error = mergeDicDeltaFile(deltaPath);
          if (error)
             LOG_ERROR(error);
       }
@@ -216,47 +271,25 @@ private:
 
    Error mergeDicDeltaFile(const FilePath& dicDeltaPath)
    {
-      // determine whether we are going to support affixes -- we do this for
-      // english only right now because we can correctly (by inspection) map
-      // the chromium numeric affix indicators (6 and 7) to the right
-      // hunspell example words. it's worth investigating whether we can do
-      // this for other languages as well
-      bool addAffixes = boost::algorithm::starts_with(dicDeltaPath.stem(),
-                                                      "en_");
-
-      // read the file and strip the BOM
-      std::string contents;
-      Error error = core::readStringFromFile(dicDeltaPath, &contents);
+      std::vector<DictionaryWord> words;
+      Error error = readDicDeltaFile(dicDeltaPath, &words);
       if (error)
          return error;
-      core::stripBOM(&contents);
-
-      // split into lines
-      std::vector<std::string> lines;
-      boost::algorithm::split(lines,
-                              contents,
-                              boost::algorithm::is_any_of("\n"));
 
-      // parse lines for words
       bool added;
-      std::string word, affix, example;
-      BOOST_FOREACH(const std::string& line, lines)
+      BOOST_FOREACH(const DictionaryWord& word, words)
       {
-         if (parseDicDeltaLine(line, &word, &affix))
+         if (!word.example.empty())
          {
-            example = exampleWordForEnglishAffix(affix);
-            if (!example.empty() && addAffixes)
-            {
-               Error error = addWordWithAffix(word, example, &added);
-               if (error)
-                  LOG_ERROR(error);
-            }
-            else
-            {
-               Error error = addWord(word, &added);
-               if (error)
-                  LOG_ERROR(error);
-            }
+            Error error = addWordWithAffix(word.word, word.example, &added);
+            if (error)
+               LOG_ERROR(error);
+         }
+         else
+         {
+            Error error = addWord(word.word, &added);
+            if (error)
+               LOG_ERROR(error);
          }
       }
 
@@ -367,16 +400,344 @@ private:
    std::string encoding_;
 };
 
+// the forms of a word which make it correct if any of them is in a
+// dictionary: the word itself and, for a capitalized or upper case word,
+// its lower case and capitalized forms (note that only ascii letters are
+// mapped, which are the same in all of the dictionary encodings, other
+// words are left to hunspell)
+std::vector<std::string> caseForms(const std::string& word)
+{
+   std::vector<std::string> forms(1, word);
+
+   bool initialUpper = !word.empty() && word[0] >= 'A' && word[0] <= 'Z';
+   if (!initialUpper)
+      return forms;
+
+   std::string lower = word;
+   bool restUpper = true;
+   for (std::size_t i = 0; i < lower.size(); i++)
+   {
+      char ch = lower[i];
+      if (ch >= 'A' && ch <= 'Z')
+         lower[i] = ch - 'A' + 'a';
+      else if (i > 0 && ch >= 'a' && ch <= 'z')
+         restUpper = false;
+   }
+
+   if (restUpper && word.size() > 1)
+   {
+      std::string capitalized = lower;
+      capitalized[0] = word[0];
+      forms.push_back(capitalized);
+   }
+   forms.push_back(lower);
+   return forms;
+}
+
+// hunspell accepts numbers (digits with single dots, commas or dashes
+// between them, optionally negative) without looking them up
+bool isNumber(const std::string& word)
+{
+   bool previousDigit = false;
+   std::size_t start = (!word.empty() && word[0] == '-') ? 1 : 0;
+   for (std::size_t i = start; i < word.size(); i++)
+   {
+      char ch = word[i];
+      if (ch >= '0' && ch <= '9')
+         previousDigit = true;
+      else if ((ch == '.' || ch == ',' || ch == '-') && previousDigit)
+         previousDigit = false;
+      else
+         return false;
+   }
+   return previousDigit;
+}
+
+// read the words of a custom dictionary (see
+// HunspellSpellChecker::addDictionary for the format)
+Error readCustomDictionaryWords(const FilePath& dicPath,
+                                std::set<std::string>* pWords)
+{
+   std::vector<std::string> lines;
+   Error error = core::readStringVectorFromFile(dicPath, &lines);
+   if (error)
+      return error;
+
+   // (the first line is the number of words)
+   std::string word, affix;
+   for (std::size_t i = 1; i < lines.size(); i++)
+   {
+      if (parseDicDeltaLine(lines[i], &word, &affix))
+         pWords->insert(word);
+   }
+
+   return Success();
+}
+
+// checks words against a compiled dictionary (and the words of any custom
+// dictionaries). the list doesn't have every correct word (e.g. compounds
+// and forms which need more than one affix) so words which aren't in it
+// are checked by hunspell, which is loaded the first time it's needed
+class CompiledSpellChecker : public SpellChecker
+{
+public:
+   typedef boost::function<boost::shared_ptr<SpellChecker>()> Factory;
+
+   CompiledSpellChecker(
+         const boost::shared_ptr<HunspellCompiledDictionary>& pDictionary,
+         const std::set<std::string>& customWords,
+         const IconvstrFunction& iconvstrFunc,
+         const Factory& hunspellFactory)
+      : pDictionary_(pDictionary),
+        customWords_(customWords),
+        iconvstrFunc_(iconvstrFunc),
+        hunspellFactory_(hunspellFactory)
+   {
+   }
+
+   Error checkSpelling(const std::string& word, bool *pCorrect)
+   {
+      std::string encoded;
+      Error error = iconvstrFunc_(word,
+                                  "UTF-8",
+                                  pDictionary_->encoding(),
+                                  false,
+                                  &encoded);
+      if (error)
+         return error;
+
+      *pCorrect = isNumber(word);
+      BOOST_FOREACH(const std::string& form, caseForms(encoded))
+      {
+         if (pDictionary_->contains(form))
+            *pCorrect = true;
+      }
+      BOOST_FOREACH(const std::string& form, caseForms(word))
+      {
+         if (customWords_.count(form))
+            *pCorrect = true;
+      }
+      if (*pCorrect)
+         return Success();
+
+      return hunspell().checkSpelling(word, pCorrect);
+   }
+
+   Error suggestionList(const std::string& word,
+                        std::vector<std::string>* pSugs)
+   {
+      return hunspell().suggestionList(word, pSugs);
+   }
+
+   Error wordChars(std::wstring *pWordChars)
+   {
+      pWordChars->append(pDictionary_->wordChars());
+      return Success();
+   }
+
+private:
+   SpellChecker& hunspell()
+   {
+      if (!pHunspell_)
+         pHunspell_ = hunspellFactory_();
+
+      return *pHunspell_;
+   }
+
+private:
+   boost::shared_ptr<HunspellCompiledDictionary> pDictionary_;
+   std::set<std::string> customWords_;
+   IconvstrFunction iconvstrFunc_;
+   Factory hunspellFactory_;
+   boost::shared_ptr<SpellChecker> pHunspell_;
+};
+
+// a dictionary compiled in the background (the state is shared with the
+// compiling thread)
+struct BackgroundCompile : boost::noncopyable
+{
+   explicit BackgroundCompile(const FilePath& compiledPath)
+      : compiledPath(compiledPath), finished(false), succeeded(false)
+   {
+   }
+
+   const FilePath compiledPath;
+
+   boost::mutex mutex;
+   bool finished;
+   bool succeeded;
+};
+
+// compiled versions of a dictionary are named <id>-<key hash>.dict
+bool isCompiledVersionOf(const HunspellDictionary& dict,
+                         const std::string& filename,
+                         bool* pTemporary)
+{
+   std::string prefix = dict.id() + "-";
+   if (!boost::algorithm::starts_with(filename, prefix))
+      return false;
+
+   std::size_t pos = prefix.size();
+   while (pos < filename.size() &&
+          std::isxdigit(static_cast<unsigned char>(filename[pos])))
+   {
+      pos++;
+   }
+   if (pos == prefix.size() || filename.compare(pos, 5, ".dict") != 0)
+      return false;
+
+   // (compiles write a temporary file named <id>-<key hash>.dict.<uuid>)
+   pos += 5;
+   if (pos == filename.size())
+      *pTemporary = false;
+   else if (filename[pos] == '.')
+      *pTemporary = true;
+   else
+      return false;
+
+   return true;
+}
+
+// remove the versions of the dictionary compiled before its files last
+// changed, along with temporary files left behind by compiles which
+// didn't finish (any which are recent may belong to a compile which
+// another process is running)
+void pruneCompiledVersions(const HunspellDictionary& dict,
+                           const FilePath& compiledPath)
+{
+   const std::time_t kMaxTemporaryAgeSeconds = 60 * 60;
+
+   std::vector<FilePath> children;
+   Error error = compiledPath.parent().children(&children);
+   if (error)
+   {
+      LOG_ERROR(error);
+      return;
+   }
+
+   BOOST_FOREACH(const FilePath& child, children)
+   {
+      bool temporary = false;
+      if (child == compiledPath ||
+          !isCompiledVersionOf(dict, child.filename(), &temporary))
+      {
+         continue;
+      }
+
+      if (temporary &&
+          std::time(NULL) - child.lastWriteTime() < kMaxTemporaryAgeSeconds)
+      {
+         continue;
+      }
+
+      error = child.removeIfExists();
+      if (error)
+         LOG_ERROR(error);
+   }
+}
+
+void compileInBackground(const HunspellDictionary& dict,
+                         const IconvstrFunction& iconvstrFunction,
+                         const std::string& key,
+                         boost::shared_ptr<BackgroundCompile> pCompile)
+{
+   std::vector<DictionaryWord> extraWords;
+   FilePath deltaPath = dicDeltaPath(dict);
+   if (deltaPath.exists())
+   {
+      Error error = readDicDeltaFile(deltaPath, &extraWords);
+      if (error)
+         LOG_ERROR(error);
+   }
+
+   Error error = pCompile->compiledPath.parent().ensureDirectory();
+   if (!error)
+   {
+      error = HunspellCompiledDictionary::compile(dict,
+                                                  extraWords,
+                                                  iconvstrFunction,
+                                                  key,
+                                                  pCompile->compiledPath);
+   }
+   if (error)
+      LOG_ERROR(error);
+   else
+      pruneCompiledVersions(dict, pCompile->compiledPath);
+
+   LOCK_MUTEX(pCompile->mutex)
+   {
+      pCompile->finished = true;
+      pCompile->succeeded = !error;
+   }
+   END_LOCK_MUTEX
+}
+
+// results of the most recently checked words
+class WordCache : boost::noncopyable
+{
+public:
+   explicit WordCache(std::size_t capacity)
+      : capacity_(capacity)
+   {
+   }
+
+   bool lookup(const std::string& word, bool* pCorrect)
+   {
+      Index::iterator it = index_.find(word);
+      if (it == index_.end())
+         return false;
+
+      // move to the front of the list
+      entries_.splice(entries_.begin(), entries_, it->second);
+      *pCorrect = it->second->second;
+      return true;
+   }
+
+   void insert(const std::string& word, bool correct)
+   {
+      if (index_.find(word) != index_.end())
+         return;
+
+      entries_.push_front(std::make_pair(word, correct));
+      index_[word] = entries_.begin();
+
+      if (entries_.size() > capacity_)
+      {
+         index_.erase(entries_.back().first);
+         entries_.pop_back();
+      }
+   }
+
+   void clear()
+   {
+      index_.clear();
+      entries_.clear();
+   }
+
+private:
+   typedef std::list<std::pair<std::string, bool> > Entries;
+   typedef boost::unordered_map<std::string, Entries::iterator> Index;
+
+   std::size_t capacity_;
+   Entries entries_; // most recently used first
+   Index index_;
+};
+
+const std::size_t kWordCacheCapacity = 10000;
+
 } // anonymous namespace
 
 struct HunspellSpellingEngine::Impl
 {
    Impl(const std::string& langId,
         const HunspellDictionaryManager& dictionaryManager,
-        const IconvstrFunction& iconvstrFunction)
+        const IconvstrFunction& iconvstrFunction,
+        const FilePath& compiledDictionariesDir)
       : currentLangId_(langId),
         dictManager_(dictionaryManager),
-        iconvstrFunction_(iconvstrFunction)
+        iconvstrFunction_(iconvstrFunction),
+        compiledDictionariesDir_(compiledDictionariesDir),
+        wordCache_(kWordCacheCapacity)
    {
    }
 
@@ -388,12 +749,28 @@ struct HunspellSpellingEngine::Impl
 
    SpellChecker& spellChecker()
    {
-      if (!pSpellChecker_)
+      if (!pSpellChecker_ || backgroundCompileSucceeded())
          resetDictionaries(currentLangId_);
 
       return *pSpellChecker_;
    }
 
+   Error checkSpelling(const std::string& word, bool *pCorrect)
+   {
+      // (get the spell checker first as switching to a newly compiled
+      // dictionary clears the cache)
+      SpellChecker& checker = spellChecker();
+      if (wordCache_.lookup(word, pCorrect))
+         return Success();
+
+      Error error = checker.checkSpelling(word, pCorrect);
+      if (error)
+         return error;
+
+      wordCache_.insert(word, *pCorrect);
+      return Success();
+   }
+
 private:
    bool dictionaryContextChanged(const std::string& langId)
    {
@@ -403,9 +780,27 @@ private:
 
    void resetDictionaries(const std::string& langId)
    {
+      wordCache_.clear();
+
       HunspellDictionary dict = dictManager_.dictionaryForLanguageId(langId);
       if (!dict.empty())
       {
+         // use the compiled dictionary if there is one, otherwise compile
+         // it in the background and use hunspell until that's done
+         boost::shared_ptr<HunspellCompiledDictionary> pCompiled =
+                                                   compiledDictionary(dict);
+         if (pCompiled)
+         {
+            currentLangId_ = langId;
+            currentCustomDicts_ = dictManager_.custom().dictionaries();
+            pSpellChecker_.reset(new CompiledSpellChecker(
+                  pCompiled,
+                  customWords(),
+                  iconvstrFunction_,
+                  boost::bind(&Impl::hunspellSpellChecker, this, dict)));
+            return;
+         }
+
          HunspellSpellChecker* pHunspell = new HunspellSpellChecker();
          pSpellChecker_.reset(pHunspell);
 
@@ -414,16 +809,7 @@ private:
          {
             currentLangId_ = langId;
             currentCustomDicts_ = dictManager_.custom().dictionaries();
-            BOOST_FOREACH(const std::string& dict, currentCustomDicts_)
-            {
-               bool added;
-               FilePath dicPath = dictManager_.custom().dictionaryPath(dict);
-               Error error = pHunspell->addDictionary(dicPath,
-                                                      dicPath.stem(),
-                                                      &added);
-               if (error)
-                  LOG_ERROR(error);
-            }
+            addCustomDictionaries(pHunspell);
          }
          else
          {
@@ -438,22 +824,133 @@ private:
       }
    }
 
+   void addCustomDictionaries(HunspellSpellChecker* pHunspell)
+   {
+      BOOST_FOREACH(const std::string& dict, currentCustomDicts_)
+      {
+         bool added;
+         FilePath dicPath = dictManager_.custom().dictionaryPath(dict);
+         Error error = pHunspell->addDictionary(dicPath,
+                                                dicPath.stem(),
+                                                &added);
+         if (error)
+            LOG_ERROR(error);
+      }
+   }
+
+   std::set<std::string> customWords()
+   {
+      std::set<std::string> words;
+      BOOST_FOREACH(const std::string& dict, currentCustomDicts_)
+      {
+         FilePath dicPath = dictManager_.custom().dictionaryPath(dict);
+         Error error = readCustomDictionaryWords(dicPath, &words);
+         if (error)
+            LOG_ERROR(error);
+      }
+      return words;
+   }
 
+   boost::shared_ptr<SpellChecker> hunspellSpellChecker(
+                                          const HunspellDictionary& dict)
+   {
+      boost::shared_ptr<HunspellSpellChecker> pHunspell(
+                                                new HunspellSpellChecker());
+      Error error = pHunspell->initialize(dict, iconvstrFunction_);
+      if (error)
+      {
+         LOG_ERROR(error);
+         return boost::shared_ptr<SpellChecker>(new NoSpellChecker());
+      }
+
+      addCustomDictionaries(pHunspell.get());
+      return pHunspell;
+   }
+
+   // the compiled version of the dictionary, returns null if it isn't
+   // available (in which case it is compiled in the background unless
+   // we have already tried)
+   boost::shared_ptr<HunspellCompiledDictionary> compiledDictionary(
+                                          const HunspellDictionary& dict)
+   {
+      boost::shared_ptr<HunspellCompiledDictionary> pCompiled;
+      if (compiledDictionariesDir_.empty())
+         return pCompiled;
+
+      // the key identifies this version of the dictionary files
+      FilePath deltaPath = dicDeltaPath(dict);
+      std::string key = dict.affPath().absolutePath() + "\n" +
+                        dict.dicPath().absolutePath();
+      FilePath files[] = { dict.affPath(), dict.dicPath(), deltaPath };
+      BOOST_FOREACH(const FilePath& file, files)
+      {
+         if (file.exists())
+         {
+            key += "\n" + safe_convert::numberToString(file.size()) +
+                   " " + safe_convert::numberToString(file.lastWriteTime());
+         }
+      }
+
+      FilePath compiledPath = compiledDictionariesDir_.childPath(
+                        dict.id() + "-" + hash::crc32HexHash(key) + ".dict");
+
+      pCompiled.reset(new HunspellCompiledDictionary());
+      Error error = pCompiled->open(compiledPath, key);
+      if (!error)
+         return pCompiled;
+      pCompiled.reset();
+
+      // we already tried (the compile is underway or failed)
+      if (pCompile_ && pCompile_->compiledPath == compiledPath)
+         return pCompiled;
+
+      pCompile_.reset(new BackgroundCompile(compiledPath));
+      core::thread::safeLaunchThread(boost::bind(compileInBackground,
+                                                 dict,
+                                                 iconvstrFunction_,
+                                                 key,
+                                                 pCompile_));
+      return pCompiled;
+   }
+
+   // returns true once (when a background compile has succeeded)
+   bool backgroundCompileSucceeded()
+   {
+      if (!pCompile_)
+         return false;
+
+      bool succeeded = false;
+      LOCK_MUTEX(pCompile_->mutex)
+      {
+         succeeded = pCompile_->finished && pCompile_->succeeded;
+         pCompile_->succeeded = false;
+      }
+      END_LOCK_MUTEX
+
+      return succeeded;
+   }
 
 private:
    std::string currentLangId_;
    std::vector<std::string> currentCustomDicts_;
    HunspellDictionaryManager dictManager_;
    IconvstrFunction iconvstrFunction_;
+   FilePath compiledDictionariesDir_;
    boost::shared_ptr<SpellChecker> pSpellChecker_;
+   boost::shared_ptr<BackgroundCompile> pCompile_;
+   WordCache wordCache_;
 };
 
 
 HunspellSpellingEngine::HunspellSpellingEngine(
                            const std::string& langId,
                            const HunspellDictionaryManager& dictionaryManager,
-                           const IconvstrFunction& iconvstrFunction)
-   : pImpl_(new Impl(langId, dictionaryManager, iconvstrFunction))
+                           const IconvstrFunction& iconvstrFunction,
+                           const FilePath& compiledDictionariesDir)
+   : pImpl_(new Impl(langId,
+                     dictionaryManager,
+                     iconvstrFunction,
+                     compiledDictionariesDir))
 {
 }
 
@@ -466,7 +963,24 @@ void HunspellSpellingEngine::useDictionary(const std::string& langId)
 Error HunspellSpellingEngine::checkSpelling(const std::string& word,
                                             bool *pCorrect)
 {
-   return pImpl_->spellChecker().checkSpelling(word, pCorrect);
+   return pImpl_->checkSpelling(word, pCorrect);
+}
+
+Error HunspellSpellingEngine::checkSpelling(
+                                    const std::vector<std::string>& words,
+                                    std::vector<bool>* pCorrect)
+{
+   pCorrect->assign(words.size(), true);
+   for (std::size_t i = 0; i < words.size(); i++)
+   {
+      bool correct = true;
+      Error error = pImpl_->checkSpelling(words[i], &correct);
+      if (error)
+         return error;
+      (*pCorrect)[i] = correct;
+   }
+
+   return Success();
 }
 
 Error HunspellSpellingEngine::suggestionList(const std::string& word,
@@ -194,7 +194,19 @@ public:
    // override of terminate (allow special handling for unix pty termination)
    virtual Error terminate();
 
+   // handler called (on a background thread) when the process has output
+   // or has exited so that it can be polled right away. must be set
+   // before the first poll
+   void setActivityHandler(const boost::function<void()>& activityHandler)
+   {
+      activityHandler_ = activityHandler;
+   }
+
 private:
+#ifndef _WIN32
+   void readOutput();
+   void takeWatchedOutput();
+#endif
 
    void reportError(const Error& error)
    {
@@ -223,6 +235,9 @@ private:
    // callbacks
    ProcessCallbacks callbacks_;
 
+   // activity handler
+   boost::function<void()> activityHandler_;
+
    // platform specific impl
    struct AsyncImpl;
    boost::scoped_ptr<AsyncImpl> pAsyncImpl_;
@@ -13,8 +13,11 @@
 
 #include "ChildProcess.hpp"
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #ifdef __APPLE__
@@ -26,6 +29,7 @@
 #include <asm/ioctls.h>
 #endif
 
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 
@@ -40,6 +44,23 @@
 #include <core/PerformanceTimer.hpp>
 
 #include "ChildProcess.hpp"
+#include "PosixChildProcessLauncher.hpp"
+
+#ifdef __linux__
+#include "PosixChildProcessReactor.hpp"
+#endif
+
+// posix_spawn file actions which are glibc extensions
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2,29)
+#define HAVE_POSIX_SPAWN_CHDIR
+#endif
+#if __GLIBC_PREREQ(2,34)
+#define HAVE_POSIX_SPAWN_CLOSEFROM
+#endif
+#endif
+
+extern char **environ;
 
 namespace core {
 namespace system {
@@ -128,6 +149,225 @@ Error readPipe(int pipeFd, std::string* pOutput, bool *pEOF = NULL)
    return Success();
 }
 
+// create a pipe which is closed on exec. this keeps the pipes of one child
+// out of children which other threads create at the same time (a spawned
+// child only closes the descriptors which were open when it was set up)
+int pipeCloseOnExec(int* pipeFds)
+{
+#ifdef __linux__
+   return ::pipe2(pipeFds, O_CLOEXEC);
+#else
+   int result = ::pipe(pipeFds);
+   if (result == 0)
+   {
+      ::fcntl(pipeFds[READ], F_SETFD, FD_CLOEXEC);
+      ::fcntl(pipeFds[WRITE], F_SETFD, FD_CLOEXEC);
+   }
+   return result;
+#endif
+}
+
+// (the child's ends are duplicated onto its standard streams, which
+// clears close on exec for them)
+Error createPipes(int* fdInput, int* fdOutput, int* fdError)
+{
+   // standard input
+   Error error = posixCall<int>(boost::bind(pipeCloseOnExec, fdInput),
+                                ERROR_LOCATION);
+   if (error)
+      return error;
+
+   // standard output
+   error = posixCall<int>(boost::bind(pipeCloseOnExec, fdOutput),
+                          ERROR_LOCATION);
+   if (error)
+   {
+      closePipe(fdInput, ERROR_LOCATION);
+      return error;
+   }
+
+   // standard error
+   error = posixCall<int>(boost::bind(pipeCloseOnExec, fdError),
+                          ERROR_LOCATION);
+   if (error)
+   {
+      closePipe(fdInput, ERROR_LOCATION);
+      closePipe(fdOutput, ERROR_LOCATION);
+      return error;
+   }
+
+   return Success();
+}
+
+void closePipes(int* fdInput, int* fdOutput, int* fdError)
+{
+   closePipe(fdInput, ERROR_LOCATION);
+   closePipe(fdOutput, ERROR_LOCATION);
+   closePipe(fdError, ERROR_LOCATION);
+}
+
+// can the child be created with posix_spawn? (we only use it on linux,
+// where glibc implements it with a vfork style clone which doesn't copy
+// the page tables of the parent)
+bool canSpawn(const ProcessOptions& options)
+{
+#ifdef __linux__
+   if (options.pseudoterminal || options.onAfterFork)
+      return false;
+
+#ifndef POSIX_SPAWN_SETSID
+   if (options.detachSession)
+      return false;
+#endif
+
+#ifndef HAVE_POSIX_SPAWN_CHDIR
+   if (!options.workingDir.empty())
+      return false;
+#endif
+
+   return true;
+#else
+   return false;
+#endif
+}
+
+#ifndef HAVE_POSIX_SPAWN_CLOSEFROM
+// the file descriptors currently open in this process
+void listOpenFileDescriptors(std::vector<int>* pFds)
+{
+   DIR* pDir = ::opendir("/proc/self/fd");
+   if (pDir == NULL)
+      return;
+
+   struct dirent* pEntry;
+   while ((pEntry = ::readdir(pDir)) != NULL)
+   {
+      int fd = ::atoi(pEntry->d_name);
+      if (fd > STDERR_FILENO && fd != ::dirfd(pDir))
+         pFds->push_back(fd);
+   }
+   ::closedir(pDir);
+}
+#endif
+
+// create the child with posix_spawn. the options must satisfy canSpawn
+Error spawnChild(const std::string& exe,
+                 const std::vector<std::string>& args,
+                 const ProcessOptions& options,
+                 int* fdInput,
+                 int* fdOutput,
+                 int* fdError,
+                 pid_t* pPid)
+{
+   // wire standard streams then close everything else
+   posix_spawn_file_actions_t fileActions;
+   ::posix_spawn_file_actions_init(&fileActions);
+   ::posix_spawn_file_actions_adddup2(&fileActions,
+                                      fdInput[READ],
+                                      STDIN_FILENO);
+   ::posix_spawn_file_actions_adddup2(&fileActions,
+                                      fdOutput[WRITE],
+                                      STDOUT_FILENO);
+   ::posix_spawn_file_actions_adddup2(&fileActions,
+                                      options.redirectStdErrToStdOut
+                                                         ? fdOutput[WRITE]
+                                                         : fdError[WRITE],
+                                      STDERR_FILENO);
+#ifdef HAVE_POSIX_SPAWN_CLOSEFROM
+   ::posix_spawn_file_actions_addclosefrom_np(&fileActions, STDERR_FILENO+1);
+#else
+   std::vector<int> openFds;
+   listOpenFileDescriptors(&openFds);
+   for (std::size_t i = 0; i < openFds.size(); i++)
+      ::posix_spawn_file_actions_addclose(&fileActions, openFds[i]);
+#endif
+
+#ifdef HAVE_POSIX_SPAWN_CHDIR
+   // (as when forking, a working directory we can't change to is logged
+   // and the child runs in ours rather than failing to start)
+   std::string workingDir = options.workingDir.absolutePath();
+   if (!workingDir.empty())
+   {
+      struct stat info;
+      if (::stat(workingDir.c_str(), &info) == -1 ||
+          ::access(workingDir.c_str(), X_OK) == -1)
+      {
+         LOG_ERROR(systemError(errno, "Error changing directory",
+                               ERROR_LOCATION));
+      }
+      else if (!S_ISDIR(info.st_mode))
+      {
+         LOG_ERROR(systemError(ENOTDIR, "Error changing directory",
+                               ERROR_LOCATION));
+      }
+      else
+      {
+         ::posix_spawn_file_actions_addchdir_np(&fileActions,
+                                                workingDir.c_str());
+      }
+   }
+#endif
+
+   // session/process group and signal mask
+   posix_spawnattr_t attr;
+   ::posix_spawnattr_init(&attr);
+   short flags = POSIX_SPAWN_SETSIGMASK;
+   sigset_t emptySet;
+   ::sigemptyset(&emptySet);
+   ::posix_spawnattr_setsigmask(&attr, &emptySet);
+   if (options.detachSession)
+   {
+#ifdef POSIX_SPAWN_SETSID
+      flags |= POSIX_SPAWN_SETSID;
+#endif
+   }
+   else if (options.terminateChildren)
+   {
+      flags |= POSIX_SPAWN_SETPGROUP;
+      ::posix_spawnattr_setpgroup(&attr, 0);
+   }
+   ::posix_spawnattr_setflags(&attr, flags);
+
+   // args and environment
+   std::vector<std::string> argsWithExe;
+   argsWithExe.push_back(exe);
+   argsWithExe.insert(argsWithExe.end(), args.begin(), args.end());
+   ProcessArgs processArgs(argsWithExe);
+
+   std::vector<std::string> env;
+   if (options.environment)
+   {
+      const Options& envOptions = options.environment.get();
+      for (Options::const_iterator
+               it = envOptions.begin(); it != envOptions.end(); ++it)
+      {
+         env.push_back(it->first + "=" + it->second);
+      }
+   }
+   ProcessArgs environment(env);
+
+   // spawn (note this returns an error code rather than setting errno)
+   int result = ::posix_spawn(pPid,
+                              exe.c_str(),
+                              &fileActions,
+                              &attr,
+                              processArgs.args(),
+                              options.environment ? environment.args()
+                                                  : environ);
+
+   ::posix_spawnattr_destroy(&attr);
+   ::posix_spawn_file_actions_destroy(&fileActions);
+
+   if (result != 0)
+   {
+      Error error = systemError(result, ERROR_LOCATION);
+      error.addProperty("exe", exe);
+      return error;
+   }
+
+   return Success();
+}
+
 } // anonymous namespace
 
 
@@ -361,6 +601,63 @@ Error ChildProcess::run()
    int fdError[2] = {0,0};
    int fdMaster = 0;
 
+   // forking copies the page tables of this process (which is slow for a
+   // large R session and can fail under strict overcommit accounting) so
+   // where possible we use posix_spawn or have the launcher process create
+   // the child instead
+   bool spawn = canSpawn(options_);
+   if (spawn || (!options_.onAfterFork && childProcessLauncherAvailable()))
+   {
+      Error error;
+      if (!options_.pseudoterminal)
+      {
+         error = createPipes(fdInput, fdOutput, fdError);
+         if (error)
+            return error;
+      }
+
+      if (spawn)
+      {
+         error = spawnChild(exe_, args_, options_,
+                            fdInput, fdOutput, fdError, &pid);
+      }
+      else
+      {
+         int childFds[3] = { fdInput[READ],
+                             fdOutput[WRITE],
+                             options_.redirectStdErrToStdOut ? fdOutput[WRITE]
+                                                             : fdError[WRITE] };
+         error = launchWithChildProcessLauncher(exe_, args_, options_,
+                                                childFds, &pid, &fdMaster);
+      }
+
+      if (error)
+      {
+         if (!options_.pseudoterminal)
+            closePipes(fdInput, fdOutput, fdError);
+
+         // fall back to fork if the launcher has gone away
+         if (spawn || childProcessLauncherAvailable())
+            return error;
+         LOG_ERROR(error);
+      }
+      else
+      {
+         if (options_.pseudoterminal)
+         {
+            pImpl_->init(pid, fdMaster);
+         }
+         else
+         {
+            closePipe(fdInput[READ], ERROR_LOCATION);
+            closePipe(fdOutput[WRITE], ERROR_LOCATION);
+            closePipe(fdError[WRITE], ERROR_LOCATION);
+            pImpl_->init(pid, fdInput[WRITE], fdOutput[READ], fdError[READ]);
+         }
+         return Success();
+      }
+   }
+
    // pseudoterminal mode: fork using the special forkpty call
    if (options_.pseudoterminal)
    {
@@ -382,35 +679,16 @@ Error ChildProcess::run()
    // standard mode: use conventional fork + stream redirection
    else
    {
-      // standard input
-      Error error = posixCall<int>(boost::bind(::pipe, fdInput), ERROR_LOCATION);
+      // pipes for the standard streams
+      Error error = createPipes(fdInput, fdOutput, fdError);
       if (error)
          return error;
 
-      // standard output
-      error = posixCall<int>(boost::bind(::pipe, fdOutput), ERROR_LOCATION);
-      if (error)
-      {
-         closePipe(fdInput, ERROR_LOCATION);
-         return error;
-      }
-
-      // standard error
-      error = posixCall<int>(boost::bind(::pipe, fdError), ERROR_LOCATION);
-      if (error)
-      {
-         closePipe(fdInput, ERROR_LOCATION);
-         closePipe(fdOutput, ERROR_LOCATION);
-         return error;
-      }
-
       // fork
       error = posixCall<pid_t>(::fork, ERROR_LOCATION, &pid);
       if (error)
       {
-         closePipe(fdInput, ERROR_LOCATION);
-         closePipe(fdOutput, ERROR_LOCATION);
-         closePipe(fdError, ERROR_LOCATION);
+         closePipes(fdInput, fdOutput, fdError);
          return error;
       }
    }
@@ -650,10 +928,30 @@ struct AsyncChildProcess::AsyncImpl
    {
    }
 
+#ifdef __linux__
+   ~AsyncImpl()
+   {
+      try
+      {
+         // stop the reactor reading our fds before they are closed
+         if (pWatched_)
+            pWatched_->stopWatching();
+      }
+      catch(...)
+      {
+      }
+   }
+#endif
+
    bool calledOnStarted_;
    bool finishedStdout_;
    bool finishedStderr_;
    bool exited_;
+
+#ifdef __linux__
+   // output read by the reactor thread (NULL if we read it on poll)
+   boost::shared_ptr<WatchedChildProcess> pWatched_;
+#endif
 };
 
 AsyncChildProcess::AsyncChildProcess(const std::string& exe,
@@ -709,6 +1007,15 @@ void AsyncChildProcess::poll()
       else
          setPipeNonBlocking(pImpl_->fdStderr);         
 
+#ifdef __linux__
+      // have the reactor thread read our output and watch for our exit
+      pAsyncImpl_->pWatched_ = watchChildProcess(
+                        pImpl_->pid,
+                        pImpl_->fdStdout,
+                        options().pseudoterminal ? -1 : pImpl_->fdStderr,
+                        activityHandler_);
+#endif
+
       if (callbacks_.onStarted)
          callbacks_.onStarted(*this);
       pAsyncImpl_->calledOnStarted_ = true;
@@ -726,48 +1033,23 @@ void AsyncChildProcess::poll()
       }
    }
 
-   // check stdout and fire event if we got output
-   if (!pAsyncImpl_->finishedStdout_)
+#ifdef __linux__
+   if (pAsyncImpl_->pWatched_)
    {
-      bool eof;
-      std::string out;
-      Error error = readPipe(pImpl_->fdStdout, &out, &eof);
-      if (error)
-      {
-         reportError(error);
-      }
-      else
-      {
-         if (!out.empty() && callbacks_.onStdout)
-            callbacks_.onStdout(*this, out);
+      // fire events for the output read by the reactor
+      takeWatchedOutput();
 
-         if (eof)
-           pAsyncImpl_->finishedStdout_ = true;
-      }
+      // no need to check for exit unless the reactor saw one (or can't
+      // watch for them)
+      if (!pAsyncImpl_->pWatched_->mayHaveExited())
+         return;
    }
-
-   // check stderr and fire event if we got output
-   if (!pAsyncImpl_->finishedStderr_)
+   else
+#endif
    {
-      bool eof;
-      std::string err;
-      Error error = readPipe(pImpl_->fdStderr, &err, &eof);
-
-      if (error)
-      {
-         reportError(error);
-      }
-      else
-      {
-         if (!err.empty() && callbacks_.onStderr)
-            callbacks_.onStderr(*this, err);
-
-         if (eof)
-           pAsyncImpl_->finishedStderr_ = true;
-      }
+      readOutput();
    }
 
-
    // Check for exited. Note that this method specifies WNOHANG
    // so we don't block forever waiting for a process the exit. We may
    // not be able to reap the child due to an error (typically ECHILD,
@@ -781,6 +1063,15 @@ void AsyncChildProcess::poll()
    // either a normal exit or an error while waiting
    if (result != 0)
    {
+#ifdef __linux__
+      // fire events for any output which is still in the pipes
+      if (pAsyncImpl_->pWatched_)
+      {
+         pAsyncImpl_->pWatched_->stopWatching();
+         takeWatchedOutput();
+      }
+#endif
+
       // close all of our pipes
       pImpl_->closeAll(ERROR_LOCATION);
 
@@ -809,6 +1100,73 @@ void AsyncChildProcess::poll()
    }
 }
 
+void AsyncChildProcess::readOutput()
+{
+   // check stdout and fire event if we got output
+   if (!pAsyncImpl_->finishedStdout_)
+   {
+      bool eof;
+      std::string out;
+      Error error = readPipe(pImpl_->fdStdout, &out, &eof);
+      if (error)
+      {
+         reportError(error);
+      }
+      else
+      {
+         if (!out.empty() && callbacks_.onStdout)
+            callbacks_.onStdout(*this, out);
+
+         if (eof)
+           pAsyncImpl_->finishedStdout_ = true;
+      }
+   }
+
+   // check stderr and fire event if we got output
+   if (!pAsyncImpl_->finishedStderr_)
+   {
+      bool eof;
+      std::string err;
+      Error error = readPipe(pImpl_->fdStderr, &err, &eof);
+
+      if (error)
+      {
+         reportError(error);
+      }
+      else
+      {
+         if (!err.empty() && callbacks_.onStderr)
+            callbacks_.onStderr(*this, err);
+
+         if (eof)
+           pAsyncImpl_->finishedStderr_ = true;
+      }
+   }
+}
+
+#ifdef __linux__
+void AsyncChildProcess::takeWatchedOutput()
+{
+   std::string out, err;
+   bool stdoutEof, stderrEof;
+   Error error;
+   pAsyncImpl_->pWatched_->takeOutput(&out, &err,
+                                      &stdoutEof, &stderrEof,
+                                      &error);
+
+   if (!out.empty() && callbacks_.onStdout)
+      callbacks_.onStdout(*this, out);
+   if (!err.empty() && callbacks_.onStderr)
+      callbacks_.onStderr(*this, err);
+
+   pAsyncImpl_->finishedStdout_ = stdoutEof;
+   pAsyncImpl_->finishedStderr_ = stderrEof;
+
+   if (error)
+      reportError(error);
+}
+#endif
+
 bool AsyncChildProcess::exited()
 {
    return pAsyncImpl_->exited_;
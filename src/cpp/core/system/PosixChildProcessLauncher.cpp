@@ -0,0 +1,671 @@
+/*
+ * PosixChildProcessLauncher.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+// The launcher is a small process forked early in main (while the parent
+// is still small and single threaded). It creates the children of the
+// parent which can't be created with posix_spawn (e.g. those attached to
+// a pseudoterminal) so that the parent never has to fork itself once it
+// has grown large. The children are created with clone(CLONE_PARENT) so
+// they are children of the parent (which can then wait on them, signal
+// them, etc. exactly as if it had forked them).
+//
+// Requests and responses are exchanged over a unix domain socket, with
+// file descriptors (the standard streams of the child going one way and
+// the pseudoterminal master going the other) passed as SCM_RIGHTS.
+
+#include "PosixChildProcessLauncher.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#ifdef __linux__
+#include <pty.h>
+#include <utmp.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <core/Error.hpp>
+#include <core/Log.hpp>
+#include <core/FilePath.hpp>
+#include <core/system/System.hpp>
+#include <core/system/Environment.hpp>
+#include <core/system/Process.hpp>
+#include <core/system/ProcessArgs.hpp>
+
+namespace core {
+namespace system {
+
+namespace {
+
+// request flags
+const int kDetachSession = 1;
+const int kTerminateChildren = 2;
+const int kPseudoterminal = 4;
+
+// maximum number of file descriptors passed with a message
+const std::size_t kMaxMessageFds = 3;
+
+// launcher socket and pid (in the parent)
+int s_launcherFd = -1;
+pid_t s_launcherPid = -1;
+
+boost::mutex& launcherMutex()
+{
+   static boost::mutex* pMutex = new boost::mutex();
+   return *pMutex;
+}
+
+void appendInt(int value, std::string* pBuffer)
+{
+   int32_t value32 = value;
+   pBuffer->append(reinterpret_cast<const char*>(&value32), sizeof(value32));
+}
+
+void appendString(const std::string& value, std::string* pBuffer)
+{
+   appendInt(static_cast<int>(value.size()), pBuffer);
+   pBuffer->append(value);
+}
+
+void appendStrings(const std::vector<std::string>& values,
+                   std::string* pBuffer)
+{
+   appendInt(static_cast<int>(values.size()), pBuffer);
+   for (std::size_t i = 0; i < values.size(); i++)
+      appendString(values[i], pBuffer);
+}
+
+class MessageReader
+{
+public:
+   explicit MessageReader(const std::string& message)
+      : message_(message), pos_(0), valid_(true)
+   {
+   }
+
+   bool valid() const { return valid_; }
+
+   int readInt()
+   {
+      int32_t value = 0;
+      if (available(sizeof(value)))
+      {
+         ::memcpy(&value, message_.data() + pos_, sizeof(value));
+         pos_ += sizeof(value);
+      }
+      return value;
+   }
+
+   std::string readString()
+   {
+      int size = readInt();
+      if (size < 0 || !available(size))
+         return std::string();
+
+      std::string value = message_.substr(pos_, size);
+      pos_ += size;
+      return value;
+   }
+
+   std::vector<std::string> readStrings()
+   {
+      std::vector<std::string> values;
+      int count = readInt();
+      for (int i = 0; valid_ && i < count; i++)
+         values.push_back(readString());
+      return values;
+   }
+
+private:
+   bool available(std::size_t size)
+   {
+      if (message_.size() - pos_ < size)
+         valid_ = false;
+      return valid_;
+   }
+
+   const std::string& message_;
+   std::size_t pos_;
+   bool valid_;
+};
+
+Error writeFully(int fd, const char* pData, std::size_t size)
+{
+   while (size > 0)
+   {
+      ssize_t written = ::send(fd, pData, size, MSG_NOSIGNAL);
+      if (written == -1)
+      {
+         if (errno == EINTR)
+            continue;
+         return systemError(errno, ERROR_LOCATION);
+      }
+      pData += written;
+      size -= written;
+   }
+   return Success();
+}
+
+Error readFully(int fd, char* pData, std::size_t size)
+{
+   while (size > 0)
+   {
+      ssize_t bytesRead = ::read(fd, pData, size);
+      if (bytesRead == -1)
+      {
+         if (errno == EINTR)
+            continue;
+         return systemError(errno, ERROR_LOCATION);
+      }
+      else if (bytesRead == 0)
+      {
+         return systemError(boost::system::errc::broken_pipe, ERROR_LOCATION);
+      }
+      pData += bytesRead;
+      size -= bytesRead;
+   }
+   return Success();
+}
+
+// messages are a 32 bit size (sent along with any file descriptors)
+// followed by the message
+Error sendMessage(int fd, const std::string& message, const std::vector<int>& fds)
+{
+   uint32_t size = message.size();
+
+   struct iovec iov;
+   iov.iov_base = &size;
+   iov.iov_len = sizeof(size);
+
+   char control[CMSG_SPACE(sizeof(int) * kMaxMessageFds)];
+   ::memset(control, 0, sizeof(control));
+
+   struct msghdr msg;
+   ::memset(&msg, 0, sizeof(msg));
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   if (!fds.empty())
+   {
+      msg.msg_control = control;
+      msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+      struct cmsghdr* pCmsg = CMSG_FIRSTHDR(&msg);
+      pCmsg->cmsg_level = SOL_SOCKET;
+      pCmsg->cmsg_type = SCM_RIGHTS;
+      pCmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+      ::memcpy(CMSG_DATA(pCmsg), &fds[0], sizeof(int) * fds.size());
+   }
+
+   ssize_t written;
+   do
+   {
+      written = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+   }
+   while (written == -1 && errno == EINTR);
+   if (written == -1)
+      return systemError(errno, ERROR_LOCATION);
+
+   // finish the size if it was split (the fds went with the first byte)
+   const char* pSize = reinterpret_cast<const char*>(&size);
+   Error error = writeFully(fd, pSize + written, sizeof(size) - written);
+   if (error)
+      return error;
+
+   return writeFully(fd, message.data(), message.size());
+}
+
+Error receiveMessage(int fd, std::string* pMessage, std::vector<int>* pFds)
+{
+   uint32_t size = 0;
+
+   struct iovec iov;
+   iov.iov_base = &size;
+   iov.iov_len = sizeof(size);
+
+   char control[CMSG_SPACE(sizeof(int) * kMaxMessageFds)];
+   struct msghdr msg;
+   ::memset(&msg, 0, sizeof(msg));
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof(control);
+
+   // (received descriptors are close on exec so they can't leak into
+   // children started by other threads before they're dealt with)
+   int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+   flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+   ssize_t bytesRead;
+   do
+   {
+      bytesRead = ::recvmsg(fd, &msg, flags);
+   }
+   while (bytesRead == -1 && errno == EINTR);
+   if (bytesRead == -1)
+      return systemError(errno, ERROR_LOCATION);
+   else if (bytesRead == 0)
+      return systemError(boost::system::errc::broken_pipe, ERROR_LOCATION);
+
+   // collect file descriptors
+   for (struct cmsghdr* pCmsg = CMSG_FIRSTHDR(&msg);
+        pCmsg != NULL;
+        pCmsg = CMSG_NXTHDR(&msg, pCmsg))
+   {
+      if (pCmsg->cmsg_level == SOL_SOCKET && pCmsg->cmsg_type == SCM_RIGHTS)
+      {
+         std::size_t count = (pCmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+         const int* pData = reinterpret_cast<const int*>(CMSG_DATA(pCmsg));
+         pFds->insert(pFds->end(), pData, pData + count);
+      }
+   }
+
+   char* pSize = reinterpret_cast<char*>(&size);
+   Error error = readFully(fd, pSize + bytesRead, sizeof(size) - bytesRead);
+   if (error)
+      return error;
+
+   pMessage->resize(size);
+   if (size > 0)
+      return readFully(fd, &((*pMessage)[0]), size);
+   else
+      return Success();
+}
+
+void closeFds(const std::vector<int>& fds)
+{
+   for (std::size_t i = 0; i < fds.size(); i++)
+      ::close(fds[i]);
+}
+
+#ifdef __linux__
+
+struct LaunchRequest
+{
+   int flags;
+   int cols;
+   int rows;
+   std::string exe;
+   std::string workingDir;
+   std::vector<std::string> args;
+   std::vector<std::string> environment;
+};
+
+// runs in the new child (from the launcher). as with fork in
+// ChildProcess::run we log and continue on errors so that we always
+// reach the exec
+void execChild(const LaunchRequest& request,
+               const std::vector<int>& fds,
+               int fdSlave)
+{
+   if (request.flags & kPseudoterminal)
+   {
+      // new session with the pseudoterminal as its controlling terminal
+      // and standard streams (as forkpty does)
+      if (::login_tty(fdSlave) == -1)
+         LOG_ERROR(systemError(errno, ERROR_LOCATION));
+
+      // specify raw mode (but don't ignore signals -- this is done
+      // so we can send Ctrl-C for interrupts)
+      struct termios termp;
+      if (::tcgetattr(STDIN_FILENO, &termp) == 0)
+      {
+         ::cfmakeraw(&termp);
+         termp.c_lflag |= ISIG;
+         if (::tcsetattr(STDIN_FILENO, TCSANOW, &termp) == -1)
+            LOG_ERROR(systemError(errno, ERROR_LOCATION));
+      }
+      else
+      {
+         LOG_ERROR(systemError(errno, ERROR_LOCATION));
+      }
+   }
+   else
+   {
+      if (request.flags & kDetachSession)
+      {
+         if (::setsid() == -1)
+            LOG_ERROR(systemError(errno, ERROR_LOCATION));
+      }
+      else if (request.flags & kTerminateChildren)
+      {
+         if (::setpgid(0,0) == -1)
+            LOG_ERROR(systemError(errno, ERROR_LOCATION));
+      }
+
+      // (dup2 clears close on exec, other than for a descriptor which
+      // is already in place)
+      for (std::size_t i = 0; i < fds.size(); i++)
+      {
+         if (fds[i] == static_cast<int>(i))
+         {
+            if (::fcntl(fds[i], F_SETFD, 0) == -1)
+               LOG_ERROR(systemError(errno, ERROR_LOCATION));
+         }
+         else if (::dup2(fds[i], i) == -1)
+         {
+            LOG_ERROR(systemError(errno, ERROR_LOCATION));
+         }
+      }
+   }
+
+   Error error = core::system::clearSignalMask();
+   if (error)
+      LOG_ERROR(error);
+
+   error = core::system::closeNonStdFileDescriptors();
+   if (error)
+      LOG_ERROR(error);
+
+   if (!request.workingDir.empty() && ::chdir(request.workingDir.c_str()))
+      LOG_ERROR(systemError(errno, "Error changing directory", ERROR_LOCATION));
+
+   std::vector<std::string> args;
+   args.push_back(request.exe);
+   args.insert(args.end(), request.args.begin(), request.args.end());
+   ProcessArgs processArgs(args);
+   ProcessArgs environment(request.environment);
+   ::execve(request.exe.c_str(), processArgs.args(), environment.args());
+
+   // only get here if the exec failed
+   LOG_ERROR(systemError(errno, ERROR_LOCATION));
+   ::_exit(EXIT_FAILURE);
+}
+
+// handle a request, returning the pid of the child (or -1 with errno set)
+pid_t launchChild(int launcherFd,
+                  const LaunchRequest& request,
+                  const std::vector<int>& fds,
+                  int* pFdMaster)
+{
+   int fdSlave = -1;
+   if (request.flags & kPseudoterminal)
+   {
+      struct winsize winSize;
+      winSize.ws_col = request.cols;
+      winSize.ws_row = request.rows;
+      winSize.ws_xpixel = 0;
+      winSize.ws_ypixel = 0;
+      if (::openpty(pFdMaster, &fdSlave, NULL, NULL, &winSize) == -1)
+         return -1;
+   }
+   else if (fds.size() != 3)
+   {
+      errno = EINVAL;
+      return -1;
+   }
+
+   // like fork, but the child belongs to our parent
+   pid_t pid = ::syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0);
+   if (pid == 0)
+   {
+      ::close(launcherFd);
+      if (*pFdMaster != -1)
+         ::close(*pFdMaster);
+      execChild(request, fds, fdSlave);
+   }
+
+   int cloneErrno = errno;
+   if (fdSlave != -1)
+      ::close(fdSlave);
+   if (pid == -1 && *pFdMaster != -1)
+   {
+      ::close(*pFdMaster);
+      *pFdMaster = -1;
+   }
+   errno = cloneErrno;
+   return pid;
+}
+
+void runLauncher(int launcherFd, pid_t parentPid)
+{
+   // exit along with the parent
+   ::prctl(PR_SET_PDEATHSIG, SIGKILL);
+   if (::getppid() != parentPid)
+      ::_exit(EXIT_SUCCESS);
+
+   while (true)
+   {
+      std::string message;
+      std::vector<int> fds;
+      Error error = receiveMessage(launcherFd, &message, &fds);
+      if (error)
+      {
+         // the parent closes the socket when it exits
+         if (error.code() != boost::system::errc::broken_pipe)
+            LOG_ERROR(error);
+         ::_exit(EXIT_SUCCESS);
+      }
+
+      LaunchRequest request;
+      MessageReader reader(message);
+      request.flags = reader.readInt();
+      request.cols = reader.readInt();
+      request.rows = reader.readInt();
+      request.exe = reader.readString();
+      request.workingDir = reader.readString();
+      request.args = reader.readStrings();
+      request.environment = reader.readStrings();
+
+      pid_t pid = -1;
+      int launchErrno = EINVAL;
+      int fdMaster = -1;
+      if (reader.valid())
+      {
+         pid = launchChild(launcherFd, request, fds, &fdMaster);
+         launchErrno = (pid == -1) ? errno : 0;
+      }
+      closeFds(fds);
+
+      std::string response;
+      appendInt(pid, &response);
+      appendInt(launchErrno, &response);
+      std::vector<int> responseFds;
+      if (fdMaster != -1)
+         responseFds.push_back(fdMaster);
+      error = sendMessage(launcherFd, response, responseFds);
+      if (fdMaster != -1)
+         ::close(fdMaster);
+      if (error)
+      {
+         LOG_ERROR(error);
+         ::_exit(EXIT_FAILURE);
+      }
+   }
+}
+
+#endif // __linux__
+
+// called with the launcher mutex held
+void markLauncherUnavailable()
+{
+   ::close(s_launcherFd);
+   s_launcherFd = -1;
+
+   // reap the launcher if it exited
+   ::waitpid(s_launcherPid, NULL, WNOHANG);
+   s_launcherPid = -1;
+}
+
+} // anonymous namespace
+
+Error startChildProcessLauncher()
+{
+#ifdef __linux__
+   boost::mutex::scoped_lock lock(launcherMutex());
+   if (s_launcherFd != -1)
+      return Success();
+
+   int fds[2];
+   Error error = posixCall<int>(
+            boost::bind(::socketpair, AF_UNIX, SOCK_STREAM, 0, fds),
+            ERROR_LOCATION);
+   if (error)
+      return error;
+
+   pid_t parentPid = ::getpid();
+   pid_t pid;
+   error = posixCall<pid_t>(::fork, ERROR_LOCATION, &pid);
+   if (error)
+   {
+      ::close(fds[0]);
+      ::close(fds[1]);
+      return error;
+   }
+
+   // child
+   if (pid == 0)
+   {
+      ::close(fds[0]);
+      runLauncher(fds[1], parentPid);
+      ::_exit(EXIT_SUCCESS);
+   }
+
+   // parent
+   ::close(fds[1]);
+   ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+   s_launcherFd = fds[0];
+   s_launcherPid = pid;
+#endif
+
+   return Success();
+}
+
+bool childProcessLauncherAvailable()
+{
+   boost::mutex::scoped_lock lock(launcherMutex());
+   return s_launcherFd != -1;
+}
+
+Error launchWithChildProcessLauncher(const std::string& exe,
+                                     const std::vector<std::string>& args,
+                                     const ProcessOptions& options,
+                                     const int* childFds,
+                                     pid_t* pPid,
+                                     int* pFdMaster)
+{
+   // build the request (the child gets the current environment and working
+   // directory of this process rather than those of the launcher)
+   int flags = 0;
+   int cols = 0, rows = 0;
+   if (options.detachSession)
+      flags |= kDetachSession;
+   if (options.terminateChildren)
+      flags |= kTerminateChildren;
+   if (options.pseudoterminal)
+   {
+      flags |= kPseudoterminal;
+      cols = options.pseudoterminal.get().cols;
+      rows = options.pseudoterminal.get().rows;
+   }
+
+   std::string workingDir = options.workingDir.absolutePath();
+   if (workingDir.empty())
+      workingDir = FilePath::safeCurrentPath(FilePath()).absolutePath();
+
+   Options envOptions;
+   if (options.environment)
+      envOptions = options.environment.get();
+   else
+      core::system::environment(&envOptions);
+   std::vector<std::string> environment;
+   for (Options::const_iterator it = envOptions.begin();
+        it != envOptions.end(); ++it)
+   {
+      environment.push_back(it->first + "=" + it->second);
+   }
+
+   std::string request;
+   appendInt(flags, &request);
+   appendInt(cols, &request);
+   appendInt(rows, &request);
+   appendString(exe, &request);
+   appendString(workingDir, &request);
+   appendStrings(args, &request);
+   appendStrings(environment, &request);
+
+   std::vector<int> requestFds;
+   if (!options.pseudoterminal)
+      requestFds.assign(childFds, childFds + 3);
+
+   // send the request and get the response
+   boost::mutex::scoped_lock lock(launcherMutex());
+   if (s_launcherFd == -1)
+      return systemError(boost::system::errc::not_connected, ERROR_LOCATION);
+
+   std::string response;
+   std::vector<int> responseFds;
+   Error error = sendMessage(s_launcherFd, request, requestFds);
+   if (!error)
+      error = receiveMessage(s_launcherFd, &response, &responseFds);
+   if (error)
+   {
+      closeFds(responseFds);
+      markLauncherUnavailable();
+      return error;
+   }
+
+   MessageReader reader(response);
+   pid_t pid = reader.readInt();
+   int launchErrno = reader.readInt();
+   if (!reader.valid())
+   {
+      closeFds(responseFds);
+      markLauncherUnavailable();
+      return systemError(boost::system::errc::protocol_error, ERROR_LOCATION);
+   }
+
+   if (pid == -1)
+   {
+      closeFds(responseFds);
+      Error error = systemError(launchErrno, ERROR_LOCATION);
+      error.addProperty("exe", exe);
+      return error;
+   }
+
+   if (options.pseudoterminal)
+   {
+      if (responseFds.size() != 1)
+      {
+         closeFds(responseFds);
+         return systemError(boost::system::errc::protocol_error,
+                            ERROR_LOCATION);
+      }
+      *pFdMaster = responseFds[0];
+   }
+   else
+   {
+      closeFds(responseFds);
+   }
+
+   *pPid = pid;
+   return Success();
+}
+
+} // namespace system
+} // namespace core
@@ -0,0 +1,49 @@
+/*
+ * PosixChildProcessLauncher.hpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#ifndef CORE_SYSTEM_POSIX_CHILD_PROCESS_LAUNCHER_HPP
+#define CORE_SYSTEM_POSIX_CHILD_PROCESS_LAUNCHER_HPP
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+namespace core {
+
+class Error;
+
+namespace system {
+
+struct ProcessOptions;
+
+// is the launcher process (see startChildProcessLauncher) running?
+bool childProcessLauncherAvailable();
+
+// have the launcher process create a child of this process. childFds are
+// the stdin, stdout and stderr of the child (not used for pseudoterminals,
+// in which case the master fd is returned in pFdMaster). onAfterFork is not
+// supported. if the launcher can't be reached it is marked as unavailable
+// and an error is returned (the caller can then fall back to fork)
+core::Error launchWithChildProcessLauncher(
+                                    const std::string& exe,
+                                    const std::vector<std::string>& args,
+                                    const ProcessOptions& options,
+                                    const int* childFds,
+                                    pid_t* pPid,
+                                    int* pFdMaster);
+
+} // namespace system
+} // namespace core
+
+#endif // CORE_SYSTEM_POSIX_CHILD_PROCESS_LAUNCHER_HPP
@@ -0,0 +1,428 @@
+/*
+ * PosixChildProcessReactor.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include "PosixChildProcessReactor.hpp"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+
+#include <map>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include <core/Log.hpp>
+#include <core/Thread.hpp>
+
+namespace core {
+namespace system {
+
+namespace {
+
+// size of the buffer used for reads
+const std::size_t kReadBufferSize = 64 * 1024;
+
+// once this much output is waiting to be taken we stop reading it (so
+// the child blocks rather than us buffering without limit)
+const std::size_t kMaxPendingOutput = 1024 * 1024;
+
+} // anonymous namespace
+
+// The reactor thread waits for any of the watched fds to become readable.
+// Each fd is registered with EPOLLONESHOT and re-armed once it has been
+// read to EAGAIN (or once its pending output is taken if we stopped
+// reading at kMaxPendingOutput). Events carry an id rather than a pointer
+// so an event for a child which is no longer watched is simply ignored.
+class ChildProcessReactor : boost::noncopyable
+{
+public:
+   static ChildProcessReactor& instance()
+   {
+      static ChildProcessReactor* pInstance = new ChildProcessReactor();
+      return *pInstance;
+   }
+
+   bool available()
+   {
+      return epollFd_ != -1;
+   }
+
+   // add an fd for the given stream of the child (returns the id)
+   uint64_t add(int fd,
+                boost::shared_ptr<WatchedChildProcess> pChild,
+                int stream)
+   {
+      uint64_t id = 0;
+      LOCK_MUTEX(mutex_)
+      {
+         id = ++lastId_;
+         Entry entry;
+         entry.pChild = pChild;
+         entry.stream = stream;
+         entries_[id] = entry;
+
+         if (!threadStarted_)
+         {
+            core::thread::safeLaunchThread(
+                     boost::bind(&ChildProcessReactor::run, this));
+            threadStarted_ = true;
+         }
+      }
+      END_LOCK_MUTEX
+
+      struct epoll_event event;
+      event.events = EPOLLIN | EPOLLONESHOT;
+      event.data.u64 = id;
+      if (::epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) == -1)
+      {
+         LOG_ERROR(systemError(errno, ERROR_LOCATION));
+         remove(id);
+         return 0;
+      }
+
+      return id;
+   }
+
+   void rearm(int fd, uint64_t id)
+   {
+      struct epoll_event event;
+      event.events = EPOLLIN | EPOLLONESHOT;
+      event.data.u64 = id;
+      if (::epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &event) == -1)
+         LOG_ERROR(systemError(errno, ERROR_LOCATION));
+   }
+
+   void remove(int fd, uint64_t id)
+   {
+      struct epoll_event event;
+      if (::epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, &event) == -1)
+         LOG_ERROR(systemError(errno, ERROR_LOCATION));
+      remove(id);
+   }
+
+private:
+   ChildProcessReactor()
+      : epollFd_(::epoll_create1(EPOLL_CLOEXEC)),
+        lastId_(0),
+        threadStarted_(false)
+   {
+      if (epollFd_ == -1)
+         LOG_ERROR(systemError(errno, ERROR_LOCATION));
+   }
+
+   void remove(uint64_t id)
+   {
+      LOCK_MUTEX(mutex_)
+      {
+         entries_.erase(id);
+      }
+      END_LOCK_MUTEX
+   }
+
+   void run()
+   {
+      std::vector<char> buffer(kReadBufferSize);
+      struct epoll_event events[64];
+      while (true)
+      {
+         int count = ::epoll_wait(epollFd_, events, 64, -1);
+         if (count == -1)
+         {
+            if (errno != EINTR)
+            {
+               LOG_ERROR(systemError(errno, ERROR_LOCATION));
+               ::sleep(1);
+            }
+            continue;
+         }
+
+         for (int i = 0; i < count; i++)
+         {
+            boost::shared_ptr<WatchedChildProcess> pChild;
+            int stream = 0;
+            LOCK_MUTEX(mutex_)
+            {
+               std::map<uint64_t,Entry>::const_iterator it =
+                                             entries_.find(events[i].data.u64);
+               if (it != entries_.end())
+               {
+                  pChild = it->second.pChild.lock();
+                  stream = it->second.stream;
+               }
+            }
+            END_LOCK_MUTEX
+
+            if (pChild)
+               pChild->onReadable(stream, &buffer);
+         }
+      }
+   }
+
+private:
+   struct Entry
+   {
+      boost::weak_ptr<WatchedChildProcess> pChild;
+      int stream;
+   };
+
+   int epollFd_;
+   boost::mutex mutex_;
+   uint64_t lastId_;
+   std::map<uint64_t,Entry> entries_;
+   bool threadStarted_;
+};
+
+
+WatchedChildProcess::WatchedChildProcess()
+   : exited_(false), notified_(false), watching_(true)
+{
+}
+
+WatchedChildProcess::~WatchedChildProcess()
+{
+   try
+   {
+      stopWatching();
+   }
+   catch(...)
+   {
+   }
+}
+
+void WatchedChildProcess::takeOutput(std::string* pStdout,
+                                     std::string* pStderr,
+                                     bool* pStdoutEof,
+                                     bool* pStderrEof,
+                                     Error* pError)
+{
+   LOCK_MUTEX(mutex_)
+   {
+      pStdout->swap(streams_[kStdout].pending);
+      streams_[kStdout].pending.clear();
+      pStderr->swap(streams_[kStderr].pending);
+      streams_[kStderr].pending.clear();
+      *pStdoutEof = streams_[kStdout].eof;
+      *pStderrEof = streams_[kStderr].eof;
+      *pError = error_;
+      error_ = Success();
+      notified_ = false;
+
+      // resume reading any streams we stopped at kMaxPendingOutput
+      if (watching_)
+      {
+         rearm(kStdout);
+         rearm(kStderr);
+      }
+   }
+   END_LOCK_MUTEX
+}
+
+bool WatchedChildProcess::mayHaveExited()
+{
+   LOCK_MUTEX(mutex_)
+   {
+      return exited_ || streams_[kExit].fd == -1;
+   }
+   END_LOCK_MUTEX
+
+   return true;
+}
+
+void WatchedChildProcess::stopWatching()
+{
+   LOCK_MUTEX(mutex_)
+   {
+      if (!watching_)
+         return;
+      watching_ = false;
+
+      std::vector<char> buffer(kReadBufferSize);
+      for (int i = 0; i < kStreamCount; i++)
+      {
+         Stream& stream = streams_[i];
+         if (stream.fd == -1)
+            continue;
+
+         ChildProcessReactor::instance().remove(stream.fd, stream.id);
+         if (i == kExit)
+         {
+            ::close(stream.fd);
+            stream.fd = -1;
+         }
+         else if (!stream.eof)
+         {
+            readStream(i, &buffer);
+         }
+      }
+   }
+   END_LOCK_MUTEX
+}
+
+void WatchedChildProcess::onReadable(int stream, std::vector<char>* pBuffer)
+{
+   boost::function<void()> onActivity;
+   LOCK_MUTEX(mutex_)
+   {
+      if (!watching_)
+         return;
+
+      streams_[stream].armed = false;
+      if (stream == kExit)
+         exited_ = true;
+      else
+         readStream(stream, pBuffer);
+      rearm(stream);
+
+      // notify once per take
+      bool activity = exited_ ||
+                      !streams_[kStdout].pending.empty() ||
+                      !streams_[kStderr].pending.empty() ||
+                      streams_[kStdout].eof ||
+                      streams_[kStderr].eof;
+      if (activity && !notified_)
+      {
+         notified_ = true;
+         onActivity = onActivity_;
+      }
+   }
+   END_LOCK_MUTEX
+
+   if (onActivity)
+      onActivity();
+}
+
+// called with the mutex held
+void WatchedChildProcess::rearm(int stream)
+{
+   Stream& s = streams_[stream];
+   if (s.fd == -1 || s.armed || s.eof ||
+       (stream == kExit && exited_) ||
+       s.pending.size() >= kMaxPendingOutput)
+   {
+      return;
+   }
+
+   ChildProcessReactor::instance().rearm(s.fd, s.id);
+   s.armed = true;
+}
+
+// called with the mutex held. reads until EAGAIN, eof or kMaxPendingOutput
+void WatchedChildProcess::readStream(int stream, std::vector<char>* pBuffer)
+{
+   Stream& s = streams_[stream];
+   while (s.pending.size() < kMaxPendingOutput)
+   {
+      ssize_t bytesRead = ::read(s.fd, &((*pBuffer)[0]), pBuffer->size());
+      if (bytesRead > 0)
+      {
+         s.pending.append(&((*pBuffer)[0]), bytesRead);
+      }
+      else if (bytesRead == 0)
+      {
+         s.eof = true;
+         return;
+      }
+      else if (errno == EINTR)
+      {
+         continue;
+      }
+      else if (errno == EAGAIN)
+      {
+         return;
+      }
+      else
+      {
+         // on linux slave terminals return EIO rather than bytesRead == 0
+         // to indicate end of file
+         int readErrno = errno;
+         if (!(readErrno == EIO && ::isatty(s.fd)) && !error_)
+            error_ = systemError(readErrno, ERROR_LOCATION);
+         s.eof = true;
+         return;
+      }
+   }
+}
+
+
+boost::shared_ptr<WatchedChildProcess> watchChildProcess(
+                                 pid_t pid,
+                                 int fdStdout,
+                                 int fdStderr,
+                                 const boost::function<void()>& onActivity)
+{
+   ChildProcessReactor& reactor = ChildProcessReactor::instance();
+   if (!reactor.available())
+      return boost::shared_ptr<WatchedChildProcess>();
+
+   boost::shared_ptr<WatchedChildProcess> pChild(new WatchedChildProcess());
+   pChild->onActivity_ = onActivity;
+
+   // a pidfd becomes readable when the child exits (linux 5.3). if we
+   // can't get one the caller needs to check for exits on each poll
+   int fdExit = -1;
+#ifdef SYS_pidfd_open
+   fdExit = ::syscall(SYS_pidfd_open, pid, 0);
+#endif
+
+   int fds[WatchedChildProcess::kStreamCount] = { fdStdout, fdStderr, fdExit };
+   LOCK_MUTEX(pChild->mutex_)
+   {
+      for (int i = 0; i < WatchedChildProcess::kStreamCount; i++)
+      {
+         WatchedChildProcess::Stream& stream = pChild->streams_[i];
+         if (fds[i] == -1)
+         {
+            // streams we don't have are at eof
+            stream.eof = (i != WatchedChildProcess::kExit);
+            continue;
+         }
+
+         stream.id = reactor.add(fds[i], pChild, i);
+         if (stream.id != 0)
+         {
+            stream.fd = fds[i];
+            stream.armed = true;
+         }
+         else if (i == WatchedChildProcess::kExit)
+         {
+            ::close(fdExit);
+         }
+         else
+         {
+            // fall back to reading the fds on poll
+            pChild->watching_ = false;
+            for (int j = 0; j < i; j++)
+            {
+               if (pChild->streams_[j].fd != -1)
+               {
+                  reactor.remove(pChild->streams_[j].fd,
+                                 pChild->streams_[j].id);
+               }
+            }
+            if (fdExit != -1)
+               ::close(fdExit);
+            return boost::shared_ptr<WatchedChildProcess>();
+         }
+      }
+   }
+   END_LOCK_MUTEX
+
+   return pChild;
+}
+
+} // namespace system
+} // namespace core
@@ -0,0 +1,115 @@
+/*
+ * PosixChildProcessReactor.hpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#ifndef CORE_SYSTEM_POSIX_CHILD_PROCESS_REACTOR_HPP
+#define CORE_SYSTEM_POSIX_CHILD_PROCESS_REACTOR_HPP
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include <core/BoostThread.hpp>
+#include <core/Error.hpp>
+
+namespace core {
+namespace system {
+
+class ChildProcessReactor;
+class WatchedChildProcess;
+
+boost::shared_ptr<WatchedChildProcess> watchChildProcess(
+                                 pid_t pid,
+                                 int fdStdout,
+                                 int fdStderr,
+                                 const boost::function<void()>& onActivity);
+
+// The output of an async child process read by the reactor thread (which
+// multiplexes the output of all children with epoll, so output is read as
+// soon as it is written rather than at the next poll). The owner of the
+// child is notified when there is output to take or the child has exited
+// so that it can poll right away.
+class WatchedChildProcess : boost::noncopyable
+{
+public:
+   ~WatchedChildProcess();
+
+   // take the output read since the last call along with whether each
+   // stream has reached eof and the read error (if one occurred since the
+   // last call)
+   void takeOutput(std::string* pStdout,
+                   std::string* pStderr,
+                   bool* pStdoutEof,
+                   bool* pStderrEof,
+                   Error* pError);
+
+   // false only if the child certainly hasn't exited (we can't always
+   // watch for exits, in which case this is always true)
+   bool mayHaveExited();
+
+   // stop watching the child (reading any output which is still available
+   // so that it can be taken). must be called before the fds are closed
+   void stopWatching();
+
+private:
+   friend class ChildProcessReactor;
+   friend boost::shared_ptr<WatchedChildProcess> watchChildProcess(
+                                 pid_t, int, int,
+                                 const boost::function<void()>&);
+   WatchedChildProcess();
+
+   // called on the reactor thread
+   void onReadable(int stream, std::vector<char>* pBuffer);
+
+   void rearm(int stream);
+   void readStream(int stream, std::vector<char>* pBuffer);
+
+   struct Stream
+   {
+      Stream() : fd(-1), id(0), armed(false), eof(false) {}
+      int fd;
+      uint64_t id;
+      bool armed;
+      bool eof;
+      std::string pending;
+   };
+
+   enum { kStdout = 0, kStderr = 1, kExit = 2, kStreamCount = 3 };
+
+   boost::mutex mutex_;
+   Stream streams_[kStreamCount];
+   Error error_;
+   bool exited_;
+   bool notified_;
+   bool watching_;
+   boost::function<void()> onActivity_;
+};
+
+// begin watching a child (fdStderr is -1 for pseudoterminals). the fds must
+// be non-blocking. returns an empty pointer if the reactor isn't available
+// (in which case the caller should read the fds itself)
+boost::shared_ptr<WatchedChildProcess> watchChildProcess(
+                                 pid_t pid,
+                                 int fdStdout,
+                                 int fdStderr,
+                                 const boost::function<void()>& onActivity);
+
+} // namespace system
+} // namespace core
+
+#endif // CORE_SYSTEM_POSIX_CHILD_PROCESS_REACTOR_HPP
@@ -0,0 +1,281 @@
+/*
+ * PosixChildProcessTests.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include <core/system/Process.hpp>
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <vector>
+
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <core/BoostThread.hpp>
+
+#include <core/Error.hpp>
+#include <core/FilePath.hpp>
+#include <core/SafeConvert.hpp>
+#include <core/system/Environment.hpp>
+
+namespace core {
+namespace system {
+
+namespace {
+
+const int kLaunches = 50;
+
+void noOp()
+{
+}
+
+ProcessResult runShell(const std::string& script,
+                       const ProcessOptions& options = ProcessOptions())
+{
+   std::vector<std::string> args;
+   args.push_back("-c");
+   args.push_back(script);
+   ProcessResult result;
+   Error error = runProgram("/bin/sh", args, "", options, &result);
+   BOOST_ASSERT(!error);
+   return result;
+}
+
+// streams, exit status, working directory, environment and file
+// descriptors are the same whether or not the child is forked
+void verifyChildSetup(const ProcessOptions& baseOptions)
+{
+   ProcessResult result = runShell("echo out; echo err 1>&2; exit 3",
+                                   baseOptions);
+   BOOST_ASSERT(result.stdOut == "out\n");
+   BOOST_ASSERT(result.stdErr == "err\n");
+   BOOST_ASSERT(result.exitStatus == 3);
+
+   ProcessOptions options = baseOptions;
+   options.redirectStdErrToStdOut = true;
+   result = runShell("echo err 1>&2", options);
+   BOOST_ASSERT(result.stdOut == "err\n");
+
+   options = baseOptions;
+   options.workingDir = FilePath("/tmp");
+   result = runShell("pwd", options);
+   BOOST_ASSERT(result.stdOut == "/tmp\n");
+
+   // a working directory we can't change to is logged (the child still runs)
+   options.workingDir = FilePath("/tmp/rs-no-such-dir");
+   result = runShell("echo ran", options);
+   BOOST_ASSERT(result.stdOut == "ran\n");
+
+   options = baseOptions;
+   Options env;
+   core::system::setenv(&env, "RS_CHILD_PROCESS_TEST", "value");
+   options.environment = env;
+   result = runShell("echo $RS_CHILD_PROCESS_TEST", options);
+   BOOST_ASSERT(result.stdOut == "value\n");
+
+   options = baseOptions;
+   options.detachSession = true;
+   result = runShell("cut -d' ' -f6 /proc/$$/stat; echo $$", options);
+   std::string sessionId = result.stdOut.substr(0,
+                                                result.stdOut.find('\n') + 1);
+   BOOST_ASSERT(!sessionId.empty() && result.stdOut == sessionId + sessionId);
+
+   // our file descriptors aren't inherited
+   int fd = ::open("/dev/null", O_RDONLY);
+   BOOST_ASSERT(fd != -1);
+   result = runShell("test -e /proc/$$/fd/" + safe_convert::numberToString(fd),
+                     baseOptions);
+   BOOST_ASSERT(result.exitStatus == 1);
+   ::close(fd);
+}
+
+void onPtyCompleted(const ProcessResult& result, ProcessResult* pResult)
+{
+   *pResult = result;
+}
+
+// pseudoterminal children are created by the launcher
+void verifyPseudoterminal()
+{
+   ProcessOptions options;
+   options.pseudoterminal = core::system::Pseudoterminal(80, 25);
+   ProcessResult result;
+   ProcessSupervisor supervisor;
+   Error error = supervisor.runCommand("tty; echo hello",
+                                       options,
+                                       boost::bind(onPtyCompleted, _1,
+                                                   &result));
+   BOOST_ASSERT(!error);
+   // (if the child doesn't exit in time we have no output to check)
+   supervisor.wait(boost::posix_time::milliseconds(10),
+                   boost::posix_time::seconds(10));
+   BOOST_ASSERT(boost::algorithm::starts_with(result.stdOut, "/dev/pts/"));
+   BOOST_ASSERT(boost::algorithm::contains(result.stdOut, "hello"));
+}
+
+struct ActivityMonitor
+{
+   ActivityMonitor() : activity(false), bytes(0), exitStatus(-1) {}
+
+   void onActivity()
+   {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      activity = true;
+      condition.notify_all();
+   }
+
+   void waitForActivity()
+   {
+      boost::unique_lock<boost::mutex> lock(mutex);
+      if (!activity)
+      {
+         condition.timed_wait(lock,
+                              boost::get_system_time() +
+                                 boost::posix_time::seconds(1));
+      }
+      activity = false;
+   }
+
+   void onStdout(ProcessOperations&, const std::string& output)
+   {
+      bytes += output.size();
+      if (firstOutput.is_not_a_date_time())
+         firstOutput = boost::posix_time::microsec_clock::universal_time();
+   }
+
+   void onExit(int status)
+   {
+      exitStatus = status;
+   }
+
+   boost::mutex mutex;
+   boost::condition condition;
+   bool activity;
+   std::size_t bytes;
+   int exitStatus;
+   boost::posix_time::ptime firstOutput;
+};
+
+// output is read as it is written and we are notified when there is
+// output to take (so we only need to poll when notified)
+void verifyReactor()
+{
+   using namespace boost::posix_time;
+
+   ActivityMonitor monitor;
+   ProcessSupervisor supervisor;
+   supervisor.setActivityHandler(boost::bind(&ActivityMonitor::onActivity,
+                                             &monitor));
+   ProcessCallbacks callbacks;
+   callbacks.onStdout = boost::bind(&ActivityMonitor::onStdout,
+                                    &monitor, _1, _2);
+   callbacks.onExit = boost::bind(&ActivityMonitor::onExit, &monitor, _1);
+
+   const std::size_t kOutputBytes = 8 * 1024 * 1024;
+   ptime start = microsec_clock::universal_time();
+   Error error = supervisor.runCommand(
+            "echo a; sleep 0.2; head -c " +
+               safe_convert::numberToString(kOutputBytes) + " /dev/zero",
+            ProcessOptions(),
+            callbacks);
+   BOOST_ASSERT(!error);
+
+   int polls = 0;
+   do
+   {
+      monitor.waitForActivity();
+      polls++;
+   }
+   while (supervisor.poll());
+   ptime end = microsec_clock::universal_time();
+
+   BOOST_ASSERT(monitor.exitStatus == 0);
+   BOOST_ASSERT(monitor.bytes == kOutputBytes + 2);
+   std::cout << boost::format("read %1% bytes in %2%ms with %3% polls "
+                              "(first output after %4%ms)")
+                  % monitor.bytes
+                  % ((end - start).total_microseconds() / 1000.0)
+                  % polls
+                  % ((monitor.firstOutput - start).total_microseconds() /
+                     1000.0)
+             << std::endl;
+}
+
+double launchMilliseconds(const ProcessOptions& options)
+{
+   using namespace boost::posix_time;
+
+   std::vector<std::string> args;
+   ptime start = microsec_clock::universal_time();
+   for (int i = 0; i < kLaunches; i++)
+   {
+      ProcessResult result;
+      Error error = runProgram("/bin/true", args, "", options, &result);
+      BOOST_ASSERT(!error);
+   }
+   ptime end = microsec_clock::universal_time();
+
+   return (end - start).total_microseconds() / 1000.0 / kLaunches;
+}
+
+} // anonymous namespace
+
+
+void runChildProcessTests()
+{
+   Error error = startChildProcessLauncher();
+   BOOST_ASSERT(!error);
+
+   // spawned and forked (onAfterFork forces a fork)
+   ProcessOptions forkOptions;
+   forkOptions.onAfterFork = noOp;
+   verifyChildSetup(ProcessOptions());
+   verifyChildSetup(forkOptions);
+
+   verifyPseudoterminal();
+   verifyReactor();
+
+   // time to launch a child as the size of this process grows
+   const std::size_t kBlockSize = 256 * 1024 * 1024;
+   const std::size_t kBlockCounts[] = { 0, 1, 4, 8 };
+   std::vector<char*> blocks;
+   for (std::size_t i = 0; i < sizeof(kBlockCounts) / sizeof(std::size_t); i++)
+   {
+      while (blocks.size() < kBlockCounts[i])
+      {
+         char* pBlock = static_cast<char*>(::malloc(kBlockSize));
+         BOOST_ASSERT(pBlock != NULL);
+         ::memset(pBlock, 1, kBlockSize);
+         blocks.push_back(pBlock);
+      }
+
+      std::cout << boost::format("%1% MB allocated: spawn %2%ms, "
+                                 "fork %3%ms")
+                     % (blocks.size() * (kBlockSize / (1024 * 1024)))
+                     % launchMilliseconds(ProcessOptions())
+                     % launchMilliseconds(forkOptions)
+                << std::endl;
+   }
+
+   for (std::size_t i = 0; i < blocks.size(); i++)
+      ::free(blocks[i]);
+}
+
+} // namespace system
+} // namespace core
@@ -14,14 +14,23 @@
 #include <core/system/FileScanner.hpp>
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
+#include <deque>
+#include <algorithm>
+
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/utility.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include <core/Error.hpp>
 #include <core/Log.hpp>
 #include <core/FilePath.hpp>
 #include <core/BoostThread.hpp>
+#include <core/Thread.hpp>
 
 #include "config.h"
 
@@ -77,6 +86,403 @@ Error scanDir(const std::string& dirPath, std::vector<std::string>* pNames)
    return Success();
 }
 
+#ifdef HAVE_FSTATAT
+
+// maximum number of threads used for parallel scans
+const unsigned int kMaxScanThreads = 4;
+
+FileInfo fileInfoFromStat(const std::string& path, const struct stat& st)
+{
+   bool isSymlink = S_ISLNK(st.st_mode);
+   if (S_ISDIR(st.st_mode))
+   {
+      return FileInfo(path, true, isSymlink);
+   }
+   else
+   {
+      return FileInfo(path,
+                      false,
+                      st.st_size,
+#ifdef __APPLE__
+                      st.st_mtimespec.tv_sec,
+#else
+                      st.st_mtime,
+#endif
+                      isSymlink);
+   }
+}
+
+// open directory stream (subdirectories are opened relative to it, so
+// it stays open until all of the jobs scanning them have started)
+class DirHandle : boost::noncopyable
+{
+public:
+   explicit DirHandle(DIR* pDir) : pDir_(pDir) {}
+   ~DirHandle() { ::closedir(pDir_); }
+   DIR* dir() const { return pDir_; }
+   int fd() const { return ::dirfd(pDir_); }
+private:
+   DIR* pDir_;
+};
+
+struct ScanNode;
+
+struct ScanEntry
+{
+   FileInfo fileInfo;
+
+   // contents (for directories which are traversed)
+   boost::shared_ptr<ScanNode> pNode;
+};
+
+struct ScanNode
+{
+   std::vector<ScanEntry> entries;
+};
+
+struct ScanJob
+{
+   FileInfo fileInfo;
+   std::string name;
+   boost::shared_ptr<DirHandle> pParent;
+   boost::shared_ptr<ScanNode> pNode;
+};
+
+struct DirEntry
+{
+   DirEntry(const char* name, unsigned char type) : name(name), type(type) {}
+   std::string name;
+   unsigned char type;
+};
+
+bool dirEntryLess(const DirEntry& a, const DirEntry& b)
+{
+   // use strcoll to match alphasort
+   return ::strcoll(a.name.c_str(), b.name.c_str()) < 0;
+}
+
+// scans directories using paths relative to their parent's descriptor,
+// consulting d_type to avoid stat calls for directories. subdirectories
+// are scanned on a small pool of threads, each of which works depth
+// first from its own queue and steals the oldest (shallowest) jobs from
+// other threads' queues when it runs out
+class ParallelScanner : boost::noncopyable
+{
+public:
+   explicit ParallelScanner(const FileScannerOptions& options)
+      : options_(options), pendingJobs_(0)
+   {
+      unsigned int threads = std::min(kMaxScanThreads,
+                                      boost::thread::hardware_concurrency());
+      for (unsigned int i = 0; i < std::max(threads, 1u); i++)
+         queues_.push_back(boost::shared_ptr<WorkQueue>(new WorkQueue()));
+   }
+
+   // COPYING: boost::noncopyable
+
+   Error scan(const tree<FileInfo>::iterator_base& fromNode,
+              tree<FileInfo>* pTree)
+   {
+      // scan the root on this thread (errors here fail the whole scan)
+      ScanJob rootJob;
+      rootJob.fileInfo = *fromNode;
+      rootJob.pNode.reset(new ScanNode());
+      Error error = scanDirectory(rootJob, 0);
+      if (error)
+         return error;
+      rootJob = ScanJob();
+
+      // scan subdirectories on the pool
+      boost::thread_group workers;
+      for (std::size_t i = 0; i < queues_.size(); i++)
+      {
+         try
+         {
+            workers.create_thread(
+                     boost::bind(&ParallelScanner::workerMain, this, i));
+         }
+         catch(const boost::thread_resource_error& e)
+         {
+            LOG_ERROR(Error(boost::thread_error::ec_from_exception(e),
+                            ERROR_LOCATION));
+            break;
+         }
+      }
+
+      // scan on this thread if we couldn't create any workers
+      if (workers.size() == 0)
+         workerMain(0);
+
+      workers.join_all();
+
+      // build the tree
+      appendEntries(fromNode, *pRootNode_, pTree);
+
+      return Success();
+   }
+
+private:
+   struct WorkQueue
+   {
+      boost::mutex mutex;
+      std::deque<ScanJob> jobs;
+   };
+
+   void workerMain(std::size_t worker)
+   {
+      ScanJob job;
+      while (dequeue(worker, &job))
+      {
+         try
+         {
+            // we don't want one "bad" directory to cause us to abort the
+            // entire scan (the directory will just have no children)
+            Error error = scanDirectory(job, worker);
+            if (error)
+               LOG_ERROR(error);
+         }
+         CATCH_UNEXPECTED_EXCEPTION
+
+         // release the parent directory
+         job = ScanJob();
+
+         LOCK_MUTEX(stateMutex_)
+         {
+            if (--pendingJobs_ == 0)
+               stateChanged_.notify_all();
+         }
+         END_LOCK_MUTEX
+      }
+   }
+
+   void enqueue(std::size_t worker, const ScanJob& job)
+   {
+      LOCK_MUTEX(queues_[worker]->mutex)
+      {
+         queues_[worker]->jobs.push_back(job);
+      }
+      END_LOCK_MUTEX
+
+      LOCK_MUTEX(stateMutex_)
+      {
+         pendingJobs_++;
+         stateChanged_.notify_one();
+      }
+      END_LOCK_MUTEX
+   }
+
+   bool dequeue(std::size_t worker, ScanJob* pJob)
+   {
+      while (true)
+      {
+         // take the most recent job from our own queue, otherwise steal
+         // the oldest job from another queue
+         for (std::size_t i = 0; i < queues_.size(); i++)
+         {
+            WorkQueue& queue = *queues_[(worker + i) % queues_.size()];
+            LOCK_MUTEX(queue.mutex)
+            {
+               if (!queue.jobs.empty())
+               {
+                  if (i == 0)
+                  {
+                     *pJob = queue.jobs.back();
+                     queue.jobs.pop_back();
+                  }
+                  else
+                  {
+                     *pJob = queue.jobs.front();
+                     queue.jobs.pop_front();
+                  }
+                  return true;
+               }
+            }
+            END_LOCK_MUTEX
+         }
+
+         // we're done once no jobs are queued or running, otherwise wait
+         // for more (with a timeout so a missed notification is harmless)
+         try
+         {
+            boost::unique_lock<boost::mutex> lock(stateMutex_);
+            if (pendingJobs_ == 0)
+               return false;
+            stateChanged_.timed_wait(lock,
+                                     boost::posix_time::milliseconds(5));
+         }
+         catch(const boost::thread_resource_error& e)
+         {
+            LOG_ERROR(Error(boost::thread_error::ec_from_exception(e),
+                            ERROR_LOCATION));
+            return false;
+         }
+      }
+   }
+
+   Error scanDirectory(const ScanJob& job, std::size_t worker)
+   {
+      // call onBeforeScanDir hook
+      if (options_.onBeforeScanDir)
+      {
+         Error error;
+         LOCK_MUTEX(callbackMutex_)
+         {
+            error = options_.onBeforeScanDir(job.fileInfo);
+         }
+         END_LOCK_MUTEX
+         if (error)
+            return error;
+      }
+
+      // open the directory (relative to its parent if we have it)
+      std::string dirPath = job.fileInfo.absolutePath();
+      int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+      int fd = job.pParent ?
+               ::openat(job.pParent->fd(), job.name.c_str(), flags | O_NOFOLLOW) :
+               ::open(dirPath.c_str(), flags);
+      if (fd == -1)
+      {
+         Error error = systemError(errno, ERROR_LOCATION);
+         error.addProperty("path", dirPath);
+         return error;
+      }
+
+      DIR* pDir = ::fdopendir(fd);
+      if (pDir == NULL)
+      {
+         Error error = systemError(errno, ERROR_LOCATION);
+         error.addProperty("path", dirPath);
+         ::close(fd);
+         return error;
+      }
+      boost::shared_ptr<DirHandle> pDirHandle(new DirHandle(pDir));
+
+      // read the entries
+      std::vector<DirEntry> dirEntries;
+      while (true)
+      {
+         errno = 0;
+         struct dirent* pEntry = ::readdir(pDir);
+         if (pEntry == NULL)
+         {
+            if (errno != 0)
+            {
+               Error error = systemError(errno, ERROR_LOCATION);
+               error.addProperty("path", dirPath);
+               return error;
+            }
+            break;
+         }
+
+         if (entryFilter(pEntry))
+            dirEntries.push_back(DirEntry(pEntry->d_name, pEntry->d_type));
+      }
+      std::sort(dirEntries.begin(), dirEntries.end(), dirEntryLess);
+
+      // compute the path prefix for children
+      if (dirPath.empty() || dirPath[dirPath.length() - 1] != '/')
+         dirPath.append("/");
+
+      job.pNode->entries.reserve(dirEntries.size());
+      BOOST_FOREACH(const DirEntry& dirEntry, dirEntries)
+      {
+         ScanEntry entry;
+         std::string path = dirPath + dirEntry.name;
+
+         // directories (which aren't links) need no further attributes
+         if (dirEntry.type == DT_DIR)
+         {
+            entry.fileInfo = FileInfo(path, true, false);
+         }
+         else
+         {
+            struct stat st;
+            int res = ::fstatat(pDirHandle->fd(),
+                                dirEntry.name.c_str(),
+                                &st,
+                                AT_SYMLINK_NOFOLLOW);
+            if (res == -1)
+            {
+               if (errno != ENOENT)
+               {
+                  Error error = systemError(errno, ERROR_LOCATION);
+                  error.addProperty("path", path);
+                  LOG_ERROR(error);
+               }
+               continue;
+            }
+
+            entry.fileInfo = fileInfoFromStat(path, st);
+         }
+
+         // apply the filter (if any)
+         if (options_.filter)
+         {
+            bool include = false;
+            LOCK_MUTEX(callbackMutex_)
+            {
+               include = options_.filter(entry.fileInfo);
+            }
+            END_LOCK_MUTEX
+            if (!include)
+               continue;
+         }
+
+         // queue a scan of subdirectories if requested
+         if (options_.recursive &&
+             entry.fileInfo.isDirectory() &&
+             !entry.fileInfo.isSymlink())
+         {
+            entry.pNode.reset(new ScanNode());
+
+            ScanJob childJob;
+            childJob.fileInfo = entry.fileInfo;
+            childJob.name = dirEntry.name;
+            childJob.pParent = pDirHandle;
+            childJob.pNode = entry.pNode;
+            enqueue(worker, childJob);
+         }
+
+         job.pNode->entries.push_back(entry);
+      }
+
+      // remember the root so we can build the tree from it
+      if (!job.pParent)
+         pRootNode_ = job.pNode;
+
+      return Success();
+   }
+
+   void appendEntries(const tree<FileInfo>::iterator_base& parent,
+                      const ScanNode& node,
+                      tree<FileInfo>* pTree)
+   {
+      BOOST_FOREACH(const ScanEntry& entry, node.entries)
+      {
+         tree<FileInfo>::iterator_base child = pTree->append_child(
+                                                         parent,
+                                                         entry.fileInfo);
+         if (entry.pNode)
+            appendEntries(child, *entry.pNode, pTree);
+      }
+   }
+
+private:
+   FileScannerOptions options_;
+   boost::shared_ptr<ScanNode> pRootNode_;
+
+   // serializes calls to the filter and onBeforeScanDir callbacks
+   boost::mutex callbackMutex_;
+
+   // work queues (one per thread) and the number of jobs queued or running
+   std::vector<boost::shared_ptr<WorkQueue> > queues_;
+   boost::mutex stateMutex_;
+   boost::condition_variable stateChanged_;
+   std::size_t pendingJobs_;
+};
+
+#endif // HAVE_FSTATAT
+
 } // anonymous namespace
 
 Error scanFiles(const tree<FileInfo>::iterator_base& fromNode,
@@ -86,6 +492,15 @@ Error scanFiles(const tree<FileInfo>::iterator_base& fromNode,
    // clear all existing
    pTree->erase_children(fromNode);
 
+#ifdef HAVE_FSTATAT
+   // use the parallel scanner if requested
+   if (options.parallel && options.recursive)
+   {
+      ParallelScanner scanner(options);
+      return scanner.scan(fromNode, pTree);
+   }
+#endif
+
    // create FilePath for root
    FilePath rootPath(fromNode->absolutePath());
 
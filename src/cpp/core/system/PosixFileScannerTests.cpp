@@ -0,0 +1,157 @@
+/*
+ * PosixFileScannerTests.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include <core/system/FileScanner.hpp>
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <iostream>
+
+#include <boost/assert.hpp>
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <core/Error.hpp>
+#include <core/Log.hpp>
+#include <core/FilePath.hpp>
+#include <core/SafeConvert.hpp>
+
+namespace core {
+namespace system {
+
+namespace {
+
+// synthetic tree of 20 x 50 directories with 200 files each (200k files)
+const int kTopLevelDirs = 20;
+const int kSubDirs = 50;
+const int kFilesPerDir = 200;
+
+void createFile(const std::string& path, int size)
+{
+   int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   BOOST_ASSERT(fd != -1);
+   std::string contents(size, 'x');
+   if (::write(fd, contents.data(), contents.size()) != size)
+      LOG_ERROR(systemError(errno, ERROR_LOCATION));
+   ::close(fd);
+}
+
+void createTree(const FilePath& rootPath)
+{
+   for (int i = 0; i < kTopLevelDirs; i++)
+   {
+      FilePath topPath = rootPath.childPath("dir" +
+                                            safe_convert::numberToString(i));
+      Error error = topPath.ensureDirectory();
+      BOOST_ASSERT(!error);
+
+      for (int j = 0; j < kSubDirs; j++)
+      {
+         FilePath subPath = topPath.childPath("sub" +
+                                              safe_convert::numberToString(j));
+         error = subPath.ensureDirectory();
+         BOOST_ASSERT(!error);
+
+         std::string prefix = subPath.absolutePath() + "/file";
+         for (int k = 0; k < kFilesPerDir; k++)
+            createFile(prefix + safe_convert::numberToString(k) + ".R", k % 7);
+      }
+   }
+
+   // links (which are never traversed) and an empty directory
+   if (::symlink(rootPath.childPath("dir0").absolutePath().c_str(),
+                 rootPath.childPath("dirlink").absolutePath().c_str()) != 0)
+   {
+      LOG_ERROR(systemError(errno, ERROR_LOCATION));
+   }
+   if (::symlink("dir0/sub0/file0.R",
+                 rootPath.childPath("filelink").absolutePath().c_str()) != 0)
+   {
+      LOG_ERROR(systemError(errno, ERROR_LOCATION));
+   }
+   Error error = rootPath.childPath("empty").ensureDirectory();
+   BOOST_ASSERT(!error);
+}
+
+double scanSeconds(const FilePath& rootPath,
+                   bool parallel,
+                   tree<FileInfo>* pTree)
+{
+   FileScannerOptions options;
+   options.recursive = true;
+   options.parallel = parallel;
+
+   boost::posix_time::ptime start =
+                        boost::posix_time::microsec_clock::universal_time();
+   Error error = scanFiles(FileInfo(rootPath), options, pTree);
+   boost::posix_time::ptime end =
+                        boost::posix_time::microsec_clock::universal_time();
+   BOOST_ASSERT(!error);
+
+   return (end - start).total_microseconds() / 1000000.0;
+}
+
+void verifyIdentical(const tree<FileInfo>& serialTree,
+                     const tree<FileInfo>& parallelTree)
+{
+   BOOST_ASSERT(serialTree.size() == parallelTree.size());
+
+   tree<FileInfo>::pre_order_iterator it = serialTree.begin();
+   tree<FileInfo>::pre_order_iterator parallelIt = parallelTree.begin();
+   for ( ; it != serialTree.end(); ++it, ++parallelIt)
+   {
+      BOOST_ASSERT(*it == *parallelIt);
+      BOOST_ASSERT(it->isSymlink() == parallelIt->isSymlink());
+      BOOST_ASSERT(serialTree.depth(it) == parallelTree.depth(parallelIt));
+   }
+}
+
+} // anonymous namespace
+
+
+void runFileScannerTests()
+{
+   char rootTemplate[] = "/tmp/rs-file-scanner-XXXXXX";
+   if (::mkdtemp(rootTemplate) == NULL)
+   {
+      LOG_ERROR(systemError(errno, ERROR_LOCATION));
+      return;
+   }
+   FilePath rootPath(rootTemplate);
+
+   createTree(rootPath);
+
+   // scan serially then in parallel (the trees must be identical)
+   tree<FileInfo> serialTree, parallelTree;
+   double serialSeconds = scanSeconds(rootPath, false, &serialTree);
+   double parallelSeconds = scanSeconds(rootPath, true, &parallelTree);
+   verifyIdentical(serialTree, parallelTree);
+
+   std::cout << boost::format("scanned %1% entries: serial %2%s, "
+                              "parallel %3%s")
+                  % (serialTree.size() - 1)
+                  % serialSeconds
+                  % parallelSeconds
+             << std::endl;
+
+   Error error = rootPath.remove();
+   if (error)
+      LOG_ERROR(error);
+}
+
+
+} // namespace system
+} // namespace core
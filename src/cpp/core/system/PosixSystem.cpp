@@ -17,6 +17,7 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
 
 #include <boost/algorithm/string.hpp>
 
@@ -27,11 +28,16 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <poll.h>
 #include <pwd.h>
 #include <grp.h>
 
 #include <uuid/uuid.h>
 
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
 #ifdef __APPLE__
 #include <mach-o/dyld.h>
 #endif
@@ -47,7 +53,7 @@
 #include <core/Log.hpp>
 #include <core/FilePath.hpp>
 #include <core/FileInfo.hpp>
-#include <core/FileLogWriter.hpp>
+#include <core/AsyncFileLogWriter.hpp>
 #include <core/Exec.hpp>
 #include <core/SyslogLogWriter.hpp>
 #include <core/StderrLogWriter.hpp>
@@ -192,7 +198,7 @@ void initializeLog(const std::string& programIdentity,
    if (s_pLogWriter)
       delete s_pLogWriter;
 
-   s_pLogWriter = new FileLogWriter(programIdentity, logLevel, logDir);
+   s_pLogWriter = new AsyncFileLogWriter(programIdentity, logLevel, logDir);
 }
 
 void log(LogLevel logLevel, const std::string& message)
@@ -628,6 +634,10 @@ void fixupExecutablePath(FilePath* pExePath)
 
 void abort()
 {
+   // write any buffered log entries first
+   if (s_pLogWriter)
+      s_pLogWriter->flush();
+
 	::abort();
 }
 
@@ -1362,6 +1372,140 @@ Error restorePriv()
 
 #endif
 
+namespace {
+
+// wait for a (possibly non-blocking) socket to become writeable
+Error waitForWriteable(int socketFd)
+{
+   struct pollfd pfd;
+   pfd.fd = socketFd;
+   pfd.events = POLLOUT;
+   pfd.revents = 0;
+   while (::poll(&pfd, 1, -1) < 0)
+   {
+      if (errno != EINTR)
+         return systemError(errno, ERROR_LOCATION);
+   }
+   return Success();
+}
+
+bool isRetryableError(int errorNumber)
+{
+   return errorNumber == EINTR ||
+          errorNumber == EAGAIN ||
+          errorNumber == EWOULDBLOCK;
+}
+
+} // anonymous namespace
+
+Error sendFile(int socketFd, const FilePath& filePath, uintmax_t length)
+{
+   // (close on exec so a child started by another thread doesn't inherit
+   // the file while we're sending it)
+   int flags = O_RDONLY;
+#ifdef O_CLOEXEC
+   flags |= O_CLOEXEC;
+#endif
+   int fd = ::open(filePath.absolutePath().c_str(), flags);
+   if (fd < 0)
+   {
+      Error error = systemError(errno, ERROR_LOCATION);
+      error.addProperty("path", filePath.absolutePath());
+      return error;
+   }
+
+   Error error;
+   uintmax_t remaining = length;
+
+#if defined(__linux__)
+
+   // let the kernel copy directly from the page cache to the socket
+   while (remaining > 0)
+   {
+      ssize_t sent = ::sendfile(socketFd,
+                                fd,
+                                NULL,
+                                std::min<uintmax_t>(remaining, 1024 * 1024));
+      if (sent == 0)
+      {
+         error = systemError(boost::system::errc::io_error, ERROR_LOCATION);
+         break;
+      }
+      else if (sent > 0)
+      {
+         remaining -= sent;
+      }
+      else if (!isRetryableError(errno))
+      {
+         error = systemError(errno, ERROR_LOCATION);
+         break;
+      }
+      else if (errno != EINTR)
+      {
+         error = waitForWriteable(socketFd);
+         if (error)
+            break;
+      }
+   }
+
+#else
+
+   // copy through a fixed size buffer
+   std::vector<char> buffer(65536);
+   while (remaining > 0)
+   {
+      ssize_t bytesRead = ::read(fd,
+                                 &buffer[0],
+                                 std::min<uintmax_t>(remaining, buffer.size()));
+      if (bytesRead == 0)
+      {
+         error = systemError(boost::system::errc::io_error, ERROR_LOCATION);
+         break;
+      }
+      if (bytesRead < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         error = systemError(errno, ERROR_LOCATION);
+         break;
+      }
+
+      ssize_t offset = 0;
+      while (offset < bytesRead)
+      {
+         ssize_t written = ::write(socketFd,
+                                   &buffer[offset],
+                                   bytesRead - offset);
+         if (written >= 0)
+         {
+            offset += written;
+         }
+         else if (!isRetryableError(errno))
+         {
+            error = systemError(errno, ERROR_LOCATION);
+            break;
+         }
+         else if (errno != EINTR)
+         {
+            error = waitForWriteable(socketFd);
+            if (error)
+               break;
+         }
+      }
+      if (error)
+         break;
+      remaining -= bytesRead;
+   }
+
+#endif
+
+   ::close(fd);
+
+   if (error)
+      error.addProperty("path", filePath.absolutePath());
+   return error;
+}
+
 
 } // namespace system
 } // namespace core
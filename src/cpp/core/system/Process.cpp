@@ -63,6 +63,7 @@ struct ProcessSupervisor::Impl
    Impl() : isPolling(false) {}
    bool isPolling;
    std::vector<boost::shared_ptr<AsyncChildProcess> > children;
+   boost::function<void()> activityHandler;
 };
 
 ProcessSupervisor::ProcessSupervisor()
@@ -78,9 +79,11 @@ namespace {
 
 Error runChild(boost::shared_ptr<AsyncChildProcess> pChild,
                std::vector<boost::shared_ptr<AsyncChildProcess> >* pChildren,
-               const ProcessCallbacks& callbacks)
+               const ProcessCallbacks& callbacks,
+               const boost::function<void()>& activityHandler)
 {
    // run the child
+   pChild->setActivityHandler(activityHandler);
    Error error = pChild->run(callbacks);
    if (error)
       return error;
@@ -88,6 +91,10 @@ Error runChild(boost::shared_ptr<AsyncChildProcess> pChild,
    // add to the list of children
    pChildren->push_back(pChild);
 
+   // the child starts being watched on its first poll so ask for one now
+   if (activityHandler)
+      activityHandler();
+
    // success
    return Success();
 }
@@ -106,7 +113,10 @@ Error ProcessSupervisor::runProgram(const std::string& executable,
                                                        options));
 
    // run the child
-   return runChild(pChild, &(pImpl_->children), callbacks);
+   return runChild(pChild,
+                   &(pImpl_->children),
+                   callbacks,
+                   pImpl_->activityHandler);
 }
 
 Error ProcessSupervisor::runCommand(const std::string& command,
@@ -118,7 +128,10 @@ Error ProcessSupervisor::runCommand(const std::string& command,
                                  new AsyncChildProcess(command, options));
 
    // run the child
-   return runChild(pChild, &(pImpl_->children), callbacks);
+   return runChild(pChild,
+                   &(pImpl_->children),
+                   callbacks,
+                   pImpl_->activityHandler);
 }
 
 namespace {
@@ -255,6 +268,12 @@ Error ProcessSupervisor::runCommand(
 
 
 
+void ProcessSupervisor::setActivityHandler(
+                           const boost::function<void()>& activityHandler)
+{
+   pImpl_->activityHandler = activityHandler;
+}
+
 bool ProcessSupervisor::hasRunningChildren()
 {
    return !pImpl_->children.empty();
@@ -18,7 +18,10 @@
 
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_set.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <core/Log.hpp>
 #include <core/Error.hpp>
@@ -98,6 +101,34 @@ bool sizeAndLastWriteTimeAreEqual(const FileInfo& a, const FileInfo& b)
    return a.size() == b.size() && a.lastWriteTime() == b.lastWriteTime();
 }
 
+std::string fileName(const FileInfo& fileInfo)
+{
+   std::string path = fileInfo.absolutePath();
+   return path.substr(path.find_last_of('/') + 1);
+}
+
+// parents before their children
+bool isShallower(const FileChangeEvent& a, const FileChangeEvent& b)
+{
+   std::string aPath = a.fileInfo().absolutePath();
+   std::string bPath = b.fileInfo().absolutePath();
+   return std::count(aPath.begin(), aPath.end(), '/') <
+          std::count(bPath.begin(), bPath.end(), '/');
+}
+
+bool isWithinAny(const std::string& path,
+                 const boost::unordered_set<std::string>& dirs)
+{
+   for (std::string::size_type pos = path.rfind('/');
+        pos != std::string::npos && pos > 0;
+        pos = path.rfind('/', pos - 1))
+   {
+      if (dirs.find(path.substr(0, pos)) != dirs.end())
+         return true;
+   }
+   return false;
+}
+
 } // anonymous namespace
 
 
@@ -369,6 +400,345 @@ Error discoverAndProcessFileChanges(
    return Success();
 }
 
+Error processFileAdded(
+              CompactFileTree* pTree,
+              CompactFileTree::NodeId parentId,
+              const FileChangeEvent& fileChange,
+              bool recursive,
+              const boost::function<bool(const FileInfo&)>& filter,
+              const boost::function<Error(const FileInfo&)>& onBeforeScanDir,
+              std::vector<FileChangeEvent>* pFileChanges)
+{
+   // see if this node already exists (see comment in tree version above)
+   CompactFileTree::NodeId id = pTree->findChild(
+                                          parentId,
+                                          fileName(fileChange.fileInfo()));
+   if (id != CompactFileTree::kNoNode)
+   {
+      if (fileChange.fileInfo() != pTree->fileInfo(id))
+      {
+         pTree->update(id, fileChange.fileInfo());
+
+         // add it to the fileChanges
+         pFileChanges->push_back(FileChangeEvent(FileChangeEvent::FileModified,
+                                                 fileChange.fileInfo()));
+      }
+      return Success();
+   }
+
+   if (recursive && shouldTraverse(fileChange.fileInfo()))
+   {
+      tree<FileInfo> subTree;
+      FileScannerOptions options;
+      options.recursive = true;
+      options.yield = true;
+      options.filter = filter;
+      options.onBeforeScanDir = onBeforeScanDir;
+      Error error = scanFiles(fileChange.fileInfo(), options, &subTree);
+      if (error)
+         return error;
+
+      // merge in the sub-tree
+      pTree->addSubtree(parentId, subTree.begin());
+
+      // generate events
+      std::for_each(subTree.begin(),
+                    subTree.end(),
+                    boost::bind(addEvent,
+                                FileChangeEvent::FileAdded,
+                                _1,
+                                pFileChanges));
+   }
+   else
+   {
+      pTree->addChild(parentId, fileChange.fileInfo());
+      pFileChanges->push_back(fileChange);
+   }
+
+   return Success();
+}
+
+void processFileModified(CompactFileTree* pTree,
+                         CompactFileTree::NodeId parentId,
+                         const FileChangeEvent& fileChange,
+                         std::vector<FileChangeEvent>* pFileChanges)
+{
+   // search for a child with this name
+   CompactFileTree::NodeId id = pTree->findChild(
+                                          parentId,
+                                          fileName(fileChange.fileInfo()));
+
+   // only generate actions if the data is actually new
+   if ((id != CompactFileTree::kNoNode) &&
+       !sizeAndLastWriteTimeAreEqual(fileChange.fileInfo(),
+                                     pTree->fileInfo(id)))
+   {
+      pTree->update(id, fileChange.fileInfo());
+
+      // add it to the fileChanges
+      pFileChanges->push_back(fileChange);
+   }
+}
+
+void processFileRemoved(CompactFileTree* pTree,
+                        CompactFileTree::NodeId parentId,
+                        const FileChangeEvent& fileChange,
+                        bool recursive,
+                        std::vector<FileChangeEvent>* pFileChanges)
+{
+   // search for a child with this name
+   CompactFileTree::NodeId id = pTree->findChild(
+                                          parentId,
+                                          fileName(fileChange.fileInfo()));
+
+   // only generate actions if the item was found in the tree
+   if (id != CompactFileTree::kNoNode)
+   {
+      // if this is folder then we need to generate recursive
+      // remove events, otherwise can just add single event (using the
+      // previous FileInfo for the payload, see tree version above)
+      FileInfo fileInfo = pTree->fileInfo(id);
+      if (recursive && shouldTraverse(fileInfo))
+      {
+         tree<FileInfo> subTree;
+         pTree->toTree(id, &subTree);
+         std::for_each(subTree.begin(),
+                       subTree.end(),
+                       boost::bind(addEvent,
+                                   FileChangeEvent::FileRemoved,
+                                   _1,
+                                   pFileChanges));
+      }
+      else
+      {
+         pFileChanges->push_back(FileChangeEvent(FileChangeEvent::FileRemoved,
+                                                 fileInfo));
+      }
+
+      // remove it from the tree
+      pTree->remove(id);
+   }
+}
+
+Error discoverAndProcessFileChanges(
+   const FileInfo& fileInfo,
+   bool recursive,
+   const boost::function<bool(const FileInfo&)>& filter,
+   const boost::function<Error(const FileInfo&)>& onBeforeScanDir,
+   CompactFileTree* pTree,
+   const  boost::function<void(const std::vector<FileChangeEvent>&)>&
+                                                               onFilesChanged)
+{
+   // find this path in our fileTree
+   CompactFileTree::NodeId id = pTree->find(fileInfo.absolutePath());
+
+   // if we don't find it then it may have been excluded by a filter, just bail
+   if (id == CompactFileTree::kNoNode)
+      return Success();
+
+   // scan this directory into a new tree which we can compare to the old tree
+   tree<FileInfo> subdirTree;
+   FileScannerOptions options;
+   options.recursive = recursive;
+   options.yield = true;
+   options.filter = filter;
+   options.onBeforeScanDir = onBeforeScanDir;
+   Error error = scanFiles(fileInfo, options, &subdirTree);
+   if (error)
+      return error;
+
+   // materialize the existing tree to compare against
+   tree<FileInfo> existingSubtree;
+   pTree->toTree(id, &existingSubtree);
+
+   // handle recursive vs. non-recursive scan differnetly
+   if (recursive)
+   {
+      // check for changes on full subtree
+      std::vector<FileChangeEvent> fileChanges;
+      collectFileChangeEvents(existingSubtree.begin(),
+                              existingSubtree.end(),
+                              subdirTree.begin(),
+                              subdirTree.end(),
+                              &fileChanges);
+
+      // fire events
+      onFilesChanged(fileChanges);
+
+      // wholesale replace subtree
+      if (id == pTree->root())
+      {
+         pTree->assign(subdirTree);
+      }
+      else
+      {
+         CompactFileTree::NodeId parentId = pTree->parent(id);
+         pTree->remove(id);
+         pTree->addSubtree(parentId, subdirTree.begin());
+      }
+   }
+   else
+   {
+      // scan for changes on just the children
+      std::vector<FileChangeEvent> childrenFileChanges;
+      collectFileChangeEvents(existingSubtree.begin(existingSubtree.begin()),
+                              existingSubtree.end(existingSubtree.begin()),
+                              subdirTree.begin(subdirTree.begin()),
+                              subdirTree.end(subdirTree.begin()),
+                              &childrenFileChanges);
+
+      // build up actual file changes and mutate the tree as appropriate
+      std::vector<FileChangeEvent> fileChanges;
+      BOOST_FOREACH(const FileChangeEvent& fileChange, childrenFileChanges)
+      {
+         switch(fileChange.type())
+         {
+         case FileChangeEvent::FileAdded:
+         {
+            Error error = processFileAdded(pTree,
+                                           id,
+                                           fileChange,
+                                           recursive,
+                                           filter,
+                                           onBeforeScanDir,
+                                           &fileChanges);
+            if (error)
+               LOG_ERROR(error);
+            break;
+         }
+         case FileChangeEvent::FileModified:
+         {
+            processFileModified(pTree, id, fileChange, &fileChanges);
+            break;
+         }
+         case FileChangeEvent::FileRemoved:
+         {
+            processFileRemoved(pTree,
+                               id,
+                               fileChange,
+                               recursive,
+                               &fileChanges);
+            break;
+         }
+         case FileChangeEvent::None:
+         default:
+            break;
+         }
+      }
+
+      // fire events
+      onFilesChanged(fileChanges);
+   }
+
+   return Success();
+}
+
+void FileChangeBatch::add(const FileChangeEvent& fileChange)
+{
+   std::string path = fileChange.fileInfo().absolutePath();
+   boost::unordered_map<std::string, std::size_t>::iterator it =
+                                                         paths_.find(path);
+   if (it != paths_.end())
+   {
+      changes_[it->second].last = fileChange;
+   }
+   else
+   {
+      paths_.insert(std::make_pair(path, changes_.size()));
+      changes_.push_back(PathChanges(fileChange));
+   }
+}
+
+void FileChangeBatch::add(const std::vector<FileChangeEvent>& fileChanges)
+{
+   std::for_each(fileChanges.begin(),
+                 fileChanges.end(),
+                 boost::bind(
+                    static_cast<void(FileChangeBatch::*)(
+                                    const FileChangeEvent&)>(
+                                                      &FileChangeBatch::add),
+                    this,
+                    _1));
+}
+
+void FileChangeBatch::take(std::vector<FileChangeEvent>* pFileChanges)
+{
+   // directories which were removed and added again (or a file replaced by
+   // a directory or vice-versa). removing them removes everything within
+   // them so the changes within them are taken as additions, after the
+   // changes to the directories themselves
+   boost::unordered_set<std::string> replacedDirs;
+   BOOST_FOREACH(const PathChanges& changes, changes_)
+   {
+      if (isReplaced(changes))
+         replacedDirs.insert(changes.last.fileInfo().absolutePath());
+   }
+   std::vector<FileChangeEvent> replacedDirChanges;
+
+   BOOST_FOREACH(const PathChanges& changes, changes_)
+   {
+      // whether the path existed before its first change and after its last
+      bool existed = changes.first.type() != FileChangeEvent::FileAdded;
+      bool exists = changes.last.type() != FileChangeEvent::FileRemoved;
+      const FileInfo& fileInfo = changes.last.fileInfo();
+
+      if (!replacedDirs.empty() &&
+          isWithinAny(fileInfo.absolutePath(), replacedDirs))
+      {
+         if (exists)
+         {
+            replacedDirChanges.push_back(
+                  FileChangeEvent(FileChangeEvent::FileAdded, fileInfo));
+         }
+      }
+      else if (!existed && !exists)
+      {
+         continue;
+      }
+      else if (!existed)
+      {
+         pFileChanges->push_back(FileChangeEvent(FileChangeEvent::FileAdded,
+                                                 fileInfo));
+      }
+      else if (!exists)
+      {
+         pFileChanges->push_back(FileChangeEvent(FileChangeEvent::FileRemoved,
+                                                 fileInfo));
+      }
+      // a replaced directory isn't just a modification
+      else if (isReplaced(changes))
+      {
+         pFileChanges->push_back(changes.first);
+         pFileChanges->push_back(FileChangeEvent(FileChangeEvent::FileAdded,
+                                                 fileInfo));
+      }
+      else
+      {
+         pFileChanges->push_back(FileChangeEvent(FileChangeEvent::FileModified,
+                                                 fileInfo));
+      }
+   }
+
+   // (nested replaced directories are among these so order them too)
+   std::stable_sort(replacedDirChanges.begin(),
+                    replacedDirChanges.end(),
+                    isShallower);
+   pFileChanges->insert(pFileChanges->end(),
+                        replacedDirChanges.begin(),
+                        replacedDirChanges.end());
+
+   changes_.clear();
+   paths_.clear();
+}
+
+bool FileChangeBatch::isReplaced(const PathChanges& changes)
+{
+   return changes.first.type() == FileChangeEvent::FileRemoved &&
+          changes.last.type() != FileChangeEvent::FileRemoved &&
+          (changes.first.fileInfo().isDirectory() ||
+           changes.last.fileInfo().isDirectory());
+}
+
 std::list<void*> activeEventContexts()
 {
    std::list<void*> contexts;
@@ -481,6 +851,139 @@ CallbackQueue& callbackQueue()
    return instance;
 }
 
+// file changes of a registration which have yet to be delivered
+struct PendingChanges
+{
+   explicit PendingChanges(const Callbacks& callbacks)
+      : callbacks(callbacks)
+   {
+   }
+
+   Callbacks callbacks;
+   impl::FileChangeBatch batch;
+   boost::posix_time::ptime firstChange;
+   boost::posix_time::ptime lastChange;
+};
+
+// holds the file changes of each registration so that bursts of changes
+// (e.g. unzipping an archive or building a package) are delivered to
+// onFilesChanged as a single batch of net changes. changes are added on
+// the file monitor thread and enqued for delivery by checkForChanges
+class ChangeBatcher : boost::noncopyable
+{
+public:
+   ChangeBatcher()
+      : quietPeriod_(boost::posix_time::milliseconds(100)),
+        maxDelay_(boost::posix_time::seconds(1))
+   {
+   }
+
+   // COPYING: prohibited
+
+   void setBatchPeriod(const boost::posix_time::time_duration& quietPeriod,
+                       const boost::posix_time::time_duration& maxDelay)
+   {
+      LOCK_MUTEX(mutex_)
+      {
+         quietPeriod_ = quietPeriod;
+         maxDelay_ = maxDelay;
+      }
+      END_LOCK_MUTEX
+   }
+
+   void add(const boost::shared_ptr<PendingChanges>& pPending)
+   {
+      LOCK_MUTEX(mutex_)
+      {
+         pending_.push_back(pPending);
+      }
+      END_LOCK_MUTEX
+   }
+
+   void addChanges(const boost::shared_ptr<PendingChanges>& pPending,
+                   const std::vector<FileChangeEvent>& fileChanges)
+   {
+      if (fileChanges.empty())
+         return;
+
+      using namespace boost::posix_time;
+      ptime now = microsec_clock::universal_time();
+
+      LOCK_MUTEX(mutex_)
+      {
+         if (pPending->batch.empty())
+            pPending->firstChange = now;
+         pPending->lastChange = now;
+         pPending->batch.add(fileChanges);
+      }
+      END_LOCK_MUTEX
+   }
+
+   // enque any changes still held (e.g. before the registration's
+   // onUnregistered) and optionally stop holding its changes
+   void flush(const boost::shared_ptr<PendingChanges>& pPending, bool remove)
+   {
+      LOCK_MUTEX(mutex_)
+      {
+         enqueChanges(pPending.get());
+         if (remove)
+            pending_.remove(pPending);
+      }
+      END_LOCK_MUTEX
+   }
+
+   // enque the changes which have been quiet for the quiet period (or have
+   // been held for the maximum delay)
+   void enqueDueChanges()
+   {
+      using namespace boost::posix_time;
+      ptime now = microsec_clock::universal_time();
+
+      LOCK_MUTEX(mutex_)
+      {
+         BOOST_FOREACH(const boost::shared_ptr<PendingChanges>& pPending,
+                       pending_)
+         {
+            if (pPending->batch.empty())
+               continue;
+
+            if ((now - pPending->lastChange) >= quietPeriod_ ||
+                (now - pPending->firstChange) >= maxDelay_)
+            {
+               enqueChanges(pPending.get());
+            }
+         }
+      }
+      END_LOCK_MUTEX
+   }
+
+private:
+   void enqueChanges(PendingChanges* pPending)
+   {
+      if (pPending->batch.empty())
+         return;
+
+      std::vector<FileChangeEvent> fileChanges;
+      pPending->batch.take(&fileChanges);
+      if (!fileChanges.empty() && pPending->callbacks.onFilesChanged)
+      {
+         callbackQueue().enque(boost::bind(pPending->callbacks.onFilesChanged,
+                                           fileChanges));
+      }
+   }
+
+   boost::mutex mutex_;
+   std::list<boost::shared_ptr<PendingChanges> > pending_;
+   boost::posix_time::time_duration quietPeriod_;
+   boost::posix_time::time_duration maxDelay_;
+};
+
+ChangeBatcher& changeBatcher()
+{
+   static ChangeBatcher* pBatcher = new ChangeBatcher();
+   return *pBatcher;
+}
+
 
 void checkForInput()
 {
@@ -569,7 +1072,7 @@ void fileMonitorThreadMain()
 
 void enqueOnRegistered(const Callbacks& callbacks,
                        Handle handle,
-                       const tree<FileInfo>& fileTree)
+                       const CompactFileTree& fileTree)
 {
    if (callbacks.onRegistered)
    {
@@ -579,33 +1082,42 @@ void enqueOnRegistered(const Callbacks& callbacks,
    }
 }
 
-void enqueOnRegistrationError(const Callbacks& callbacks, const Error& error)
+void enqueOnRegistrationError(
+                     const boost::shared_ptr<PendingChanges>& pPending,
+                     const Error& error)
 {
+   const Callbacks& callbacks = pPending->callbacks;
+   changeBatcher().flush(pPending, true);
    if (callbacks.onRegistrationError)
    {
       callbackQueue().enque(boost::bind(callbacks.onRegistrationError, error));
    }
 }
 
-void enqueOnMonitoringError(const Callbacks& callbacks, const Error& error)
+void enqueOnMonitoringError(const boost::shared_ptr<PendingChanges>& pPending,
+                            const Error& error)
 {
+   // deliver the changes which preceded the error first
+   const Callbacks& callbacks = pPending->callbacks;
+   changeBatcher().flush(pPending, false);
    if (callbacks.onMonitoringError)
    {
       callbackQueue().enque(boost::bind(callbacks.onMonitoringError, error));
    }
 }
 
-void enqueOnFilesChanged(const Callbacks& callbacks,
+void enqueOnFilesChanged(const boost::shared_ptr<PendingChanges>& pPending,
                          const std::vector<FileChangeEvent>& fileChanges)
 {
-   if (callbacks.onFilesChanged)
-   {
-      callbackQueue().enque(boost::bind(callbacks.onFilesChanged, fileChanges));
-   }
+   changeBatcher().addChanges(pPending, fileChanges);
 }
 
-void enqueOnUnregistered(const Callbacks& callbacks, Handle handle)
+void enqueOnUnregistered(const boost::shared_ptr<PendingChanges>& pPending,
+                         Handle handle)
 {
+   // deliver the changes which preceded unregistration first
+   const Callbacks& callbacks = pPending->callbacks;
+   changeBatcher().flush(pPending, true);
    if (callbacks.onUnregistered)
    {
       callbackQueue().enque(boost::bind(callbacks.onUnregistered, handle));
@@ -644,17 +1156,21 @@ void registerMonitor(const FilePath& filePath,
                      const boost::function<bool(const FileInfo&)>& filter,
                      const Callbacks& callbacks)
 {
+   // file changes are held so they can be delivered in batches
+   boost::shared_ptr<PendingChanges> pPending(new PendingChanges(callbacks));
+   changeBatcher().add(pPending);
+
    // bind a new version of the callbacks that puts them on the callback queue
    Callbacks qCallbacks;
    qCallbacks.onRegistered = boost::bind(enqueOnRegistered, callbacks, _1, _2);
    qCallbacks.onRegistrationError = boost::bind(enqueOnRegistrationError,
-                                                callbacks,
+                                                pPending,
                                                 _1);
    qCallbacks.onMonitoringError = boost::bind(enqueOnMonitoringError,
-                                              callbacks,
+                                              pPending,
                                               _1);
-   qCallbacks.onFilesChanged = boost::bind(enqueOnFilesChanged, callbacks, _1);
-   qCallbacks.onUnregistered = boost::bind(enqueOnUnregistered, callbacks, _1);
+   qCallbacks.onFilesChanged = boost::bind(enqueOnFilesChanged, pPending, _1);
+   qCallbacks.onUnregistered = boost::bind(enqueOnUnregistered, pPending, _1);
 
    // enque the registration
    registrationCommandQueue().enque(RegistrationCommand(filePath,
@@ -668,8 +1184,17 @@ void unregisterMonitor(Handle handle)
    registrationCommandQueue().enque(RegistrationCommand(handle));
 }
 
+void setBatchPeriod(const boost::posix_time::time_duration& quietPeriod,
+                    const boost::posix_time::time_duration& maxDelay)
+{
+   changeBatcher().setBatchPeriod(quietPeriod, maxDelay);
+}
+
 void checkForChanges()
 {
+   // enque the file changes which are due
+   changeBatcher().enqueDueChanges();
+
    boost::function<void()> callback;
    while (callbackQueue().deque(&callback))
       callback();
@@ -17,10 +17,13 @@
 #include <string>
 #include <algorithm>
 #include <list>
+#include <vector>
 
 #include <boost/bind.hpp>
+#include <boost/unordered_map.hpp>
 
 #include <core/FilePath.hpp>
+#include <core/CompactFileTree.hpp>
 #include <core/collection/Tree.hpp>
 
 #include <core/system/FileChangeEvent.hpp>
@@ -95,6 +98,73 @@ inline Error discoverAndProcessFileChanges(
                                  onFilesChanged);
 }
 
+// variations of the above for monitors which keep a CompactFileTree (the
+// parent is found by the caller and the child is found by name)
+
+Error processFileAdded(
+               CompactFileTree* pTree,
+               CompactFileTree::NodeId parentId,
+               const FileChangeEvent& fileChange,
+               bool recursive,
+               const boost::function<bool(const FileInfo&)>& filter,
+               const boost::function<Error(const FileInfo&)>& onBeforeScanDir,
+               std::vector<FileChangeEvent>* pFileChanges);
+
+void processFileModified(CompactFileTree* pTree,
+                         CompactFileTree::NodeId parentId,
+                         const FileChangeEvent& fileChange,
+                         std::vector<FileChangeEvent>* pFileChanges);
+
+void processFileRemoved(CompactFileTree* pTree,
+                        CompactFileTree::NodeId parentId,
+                        const FileChangeEvent& fileChange,
+                        bool recursive,
+                        std::vector<FileChangeEvent>* pFileChanges);
+
+Error discoverAndProcessFileChanges(
+   const FileInfo& fileInfo,
+   bool recursive,
+   const boost::function<bool(const FileInfo&)>& filter,
+   const boost::function<Error(const FileInfo&)>& onBeforeScanDir,
+   CompactFileTree* pTree,
+   const boost::function<void(const std::vector<FileChangeEvent>&)>&
+                                                            onFilesChanged);
+
+// changes held for delivery as a batch. the changes to each path are
+// merged into their net effect (e.g. a file added then removed has no
+// change, a file added then modified is added)
+class FileChangeBatch
+{
+public:
+   // COPYING: via compiler
+
+   void add(const FileChangeEvent& fileChange);
+   void add(const std::vector<FileChangeEvent>& fileChanges);
+
+   bool empty() const { return changes_.empty(); }
+
+   // append the net changes (in order of each path's first change, other
+   // than the changes within a replaced directory which follow it) and
+   // clear the batch
+   void take(std::vector<FileChangeEvent>* pFileChanges);
+
+private:
+   struct PathChanges
+   {
+      explicit PathChanges(const FileChangeEvent& fileChange)
+         : first(fileChange), last(fileChange)
+      {
+      }
+      FileChangeEvent first;
+      FileChangeEvent last;
+   };
+
+   static bool isReplaced(const PathChanges& changes);
+
+   std::vector<PathChanges> changes_;
+   boost::unordered_map<std::string, std::size_t> paths_;
+};
+
 template <typename Iterator>
 Iterator findFile(Iterator begin, Iterator end, const std::string& path)
 {
@@ -0,0 +1,445 @@
+/*
+ * FileMonitorTests.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include <core/system/FileMonitor.hpp>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+#include <boost/assert.hpp>
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <core/Error.hpp>
+#include <core/FileInfo.hpp>
+#include <core/CompactFileTree.hpp>
+#include <core/SafeConvert.hpp>
+
+#include "FileMonitorImpl.hpp"
+
+namespace core {
+namespace system {
+namespace file_monitor {
+
+namespace {
+
+// synthetic (in memory) tree of 1000 directories with 200 files each
+const char * const kRootPath = "/rs-file-monitor";
+const int kDirs = 1000;
+const int kFilesPerDir = 200;
+
+std::string dirPath(int dir)
+{
+   return std::string(kRootPath) + "/dir" + safe_convert::numberToString(dir);
+}
+
+std::string filePath(int dir, const std::string& name)
+{
+   return dirPath(dir) + "/" + name;
+}
+
+void createTree(int dirs, tree<FileInfo>* pTree)
+{
+   tree<FileInfo>::iterator rootIt = pTree->set_head(FileInfo(kRootPath,
+                                                              true));
+   for (int i = 0; i < dirs; i++)
+   {
+      tree<FileInfo>::iterator dirIt = pTree->append_child(
+                                          rootIt,
+                                          FileInfo(dirPath(i), true));
+      for (int j = 0; j < kFilesPerDir; j++)
+      {
+         std::string name = "file" + safe_convert::numberToString(j) + ".R";
+         pTree->append_child(dirIt, FileInfo(filePath(i, name), false, 1, 1));
+      }
+      pTree->sort(pTree->begin(dirIt),
+                  pTree->end(dirIt),
+                  fileInfoPathLessThan,
+                  false);
+   }
+   pTree->sort(pTree->begin(rootIt),
+               pTree->end(rootIt),
+               fileInfoPathLessThan,
+               false);
+}
+
+// the events generated by e.g. a checkout: a new file in each directory,
+// modification of an existing one and removal of the file added by the
+// previous event in the directory
+std::vector<FileChangeEvent> checkoutEvents(int dirs, int count)
+{
+   std::vector<FileChangeEvent> events;
+   for (int i = 0; i < count; i++)
+   {
+      int dir = i % dirs;
+      int round = i / dirs;
+      std::string added = "new" + safe_convert::numberToString(round) + ".R";
+      events.push_back(FileChangeEvent(
+                          FileChangeEvent::FileAdded,
+                          FileInfo(filePath(dir, added), false, 1, 1)));
+
+      std::string modified = "file" +
+                             safe_convert::numberToString(round) + ".R";
+      events.push_back(FileChangeEvent(
+                          FileChangeEvent::FileModified,
+                          FileInfo(filePath(dir, modified), false, 2, 2)));
+
+      if (round > 0)
+      {
+         std::string removed = "new" +
+                               safe_convert::numberToString(round - 1) + ".R";
+         events.push_back(FileChangeEvent(
+                             FileChangeEvent::FileRemoved,
+                             FileInfo(filePath(dir, removed), false)));
+      }
+   }
+   return events;
+}
+
+// process an event as the mac and windows monitors do (find the parent
+// directory then update the tree)
+void processEvent(const FileChangeEvent& event,
+                  tree<FileInfo>* pTree,
+                  std::vector<FileChangeEvent>* pFileChanges)
+{
+   std::string path = event.fileInfo().absolutePath();
+   std::string parentPath = path.substr(0, path.find_last_of('/'));
+
+   tree<FileInfo>::iterator parentIt = impl::findFile(pTree->begin(),
+                                                      pTree->end(),
+                                                      parentPath);
+   BOOST_ASSERT(parentIt != pTree->end());
+
+   switch(event.type())
+   {
+      case FileChangeEvent::FileAdded:
+      {
+         Error error = impl::processFileAdded(
+                                 parentIt,
+                                 event,
+                                 false,
+                                 boost::function<bool(const FileInfo&)>(),
+                                 pTree,
+                                 pFileChanges);
+         BOOST_ASSERT(!error);
+         break;
+      }
+      case FileChangeEvent::FileModified:
+         impl::processFileModified(parentIt, event, pTree, pFileChanges);
+         break;
+      case FileChangeEvent::FileRemoved:
+         impl::processFileRemoved(parentIt,
+                                  event,
+                                  false,
+                                  pTree,
+                                  pFileChanges);
+         break;
+      case FileChangeEvent::None:
+         break;
+   }
+}
+
+// process an event as the linux monitor does
+void processEvent(const FileChangeEvent& event,
+                  CompactFileTree* pTree,
+                  std::vector<FileChangeEvent>* pFileChanges)
+{
+   std::string path = event.fileInfo().absolutePath();
+   std::string parentPath = path.substr(0, path.find_last_of('/'));
+
+   CompactFileTree::NodeId parentId = pTree->find(parentPath);
+   BOOST_ASSERT(parentId != CompactFileTree::kNoNode);
+
+   switch(event.type())
+   {
+      case FileChangeEvent::FileAdded:
+      {
+         Error error = impl::processFileAdded(
+                                 pTree,
+                                 parentId,
+                                 event,
+                                 false,
+                                 boost::function<bool(const FileInfo&)>(),
+                                 boost::function<Error(const FileInfo&)>(),
+                                 pFileChanges);
+         BOOST_ASSERT(!error);
+         break;
+      }
+      case FileChangeEvent::FileModified:
+         impl::processFileModified(pTree, parentId, event, pFileChanges);
+         break;
+      case FileChangeEvent::FileRemoved:
+         impl::processFileRemoved(pTree, parentId, event, false, pFileChanges);
+         break;
+      case FileChangeEvent::None:
+         break;
+   }
+}
+
+template <typename Tree>
+double processSeconds(const std::vector<FileChangeEvent>& events,
+                      Tree* pTree,
+                      std::vector<FileChangeEvent>* pFileChanges)
+{
+   boost::posix_time::ptime start =
+                        boost::posix_time::microsec_clock::universal_time();
+   for (std::size_t i = 0; i < events.size(); i++)
+      processEvent(events[i], pTree, pFileChanges);
+   boost::posix_time::ptime end =
+                        boost::posix_time::microsec_clock::universal_time();
+
+   return (end - start).total_microseconds() / 1000000.0;
+}
+
+void verifySameTree(const tree<FileInfo>& fileTree,
+                    const CompactFileTree& compactTree)
+{
+   tree<FileInfo> materialized;
+   compactTree.toTree(compactTree.root(), &materialized);
+
+   BOOST_ASSERT(fileTree.size() == compactTree.size());
+   BOOST_ASSERT(fileTree.size() == materialized.size());
+   tree<FileInfo>::pre_order_iterator it = fileTree.begin();
+   tree<FileInfo>::pre_order_iterator materializedIt = materialized.begin();
+   for ( ; it != fileTree.end(); ++it, ++materializedIt)
+   {
+      BOOST_ASSERT(*it == *materializedIt);
+      BOOST_ASSERT(compactTree.absolutePath(
+                      compactTree.find(it->absolutePath())) ==
+                   it->absolutePath());
+   }
+}
+
+// the compact tree and the events generated must be the same as for a
+// tree<FileInfo>
+void verifyCompact()
+{
+   const int kTestDirs = 20;
+   std::vector<FileChangeEvent> events = checkoutEvents(kTestDirs, 500);
+
+   tree<FileInfo> fileTree;
+   createTree(kTestDirs, &fileTree);
+   CompactFileTree compactTree(fileTree);
+   verifySameTree(fileTree, compactTree);
+
+   std::vector<FileChangeEvent> fileChanges, compactFileChanges;
+   processSeconds(events, &fileTree, &fileChanges);
+   processSeconds(events, &compactTree, &compactFileChanges);
+
+   BOOST_ASSERT(fileChanges.size() == compactFileChanges.size());
+   for (std::size_t i = 0; i < fileChanges.size(); i++)
+   {
+      BOOST_ASSERT(fileChanges[i].type() == compactFileChanges[i].type());
+      BOOST_ASSERT(fileChanges[i].fileInfo() ==
+                   compactFileChanges[i].fileInfo());
+   }
+   verifySameTree(fileTree, compactTree);
+
+   // removing a directory removes its descendents
+   std::string childPath = filePath(0, "file0.R");
+   tree<FileInfo> dirTree;
+   compactTree.toTree(compactTree.find(dirPath(0)), &dirTree);
+   std::vector<FileChangeEvent> removeEvents;
+   impl::processFileRemoved(&compactTree,
+                            compactTree.root(),
+                            FileChangeEvent(FileChangeEvent::FileRemoved,
+                                            FileInfo(dirPath(0), true)),
+                            true,
+                            &removeEvents);
+   BOOST_ASSERT(removeEvents.size() == dirTree.size());
+   BOOST_ASSERT(compactTree.find(dirPath(0)) == CompactFileTree::kNoNode);
+   BOOST_ASSERT(compactTree.find(childPath) == CompactFileTree::kNoNode);
+   BOOST_ASSERT(compactTree.find(dirPath(1)) != CompactFileTree::kNoNode);
+
+   // inserting a file adds its missing parents
+   CompactFileTree::NodeId id = compactTree.insert(FileInfo(childPath, false));
+   std::string name = id != CompactFileTree::kNoNode ? compactTree.name(id)
+                                                     : std::string();
+   BOOST_ASSERT(name == "file0.R");
+   BOOST_ASSERT(compactTree.isDirectory(compactTree.find(dirPath(0))));
+   BOOST_ASSERT(compactTree.insert(FileInfo("/elsewhere/file0.R", false)) ==
+                CompactFileTree::kNoNode);
+}
+
+FileChangeEvent change(FileChangeEvent::Type type,
+                       const std::string& path,
+                       bool isDirectory = false)
+{
+   return FileChangeEvent(type, FileInfo(path, isDirectory));
+}
+
+// the changes to each path in a batch are merged into their net effect
+void verifyBatch()
+{
+   impl::FileChangeBatch batch;
+   batch.add(change(FileChangeEvent::FileAdded, "/p/added"));
+   batch.add(change(FileChangeEvent::FileModified, "/p/modified"));
+   batch.add(change(FileChangeEvent::FileAdded, "/p/temp"));
+   batch.add(change(FileChangeEvent::FileRemoved, "/p/replaced"));
+   batch.add(change(FileChangeEvent::FileRemoved, "/p/dir", true));
+   batch.add(change(FileChangeEvent::FileModified, "/p/added"));
+   batch.add(change(FileChangeEvent::FileRemoved, "/p/modified"));
+   batch.add(change(FileChangeEvent::FileRemoved, "/p/temp"));
+   batch.add(change(FileChangeEvent::FileAdded, "/p/replaced"));
+   batch.add(change(FileChangeEvent::FileAdded, "/p/dir", true));
+
+   std::vector<FileChangeEvent> changes;
+   batch.take(&changes);
+   BOOST_ASSERT(batch.empty());
+   BOOST_ASSERT(changes.size() == 5);
+   BOOST_ASSERT(changes[0].type() == FileChangeEvent::FileAdded);
+   BOOST_ASSERT(changes[0].fileInfo().absolutePath() == "/p/added");
+   BOOST_ASSERT(changes[1].type() == FileChangeEvent::FileRemoved);
+   BOOST_ASSERT(changes[1].fileInfo().absolutePath() == "/p/modified");
+   BOOST_ASSERT(changes[2].type() == FileChangeEvent::FileModified);
+   BOOST_ASSERT(changes[2].fileInfo().absolutePath() == "/p/replaced");
+   BOOST_ASSERT(changes[3].type() == FileChangeEvent::FileRemoved);
+   BOOST_ASSERT(changes[4].type() == FileChangeEvent::FileAdded);
+   BOOST_ASSERT(changes[4].fileInfo().absolutePath() == "/p/dir");
+}
+
+// the changes within a directory which is removed and added again follow
+// the directory's changes (as additions of what is there now)
+void verifyReplacedDirectoryBatch()
+{
+   impl::FileChangeBatch batch;
+   batch.add(change(FileChangeEvent::FileModified, "/p/dir/sub/file"));
+   batch.add(change(FileChangeEvent::FileModified, "/p/dir/kept"));
+   batch.add(change(FileChangeEvent::FileRemoved, "/p/dir", true));
+   batch.add(change(FileChangeEvent::FileRemoved, "/p/dir/gone"));
+   batch.add(change(FileChangeEvent::FileAdded, "/p/dir", true));
+   batch.add(change(FileChangeEvent::FileAdded, "/p/dir/sub", true));
+   batch.add(change(FileChangeEvent::FileAdded, "/p/dir/sub/file"));
+   batch.add(change(FileChangeEvent::FileAdded, "/p/dir/kept"));
+
+   std::vector<FileChangeEvent> changes;
+   batch.take(&changes);
+   BOOST_ASSERT(changes.size() == 5);
+   BOOST_ASSERT(changes[0].type() == FileChangeEvent::FileRemoved);
+   BOOST_ASSERT(changes[0].fileInfo().absolutePath() == "/p/dir");
+   BOOST_ASSERT(changes[1].type() == FileChangeEvent::FileAdded);
+   BOOST_ASSERT(changes[1].fileInfo().absolutePath() == "/p/dir");
+   BOOST_ASSERT(changes[2].type() == FileChangeEvent::FileAdded);
+   BOOST_ASSERT(changes[2].fileInfo().absolutePath() == "/p/dir/kept");
+   BOOST_ASSERT(changes[3].type() == FileChangeEvent::FileAdded);
+   BOOST_ASSERT(changes[3].fileInfo().absolutePath() == "/p/dir/sub");
+   BOOST_ASSERT(changes[4].type() == FileChangeEvent::FileAdded);
+   BOOST_ASSERT(changes[4].fileInfo().absolutePath() == "/p/dir/sub/file");
+}
+
+// the changes made by e.g. building a package: an archive is unzipped
+// (each file is added then written) and a check directory is created,
+// written and removed
+std::vector<FileChangeEvent> buildEvents(int files)
+{
+   std::vector<FileChangeEvent> events;
+   for (int i = 0; i < files; i++)
+   {
+      std::string name = "file" + safe_convert::numberToString(i) + ".R";
+      events.push_back(change(FileChangeEvent::FileAdded, "/p/pkg/" + name));
+      events.push_back(change(FileChangeEvent::FileModified, "/p/pkg/" + name));
+   }
+   events.push_back(change(FileChangeEvent::FileAdded, "/p/pkg.Rcheck", true));
+   for (int i = 0; i < files; i++)
+   {
+      std::string path = "/p/pkg.Rcheck/file" +
+                         safe_convert::numberToString(i) + ".Rout";
+      events.push_back(change(FileChangeEvent::FileAdded, path));
+      events.push_back(change(FileChangeEvent::FileModified, path));
+      events.push_back(change(FileChangeEvent::FileRemoved, path));
+   }
+   events.push_back(change(FileChangeEvent::FileRemoved, "/p/pkg.Rcheck", true));
+   return events;
+}
+
+// resident memory of the process in bytes (0 where there is no procfs)
+std::size_t residentBytes()
+{
+#ifndef _WIN32
+   std::size_t pages = 0, residentPages = 0;
+   std::ifstream statm("/proc/self/statm");
+   statm >> pages >> residentPages;
+   return residentPages * ::sysconf(_SC_PAGESIZE);
+#else
+   return 0;
+#endif
+}
+
+} // anonymous namespace
+
+
+void runFileMonitorTests()
+{
+   verifyCompact();
+   verifyBatch();
+   verifyReplacedDirectoryBatch();
+
+   // changes delivered for a burst of events
+   std::vector<FileChangeEvent> burst = buildEvents(2000);
+   impl::FileChangeBatch batch;
+   batch.add(burst);
+   std::vector<FileChangeEvent> batched;
+   batch.take(&batched);
+   BOOST_ASSERT(batched.size() == 2000);
+   std::cout << boost::format("%1% events delivered as %2% changes")
+                  % burst.size()
+                  % batched.size()
+             << std::endl;
+
+   // memory used by the listing of a large project
+   std::size_t startBytes = residentBytes();
+   tree<FileInfo> fileTree;
+   createTree(kDirs, &fileTree);
+   std::size_t treeBytes = residentBytes();
+   CompactFileTree compactTree(fileTree);
+   std::size_t compactBytes = residentBytes();
+
+   std::cout << boost::format("%1% entries, resident: tree<FileInfo> %2%KB, "
+                              "compact %3%KB (%4%KB reported)")
+                  % (fileTree.size() - 1)
+                  % ((treeBytes - startBytes) / 1024)
+                  % ((compactBytes - treeBytes) / 1024)
+                  % (compactTree.memoryUsage() / 1024)
+             << std::endl;
+
+   // time to process the events of a large checkout (searching a
+   // tree<FileInfo> for the parent of each event is slow so we only time a
+   // sample of them)
+   const int kEvents = 10000;
+   const int kSearchedEvents = 200;
+   std::vector<FileChangeEvent> events = checkoutEvents(kDirs, kEvents);
+   std::vector<FileChangeEvent> sample(events.begin(),
+                                       events.begin() + kSearchedEvents);
+
+   std::vector<FileChangeEvent> fileChanges;
+   double seconds = processSeconds(sample, &fileTree, &fileChanges);
+   fileChanges.clear();
+   double compactSeconds = processSeconds(events, &compactTree, &fileChanges);
+   BOOST_ASSERT(fileChanges.size() == events.size());
+
+   std::cout << boost::format("per event: compact %1%us, "
+                              "tree<FileInfo> %2%us")
+                  % (compactSeconds * 1000000 / events.size())
+                  % (seconds * 1000000 / sample.size())
+             << std::endl;
+}
+
+
+} // namespace file_monitor
+} // namespace system
+} // namespace core
@@ -172,7 +172,7 @@ public:
    FilePath rootPath;
    bool recursive;
    boost::function<bool(const FileInfo&)> filter;
-   tree<FileInfo> fileTree;
+   CompactFileTree fileTree;
    Callbacks callbacks;
 };
 
@@ -309,20 +309,17 @@ Error processEvent(FileEventContext* pContext,
       if (watch.empty())
          return Success();
 
-      // get an iterator to the parent dir
-      tree<FileInfo>::iterator parentIt = impl::findFile(
-                                                   pContext->fileTree.begin(),
-                                                   pContext->fileTree.end(),
-                                                   watch.path);
+      // get the parent dir
+      CompactFileTree::NodeId parentId = pContext->fileTree.find(watch.path);
 
       // if we can't find a parent then return (this directory may have
       // been excluded from scanning due to a filter)
-      if (parentIt == pContext->fileTree.end())
+      if (parentId == CompactFileTree::kNoNode)
          return Success();
 
       // get file info
-      FilePath filePath = FilePath(parentIt->absolutePath()).complete(
-                                                                 pEvent->name);
+      FilePath filePath = FilePath(
+            pContext->fileTree.absolutePath(parentId)).complete(pEvent->name);
 
 
       // if the file exists then collect as many extended attributes
@@ -349,10 +346,10 @@ Error processEvent(FileEventContext* pContext,
             // generate events
             FileChangeEvent event(FileChangeEvent::FileRemoved, fileInfo);
             std::vector<FileChangeEvent> removeEvents;
-            impl::processFileRemoved(parentIt,
+            impl::processFileRemoved(&pContext->fileTree,
+                                     parentId,
                                      event,
                                      pContext->recursive,
-                                     &pContext->fileTree,
                                      &removeEvents);
 
             // for each directory remove event remove any watches we have for it
@@ -380,12 +377,12 @@ Error processEvent(FileEventContext* pContext,
          case FileChangeEvent::FileAdded:
          {
             FileChangeEvent event(FileChangeEvent::FileAdded, fileInfo);
-            Error error = impl::processFileAdded(parentIt,
+            Error error = impl::processFileAdded(&pContext->fileTree,
+                                                 parentId,
                                                  event,
                                                  pContext->recursive,
                                                  pContext->filter,
                                                  addWatchFunction(pContext),
-                                                 &pContext->fileTree,
                                                  pFileChanges);
             // log the error if it wasn't no such file/dir (this can happen
             // in the normal course of business if a file is deleted between
@@ -400,9 +397,9 @@ Error processEvent(FileEventContext* pContext,
          case FileChangeEvent::FileModified:
          {
             FileChangeEvent event(FileChangeEvent::FileModified, fileInfo);
-            impl::processFileModified(parentIt,
+            impl::processFileModified(&pContext->fileTree,
+                                      parentId,
                                       event,
-                                      &pContext->fileTree,
                                       pFileChanges);
             break;
          }
@@ -476,9 +473,11 @@ Handle registerMonitor(const core::FilePath& filePath,
    FileScannerOptions options;
    options.recursive = recursive;
    options.yield = true;
+   options.parallel = true;
    options.filter = filter;
    options.onBeforeScanDir = addWatchFunction(pContext, true);
-   Error error = scanFiles(FileInfo(filePath), options, &pContext->fileTree);
+   tree<FileInfo> fileTree;
+   Error error = scanFiles(FileInfo(filePath), options, &fileTree);
    if (error)
    {
        // close context
@@ -489,6 +488,10 @@ Handle registerMonitor(const core::FilePath& filePath,
        return Handle();
    }
 
+   // keep the listing in a compact tree (a full FileInfo per file is
+   // expensive for large projects)
+   pContext->fileTree.assign(fileTree);
+
    // now that we have finished the file listing we know we have a valid
    // file-monitor so set the callbacks
    pContext->callbacks = callbacks;
@@ -246,6 +246,7 @@ Handle registerMonitor(const FilePath& filePath,
    core::system::FileScannerOptions options;
    options.recursive = recursive;
    options.yield = true;
+   options.parallel = true;
    options.filter = filter;
    Error error = scanFiles(FileInfo(filePath), options, &pContext->fileTree);
    if (error)
@@ -267,7 +268,8 @@ Handle registerMonitor(const FilePath& filePath,
    autoPtrContext.release();
 
    // notify the caller that we have successfully registered
-   callbacks.onRegistered(pContext->handle, pContext->fileTree);
+   callbacks.onRegistered(pContext->handle,
+                          CompactFileTree(pContext->fileTree));
 
    // return the handle
    return pContext->handle;
@@ -571,7 +571,8 @@ Handle registerMonitor(const core::FilePath& filePath,
    pContext->callbacks = callbacks;
 
    // notify the caller that we have successfully registered
-   callbacks.onRegistered(pContext->handle, pContext->fileTree);
+   callbacks.onRegistered(pContext->handle,
+                          CompactFileTree(pContext->fileTree));
 
    // return the handle
    return pContext->handle;
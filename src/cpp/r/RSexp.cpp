@@ -97,7 +97,8 @@ void listEnvironment(SEXP env,
       SEXP varSEXP = Rf_findVar(Rf_install(varName.c_str()), env);
       if (varSEXP != R_UnboundValue) // should never be unbound 
       {
-         pProtect->add(varSEXP);
+         if (pProtect)
+            pProtect->add(varSEXP);
          pVariables->push_back(std::make_pair(varName, varSEXP));
       }
       else
@@ -43,7 +43,8 @@ class Protect;
 // environments and namespaces
 SEXP findNamespace(const std::string& name);
    
-// variables within an environment
+// variables within an environment (pProtect may be NULL if the caller
+// doesn't use the values beyond the time they remain bound)
 typedef std::pair<std::string,SEXP> Variable ;
 void listEnvironment(SEXP env, 
                      bool includeAll,
@@ -18,6 +18,7 @@
 #include <core/Error.hpp>
 #include <core/ProgramStatus.hpp>
 #include <core/ProgramOptions.hpp>
+#include <core/PeriodicCommand.hpp>
 
 #include <core/text/TemplateFilter.hpp>
 
@@ -112,10 +113,16 @@ Error httpServerInit()
    s_pHttpServer.reset(new http::TcpIpAsyncServer("RStudio"));
 
    // set server options
+   Options& options = server::options();
    s_pHttpServer->setAbortOnResourceError(true);
+   if (options.wwwKeepAliveMaxRequests() > 0)
+   {
+      s_pHttpServer->setKeepAlive(
+                  options.wwwKeepAliveMaxRequests(),
+                  boost::posix_time::seconds(options.wwwKeepAliveTimeout()));
+   }
 
    // initialize the http server
-   Options& options = server::options();
    return s_pHttpServer->init(options.wwwAddress(), options.wwwPort());
 }
 
@@ -168,6 +175,11 @@ void httpServerAddHandlers()
 
    // add default handler for gwt app
    uri_handlers::setBlockingDefault(blockingFileHandler());
+
+   // periodically close idle connections to sessions
+   scheduler::addCommand(boost::shared_ptr<ScheduledCommand>(
+         new PeriodicCommand(boost::posix_time::seconds(15),
+                             session_proxy::pruneIdleConnections)));
 }
 
 
@@ -99,7 +99,13 @@ ProgramStatus Options::read(int argc, char * const argv[])
          "www files path")
       ("www-thread-pool-size",
          value<int>(&wwwThreadPoolSize_)->default_value(2),
-         "thread pool size");
+         "thread pool size")
+      ("www-keep-alive-max-requests",
+         value<int>(&wwwKeepAliveMaxRequests_)->default_value(100),
+         "requests served per connection (0 to disable keep alive)")
+      ("www-keep-alive-timeout",
+         value<int>(&wwwKeepAliveTimeout_)->default_value(15),
+         "seconds to wait for the next request on a connection");
 
    // rsession
    options_description rsession("rsession");
@@ -127,7 +133,13 @@ ProgramStatus Options::read(int argc, char * const argv[])
          "rsession stack limit (mb)")
       ("rsession-process-limit",
          value<int>(&rsessionUserProcessLimit_)->default_value(0),
-         "rsession user process limit");
+         "rsession user process limit")
+      ("rsession-connection-pool-size",
+         value<int>(&rsessionConnectionPoolSize_)->default_value(4),
+         "kept alive connections per rsession (0 to disable)")
+      ("rsession-connection-idle-timeout",
+         value<int>(&rsessionConnectionIdleTimeout_)->default_value(30),
+         "seconds to keep an idle rsession connection open");
    
    // still read depracated options (so we don't break config files)
    bool deprecatedAuthPamRequiresPriv;
@@ -0,0 +1,201 @@
+/*
+ * ServerSessionConnectionPool.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include "ServerSessionConnectionPool.hpp"
+
+#include <iostream>
+#include <vector>
+
+#include <core/Error.hpp>
+#include <core/Log.hpp>
+#include <core/Thread.hpp>
+#include <core/FilePath.hpp>
+
+#include <session/SessionLocalStreams.hpp>
+
+#include <server/ServerOptions.hpp>
+
+using namespace core ;
+
+namespace server {
+namespace session_proxy {
+
+namespace {
+
+boost::posix_time::ptime now()
+{
+   return boost::posix_time::microsec_clock::universal_time();
+}
+
+void closeClients(
+   const std::vector<boost::shared_ptr<http::LocalStreamAsyncClient> >& clients)
+{
+   for (std::size_t i = 0; i<clients.size(); i++)
+      clients[i]->close();
+}
+
+} // anonymous namespace
+
+std::ostream& operator<<(std::ostream& os, const ConnectionPoolStats& stats)
+{
+   os << "created=" << stats.created
+      << " reused=" << stats.reused
+      << " released=" << stats.released
+      << " discarded=" << stats.discarded
+      << " expired=" << stats.expired;
+   return os;
+}
+
+ConnectionPool& connectionPool()
+{
+   static ConnectionPool instance;
+   return instance;
+}
+
+boost::shared_ptr<http::LocalStreamAsyncClient> ConnectionPool::acquire(
+                                    const std::string& username,
+                                    boost::asio::io_service& ioService)
+{
+   // connections which we find have expired (closed outside the lock)
+   std::vector<boost::shared_ptr<http::LocalStreamAsyncClient> > expired;
+   boost::shared_ptr<http::LocalStreamAsyncClient> pReused;
+
+   LOCK_MUTEX(mutex_)
+   {
+      IdleConnections& connections = idleConnections_[username];
+      boost::posix_time::ptime currentTime = now();
+      while (!connections.empty())
+      {
+         // take the most recently used connection (least likely to have
+         // been closed by the session)
+         IdleConnection connection = connections.back();
+         connections.pop_back();
+
+         if (isExpired(connection, currentTime))
+         {
+            expired.push_back(connection.pClient);
+            stats_.expired++;
+         }
+         else
+         {
+            stats_.reused++;
+            pReused = connection.pClient;
+            break;
+         }
+      }
+
+      if (!pReused)
+         stats_.created++;
+   }
+   END_LOCK_MUTEX
+
+   closeClients(expired);
+   if (pReused)
+      return pReused;
+
+   // create a new client
+   FilePath streamPath = session::local_streams::streamPath(username);
+   boost::shared_ptr<http::LocalStreamAsyncClient> pClient(
+                  new http::LocalStreamAsyncClient(ioService, streamPath));
+   pClient->setKeepAlive(server::options().rsessionConnectionPoolSize() > 0);
+   return pClient;
+}
+
+void ConnectionPool::release(
+                  const std::string& username,
+                  boost::shared_ptr<http::LocalStreamAsyncClient> pClient)
+{
+   std::size_t poolSize = server::options().rsessionConnectionPoolSize();
+
+   bool pooled = false;
+   if (pClient->isReusable())
+   {
+      LOCK_MUTEX(mutex_)
+      {
+         IdleConnections& connections = idleConnections_[username];
+         if (connections.size() < poolSize)
+         {
+            IdleConnection connection;
+            connection.pClient = pClient;
+            connection.idleSince = now();
+            connections.push_back(connection);
+            stats_.released++;
+            pooled = true;
+         }
+         else
+         {
+            stats_.discarded++;
+         }
+      }
+      END_LOCK_MUTEX
+   }
+
+   if (!pooled)
+      pClient->close();
+}
+
+void ConnectionPool::pruneIdleConnections()
+{
+   std::vector<boost::shared_ptr<http::LocalStreamAsyncClient> > expired;
+
+   LOCK_MUTEX(mutex_)
+   {
+      boost::posix_time::ptime currentTime = now();
+      std::map<std::string,IdleConnections>::iterator it =
+                                                   idleConnections_.begin();
+      while (it != idleConnections_.end())
+      {
+         // connections are ordered by idle time so expired ones
+         // are always at the front
+         IdleConnections& connections = it->second;
+         while (!connections.empty() &&
+                isExpired(connections.front(), currentTime))
+         {
+            expired.push_back(connections.front().pClient);
+            connections.pop_front();
+            stats_.expired++;
+         }
+
+         // don't keep around entries for users with no connections
+         if (connections.empty())
+            idleConnections_.erase(it++);
+         else
+            ++it;
+      }
+   }
+   END_LOCK_MUTEX
+
+   closeClients(expired);
+}
+
+ConnectionPoolStats ConnectionPool::stats()
+{
+   LOCK_MUTEX(mutex_)
+   {
+      return stats_;
+   }
+   END_LOCK_MUTEX
+
+   // keep compiler happy
+   return ConnectionPoolStats();
+}
+
+bool ConnectionPool::isExpired(const IdleConnection& connection,
+                               const boost::posix_time::ptime& now)
+{
+   int idleTimeout = server::options().rsessionConnectionIdleTimeout();
+   return (now - connection.idleSince) > boost::posix_time::seconds(idleTimeout);
+}
+
+} // namespace session_proxy
+} // namespace server
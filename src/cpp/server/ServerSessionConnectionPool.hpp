@@ -0,0 +1,102 @@
+/*
+ * ServerSessionConnectionPool.hpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#ifndef SERVER_SESSION_CONNECTION_POOL_HPP
+#define SERVER_SESSION_CONNECTION_POOL_HPP
+
+#include <string>
+#include <deque>
+#include <map>
+
+#include <boost/utility.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <core/BoostThread.hpp>
+#include <core/http/LocalStreamAsyncClient.hpp>
+
+namespace server {
+namespace session_proxy {
+
+// counters describing how effectively connections are being reused
+struct ConnectionPoolStats
+{
+   ConnectionPoolStats()
+      : created(0), reused(0), released(0), discarded(0), expired(0)
+   {
+   }
+
+   std::size_t created;    // new connections made to sessions
+   std::size_t reused;     // requests written to a pooled connection
+   std::size_t released;   // connections returned to the pool
+   std::size_t discarded;  // connections closed because the pool was full
+                           // or the session didn't agree to keep alive
+   std::size_t expired;    // connections closed after being idle too long
+};
+
+std::ostream& operator<<(std::ostream& os, const ConnectionPoolStats& stats);
+
+// singleton
+class ConnectionPool;
+ConnectionPool& connectionPool();
+
+// Per-user pool of kept alive local stream connections to rsessions. This
+// saves a socket connect/accept/close for every request we proxy. Clients
+// are acquired for a single request and then released back to the pool
+// once their response has been written.
+class ConnectionPool : boost::noncopyable
+{
+private:
+   // singleton
+   ConnectionPool() {}
+   friend ConnectionPool& connectionPool();
+
+public:
+   // get a client for the specified user (either a pooled client which
+   // already has an open connection or a new client)
+   boost::shared_ptr<core::http::LocalStreamAsyncClient> acquire(
+                                    const std::string& username,
+                                    boost::asio::io_service& ioService);
+
+   // return a client to the pool (it is closed rather than pooled if its
+   // connection isn't reusable or if the user's pool is already full)
+   void release(const std::string& username,
+                boost::shared_ptr<core::http::LocalStreamAsyncClient> pClient);
+
+   // close connections which have been idle longer than the idle timeout
+   void pruneIdleConnections();
+
+   ConnectionPoolStats stats();
+
+private:
+   struct IdleConnection
+   {
+      boost::shared_ptr<core::http::LocalStreamAsyncClient> pClient;
+      boost::posix_time::ptime idleSince;
+   };
+   typedef std::deque<IdleConnection> IdleConnections;
+
+   bool isExpired(const IdleConnection& connection,
+                  const boost::posix_time::ptime& now);
+
+private:
+   boost::mutex mutex_;
+   std::map<std::string,IdleConnections> idleConnections_;
+   ConnectionPoolStats stats_;
+};
+
+} // namespace session_proxy
+} // namespace server
+
+#endif // SERVER_SESSION_CONNECTION_POOL_HPP
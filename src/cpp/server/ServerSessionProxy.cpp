@@ -49,6 +49,7 @@
 #include <server/ServerOptions.hpp>
 
 #include "ServerSessionManager.hpp"
+#include "ServerSessionConnectionPool.hpp"
 
 using namespace core ;
 
@@ -76,9 +77,21 @@ http::ConnectionRetryProfile sessionRetryProfile(const std::string& username)
 }
 
 
+void logIfNotConnectionTerminated(const Error& error,
+                                  const http::Request& request)
+{
+   if (!http::isConnectionTerminatedError(error))
+   {
+      Error logError(error);
+      logError.addProperty("request-uri", request.uri());
+      LOG_ERROR(logError);
+   }
+}
+
 void handleProxyResponse(
       boost::shared_ptr<core::http::AsyncConnection> ptrConnection,
       std::string username,
+      boost::shared_ptr<http::LocalStreamAsyncClient> pClient,
       const http::Response& response)
 {
    // if there was a launch pending then remove it
@@ -86,20 +99,93 @@ void handleProxyResponse(
 
    // write the response
    ptrConnection->writeResponse(response);
+
+   // return the client to the pool (note this must occur after the
+   // response is copied by writeResponse since the client may be
+   // immediately re-used by another thread)
+   connectionPool().release(username, pClient);
 }
 
+void relayNextBodyBlock(
+      boost::shared_ptr<core::http::AsyncConnection> ptrConnection,
+      std::string username,
+      boost::shared_ptr<http::LocalStreamAsyncClient> pClient,
+      const Error& writeError);
 
-void logIfNotConnectionTerminated(const Error& error,
-                                  const http::Request& request)
+void handleBodyBlock(
+      boost::shared_ptr<core::http::AsyncConnection> ptrConnection,
+      std::string username,
+      boost::shared_ptr<http::LocalStreamAsyncClient> pClient,
+      const Error& error,
+      const std::string& block)
 {
-   if (!http::isConnectionTerminatedError(error))
+   if (error)
    {
-      Error logError(error);
-      logError.addProperty("request-uri", request.uri());
-      LOG_ERROR(logError);
+      // the response is truncated so the browser connection can't be
+      // used for anything else
+      logIfNotConnectionTerminated(error, ptrConnection->request());
+      ptrConnection->close();
+   }
+   else if (block.empty())
+   {
+      // the body is complete so the client can serve another request
+      ptrConnection->writeBodyComplete();
+      connectionPool().release(username, pClient);
+   }
+   else
+   {
+      ptrConnection->writeBodyBlock(block, boost::bind(relayNextBodyBlock,
+                                                       ptrConnection,
+                                                       username,
+                                                       pClient,
+                                                       _1));
+   }
+}
+
+void relayNextBodyBlock(
+      boost::shared_ptr<core::http::AsyncConnection> ptrConnection,
+      std::string username,
+      boost::shared_ptr<http::LocalStreamAsyncClient> pClient,
+      const Error& writeError)
+{
+   if (writeError)
+   {
+      // the browser went away, drop the rest of the body (and with it
+      // the session connection, which is mid-response)
+      logIfNotConnectionTerminated(writeError, ptrConnection->request());
+      pClient->close();
+      ptrConnection->close();
+      return;
    }
+
+   pClient->readBodyBlock(boost::bind(handleBodyBlock,
+                                      ptrConnection,
+                                      username,
+                                      pClient,
+                                      _1,
+                                      _2));
 }
 
+// large (or chunked) response bodies are relayed to the browser a block at
+// a time as they are read from the session rather than being buffered
+void handleStreamingProxyResponse(
+      boost::shared_ptr<core::http::AsyncConnection> ptrConnection,
+      std::string username,
+      boost::shared_ptr<http::LocalStreamAsyncClient> pClient,
+      const http::Response& response)
+{
+   // if there was a launch pending then remove it
+   sessionManager().removePendingLaunch(username);
+
+   ptrConnection->writeStreamingResponse(response,
+                                         boost::bind(relayNextBodyBlock,
+                                                     ptrConnection,
+                                                     username,
+                                                     pClient,
+                                                     _1));
+}
+
+
 void handleContentError(
       boost::shared_ptr<core::http::AsyncConnection> ptrConnection,
       std::string username,
@@ -186,12 +272,9 @@ void proxyRequest(
       const http::ConnectionRetryProfile& connectionRetryProfile =
                                              http::ConnectionRetryProfile())
 {
-   // calculate stream path
-   FilePath streamPath = session::local_streams::streamPath(username);
-
-   // create async client
-   boost::shared_ptr<http::LocalStreamAsyncClient> pClient(
-    new http::LocalStreamAsyncClient(ptrConnection->ioService(), streamPath));
+   // get an async client (re-uses a kept alive connection if possible)
+   boost::shared_ptr<http::LocalStreamAsyncClient> pClient =
+         connectionPool().acquire(username, ptrConnection->ioService());
 
    // setup retry context
    if (!connectionRetryProfile.empty())
@@ -202,7 +285,9 @@ void proxyRequest(
 
    // execute
    pClient->execute(
-         boost::bind(handleProxyResponse, ptrConnection, username, _1),
+         boost::bind(handleProxyResponse, ptrConnection, username, pClient, _1),
+         boost::bind(handleStreamingProxyResponse,
+                     ptrConnection, username, pClient, _1),
          errorHandler);
 }
 
@@ -243,6 +328,17 @@ Error initialize()
    return session::local_streams::createStreamsDir();
 }
 
+bool pruneIdleConnections()
+{
+   connectionPool().pruneIdleConnections();
+
+   std::ostringstream ostr;
+   ostr << "Session connection pool: " << connectionPool().stats();
+   LOG_DEBUG_MESSAGE(ostr.str());
+
+   return true;
+}
+
 Error runVerifyInstallationSession()
 {
    // get current user
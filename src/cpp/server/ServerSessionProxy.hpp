@@ -28,6 +28,9 @@ namespace session_proxy {
 core::Error initialize();
 
 core::Error runVerifyInstallationSession();
+
+// close idle connections to sessions (intended to be run periodically)
+bool pruneIdleConnections();
    
 void proxyContentRequest(
       const std::string& username,
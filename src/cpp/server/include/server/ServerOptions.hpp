@@ -86,6 +86,16 @@ public:
       return wwwThreadPoolSize_;
    }
 
+   int wwwKeepAliveMaxRequests() const
+   {
+      return wwwKeepAliveMaxRequests_;
+   }
+
+   int wwwKeepAliveTimeout() const
+   {
+      return wwwKeepAliveTimeout_;
+   }
+
    // auth
    bool authValidateUsers()
    {
@@ -143,6 +153,16 @@ public:
       return rsessionUserProcessLimit_;
    }
 
+   std::size_t rsessionConnectionPoolSize() const
+   {
+      return rsessionConnectionPoolSize_ > 0 ? rsessionConnectionPoolSize_ : 0;
+   }
+
+   int rsessionConnectionIdleTimeout() const
+   {
+      return rsessionConnectionIdleTimeout_;
+   }
+
 private:
    bool verifyInstallation_;
    std::string serverWorkingDir_;
@@ -154,6 +174,8 @@ private:
    std::string wwwPort_ ;
    std::string wwwLocalPath_ ;
    int wwwThreadPoolSize_;
+   int wwwKeepAliveMaxRequests_;
+   int wwwKeepAliveTimeout_;
    bool authValidateUsers_;
    std::string authRequiredUserGroup_;
    std::string authPamHelperPath_;
@@ -165,6 +187,8 @@ private:
    int rsessionMemoryLimitMb_;
    int rsessionStackLimitMb_;
    int rsessionUserProcessLimit_;
+   int rsessionConnectionPoolSize_;
+   int rsessionConnectionIdleTimeout_;
 };
       
 } // namespace server
@@ -13,13 +13,14 @@
 
 #include "SessionClientEventQueue.hpp"
 
+#include <set>
+
 #include <boost/foreach.hpp>
 
 
 #include <core/BoostThread.hpp>
 #include <core/Thread.hpp>
 #include <core/json/Json.hpp>
-#include <core/StringUtils.hpp>
 
 #include <r/session/RConsoleActions.hpp>
 
@@ -29,8 +30,54 @@ namespace session {
  
 namespace {
 ClientEventQueue* s_pClientEventQueue = NULL;
+
+// capacity of the event ring (must be a power of 2). when the ring is
+// full the producer drains it into the consumer's staging area itself
+const std::size_t kRingCapacity = 4096;
+
+// pending events beyond which superseded events are dropped (below this
+// there's little to gain from scanning for them)
+const std::size_t kCoalesceThreshold = 1024;
+
+// full memory barrier around reads of the wait state
+inline std::size_t atomicLoad(volatile std::size_t* pValue)
+{
+   std::size_t value = *pValue;
+   __sync_synchronize();
+   return value;
+}
+
+// If there's more console output than the client can even show, then
+// truncate it to the amount that the client can show. Too much output
+// can overwhelm the client, causing it to become unresponsive.
+int consoleOutputLimit()
+{
+   return r::session::consoleActions().capacity() + 1;
+}
+
+boost::int64_t microsecondsSinceEpoch(const boost::posix_time::ptime& time)
+{
+   using namespace boost::posix_time;
+   static const ptime epoch(boost::gregorian::date(1970, 1, 1));
+   return (time - epoch).total_microseconds();
 }
 
+// events which carry the complete state of something on the client, so
+// only the most recent one of each type needs to be delivered
+bool isSupersededByLaterEvents(int type)
+{
+   using namespace client_events;
+   return type == kWorkingDirChanged ||
+          type == kPlotsStateChanged ||
+          type == kPlotsZoomSizeChanged ||
+          type == kQuotaStatus ||
+          type == kSaveActionChanged ||
+          type == kWorkspaceRefresh ||
+          type == kInstalledPackagesChanged;
+}
+
+} // anonymous namespace
+
 void initializeClientEventQueue()
 {
    BOOST_ASSERT(s_pClientEventQueue == NULL);
@@ -43,45 +90,51 @@ ClientEventQueue& clientEventQueue()
 }
    
 ClientEventQueue::ClientEventQueue()
-   :  pMutex_(new boost::mutex()),
+   :  pConsumerMutex_(new boost::mutex()),
+      pWaitMutex_(new boost::mutex()),
       pWaitForEventCondition_(new boost::condition()),
-      lastEventAddTime_(boost::posix_time::not_a_date_time)
+      ring_(kRingCapacity),
+      eventsAdded_(0),
+      waiters_(0),
+      lastEventAddTime_(-1),
+      pAddTimeMutex_(new boost::mutex())
 {
 }
 
 void ClientEventQueue::add(const ClientEvent& event)
 { 
-   LOCK_MUTEX(*pMutex_)
+   // copy the event outside of any synchronization
+   ClientEvent* pEvent = new ClientEvent(event);
+
+   // add to the ring. if it's full then drain it into the staging area
+   // (compacting it in the process) and try again
+   while (!ring_.enqueue(pEvent))
    {
-      // console output is batched up for compactness/efficiency.
-      if (event.type() == client_events::kConsoleWriteOutput)
+      LOCK_MUTEX(*pConsumerMutex_)
       {
-         if (event.data().type() == json::StringType)
-            pendingConsoleOutput_ += event.data().get_str();
+         drainRing();
+         if (pendingEvents_.size() > kCoalesceThreshold)
+            coalesceStaleEvents();
       }
-      else
-      {
-         // flush existing console output prior to adding an 
-         // action of another type
-         flushPendingConsoleOutput() ;
-         
-         // add event to queue
-         pendingEvents_.push_back(event) ;
-      }
-      
-      lastEventAddTime_ = boost::posix_time::microsec_clock::universal_time();
+      END_LOCK_MUTEX
    }
-   END_LOCK_MUTEX
-   
+
+   // record the add time
+   setLastEventAddTime(microsecondsSinceEpoch(
+                        boost::posix_time::microsec_clock::universal_time()));
+
    // notify listeners that an event has been added
-   pWaitForEventCondition_->notify_all();
+   __sync_fetch_and_add(&eventsAdded_, 1);
+   notifyWaiters();
 }
    
 bool ClientEventQueue::hasEvents() 
 {
-   LOCK_MUTEX(*pMutex_)
+   LOCK_MUTEX(*pConsumerMutex_)
    {
-      return pendingEvents_.size() > 0 || pendingConsoleOutput_.length() > 0;
+      return !ring_.isEmpty() ||
+             pendingEvents_.size() > 0 ||
+             !pendingConsoleOutput_.empty();
    }
    END_LOCK_MUTEX
    
@@ -89,17 +142,29 @@ bool ClientEventQueue::hasEvents()
    return false ;
 }
   
-void ClientEventQueue::remove(std::vector<ClientEvent>* pEvents)
+void ClientEventQueue::remove(
+                  std::vector<boost::shared_ptr<const ClientEvent> >* pEvents)
 {
-   LOCK_MUTEX(*pMutex_)
+   LOCK_MUTEX(*pConsumerMutex_)
    {
-      // flush any pending output
+      // take everything from the ring and flush any pending output
+      drainRing();
       flushPendingConsoleOutput();
+      if (pendingEvents_.size() > kCoalesceThreshold)
+         coalesceStaleEvents();
       
-      // copy the events to the caller
-      pEvents->insert(pEvents->begin(), 
-                      pendingEvents_.begin(), 
-                      pendingEvents_.end());
+      // hand the events to the caller (a swap rather than a copy in
+      // the usual case where the caller passes an empty vector)
+      if (pEvents->empty())
+      {
+         pEvents->swap(pendingEvents_);
+      }
+      else
+      {
+         pEvents->insert(pEvents->end(),
+                         pendingEvents_.begin(),
+                         pendingEvents_.end());
+      }
    
       // clear pending events
       pendingEvents_.clear();
@@ -109,8 +174,12 @@ void ClientEventQueue::remove(std::vector<ClientEvent>* pEvents)
    
 void ClientEventQueue::clear()
 {
-   LOCK_MUTEX(*pMutex_)
+   LOCK_MUTEX(*pConsumerMutex_)
    {
+      ClientEvent* pEvent;
+      while (ring_.dequeue(&pEvent))
+         delete pEvent;
+
       pendingConsoleOutput_.clear();
       pendingEvents_.clear();
    }
@@ -124,12 +193,31 @@ bool ClientEventQueue::waitForEvent(
    using namespace boost;
    try
    {
-      unique_lock<mutex> lock(*pMutex_);
+      unique_lock<mutex> lock(*pWaitMutex_);
+      __sync_fetch_and_add(&waiters_, 1);
+      std::size_t eventsAdded = atomicLoad(&eventsAdded_);
+
       system_time timeoutTime = get_system_time() + waitDuration;
-      return pWaitForEventCondition_->timed_wait(lock, timeoutTime);
+      bool added = false;
+      for (;;)
+      {
+         added = atomicLoad(&eventsAdded_) != eventsAdded;
+         if (added)
+            break;
+
+         if (!pWaitForEventCondition_->timed_wait(lock, timeoutTime))
+         {
+            added = atomicLoad(&eventsAdded_) != eventsAdded;
+            break;
+         }
+      }
+
+      __sync_fetch_and_sub(&waiters_, 1);
+      return added;
    }
    catch(const thread_resource_error& e) 
    { 
+      __sync_fetch_and_sub(&waiters_, 1);
       Error waitError(boost::thread_error::ec_from_exception(e), 
                         ERROR_LOCATION) ; 
       LOG_ERROR(waitError);
@@ -140,17 +228,129 @@ bool ClientEventQueue::waitForEvent(
 
 bool ClientEventQueue::eventAddedSince(const boost::posix_time::ptime& time)
 {
-   LOCK_MUTEX(*pMutex_)
+   boost::int64_t addTime = lastEventAddTime();
+   if (addTime < 0)
+      return false;
+   else
+      return addTime >= microsecondsSinceEpoch(time);
+}
+
+#if __SIZEOF_POINTER__ >= 8
+
+void ClientEventQueue::setLastEventAddTime(boost::int64_t time)
+{
+   __sync_lock_test_and_set(&lastEventAddTime_, time);
+}
+
+boost::int64_t ClientEventQueue::lastEventAddTime()
+{
+   return __sync_fetch_and_add(&lastEventAddTime_, 0);
+}
+
+#else
+
+void ClientEventQueue::setLastEventAddTime(boost::int64_t time)
+{
+   LOCK_MUTEX(*pAddTimeMutex_)
    {
-      if (lastEventAddTime_.is_not_a_date_time())
-         return false;
-      else
-         return lastEventAddTime_ >= time;
+      lastEventAddTime_ = time;
    }
    END_LOCK_MUTEX
-   
+}
+
+boost::int64_t ClientEventQueue::lastEventAddTime()
+{
+   LOCK_MUTEX(*pAddTimeMutex_)
+   {
+      return lastEventAddTime_;
+   }
+   END_LOCK_MUTEX
+
    // keep compiler happy
-   return false;
+   return -1;
+}
+
+#endif
+
+void ClientEventQueue::drainRing()
+{
+   // NOTE: private helper so no lock required (mutex is not recursive) 
+
+   ClientEvent* pEvent;
+   while (ring_.dequeue(&pEvent))
+      stageEvent(pEvent);
+}
+
+void ClientEventQueue::stageEvent(ClientEvent* pEvent)
+{
+   // NOTE: private helper so no lock required (mutex is not recursive) 
+
+   // takes ownership of pEvent
+   boost::shared_ptr<const ClientEvent> pOwnedEvent(pEvent);
+
+   // console output is batched up for compactness/efficiency. we hold
+   // onto the events themselves rather than copying their output and
+   // discard leading output as soon as it can no longer be displayed
+   if (pEvent->type() == client_events::kConsoleWriteOutput)
+   {
+      pendingConsoleOutput_.append(pOwnedEvent);
+      pendingConsoleOutput_.trimLeadingLines(consoleOutputLimit());
+   }
+   else
+   {
+      // flush existing console output prior to adding an 
+      // action of another type
+      flushPendingConsoleOutput() ;
+      
+      // add event to queue
+      pendingEvents_.push_back(pOwnedEvent) ;
+   }
+}
+
+void ClientEventQueue::coalesceStaleEvents()
+{
+   // NOTE: private helper so no lock required (mutex is not recursive) 
+
+   // walk backwards so we keep the most recent event of each type
+   std::set<int> seenTypes;
+   std::vector<bool> stale(pendingEvents_.size(), false);
+   bool haveStale = false;
+   for (std::size_t i = pendingEvents_.size(); i > 0; i--)
+   {
+      int type = pendingEvents_[i-1]->type();
+      if (isSupersededByLaterEvents(type) && !seenTypes.insert(type).second)
+      {
+         stale[i-1] = true;
+         haveStale = true;
+      }
+   }
+
+   if (!haveStale)
+      return;
+
+   std::vector<boost::shared_ptr<const ClientEvent> > events;
+   events.reserve(pendingEvents_.size());
+   for (std::size_t i = 0; i < pendingEvents_.size(); i++)
+   {
+      if (!stale[i])
+         events.push_back(pendingEvents_[i]);
+   }
+   pendingEvents_.swap(events);
+}
+
+void ClientEventQueue::notifyWaiters()
+{
+   // only pay for the mutex/condition when someone is waiting. the waiter
+   // registers and samples eventsAdded_ under the mutex so this can't
+   // miss a wakeup
+   if (atomicLoad(&waiters_) > 0)
+   {
+      LOCK_MUTEX(*pWaitMutex_)
+      {
+         pWaitForEventCondition_->notify_all();
+      }
+      END_LOCK_MUTEX
+   }
 }
    
 
@@ -160,14 +360,12 @@ void ClientEventQueue::flushPendingConsoleOutput()
    
    if ( !pendingConsoleOutput_.empty() )
    {
-      // If there's more console output than the client can even show, then
-      // truncate it to the amount that the client can show. Too much output
-      // can overwhelm the client, causing it to become unresponsive.
-      int limit = r::session::consoleActions().capacity() + 1;
-      string_utils::trimLeadingLines(limit, &pendingConsoleOutput_);
-
-      pendingEvents_.push_back(ClientEvent(client_events::kConsoleWriteOutput, 
-                                           pendingConsoleOutput_)); 
+      // concatenate the output (a single allocation, trimmed to the
+      // amount of output the client can show)
+      pendingEvents_.push_back(boost::shared_ptr<const ClientEvent>(
+                  new ClientEvent(client_events::kConsoleWriteOutput,
+                                  pendingConsoleOutput_.str(
+                                                consoleOutputLimit()))));
       pendingConsoleOutput_.clear() ;
    }
 }
@@ -19,12 +19,17 @@
 
 #include <boost/function.hpp>
 #include <boost/utility.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <core/BoostThread.hpp>
+#include <core/Thread.hpp>
 
 #include <session/SessionClientEvent.hpp>
 
+#include "SessionConsoleOutputBuffer.hpp"
+
 namespace session {
    
 // initialization
@@ -46,8 +51,9 @@ public:
    // add an event
    void add(const ClientEvent& event);
    
-   // remove all available events
-   void remove(std::vector<ClientEvent>* pEvents);
+   // remove all available events (appended to pEvents). the events are
+   // handed over as they were queued rather than copied
+   void remove(std::vector<boost::shared_ptr<const ClientEvent> >* pEvents);
    
    // are there any events pending?
    bool hasEvents();
@@ -62,7 +68,16 @@ public:
    bool eventAddedSince(const boost::posix_time::ptime& time);
       
 private:   
+   // NOTE: the following require that pConsumerMutex_ is held
+   void drainRing();
+   void stageEvent(ClientEvent* pEvent);
    void flushPendingConsoleOutput();
+   void coalesceStaleEvents();
+
+   void notifyWaiters();
+
+   void setLastEventAddTime(boost::int64_t time);
+   boost::int64_t lastEventAddTime();
  
 private:
    // synchronization objects. heap based so they are never destructed
@@ -70,15 +85,30 @@ private:
    // explicitly stop the queue and this sometimes results in mutex
    // destroy assertions if someone is waiting on the queue while
    // it is being destroyed
-   boost::mutex* pMutex_ ;
+   boost::mutex* pConsumerMutex_ ;
+   boost::mutex* pWaitMutex_ ;
    boost::condition* pWaitForEventCondition_ ;
 
-   // instance data
-   std::string pendingConsoleOutput_ ;
-   std::vector<ClientEvent> pendingEvents_ ; 
-   boost::posix_time::ptime lastEventAddTime_;
-   
+   // events are added to a bounded lock-free ring by any number of
+   // producer threads. only the consumer side (remove, clear, etc.)
+   // takes a lock, so adding an event never blocks on the thread
+   // which is servicing get_events
+   core::thread::BoundedRing<ClientEvent*> ring_;
+
+   // events which have been removed from the ring but not yet
+   // delivered (protected by pConsumerMutex_)
+   ConsoleOutputBuffer pendingConsoleOutput_ ;
+   std::vector<boost::shared_ptr<const ClientEvent> > pendingEvents_ ;
+
+   // wait/notify state
+   volatile std::size_t eventsAdded_;
+   volatile std::size_t waiters_;
 
+   // microseconds since the epoch of the last add (-1 if none). 64 bit
+   // atomics aren't lock free on 32 bit targets so there it is protected
+   // by pAddTimeMutex_ instead
+   volatile boost::int64_t lastEventAddTime_;
+   boost::mutex* pAddTimeMutex_;
 };
 
 } // namespace session
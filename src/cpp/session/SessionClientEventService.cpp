@@ -318,15 +318,15 @@ void ClientEventService::run()
          if (request.clientId == clientId())
          {
             // deque the events
-            std::vector<ClientEvent> events;
+            std::vector<boost::shared_ptr<const ClientEvent> > events;
             clientEventQueue.remove(&events);
             
             // convert to json and add event id
-            for (std::vector<ClientEvent>::const_iterator 
-                 it = events.begin(); it != events.end(); ++it)
+            for (std::vector<boost::shared_ptr<const ClientEvent> >::
+                    const_iterator it = events.begin(); it != events.end(); ++it)
             {
                json::Object event ;
-               it->asJsonObject(nextEventId++, &event);
+               (*it)->asJsonObject(nextEventId++, &event);
                addClientEvent(event);
             }
 
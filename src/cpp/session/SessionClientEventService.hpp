@@ -47,10 +47,11 @@ public:
    
    void setClientId(const std::string& clientId, bool clearEvents);
 
-
-private:
+   // active client id (may be called from any thread)
    std::string clientId();
 
+
+private:
    void run();
 
    void erasePreviouslyDeliveredEvents(int lastClientEventIdSeen);
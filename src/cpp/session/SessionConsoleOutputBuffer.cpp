@@ -0,0 +1,82 @@
+/*
+ * SessionConsoleOutputBuffer.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include "SessionConsoleOutputBuffer.hpp"
+
+#include <algorithm>
+
+#include <core/StringUtils.hpp>
+#include <core/json/Json.hpp>
+
+using namespace core ;
+
+namespace session {
+
+void ConsoleOutputBuffer::append(
+                        const boost::shared_ptr<const ClientEvent>& pEvent)
+{
+   if (pEvent->data().type() != json::StringType)
+      return;
+
+   Segment segment;
+   segment.pEvent = pEvent;
+   const std::string& text = segment.text();
+   if (text.empty())
+      return;
+   segment.lines = std::count(text.begin(), text.end(), '\n');
+
+   segments_.push_back(segment);
+   lines_ += segment.lines;
+   length_ += text.length();
+}
+
+void ConsoleOutputBuffer::trimLeadingLines(int maxLines)
+{
+   // the leading segment is entirely trimmed (see
+   // string_utils::trimLeadingLines) if the segments after it are
+   // long enough and contain more than maxLines line breaks
+   std::size_t keepLines = static_cast<std::size_t>(std::max(maxLines, 0));
+   while (segments_.size() > 1 &&
+          (lines_ - segments_.front().lines) > keepLines &&
+          (length_ - segments_.front().text().length()) > (keepLines*2))
+   {
+      lines_ -= segments_.front().lines;
+      length_ -= segments_.front().text().length();
+      segments_.pop_front();
+   }
+}
+
+void ConsoleOutputBuffer::clear()
+{
+   segments_.clear();
+   lines_ = 0;
+   length_ = 0;
+}
+
+std::string ConsoleOutputBuffer::str(int maxLines) const
+{
+   std::string output;
+   output.reserve(length_);
+   for (std::deque<Segment>::const_iterator it = segments_.begin();
+        it != segments_.end();
+        ++it)
+   {
+      output.append(it->text());
+   }
+
+   // trim any partial leading segment
+   string_utils::trimLeadingLines(maxLines, &output);
+   return output;
+}
+
+} // namespace session
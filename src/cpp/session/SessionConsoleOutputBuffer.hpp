@@ -0,0 +1,70 @@
+/*
+ * SessionConsoleOutputBuffer.hpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#ifndef SESSION_SESSION_CONSOLE_OUTPUT_BUFFER_HPP
+#define SESSION_SESSION_CONSOLE_OUTPUT_BUFFER_HPP
+
+#include <string>
+#include <deque>
+
+#include <boost/shared_ptr.hpp>
+
+#include <session/SessionClientEvent.hpp>
+
+namespace session {
+
+// buffer of pending console output. output is held as the list of
+// console output events it arrived in (rather than being appended to
+// a single string) and line counts are tracked per segment, so output
+// beyond what the client can display is discarded a segment at a time
+// without ever being copied
+class ConsoleOutputBuffer
+{
+public:
+   ConsoleOutputBuffer() : lines_(0), length_(0) {}
+   // COPYING: via compiler (segments are immutable and shared)
+
+public:
+   // append a kConsoleWriteOutput event (events with non-string
+   // data are ignored)
+   void append(const boost::shared_ptr<const ClientEvent>& pEvent);
+
+   // discard whole leading segments which couldn't be part of the
+   // last maxLines lines of output
+   void trimLeadingLines(int maxLines);
+
+   bool empty() const { return segments_.empty(); }
+   std::size_t length() const { return length_; }
+   std::size_t lines() const { return lines_; }
+
+   void clear();
+
+   // concatenate the output (trimmed to maxLines) into a single string
+   std::string str(int maxLines) const;
+
+private:
+   struct Segment
+   {
+      boost::shared_ptr<const ClientEvent> pEvent;
+      std::size_t lines;
+      const std::string& text() const { return pEvent->data().get_str(); }
+   };
+
+   std::deque<Segment> segments_;
+   std::size_t lines_;
+   std::size_t length_;
+};
+
+} // namespace session
+
+#endif // SESSION_SESSION_CONSOLE_OUTPUT_BUFFER_HPP
@@ -134,6 +134,9 @@ http::UriHandlerFunction s_defaultUriHandler;
 
 // json rpc methods
 core::json::JsonRpcAsyncMethods s_jsonRpcMethods;
+
+// json rpc methods which don't use R (also in s_jsonRpcMethods)
+core::json::JsonRpcAsyncMethods s_rFreeRpcMethods;
    
 // R browseUrl handlers
 std::vector<module_context::RBrowseUrlHandler> s_rBrowseUrlHandlers;
@@ -157,6 +160,10 @@ bool s_rSessionResumed = false;
 // manage global state indicating whether R is processing input
 volatile sig_atomic_t s_rProcessingInput = 0;
 
+// set (on a background thread) when a child of the process supervisor
+// has output or has exited
+volatile sig_atomic_t s_childProcessActivity = 0;
+
 // did we fail to coerce the charset to UTF-8
 bool s_printCharsetWarning = false;
 
@@ -563,6 +570,202 @@ void endHandleRpcRequestIndirect(
    module_context::enqueClientEvent(evt);
 }
 
+void endHandleRFreeRpcRequest(boost::shared_ptr<HttpConnection> ptrConnection,
+                              boost::posix_time::ptime executeStartTime,
+                              const core::Error& executeError,
+                              json::JsonRpcResponse* pJsonRpcResponse)
+{
+   // as with endHandleRpcRequestDirect, save for detecting changes (which
+   // is left to the main thread)
+   if (executeError)
+   {
+      ptrConnection->sendJsonRpcError(executeError);
+   }
+   else
+   {
+      if ( !clientEventQueue().eventAddedSince(executeStartTime) &&
+           !pJsonRpcResponse->hasAfterResponse() )
+      {
+         pJsonRpcResponse->setField(kEventsPending, "false");
+      }
+
+      ptrConnection->sendJsonRpcResponse(*pJsonRpcResponse);
+
+      if (pJsonRpcResponse->hasAfterResponse())
+         pJsonRpcResponse->runAfterResponse();
+   }
+}
+
+// pool of threads which execute the rpc methods that don't use R. the
+// connections for these methods are taken from the listener thread (by
+// a connection filter) rather than being queued for the main thread, so
+// they are handled promptly no matter what R is doing
+const unsigned int kMaxRpcWorkerThreads = 4;
+
+class RpcWorkers : boost::noncopyable
+{
+public:
+   RpcWorkers()
+      : started_(false)
+   {
+   }
+
+   // COPYING: boost::noncopyable
+
+   // start taking connections for the passed methods (called once all
+   // methods have been registered -- methods_ isn't modified after this
+   // so can be read from any thread)
+   void start(const json::JsonRpcAsyncMethods& methods)
+   {
+      if (started_ || methods.empty())
+         return;
+      started_ = true;
+
+      methods_ = methods;
+
+      unsigned int threads = std::max(1U,
+                                      std::min(kMaxRpcWorkerThreads,
+                                      boost::thread::hardware_concurrency()));
+      for (unsigned int i = 0; i < threads; i++)
+      {
+         core::thread::safeLaunchThread(
+                  boost::bind(&RpcWorkers::workerMain, this));
+      }
+
+      httpConnectionListener().setConnectionFilter(
+                  boost::bind(&RpcWorkers::takeConnection, this, _1));
+   }
+
+private:
+   // called on the listener thread
+   bool takeConnection(boost::shared_ptr<HttpConnection> ptrConnection)
+   {
+      const std::string kRpcPrefix = "/rpc/";
+      const std::string& uri = ptrConnection->request().uri();
+      if (!boost::algorithm::starts_with(uri, kRpcPrefix))
+         return false;
+
+      std::string method = uri.substr(kRpcPrefix.length());
+      if (methods_.find(method) == methods_.end())
+         return false;
+
+      connections_.enque(ptrConnection);
+      return true;
+   }
+
+   void workerMain()
+   {
+      try
+      {
+         while (true)
+         {
+            boost::shared_ptr<HttpConnection> ptrConnection;
+            if (connections_.deque(&ptrConnection,
+                                   boost::posix_time::seconds(1)))
+            {
+               handleConnection(ptrConnection);
+            }
+         }
+      }
+      catch(const boost::thread_interrupted&)
+      {
+      }
+      CATCH_UNEXPECTED_EXCEPTION
+   }
+
+   void handleConnection(boost::shared_ptr<HttpConnection> ptrConnection)
+   {
+      try
+      {
+         // parse and validate (as parseAndValidateJsonRpcConnection does,
+         // but checking the client id known to the client event service
+         // as persistent state can only be read from the main thread)
+         json::JsonRpcRequest request;
+         Error error = json::parseJsonRpcRequest(
+                                          ptrConnection->request().body(),
+                                          &request);
+         if (error)
+         {
+            ptrConnection->sendJsonRpcError(error);
+            return;
+         }
+
+         if (request.clientId != clientEventService().clientId())
+         {
+            Error error(json::errc::InvalidClientId, ERROR_LOCATION);
+            ptrConnection->sendJsonRpcError(error);
+            return;
+         }
+
+         if ( (request.version > 0) && (s_version > request.version) )
+         {
+            Error error(json::errc::InvalidClientVersion, ERROR_LOCATION);
+            ptrConnection->sendJsonRpcError(error);
+            return;
+         }
+
+         // changes are only detected on the main thread
+         request.isBackgroundConnection = true;
+
+         using namespace boost::posix_time;
+         ptime executeStartTime = microsec_clock::universal_time();
+
+         json::JsonRpcAsyncMethods::const_iterator it =
+                                             methods_.find(request.method);
+         if (it == methods_.end())
+         {
+            Error error(json::errc::MethodNotFound, ERROR_LOCATION);
+            error.addProperty("method", request.method);
+            LOG_ERROR(error);
+            ptrConnection->sendJsonRpcError(error);
+            return;
+         }
+
+         json::JsonRpcAsyncFunction handlerFunction = it->second.second;
+         if (it->second.first)
+         {
+            // direct return
+            handlerFunction(request,
+                            boost::bind(endHandleRFreeRpcRequest,
+                                        ptrConnection,
+                                        executeStartTime,
+                                        _1,
+                                        _2));
+         }
+         else
+         {
+            // indirect return (asyncHandle style)
+            std::string handle = core::system::generateUuid(true);
+            json::JsonRpcResponse response;
+            response.setAsyncHandle(handle);
+            response.setField(kEventsPending, "false");
+            ptrConnection->sendJsonRpcResponse(response);
+
+            handlerFunction(request,
+                            boost::bind(endHandleRpcRequestIndirect,
+                                        handle,
+                                        _1,
+                                        _2));
+         }
+      }
+      CATCH_UNEXPECTED_EXCEPTION
+   }
+
+private:
+   bool started_;
+   json::JsonRpcAsyncMethods methods_;
+   core::thread::ThreadsafeQueue<boost::shared_ptr<HttpConnection> >
+                                                            connections_;
+};
+
+// the workers are never destroyed as they may be blocked waiting for
+// connections at exit
+RpcWorkers& rpcWorkers()
+{
+   static RpcWorkers* pWorkers = new RpcWorkers();
+   return *pWorkers;
+}
+
 void handleRpcRequest(const core::json::JsonRpcRequest& request,
                       boost::shared_ptr<HttpConnection> ptrConnection,
                       ConnectionType connectionType)
@@ -839,6 +1042,14 @@ void polledEventHandler()
       return;
    }
 
+   // poll child processes which have output or have exited right away
+   // rather than waiting for the throttled background processing below
+   if (s_childProcessActivity)
+   {
+      s_childProcessActivity = 0;
+      module_context::processSupervisor().poll();
+   }
+
    // static lastPerformed value used for throttling
    using namespace boost::posix_time;
    static ptime s_lastPerformed;
@@ -862,22 +1073,28 @@ void polledEventHandler()
    // (otherwise we'll handle them directly in waitForMethod)
    if (s_rProcessingInput)
    {
-      // check the uri of the next connection
-      std::string nextConnectionUri =
-       httpConnectionListener().mainConnectionQueue().peekNextConnectionUri();
+      // handle as many connections as we can within the batch interval
+      // (we'll be called back again if processing continues). we always
+      // handle at least one so a zero interval handles one per call
+      HttpConnectionQueue& queue = httpConnectionListener().mainConnectionQueue();
+      ptime batchEnd = microsec_clock::universal_time() +
+                       milliseconds(session::options().connectionBatchMs());
+      do
+      {
+         // check the uri of the next connection
+         std::string nextConnectionUri = queue.peekNextConnectionUri();
 
-      // if the uri is empty or if it one of our special waitForMethod calls
-      // then bails so that the waitForMethod logic can handle it
-      if (nextConnectionUri.empty() || isWaitForMethodUri(nextConnectionUri))
-         return;
+         // if the uri is empty or if it one of our special waitForMethod calls
+         // then bails so that the waitForMethod logic can handle it
+         if (nextConnectionUri.empty() || isWaitForMethodUri(nextConnectionUri))
+            return;
+
+         // attempt to deque a connection and handle it
+         boost::shared_ptr<HttpConnection> ptrConnection =
+                                                   queue.dequeConnection();
+         if (!ptrConnection)
+            return;
 
-      // attempt to deque a connection and handle it. for now we just handle
-      // a single connection at a time (we'll be called back again if processing
-      // continues)
-      boost::shared_ptr<HttpConnection> ptrConnection =
-            httpConnectionListener().mainConnectionQueue().dequeConnection();
-      if (ptrConnection)
-      {
          if ( isMethod(ptrConnection, kClientInit) )
          {
             // client_init means the user is attempting to reload the browser
@@ -893,6 +1110,8 @@ void polledEventHandler()
             handleConnection(ptrConnection, BackgroundConnection);
          }
       }
+      while (s_rProcessingInput &&
+             microsec_clock::universal_time() < batchEnd);
    }
 }
 
@@ -1230,6 +1449,14 @@ Error startHttpConnectionListener()
    return httpConnectionListener().start();
 }
 
+void onChildProcessActivity()
+{
+   s_childProcessActivity = 1;
+
+   // wake waitForMethod so it polls the supervisor right away
+   httpConnectionListener().mainConnectionQueue().wakeup();
+}
+
 Error startClientEventService()
 {
    return clientEventService().start(session::persistentState().activeClientId());
@@ -1464,6 +1691,9 @@ Error rInit(const r::session::RInitInfo& rInitInfo)
    // setup fork handlers
    setupForkHandlers();
 
+   // start executing the rpc methods which don't use R on worker threads
+   rpcWorkers().start(s_rFreeRpcMethods);
+
    // success!
    return Success();
 }
@@ -2250,6 +2480,26 @@ Error registerRpcMethod(const std::string& name,
    return Success();
 }
 
+Error registerRFreeAsyncRpcMethod(
+                              const std::string& name,
+                              const core::json::JsonRpcAsyncFunction& function)
+{
+   // methods are also registered for the main thread (which handles any
+   // requests received before the workers start)
+   s_rFreeRpcMethods.insert(
+         std::make_pair(name, std::make_pair(false, function)));
+   return registerAsyncRpcMethod(name, function);
+}
+
+Error registerRFreeRpcMethod(const std::string& name,
+                             const core::json::JsonRpcFunction& function)
+{
+   s_rFreeRpcMethods.insert(
+         std::make_pair(name,
+                        std::make_pair(true, json::adaptToAsync(function))));
+   return registerRpcMethod(name, function);
+}
+
 namespace {
 
 bool continueChildProcess(core::system::ProcessOperations&)
@@ -2482,6 +2732,14 @@ int main (int argc, char * const argv[])
       if (error)
          LOG_ERROR(error);
 
+#ifndef _WIN32
+      // start the child process launcher while we are still small (and
+      // before any threads are created)
+      error = core::system::startChildProcessLauncher();
+      if (error)
+         LOG_ERROR(error);
+#endif
+
       // get main thread id (used to distinguish forks which occur
       // from the main thread vs. child threads)
       s_mainThreadId = boost::this_thread::get_id();
@@ -2601,6 +2859,11 @@ int main (int argc, char * const argv[])
       if (error)
          return sessionExitFailure(error, ERROR_LOCATION);
 
+      // deliver child process output as soon as it is available (needs to
+      // be after the http listener as it wakes the main connection queue)
+      module_context::processSupervisor().setActivityHandler(
+                                                   onChildProcessActivity);
+
       // run optional preflight script -- needs to be after the http listeners
       // so the proxy server sees that we have startup up
       error = runPreflightScript();
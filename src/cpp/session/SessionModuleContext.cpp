@@ -54,6 +54,7 @@
 #include <r/session/RConsoleActions.hpp>
 
 #include <session/SessionOptions.hpp>
+#include <session/SessionHttpConnectionListener.hpp>
 #include "SessionClientEventQueue.hpp"
 
 #include <session/projects/SessionProjects.hpp>
@@ -172,6 +173,15 @@ SEXP rs_threadSleep(SEXP secondsSEXP)
    return R_NilValue;
 }
 
+// get statistics for the main connection queue
+SEXP rs_connectionQueueStats()
+{
+   r::sexp::Protect rProtect;
+   return r::sexp::create(
+         httpConnectionListener().mainConnectionQueue().statsAsJson(),
+         &rProtect);
+}
+
 // get rstudio mode
 SEXP rs_rstudioProgramMode()
 {
@@ -407,6 +417,14 @@ Error initialize()
    methodDef9.fun = (DL_FUNC) rs_sourceDiagnostics;
    methodDef9.numArgs = 0;
    r::routines::addCallMethod(methodDef9);
+
+   // register rs_connectionQueueStats with R (debugging function used to
+   // tune how connections are handled while R is busy)
+   R_CallMethodDef methodDef10;
+   methodDef10.name = "rs_connectionQueueStats" ;
+   methodDef10.fun = (DL_FUNC) rs_connectionQueueStats;
+   methodDef10.numArgs = 0;
+   r::routines::addCallMethod(methodDef10);
    
    // register Sys.sleep() hook to notify modules of sleep (currently
    // used by plots to check for changes on sleep so we can support the
@@ -153,7 +153,10 @@ core::ProgramStatus Options::read(int argc, char * const argv[])
          "automatically create public folder")
       ("session-rprofile-on-resume-default",
           value<bool>(&rProfileOnResumeDefault_)->default_value(false),
-          "default user setting for running Rprofile on resume");
+          "default user setting for running Rprofile on resume")
+      ("session-connection-batch-ms",
+         value<int>(&connectionBatchMs_)->default_value(5),
+         "time spent handling queued requests while R is busy (ms)");
 
    // r options
    bool rShellEscape; // no longer works but don't want to break any
@@ -232,6 +235,9 @@ core::ProgramStatus Options::read(int argc, char * const argv[])
       ("external-hunspell-dictionaries-path",
        value<std::string>(&hunspellDictionariesPath_)->default_value("resources/dictionaries"),
        "Path to hunspell dictionaries")
+      ("external-compiled-dictionaries-path",
+       value<std::string>(&compiledDictionariesPath_)->default_value(""),
+       "Path to compiled dictionaries (shared by sessions)")
       ("external-mathjax-path",
         value<std::string>(&mathjaxPath_)->default_value("resources/mathjax"),
         "Path to mathjax library");
@@ -34,6 +34,10 @@
 
 #include <core/json/JsonRpc.hpp>
 
+#ifndef _WIN32
+#include <core/system/PosixSystem.hpp>
+#endif
+
 #include <session/SessionHttpConnection.hpp>
 
 namespace session {
@@ -57,7 +61,21 @@ public:
 public:
    HttpConnectionImpl(boost::asio::io_service& ioService,
                       const Handler& handler)
-      : socket_(ioService), handler_(handler)
+      : ptrSocket_(new typename ProtocolType::socket(ioService)),
+        handler_(handler),
+        closeAfterResponse_(false),
+        handedOff_(false)
+   {
+   }
+
+   // continue reading requests from an existing (kept alive) socket
+   HttpConnectionImpl(
+         boost::shared_ptr<typename ProtocolType::socket> ptrSocket,
+         const Handler& handler)
+      : ptrSocket_(ptrSocket),
+        handler_(handler),
+        closeAfterResponse_(false),
+        handedOff_(false)
    {
    }
 
@@ -80,12 +98,39 @@ public:
 
    virtual void sendResponse(const core::http::Response &response)
    {
+      // keep the connection open if the client asked us to and the end of
+      // the response is marked by its Content-Length (other responses are
+      // delimited by closing the connection as our client in rserver
+      // doesn't decode chunked responses)
+      bool keepAlive = !closeAfterResponse_ &&
+                       request_.keepAlive() &&
+                       response.containsHeader("Content-Length") &&
+                       !response.containsHeader("Transfer-Encoding");
+      bool written = false;
+
       try
       {
          // write the response
-         boost::asio::write(socket_,
+         using namespace core::http;
+         boost::asio::write(socket(),
                             response.toBuffers(
-                                  core::http::Header::connectionClose()));
+                                  keepAlive ? Header::connectionKeepAlive() :
+                                              Header::connectionClose()));
+
+         // write the streamed body (if any)
+         if (response.isStreamResponse())
+         {
+            core::Error error = writeStreamBody(response);
+            if (error)
+            {
+               error.addProperty("request-uri", request_.uri());
+               if (!core::http::isConnectionTerminatedError(error))
+                  LOG_ERROR(error);
+               keepAlive = false;
+            }
+         }
+
+         written = true;
       }
       catch(const boost::system::system_error& e)
       {
@@ -99,10 +144,14 @@ public:
       }
       CATCH_UNEXPECTED_EXCEPTION
 
-      // always close connection
+      // read the next request if we are keeping the connection alive,
+      // otherwise close the connection
       try
       {
-         close();
+         if (keepAlive && written)
+            readNextRequest();
+         else
+            close();
       }
       CATCH_UNEXPECTED_EXCEPTION
    }
@@ -141,8 +190,11 @@ public:
    // need to be closed in other circumstances
    virtual void close()
    {
-      // always close connection
-      core::Error error = core::http::closeSocket(socket_);
+      // don't close a socket which we've handed off to the next request
+      if (handedOff_)
+         return;
+
+      core::Error error = core::http::closeSocket(socket());
       if (error)
          LOG_ERROR(error);
    }
@@ -158,11 +210,48 @@ public:
    }
 
    // get the socket
-   typename ProtocolType::socket& socket() { return socket_; }
+   typename ProtocolType::socket& socket() { return *ptrSocket_; }
 
 
 private:
 
+   core::Error writeStreamBody(const core::http::Response& response)
+   {
+#ifndef _WIN32
+      // send files directly from the kernel's page cache
+      if (!response.streamFile().empty())
+      {
+         return core::system::sendFile(socket().native(),
+                                       response.streamFile(),
+                                       response.streamFileSize());
+      }
+#endif
+
+      std::string block;
+      for (;;)
+      {
+         core::Error error = response.readStreamBlock(&block);
+         if (error)
+            return error;
+         if (block.empty())
+            return core::Success();
+
+         boost::asio::write(socket(), boost::asio::buffer(block));
+      }
+   }
+
+   // hand the socket off to a new connection which reads the next request.
+   // we do this rather than re-using this object because each HttpConnection
+   // represents exactly one request (handlers routinely retain references
+   // to the connection and its request after the response is sent)
+   void readNextRequest()
+   {
+      boost::shared_ptr<HttpConnectionImpl<ProtocolType> > ptrNextConnection(
+            new HttpConnectionImpl<ProtocolType>(ptrSocket_, handler_));
+      handedOff_ = true;
+      ptrNextConnection->startReading();
+   }
+
    // async request reading interface
    void readSome()
    {
@@ -172,7 +261,7 @@ private:
       // (unless the handler chooses to retain a copy of it e.g. to perform
       // processing in a background thread)
 
-      socket_.async_read_some(
+      socket().async_read_some(
          boost::asio::buffer(buffer_),
          boost::bind(
                &HttpConnectionImpl<ProtocolType>::handleRead,
@@ -197,6 +286,7 @@ private:
             // error - return bad request
             if (status == core::http::RequestParser::error)
             {
+               closeAfterResponse_ = true;
                core::http::Response response;
                response.setStatusCode(core::http::status::BadRequest);
                sendResponse(response);
@@ -244,12 +334,14 @@ private:
    }
 
 private:
-   typename ProtocolType::socket socket_;
+   boost::shared_ptr<typename ProtocolType::socket> ptrSocket_;
    boost::array<char, 8192> buffer_ ;
    core::http::RequestParser requestParser_ ;
    core::http::Request request_;
    std::string requestId_;
    Handler handler_;
+   bool closeAfterResponse_;
+   bool handedOff_;
 };
 
 } // namespace session
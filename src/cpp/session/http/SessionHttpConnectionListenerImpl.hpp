@@ -168,6 +168,12 @@ public:
       return eventsConnectionQueue_;
    }
 
+   virtual void setConnectionFilter(const HttpConnectionFilter& filter)
+   {
+      boost::lock_guard<boost::mutex> lock(filterMutex_);
+      connectionFilter_ = filter;
+   }
+
 protected:
 
    virtual bool authenticate(boost::shared_ptr<HttpConnection>)
@@ -261,6 +267,7 @@ private:
          core::http::Response response;
          response.setStatusCode(403);
          response.setStatusMessage("Forbidden");
+         response.setContentLength(0);
          ptrConnection->sendResponse(response);
          return;
       }
@@ -272,13 +279,25 @@ private:
       if (checkForAbort(ptrHttpConnection))
          return;
 
-      // place the connection on the correct queue
+      // place the connection on the correct queue (unless the connection
+      // filter takes it)
       if (isGetEvents(ptrHttpConnection))
          eventsConnectionQueue_.enqueConnection(ptrHttpConnection);
-      else
+      else if (!filterConnection(ptrHttpConnection))
          mainConnectionQueue_.enqueConnection(ptrHttpConnection);
    }
 
+   bool filterConnection(boost::shared_ptr<HttpConnection> ptrConnection)
+   {
+      HttpConnectionFilter filter;
+      {
+         boost::lock_guard<boost::mutex> lock(filterMutex_);
+         filter = connectionFilter_;
+      }
+
+      return filter && filter(ptrConnection);
+   }
+
    static bool isMethod(boost::shared_ptr<HttpConnection> ptrConnection,
                         const std::string& method)
    {
@@ -385,6 +404,10 @@ private:
    HttpConnectionQueue mainConnectionQueue_;
    HttpConnectionQueue eventsConnectionQueue_;
 
+   // connection filter
+   boost::mutex filterMutex_;
+   HttpConnectionFilter connectionFilter_;
+
    // listener thread
    boost::thread listenerThread_ ;
 
@@ -13,6 +13,10 @@
 
 #include <session/SessionHttpConnectionQueue.hpp>
 
+#include <algorithm>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
 #include <core/Log.hpp>
 #include <core/Error.hpp>
 #include <core/Thread.hpp>
@@ -29,7 +33,12 @@ void HttpConnectionQueue::enqueConnection(
    LOCK_MUTEX(*pMutex_)
    {
       // enque
-      queue_.push(ptrConnection);
+      QueuedConnection queued;
+      queued.ptrConnection = ptrConnection;
+      queued.enqueTime = boost::posix_time::microsec_clock::universal_time();
+      queue_.push(queued);
+
+      addToHistogram(queue_.size(), &depthHistogram_);
    }
    END_LOCK_MUTEX
 
@@ -44,11 +53,19 @@ boost::shared_ptr<HttpConnection> HttpConnectionQueue::doDequeConnection()
       if (!queue_.empty())
       {
          // remove it
-         boost::shared_ptr<HttpConnection> next = queue_.front();
+         QueuedConnection next = queue_.front();
          queue_.pop();
 
+         // record how long it waited
+         using namespace boost::posix_time;
+         time_duration waited = microsec_clock::universal_time() -
+                                next.enqueTime;
+         addToHistogram(std::max<boost::int64_t>(
+                                       waited.total_milliseconds(), 0),
+                        &waitHistogram_);
+
          // return it
-         return next;
+         return next.ptrConnection;
       }
       else
       {
@@ -90,7 +107,7 @@ std::string HttpConnectionQueue::peekNextConnectionUri()
    LOCK_MUTEX(*pMutex_)
    {
       if (!queue_.empty())
-         return queue_.front()->request().uri();
+         return queue_.front().ptrConnection->request().uri();
       else
          return std::string();
    }
@@ -100,6 +117,40 @@ std::string HttpConnectionQueue::peekNextConnectionUri()
    return std::string();
 }
 
+void HttpConnectionQueue::wakeup()
+{
+   pWaitCondition_->notify_all();
+}
+
+json::Object HttpConnectionQueue::statsAsJson()
+{
+   json::Object statsJson;
+   LOCK_MUTEX(*pMutex_)
+   {
+      statsJson["depth"] = json::toJsonArray(depthHistogram_);
+      statsJson["wait_ms"] = json::toJsonArray(waitHistogram_);
+   }
+   END_LOCK_MUTEX
+
+   return statsJson;
+}
+
+void HttpConnectionQueue::addToHistogram(
+                                 boost::uint64_t value,
+                                 std::vector<boost::uint64_t>* pHistogram)
+{
+   std::size_t bucket = 0;
+   while (value > 0)
+   {
+      value >>= 1;
+      bucket++;
+   }
+
+   if (pHistogram->size() <= bucket)
+      pHistogram->resize(bucket + 1, 0);
+   (*pHistogram)[bucket]++;
+}
+
 bool HttpConnectionQueue::waitForConnection(
                      const boost::posix_time::time_duration& waitDuration)
 {
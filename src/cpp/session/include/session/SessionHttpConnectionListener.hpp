@@ -66,6 +66,9 @@
 
 */
 
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+
 #include "SessionHttpConnectionQueue.hpp"
 
 namespace core {
@@ -82,6 +85,9 @@ void initializeHttpConnectionListener();
 class HttpConnectionListener;
 HttpConnectionListener& httpConnectionListener();
 
+typedef boost::function<bool(boost::shared_ptr<HttpConnection>)>
+                                                   HttpConnectionFilter;
+
 class HttpConnectionListener
 {  
 public:
@@ -94,6 +100,11 @@ public:
    // connection queues
 	virtual HttpConnectionQueue& mainConnectionQueue() = 0;
 	virtual HttpConnectionQueue& eventsConnectionQueue() = 0;
+
+   // set a filter which is offered each connection (on the listener
+   // thread) before it is queued. if the filter returns true it has
+   // taken responsibility for the connection and it isn't queued
+   virtual void setConnectionFilter(const HttpConnectionFilter& filter) = 0;
 };
 
 } // namespace session
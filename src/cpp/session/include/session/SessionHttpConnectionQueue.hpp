@@ -15,13 +15,17 @@
 #define SESSION_HTTP_CONNECTION_QUEUE_HPP
 
 #include <queue>
+#include <vector>
 
+#include <boost/cstdint.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include <boost/utility.hpp>
 
 #include <core/BoostThread.hpp>
 
+#include <core/json/Json.hpp>
+
 #include <session/SessionHttpConnection.hpp>
 
 namespace core {
@@ -48,10 +52,23 @@ public:
 
    std::string peekNextConnectionUri();
 
+   // wake anyone waiting in dequeConnection (they return no connection if
+   // none has been enqueued)
+   void wakeup();
+
+   // statistics used to tune how the queue is drained: histograms of the
+   // depth of the queue after each enque and of how long (in ms) each
+   // connection waited to be dequed. both have power of two buckets
+   // (bucket 0 counts zeros and bucket n counts values in [2^(n-1), 2^n))
+   core::json::Object statsAsJson();
+
 private:
    boost::shared_ptr<HttpConnection> doDequeConnection();
    bool waitForConnection(const boost::posix_time::time_duration& waitDuration);
 
+   static void addToHistogram(boost::uint64_t value,
+                              std::vector<boost::uint64_t>* pHistogram);
+
 private:
    // synchronization objects. heap based so they are never destructed
    // we don't want them destructed because in desktop mode we don't
@@ -62,7 +79,16 @@ private:
    boost::condition* pWaitCondition_ ;
 
    // instance data
-   std::queue<boost::shared_ptr<HttpConnection> > queue_;
+   struct QueuedConnection
+   {
+      boost::shared_ptr<HttpConnection> ptrConnection;
+      boost::posix_time::ptime enqueTime;
+   };
+   std::queue<QueuedConnection> queue_;
+
+   // statistics
+   std::vector<boost::uint64_t> depthHistogram_;
+   std::vector<boost::uint64_t> waitHistogram_;
 };
 
 } // namespace session
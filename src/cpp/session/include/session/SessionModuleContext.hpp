@@ -131,6 +131,16 @@ core::Error registerAsyncRpcMethod(
 core::Error registerRpcMethod(const std::string& name,
                               const core::json::JsonRpcFunction& function);
 
+// register rpc methods which don't use R (or any other state which isn't
+// threadsafe). these are executed on a pool of worker threads rather than
+// the main thread so they remain responsive while R is busy
+core::Error registerRFreeAsyncRpcMethod(
+                              const std::string& name,
+                              const core::json::JsonRpcAsyncFunction& function);
+
+core::Error registerRFreeRpcMethod(const std::string& name,
+                                   const core::json::JsonRpcFunction& function);
+
 
 core::Error executeAsync(const core::json::JsonRpcFunction& function,
                          const core::json::JsonRpcRequest& request,
@@ -120,6 +120,8 @@ public:
 
    bool rProfileOnResumeDefault() const { return rProfileOnResumeDefault_; }
 
+   int connectionBatchMs() const { return connectionBatchMs_; }
+
    unsigned int minimumUserId() const { return 100; }
    
    core::FilePath coreRSourcePath() const 
@@ -213,6 +215,11 @@ public:
       return core::FilePath(hunspellDictionariesPath_.c_str());
    }
 
+   core::FilePath compiledDictionariesPath() const
+   {
+      return core::FilePath(compiledDictionariesPath_.c_str());
+   }
+
    core::FilePath mathjaxPath() const
    {
       return core::FilePath(mathjaxPath_.c_str());
@@ -310,6 +317,7 @@ private:
    int timeoutMinutes_;
    bool createPublicFolder_;
    bool rProfileOnResumeDefault_;
+   int connectionBatchMs_;
 
    // r
    std::string coreRSourcePath_;
@@ -337,6 +345,7 @@ private:
    std::string msysSshPath_;
    std::string sumatraPath_;
    std::string hunspellDictionariesPath_;
+   std::string compiledDictionariesPath_;
    std::string mathjaxPath_;
 
    // user info
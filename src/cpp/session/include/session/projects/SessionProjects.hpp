@@ -31,7 +31,7 @@
 
 #include <core/json/Json.hpp>
 
-#include <core/collection/Tree.hpp>
+#include <core/CompactFileTree.hpp>
 
 #include <core/r_util/RProjectFile.hpp>
 #include <core/r_util/RSourceIndex.hpp>
@@ -43,7 +43,7 @@ namespace projects {
 // file monitoring callbacks (all callbacks are optional)
 struct FileMonitorCallbacks
 {
-   boost::function<void(const tree<core::FileInfo>&)> onMonitoringEnabled;
+   boost::function<void(const core::CompactFileTree&)> onMonitoringEnabled;
    boost::function<void(
          const std::vector<core::system::FileChangeEvent>&)> onFilesChanged;
    boost::function<void()> onMonitoringDisabled;
@@ -167,7 +167,7 @@ private:
 
    // file monitor event handlers
    void fileMonitorRegistered(core::system::file_monitor::Handle handle,
-                              const tree<core::FileInfo>& files);
+                              const core::CompactFileTree& files);
    void fileMonitorFilesChanged(
                    const std::vector<core::system::FileChangeEvent>& events);
    void fileMonitorTermination(const core::Error& error);
@@ -191,7 +191,7 @@ private:
 
    bool hasFileMonitor_;
    std::vector<std::string> monitorSubscribers_;
-   boost::signal<void(const tree<core::FileInfo>&)> onMonitoringEnabled_;
+   boost::signal<void(const core::CompactFileTree&)> onMonitoringEnabled_;
    boost::signal<void(const std::vector<core::system::FileChangeEvent>&)>
                                                             onFilesChanged_;
    boost::signal<void()> onMonitoringDisabled_;
@@ -15,20 +15,29 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <set>
+#include <map>
 
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/foreach.hpp>
 #include <boost/format.hpp>
 #include <boost/regex.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
 
 #include <core/Error.hpp>
 #include <core/Exec.hpp>
+#include <core/CompactFileTree.hpp>
 #include <core/FilePath.hpp>
 #include <core/FileSerializer.hpp>
 #include <core/SafeConvert.hpp>
+#include <core/StringUtils.hpp>
+#include <core/Thread.hpp>
 
 #include <core/r_util/RSourceIndex.hpp>
 
@@ -39,12 +48,14 @@
 
 #include <r/RExec.hpp>
 
+#include <session/SessionOptions.hpp>
 #include <session/SessionUserSettings.hpp>
 #include <session/SessionModuleContext.hpp>
 
 #include <session/projects/SessionProjects.hpp>
 
 #include "SessionSource.hpp"
+#include "SessionFindInFiles.hpp"
 
 using namespace core ;
 
@@ -93,11 +104,564 @@ bool enforceMaxResults(std::size_t maxResults,
 }
 
 
+// lookup table from (lower case) symbol names to the source items which
+// define them. prefix lookups use the ordering of the table and substring
+// lookups are narrowed to the names sharing a trigram with the term
+class SymbolIndex : boost::noncopyable
+{
+public:
+   SymbolIndex()
+   {
+   }
+
+   // COPYING: prohibited
+
+   void add(const boost::shared_ptr<r_util::RSourceIndex>& pIndex)
+   {
+      const std::vector<r_util::RSourceItem>& items = pIndex->items();
+      for (std::size_t i = 0; i < items.size(); i++)
+      {
+         std::string name = string_utils::toLower(items[i].name());
+         std::vector<Posting>& postings = names_[name];
+         if (postings.empty())
+            addTrigrams(name);
+         postings.push_back(Posting(pIndex, i));
+      }
+   }
+
+   void remove(const boost::shared_ptr<r_util::RSourceIndex>& pIndex)
+   {
+      BOOST_FOREACH(const r_util::RSourceItem& item, pIndex->items())
+      {
+         std::string name = string_utils::toLower(item.name());
+         NameMap::iterator it = names_.find(name);
+         if (it == names_.end())
+            continue;
+
+         std::vector<Posting>& postings = it->second;
+         postings.erase(std::remove_if(postings.begin(),
+                                       postings.end(),
+                                       boost::bind(&Posting::isFrom,
+                                                   _1,
+                                                   pIndex.get())),
+                        postings.end());
+         if (postings.empty())
+         {
+            removeTrigrams(name);
+            names_.erase(it);
+         }
+      }
+   }
+
+   void clear()
+   {
+      names_.clear();
+      trigrams_.clear();
+   }
+
+   bool findGlobalFunction(const std::string& functionName,
+                           const std::set<std::string>& excludeContexts,
+                           r_util::RSourceItem* pFunctionItem) const
+   {
+      NameMap::const_iterator it =
+                        names_.find(string_utils::toLower(functionName));
+      if (it == names_.end())
+         return false;
+
+      // take the match from the first context (so that the result
+      // doesn't depend on the order in which files were indexed)
+      const Posting* pMatch = NULL;
+      BOOST_FOREACH(const Posting& posting, it->second)
+      {
+         const std::string& context = posting.pIndex->context();
+         if (excludeContexts.find(context) != excludeContexts.end())
+            continue;
+
+         if (!isGlobalFunctionNamed(posting.item(), functionName))
+            continue;
+
+         if (pMatch == NULL || context < pMatch->pIndex->context())
+            pMatch = &posting;
+      }
+
+      if (pMatch == NULL)
+         return false;
+
+      *pFunctionItem = pMatch->item().withContext(pMatch->pIndex->context());
+      return true;
+   }
+
+   void search(const std::string& term,
+               std::size_t maxResults,
+               bool prefixOnly,
+               const std::set<std::string>& excludeContexts,
+               std::vector<r_util::RSourceItem>* pItems) const
+   {
+      std::string lowerTerm = string_utils::toLower(term);
+
+      // wildcard search: test every name against the pattern
+      boost::regex pattern = regexFromTerm(lowerTerm);
+      if (!pattern.empty())
+      {
+         for (NameMap::const_iterator it = names_.begin();
+              it != names_.end(); ++it)
+         {
+            if (regex_utils::textMatches(it->first, pattern, prefixOnly, false))
+            {
+               if (addItems(it->second, excludeContexts, maxResults, pItems))
+                  return;
+            }
+         }
+      }
+
+      // prefix search: names with the prefix are adjacent in the table
+      else if (prefixOnly)
+      {
+         for (NameMap::const_iterator it = names_.lower_bound(lowerTerm);
+              it != names_.end() &&
+                     boost::algorithm::starts_with(it->first, lowerTerm);
+              ++it)
+         {
+            if (addItems(it->second, excludeContexts, maxResults, pItems))
+               return;
+         }
+      }
+
+      // substring search: only consider the names which contain the
+      // term's least common trigram
+      else if (lowerTerm.length() >= 3)
+      {
+         const std::set<std::string>* pCandidates = NULL;
+         for (std::size_t i = 0; i + 3 <= lowerTerm.length(); i++)
+         {
+            TrigramMap::const_iterator it =
+                                 trigrams_.find(lowerTerm.substr(i, 3));
+            if (it == trigrams_.end())
+               return;
+
+            if (pCandidates == NULL || it->second.size() < pCandidates->size())
+               pCandidates = &(it->second);
+         }
+
+         BOOST_FOREACH(const std::string& name, *pCandidates)
+         {
+            if (name.find(lowerTerm) == std::string::npos)
+               continue;
+
+            NameMap::const_iterator it = names_.find(name);
+            if (addItems(it->second, excludeContexts, maxResults, pItems))
+               return;
+         }
+      }
+
+      // short substring search: test every name
+      else
+      {
+         for (NameMap::const_iterator it = names_.begin();
+              it != names_.end(); ++it)
+         {
+            if (it->first.find(lowerTerm) != std::string::npos)
+            {
+               if (addItems(it->second, excludeContexts, maxResults, pItems))
+                  return;
+            }
+         }
+      }
+   }
+
+private:
+
+   struct Posting
+   {
+      Posting(const boost::shared_ptr<r_util::RSourceIndex>& pIndex,
+              std::size_t index)
+         : pIndex(pIndex), index(index)
+      {
+      }
+
+      boost::shared_ptr<r_util::RSourceIndex> pIndex;
+      std::size_t index;
+
+      const r_util::RSourceItem& item() const
+      {
+         return pIndex->items()[index];
+      }
+
+      bool isFrom(const r_util::RSourceIndex* pOtherIndex) const
+      {
+         return pIndex.get() == pOtherIndex;
+      }
+   };
+
+   typedef std::map<std::string, std::vector<Posting> > NameMap;
+   typedef std::map<std::string, std::set<std::string> > TrigramMap;
+
+   // add items to the results, returns true if maxResults was reached
+   bool addItems(const std::vector<Posting>& postings,
+                 const std::set<std::string>& excludeContexts,
+                 std::size_t maxResults,
+                 std::vector<r_util::RSourceItem>* pItems) const
+   {
+      BOOST_FOREACH(const Posting& posting, postings)
+      {
+         const std::string& context = posting.pIndex->context();
+         if (excludeContexts.find(context) != excludeContexts.end())
+            continue;
+
+         pItems->push_back(posting.item().withContext(context));
+
+         if (pItems->size() >= maxResults)
+         {
+            pItems->resize(maxResults);
+            return true;
+         }
+      }
+
+      return false;
+   }
+
+   void addTrigrams(const std::string& name)
+   {
+      for (std::size_t i = 0; i + 3 <= name.length(); i++)
+         trigrams_[name.substr(i, 3)].insert(name);
+   }
+
+   void removeTrigrams(const std::string& name)
+   {
+      for (std::size_t i = 0; i + 3 <= name.length(); i++)
+      {
+         TrigramMap::iterator it = trigrams_.find(name.substr(i, 3));
+         if (it != trigrams_.end())
+         {
+            it->second.erase(name);
+            if (it->second.empty())
+               trigrams_.erase(it);
+         }
+      }
+   }
+
+private:
+   NameMap names_;
+   TrigramMap trigrams_;
+};
+
+
+// persistent copy of the project's source index (stored in the project
+// scratch path so that the index needn't be rebuilt from scratch each
+// time the session starts). entries are keyed by path and are only
+// used if the file's size and modification time are unchanged
+struct PersistentIndexEntry
+{
+   PersistentIndexEntry() : lastWriteTime(0), size(0) {}
+   std::time_t lastWriteTime;
+   uintmax_t size;
+   std::vector<r_util::RSourceItem> items;
+};
+
+typedef std::map<std::string,PersistentIndexEntry> PersistentIndex;
+
+const char * const kPersistentIndexHeader = "source-index-v1";
+
+FilePath persistentIndexPath()
+{
+   return projects::projectContext().scratchPath().complete("source_index");
+}
+
+std::string escapeIndexField(const std::string& field)
+{
+   std::string escaped;
+   escaped.reserve(field.length());
+   BOOST_FOREACH(char ch, field)
+   {
+      switch(ch)
+      {
+         case '\\':
+            escaped.append("\\\\");
+            break;
+         case '\t':
+            escaped.append("\\t");
+            break;
+         case '\n':
+            escaped.append("\\n");
+            break;
+         case '\r':
+            escaped.append("\\r");
+            break;
+         default:
+            escaped.push_back(ch);
+      }
+   }
+   return escaped;
+}
+
+std::string unescapeIndexField(const std::string& field)
+{
+   std::string unescaped;
+   unescaped.reserve(field.length());
+   for (std::size_t i = 0; i < field.length(); i++)
+   {
+      char ch = field[i];
+      if (ch == '\\' && (i + 1) < field.length())
+      {
+         ch = field[++i];
+         if (ch == 't')
+            ch = '\t';
+         else if (ch == 'n')
+            ch = '\n';
+         else if (ch == 'r')
+            ch = '\r';
+      }
+      unescaped.push_back(ch);
+   }
+   return unescaped;
+}
+
+std::vector<std::string> splitIndexLine(const std::string& line)
+{
+   std::vector<std::string> fields;
+   boost::algorithm::split(fields, line, boost::algorithm::is_any_of("\t"));
+   return fields;
+}
+
+// reads the persistent index (returns an empty index if there is no
+// persistent index or it can't be read)
+PersistentIndex readPersistentIndex()
+{
+   PersistentIndex index;
+
+   FilePath indexPath = persistentIndexPath();
+   if (!indexPath.exists())
+      return index;
+
+   boost::shared_ptr<std::istream> pStream;
+   Error error = indexPath.open_r(&pStream);
+   if (error)
+   {
+      LOG_ERROR(error);
+      return index;
+   }
+
+   try
+   {
+      std::string line;
+      std::getline(*pStream, line);
+      if (line != kPersistentIndexHeader)
+         return index;
+
+      PersistentIndexEntry* pEntry = NULL;
+      while (std::getline(*pStream, line))
+      {
+         std::vector<std::string> fields = splitIndexLine(line);
+
+         // F <path> <last-write-time> <size>
+         if (fields.size() == 4 && fields[0] == "F")
+         {
+            pEntry = &(index[unescapeIndexField(fields[1])]);
+            pEntry->lastWriteTime = safe_convert::stringTo<std::time_t>(
+                                                              fields[2], 0);
+            pEntry->size = safe_convert::stringTo<uintmax_t>(fields[3], 0);
+         }
+
+         // I <type> <brace-level> <line> <column> <name> [<param> <type>]*
+         else if (fields.size() >= 6 && (fields.size() % 2) == 0 &&
+                  fields[0] == "I" && pEntry != NULL)
+         {
+            std::vector<r_util::RS4MethodParam> signature;
+            for (std::size_t i = 6; i < fields.size(); i += 2)
+            {
+               signature.push_back(r_util::RS4MethodParam(
+                                          unescapeIndexField(fields[i]),
+                                          unescapeIndexField(fields[i+1])));
+            }
+
+            using namespace safe_convert;
+            pEntry->items.push_back(r_util::RSourceItem(
+                                       stringTo<int>(fields[1], 0),
+                                       unescapeIndexField(fields[5]),
+                                       signature,
+                                       stringTo<int>(fields[2], 0),
+                                       stringTo<std::size_t>(fields[3], 0),
+                                       stringTo<std::size_t>(fields[4], 0)));
+         }
+
+         // corrupt (discard the whole index, it will be rebuilt)
+         else
+         {
+            LOG_WARNING_MESSAGE("Discarding invalid source index " +
+                                indexPath.absolutePath());
+            return PersistentIndex();
+         }
+      }
+   }
+   catch(const std::exception& e)
+   {
+      LOG_ERROR_MESSAGE("Error reading source index: " +
+                        std::string(e.what()));
+      return PersistentIndex();
+   }
+
+   return index;
+}
+
+
+// request to index a source file on a background thread
+struct IndexJob
+{
+   IndexJob() : epoch(0), generation(0) {}
+   std::size_t epoch;
+   std::size_t generation;
+   FileInfo fileInfo;
+   std::string context;
+   std::string encoding;
+};
+
+struct IndexResult
+{
+   IndexResult() : epoch(0), generation(0) {}
+   explicit IndexResult(const IndexJob& job)
+      : epoch(job.epoch), generation(job.generation), fileInfo(job.fileInfo)
+   {
+   }
+   std::size_t epoch;
+   std::size_t generation;
+   FileInfo fileInfo;
+   boost::shared_ptr<r_util::RSourceIndex> pIndex;
+};
+
+// pool of threads which read, decode, and index source files. this
+// requires no R interpreter so can proceed in parallel with the main
+// thread, which only swaps the finished indexes into place
+class IndexingWorkers : boost::noncopyable
+{
+public:
+   IndexingWorkers()
+      : threadsLaunched_(false)
+   {
+   }
+
+   // COPYING: prohibited
+
+   void enque(const IndexJob& job)
+   {
+      if (!threadsLaunched_)
+      {
+         threadsLaunched_ = true;
+
+         // leave a core for the main thread
+         unsigned int threads = boost::thread::hardware_concurrency();
+         threads = std::max(1U, std::min(4U, threads > 1 ? threads - 1 : 1));
+         for (unsigned int i = 0; i < threads; i++)
+         {
+            core::thread::safeLaunchThread(
+                  boost::bind(&IndexingWorkers::workerMain, this));
+         }
+      }
+
+      jobs_.enque(job);
+   }
+
+   bool dequeResult(IndexResult* pResult)
+   {
+      return results_.deque(pResult);
+   }
+
+private:
+   void workerMain()
+   {
+      try
+      {
+         // (each worker decodes files with its own decoder)
+         boost::scoped_ptr<find::LineDecoder> pDecoder;
+         while (true)
+         {
+            // wait for a job (with a timeout so a missed notification
+            // never stalls indexing for long)
+            IndexJob job;
+            if (jobs_.deque(&job, boost::posix_time::seconds(1)))
+            {
+               if (!pDecoder || pDecoder->encoding() != job.encoding)
+                  pDecoder.reset(new find::LineDecoder(job.encoding));
+               results_.enque(indexFile(job, pDecoder.get()));
+            }
+         }
+      }
+      catch(const boost::thread_interrupted&)
+      {
+      }
+      CATCH_UNEXPECTED_EXCEPTION
+   }
+
+   // (this runs on a worker thread so it mustn't touch R, we decode the
+   // file ourselves rather than with module_context::readAndDecodeFile)
+   static IndexResult indexFile(const IndexJob& job,
+                                find::LineDecoder* pDecoder)
+   {
+      IndexResult result(job);
+
+      // read the file
+      FilePath filePath(job.fileInfo.absolutePath());
+      std::string encoded;
+      Error error = core::readStringFromFile(
+                                    filePath,
+                                    &encoded,
+                                    session::options().sourceLineEnding());
+      if (error)
+      {
+         error.addProperty("src-file", filePath.absolutePath());
+         LOG_ERROR(error);
+         return result;
+      }
+
+      // convert it to UTF-8 (substituting for invalid input)
+      std::string code;
+      error = pDecoder->decode(encoded.data(),
+                               encoded.data() + encoded.size(),
+                               &code);
+      if (!error)
+      {
+         core::stripBOM(&code);
+         error = string_utils::utf8Clean(code.begin(), code.end(), '?');
+      }
+      if (error)
+      {
+         error.addProperty("src-file", filePath.absolutePath());
+         LOG_ERROR(error);
+         return result;
+      }
+
+      // index it
+      result.pIndex.reset(new r_util::RSourceIndex(job.context, code));
+      return result;
+   }
+
+private:
+   bool threadsLaunched_;
+   core::thread::ThreadsafeQueue<IndexJob> jobs_;
+   core::thread::ThreadsafeQueue<IndexResult> results_;
+};
+
+// the workers (and their queues) are never destroyed as they may
+// be blocked waiting for jobs at exit
+IndexingWorkers& indexingWorkers()
+{
+   static IndexingWorkers* pWorkers = new IndexingWorkers();
+   return *pWorkers;
+}
+
+
 class SourceFileIndex : boost::noncopyable
 {
 public:
    SourceFileIndex()
-      : indexing_(false)
+      : indexing_(false),
+        epoch_(0),
+        nextGeneration_(1),
+        pendingJobs_(0),
+        pollingResults_(false),
+        batchFiles_(0),
+        persistentIndexLoaded_(false),
+        persistentIndexDirty_(false),
+        saveScheduled_(false)
    {
    }
 
@@ -164,36 +728,9 @@ public:
                            const std::set<std::string>& excludeContexts,
                            r_util::RSourceItem* pFunctionItem)
    {
-      std::vector<r_util::RSourceItem> sourceItems;
-      BOOST_FOREACH(const Entry& entry, entries_)
-      {
-         // bail if there is no index
-         if (!entry.hasIndex())
-            continue;
-
-         // bail if this is an exluded context
-         if (excludeContexts.find(entry.pIndex->context()) !=
-             excludeContexts.end())
-         {
-            continue;
-         }
-
-         // scan the next index
-         sourceItems.clear();
-         entry.pIndex->search(
-                  boost::bind(isGlobalFunctionNamed, _1, functionName),
-                  std::back_inserter(sourceItems));
-
-         // return if we got a hit
-         if (sourceItems.size() > 0)
-         {
-            *pFunctionItem = sourceItems[0];
-            return true;
-         }
-      }
-
-      // none found
-      return false;
+      return symbolIndex_.findGlobalFunction(functionName,
+                                             excludeContexts,
+                                             pFunctionItem);
    }
 
    void searchSource(const std::string& term,
@@ -202,32 +739,11 @@ public:
                      const std::set<std::string>& excludeContexts,
                      std::vector<r_util::RSourceItem>* pItems)
    {
-      BOOST_FOREACH(const Entry& entry, entries_)
-      {
-         // skip if it has no index
-         if (!entry.hasIndex())
-            continue;
-
-         // bail if this is an exluded context
-         if (excludeContexts.find(entry.pIndex->context()) !=
-             excludeContexts.end())
-         {
-            continue;
-         }
-
-         // scan the next index
-         entry.pIndex->search(term,
-                              prefixOnly,
-                              false,
-                              std::back_inserter(*pItems));
-
-         // return if we are past maxResults
-         if (pItems->size() >= maxResults)
-         {
-            pItems->resize(maxResults);
-            return;
-         }
-      }
+      symbolIndex_.search(term,
+                          maxResults,
+                          prefixOnly,
+                          excludeContexts,
+                          pItems);
    }
 
    void searchFiles(const std::string& term,
@@ -243,12 +759,18 @@ public:
       // create wildcard pattern if the search has a '*'
       boost::regex pattern = regexFromTerm(term);
 
-      // iterate over the files
-      BOOST_FOREACH(const Entry& entry, entries_)
+      // iterate over the files (directories in the tree are just the
+      // parents of files)
+      std::vector<FileInfo> matchingFiles;
+      for (CompactFileTree::NodeId id = files_.root();
+           id != CompactFileTree::kNoNode;
+           id = files_.next(id))
       {
-         // get file and name
-         FilePath filePath(entry.fileInfo.absolutePath());
-         std::string name = filePath.filename();
+         if (files_.isDirectory(id))
+            continue;
+
+         // get name
+         std::string name = files_.name(id);
 
          // compare for match (wildcard or standard)
          bool matches = false;
@@ -267,54 +789,53 @@ public:
                matches = boost::algorithm::icontains(name, term);
          }
 
-         // add the file if we found a match
+         // collect the file if we found a match
          if (matches)
-         {
-            // name and aliased path
-            pNames->push_back(filePath.filename());
-            pPaths->push_back(module_context::createAliasedPath(filePath));
+            matchingFiles.push_back(files_.fileInfo(id));
+      }
 
-            // return if we are past max results
-            if (enforceMaxResults(maxResults, pNames, pPaths, pMoreAvailable))
-               return;
-         }
+      // return matches in path order
+      std::sort(matchingFiles.begin(),
+                matchingFiles.end(),
+                core::fileInfoPathLessThan);
+      BOOST_FOREACH(const FileInfo& fileInfo, matchingFiles)
+      {
+         // name and aliased path
+         FilePath filePath(fileInfo.absolutePath());
+         pNames->push_back(filePath.filename());
+         pPaths->push_back(module_context::createAliasedPath(filePath));
+
+         // return if we are past max results
+         if (enforceMaxResults(maxResults, pNames, pPaths, pMoreAvailable))
+            return;
       }
    }
 
-   void clear()
+   // persist any changes we haven't yet written
+   void flush()
    {
-      indexing_ = false;
-      indexingQueue_ = std::queue<core::system::FileChangeEvent>();
-      entries_.clear();
+      if (persistentIndexDirty_)
+         savePersistentIndex();
    }
 
-private:
-
-   // index entries we are managing
-   struct Entry
+   void clear()
    {
-      explicit Entry(const FileInfo& fileInfo)
-         : fileInfo(fileInfo)
-      {
-      }
+      flush();
 
-      Entry(const FileInfo& fileInfo,
-            boost::shared_ptr<core::r_util::RSourceIndex> pIndex)
-         : fileInfo(fileInfo), pIndex(pIndex)
-      {
-      }
-
-      FileInfo fileInfo;
-
-      boost::shared_ptr<core::r_util::RSourceIndex> pIndex;
+      indexing_ = false;
+      indexingQueue_ = std::queue<core::system::FileChangeEvent>();
+      files_.clear();
+      indexes_.clear();
 
-      bool hasIndex() const { return pIndex.get() != NULL; }
+      // results of jobs which are still in flight will be discarded
+      epoch_++;
+      pendingJobs_ = 0;
+      pendingPaths_.clear();
 
-      bool operator < (const Entry& other) const
-      {
-         return core::fileInfoPathLessThan(fileInfo, other.fileInfo);
-      }
-   };
+      symbolIndex_.clear();
+      persistentIndexLoaded_ = false;
+      persistentIndex_.clear();
+   }
 
 private:
 
@@ -341,6 +862,7 @@ private:
 
             case FileChangeEvent::FileRemoved:
             {
+               cancelPendingJobs(fileInfo);
                removeIndexEntry(fileInfo);
                break;
             }
@@ -350,73 +872,326 @@ private:
          }
       }
 
+      // pick up any files the workers have finished
+      applyResults();
+
       // return status
       indexing_ = !indexingQueue_.empty();
+
+      // poll for the remaining results rather than spinning through
+      // our time slices waiting on the workers
+      if (!indexing_ && pendingJobs_ > 0 && !pollingResults_)
+      {
+         pollingResults_ = true;
+         module_context::schedulePeriodicWork(
+                           boost::posix_time::milliseconds(50),
+                           boost::bind(&SourceFileIndex::pollResults, this),
+                           false /* allow indexing even when non-idle */);
+      }
+
+      onIndexingProgress();
+
       return indexing_;
    }
 
+   bool pollResults()
+   {
+      applyResults();
+      onIndexingProgress();
+
+      pollingResults_ = pendingJobs_ > 0;
+      return pollingResults_;
+   }
+
+   void onIndexingProgress()
+   {
+      // done once we've caught up with the queue and the workers
+      if (indexing_ || pendingJobs_ > 0)
+         return;
+
+      // report throughput
+      if (batchFiles_ > 0)
+      {
+         using namespace boost::posix_time;
+         double seconds = (microsec_clock::universal_time() - batchStart_)
+                                             .total_milliseconds() / 1000.0;
+         boost::format fmt("Indexed %1% R source files in %2%s "
+                           "(%3% files/sec)");
+         LOG_DEBUG_MESSAGE(boost::str(fmt % batchFiles_ % seconds %
+                     (seconds > 0 ? static_cast<int>(batchFiles_ / seconds)
+                                  : static_cast<int>(batchFiles_))));
+         batchFiles_ = 0;
+      }
+
+      // any persisted entries we didn't use are for files which no longer
+      // exist. rather than rewriting the index after every change we write
+      // it once things have been quiet for a while (or at exit)
+      persistentIndex_.clear();
+      if (persistentIndexDirty_ && !saveScheduled_)
+      {
+         saveScheduled_ = true;
+         module_context::schedulePeriodicWork(
+                  boost::posix_time::seconds(30),
+                  boost::bind(&SourceFileIndex::savePersistentIndexIfIdle,
+                              this),
+                  true /* idle only */);
+      }
+   }
+
+   bool savePersistentIndexIfIdle()
+   {
+      // try again later if indexing has started up again
+      if (indexing_ || pendingJobs_ > 0)
+         return true;
+
+      saveScheduled_ = false;
+      if (persistentIndexDirty_)
+         savePersistentIndex();
+      return false;
+   }
+
    void updateIndexEntry(const FileInfo& fileInfo)
    {
-      // index the source if necessary
-      boost::shared_ptr<r_util::RSourceIndex> pIndex;
-      if (isIndexableSourceFile(fileInfo))
+      // files which we don't index just need an entry
+      if (!isIndexableSourceFile(fileInfo))
       {
-         // read the file
-         FilePath filePath(fileInfo.absolutePath());
-         std::string code;
-         Error error = module_context::readAndDecodeFile(
-                                 filePath,
-                                 projects::projectContext().defaultEncoding(),
-                                 true,
-                                 &code);
-         if (error)
-         {
-            error.addProperty("src-file", filePath.absolutePath());
-            LOG_ERROR(error);
-            return;
-         }
+         setIndexEntry(fileInfo, boost::shared_ptr<r_util::RSourceIndex>());
+         return;
+      }
 
-         // add index entry
-         std::string context = module_context::createAliasedPath(filePath);
-         pIndex.reset(new r_util::RSourceIndex(context, code));
+      // use the persisted index if the file is unchanged
+      boost::shared_ptr<r_util::RSourceIndex> pIndex =
+                                             persistedIndex(fileInfo);
+      if (pIndex)
+      {
+         setIndexEntry(fileInfo, pIndex);
+         return;
       }
 
-      // attempt to add the entry
-      Entry entry(fileInfo, pIndex);
-      std::pair<std::set<Entry>::iterator,bool> result = entries_.insert(entry);
+      // otherwise have the workers index it
+      if (pendingJobs_ == 0 && batchFiles_ == 0)
+         batchStart_ = boost::posix_time::microsec_clock::universal_time();
+
+      FilePath filePath(fileInfo.absolutePath());
+      IndexJob job;
+      job.epoch = epoch_;
+      job.generation = nextGeneration_++;
+      job.fileInfo = fileInfo;
+      job.context = module_context::createAliasedPath(filePath);
+      job.encoding = projects::projectContext().defaultEncoding();
+
+      PendingPath& pending = pendingPaths_[fileInfo.absolutePath()];
+      pending.generation = job.generation;
+      pending.jobs++;
+      pendingJobs_++;
+
+      indexingWorkers().enque(job);
+   }
+
+   void cancelPendingJobs(const FileInfo& fileInfo)
+   {
+      // any results still to come for the file are stale
+      std::map<std::string,PendingPath>::iterator it =
+                                 pendingPaths_.find(fileInfo.absolutePath());
+      if (it != pendingPaths_.end())
+         it->second.generation = 0;
+   }
 
-      // insert failed, remove then re-add
-      if (result.second == false)
+   void applyResults()
+   {
+      IndexResult result;
+      while (indexingWorkers().dequeResult(&result))
       {
-         // was the first item, erase and re-insert without a hint
-         if (result.first == entries_.begin())
+         // ignore results from before we were last cleared
+         if (result.epoch != epoch_)
+            continue;
+
+         pendingJobs_--;
+         batchFiles_++;
+
+         // only apply the result of the most recent job for the file
+         std::map<std::string,PendingPath>::iterator it =
+                           pendingPaths_.find(result.fileInfo.absolutePath());
+         if (it == pendingPaths_.end())
+            continue;
+
+         bool current = it->second.generation == result.generation;
+         if (--(it->second.jobs) == 0)
+            pendingPaths_.erase(it);
+
+         if (current && result.pIndex)
          {
-            entries_.erase(result.first);
-            entries_.insert(entry);
+            setIndexEntry(result.fileInfo, result.pIndex);
+            persistentIndexDirty_ = true;
          }
-         // can derive a valid hint
-         else
-         {
-            // derive hint iterator
-            std::set<Entry>::iterator hintIter = result.first;
-            hintIter--;
+      }
+   }
 
-            // erase and re-insert with hint
-            entries_.erase(result.first);
-            entries_.insert(hintIter, entry);
-         }
+   void setIndexEntry(const FileInfo& fileInfo,
+                      boost::shared_ptr<r_util::RSourceIndex> pIndex)
+   {
+      // files are kept in a tree rooted at the project directory
+      if (files_.empty())
+      {
+         files_.assign(FileInfo(
+               projects::projectContext().directory().absolutePath(), true));
+      }
+
+      // add the file (or find the existing one)
+      CompactFileTree::NodeId id = files_.insert(fileInfo);
+      if (id == CompactFileTree::kNoNode)
+         return;
+
+      // remove the previous symbols
+      IndexMap::iterator it = indexes_.find(id);
+      if (it != indexes_.end())
+      {
+         symbolIndex_.remove(it->second);
+         indexes_.erase(it);
+      }
+
+      // add it to the symbol index
+      if (pIndex)
+      {
+         symbolIndex_.add(pIndex);
+         indexes_[id] = pIndex;
       }
    }
 
    void removeIndexEntry(const FileInfo& fileInfo)
    {
-      // create a fake entry with a null source index to pass to find
-      Entry entry(fileInfo, boost::shared_ptr<r_util::RSourceIndex>());
+      // find the file (directories are only in the tree as parents)
+      CompactFileTree::NodeId id = files_.find(fileInfo.absolutePath());
+      if (id == CompactFileTree::kNoNode || files_.isDirectory(id))
+         return;
+
+      IndexMap::iterator it = indexes_.find(id);
+      if (it != indexes_.end())
+      {
+         symbolIndex_.remove(it->second);
+         persistentIndexDirty_ = true;
+         indexes_.erase(it);
+      }
+
+      // remove the file along with any directories it leaves empty
+      CompactFileTree::NodeId parentId = files_.parent(id);
+      files_.remove(id);
+      while (parentId != files_.root() &&
+             files_.firstChild(parentId) == CompactFileTree::kNoNode)
+      {
+         id = parentId;
+         parentId = files_.parent(id);
+         files_.remove(id);
+      }
+   }
+
+   boost::shared_ptr<r_util::RSourceIndex> persistedIndex(
+                                                const FileInfo& fileInfo)
+   {
+      // load the persistent index on demand
+      if (!persistentIndexLoaded_)
+      {
+         persistentIndex_ = readPersistentIndex();
+         persistentIndexLoaded_ = true;
+      }
+
+      // look for an entry for this version of the file (files without a
+      // modification time can't be validated so are always indexed)
+      PersistentIndex::iterator it =
+                           persistentIndex_.find(fileInfo.absolutePath());
+      if (it == persistentIndex_.end())
+         return boost::shared_ptr<r_util::RSourceIndex>();
+
+      boost::shared_ptr<r_util::RSourceIndex> pIndex;
+      if (fileInfo.lastWriteTime() != 0 &&
+          it->second.lastWriteTime == fileInfo.lastWriteTime() &&
+          it->second.size == fileInfo.size())
+      {
+         FilePath filePath(fileInfo.absolutePath());
+         std::string context = module_context::createAliasedPath(filePath);
+         pIndex.reset(new r_util::RSourceIndex(context, it->second.items));
+      }
+
+      // each entry is used at most once
+      persistentIndex_.erase(it);
+      return pIndex;
+   }
+
+   void savePersistentIndex()
+   {
+      persistentIndexDirty_ = false;
+
+      // write to a temporary file which is then renamed over the index (so
+      // an interrupted write never leaves a truncated index behind)
+      FilePath indexPath = persistentIndexPath();
+      FilePath tempPath = indexPath.parent().complete(indexPath.filename() +
+                                                      ".tmp");
+      Error error = writePersistentIndex(tempPath);
+      if (!error)
+         error = tempPath.move(indexPath);
+      if (error)
+      {
+         LOG_ERROR(error);
+         Error removeError = tempPath.removeIfExists();
+         if (removeError)
+            LOG_ERROR(removeError);
+      }
+   }
+
+   Error writePersistentIndex(const FilePath& filePath)
+   {
+      boost::shared_ptr<std::ostream> pStream;
+      Error error = filePath.open_w(&pStream);
+      if (error)
+         return error;
+
+      try
+      {
+         pStream->exceptions(std::ostream::failbit | std::ostream::badbit);
+
+         std::ostream& os = *pStream;
+         os << kPersistentIndexHeader << "\n";
+         for (IndexMap::const_iterator it = indexes_.begin();
+              it != indexes_.end();
+              ++it)
+         {
+            FileInfo fileInfo = files_.fileInfo(it->first);
+            os << "F\t" << escapeIndexField(fileInfo.absolutePath())
+               << "\t" << fileInfo.lastWriteTime()
+               << "\t" << fileInfo.size() << "\n";
+
+            BOOST_FOREACH(const r_util::RSourceItem& item,
+                          it->second->items())
+            {
+               os << "I\t" << item.type()
+                  << "\t" << item.braceLevel()
+                  << "\t" << item.line()
+                  << "\t" << item.column()
+                  << "\t" << escapeIndexField(item.name());
+
+               BOOST_FOREACH(const r_util::RS4MethodParam& param,
+                             item.signature())
+               {
+                  os << "\t" << escapeIndexField(param.name())
+                     << "\t" << escapeIndexField(param.type());
+               }
+
+               os << "\n";
+            }
+         }
 
-      // do the find (will use Entry::operator< for equivilance test)
-      std::set<Entry>::iterator it = entries_.find(entry);
-      if (it != entries_.end())
-         entries_.erase(it);
+         os.flush();
+      }
+      catch(const std::exception& e)
+      {
+         Error error = systemError(boost::system::errc::io_error,
+                                   ERROR_LOCATION);
+         error.addProperty("what", e.what());
+         error.addProperty("path", filePath.absolutePath());
+         return error;
+      }
+
+      return Success();
    }
 
    static bool isSourceFile(const FileInfo& fileInfo)
@@ -446,12 +1221,46 @@ private:
    }
 
 private:
-   // index entries
-   std::set<Entry> entries_;
+   // files we are managing (a project's listing includes many files with
+   // the same names so we keep it compact) and the indexes of those which
+   // have one
+   CompactFileTree files_;
+   typedef boost::unordered_map<CompactFileTree::NodeId,
+                                boost::shared_ptr<r_util::RSourceIndex> >
+                                                                  IndexMap;
+   IndexMap indexes_;
+
+   // symbols defined by the entries
+   SymbolIndex symbolIndex_;
 
    // indexing queue
    bool indexing_;
    std::queue<core::system::FileChangeEvent> indexingQueue_;
+
+   // jobs submitted to the indexing workers (per-path generations
+   // identify the most recent job for a file and the epoch changes
+   // whenever the index is cleared)
+   struct PendingPath
+   {
+      PendingPath() : generation(0), jobs(0) {}
+      std::size_t generation;
+      std::size_t jobs;
+   };
+   std::size_t epoch_;
+   std::size_t nextGeneration_;
+   std::size_t pendingJobs_;
+   std::map<std::string,PendingPath> pendingPaths_;
+   bool pollingResults_;
+
+   // throughput of the current batch of indexing
+   boost::posix_time::ptime batchStart_;
+   std::size_t batchFiles_;
+
+   // persistent index
+   bool persistentIndexLoaded_;
+   bool persistentIndexDirty_;
+   bool saveScheduled_;
+   PersistentIndex persistentIndex_;
 };
 
 // global source file index
@@ -1372,9 +2181,17 @@ Error findFunctionInSearchPath(const json::JsonRpcRequest& request,
    return Success();
 }
 
-void onFileMonitorEnabled(const tree<core::FileInfo>& files)
+void onFileMonitorEnabled(const CompactFileTree& files)
 {
-   s_projectIndex.enqueFiles(files.begin_leaf(), files.end_leaf());
+   std::vector<FileInfo> sourceFiles;
+   for (CompactFileTree::NodeId id = files.root();
+        id != CompactFileTree::kNoNode;
+        id = files.next(id))
+   {
+      if (!files.isDirectory(id))
+         sourceFiles.push_back(files.fileInfo(id));
+   }
+   s_projectIndex.enqueFiles(sourceFiles.begin(), sourceFiles.end());
 }
 
 void onFilesChanged(const std::vector<core::system::FileChangeEvent>& events)
@@ -1391,6 +2208,12 @@ void onFileMonitorDisabled()
    s_projectIndex.clear();
 }
 
+void onShutdown(bool)
+{
+   // write any index changes which are still waiting for idle time
+   s_projectIndex.flush();
+}
+
    
 } // anonymous namespace
    
@@ -1405,6 +2228,8 @@ Error initialize()
    projects::projectContext().subscribeToFileMonitor("R source file indexing",
                                                      cb);
 
+   module_context::events().onShutdown.connect(onShutdown);
+
    using boost::bind;
    using namespace module_context;
    ExecBlock initBlock ;
@@ -13,18 +13,27 @@
 
 #include "SessionData.hpp"
 
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <list>
 #include <string>
 #include <vector>
 #include <sstream>
 
 #include <boost/bind.hpp>
 #include <boost/format.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 
 #include <core/Log.hpp>
 #include <core/Error.hpp>
 #include <core/Exec.hpp>
 #include <core/FileSerializer.hpp>
+#include <core/SafeConvert.hpp>
 #include <core/StringUtils.hpp>
+#include <core/system/System.hpp>
 
 #define R_INTERNAL_FUNCTIONS
 #include <r/RInternal.hpp>
@@ -75,163 +84,647 @@ void appendTH(std::string* pHTML, const std::string& text)
 }
 
 
-SEXP rs_viewData(SEXP dataSEXP, SEXP titleSEXP)
-{    
-   try
+// limits of the table initially shown (the client pages through the
+// rest of the data, a page of this size at a time, with get_data_chunk)
+const int kMaxColumns = 100;
+const int kMaxRows = 1000;
+
+// limits of a single chunk
+const int kMaxChunkColumns = 200;
+const int kMaxChunkRows = 5000;
+
+// data viewers we keep (the least recently used are released beyond this)
+const std::size_t kMaxDataViewers = 5;
+
+// row orders we keep for each viewer
+const std::size_t kMaxRowOrders = 4;
+
+// how the numbers of a column are shown: like format, with enough
+// digits (up to getOption("digits") significant digits) for every value
+// of the column and in scientific notation only when that is narrower
+struct NumberFormat
+{
+   NumberFormat() : scientific(false), digits(0) {}
+   bool scientific;
+   int digits; // decimal places (fixed) or significant digits (scientific)
+};
+
+NumberFormat numberFormat(const double* pValues, int length, int maxDigits)
+{
+   int maxSig = 1;
+   int maxDecimals = 0;
+   int maxExp = 0, minExp = 0;
+   bool negative = false, any = false;
+   char buffer[64];
+   for (int i = 0; i < length; i++)
    {
-      // validate title
-      if (!Rf_isString(titleSEXP) || Rf_length(titleSEXP) != 1)
-         throw r::exec::RErrorException("invalid title argument");
-           
-      // validate data
-      if (TYPEOF(dataSEXP) != VECSXP)
-         throw r::exec::RErrorException("invalid data argument (not a list)");
-      
-      // validate names (View ensures that length(names) == length(data))
-      SEXP namesSEXP = Rf_getAttrib(dataSEXP, R_NamesSymbol);
-      if (TYPEOF(namesSEXP) != STRSXP || 
-          Rf_length(namesSEXP) != Rf_length(dataSEXP))
+      double value = pValues[i];
+      if (!R_FINITE(value))
+         continue;
+      if (value < 0)
+         negative = true;
+      if (value == 0)
+         continue;
+
+      // significant digits and exponent of the value (rounded to
+      // maxDigits significant digits)
+      ::snprintf(buffer, sizeof(buffer), "%.*e", maxDigits - 1, value);
+      const char* mantissa = buffer + (value < 0 ? 1 : 0);
+      int exponent = std::atoi(std::strchr(mantissa, 'e') + 1);
+      int sig = maxDigits;
+      while (sig > 1 && mantissa[sig] == '0') // (mantissa is d.ddd...)
+         sig--;
+
+      maxSig = std::max(maxSig, sig);
+      maxDecimals = std::max(maxDecimals, sig - 1 - exponent);
+      if (!any)
       {
-         throw r::exec::RErrorException(
-                              "invalid data argument (names not specified)");
+         maxExp = minExp = exponent;
+         any = true;
       }
+      maxExp = std::max(maxExp, exponent);
+      minExp = std::min(minExp, exponent);
+   }
 
-      // get column count
-      int columnCount = r::sexp::length(dataSEXP);
+   NumberFormat format;
+   maxDecimals = std::min(maxDecimals, 15);
+   int fixedWidth = (negative ? 1 : 0) + std::max(maxExp + 1, 1) +
+                    (maxDecimals > 0 ? maxDecimals + 1 : 0);
+   int sciWidth = (negative ? 1 : 0) + maxSig + (maxSig > 1 ? 1 : 0) +
+                  ((maxExp >= 100 || minExp <= -100) ? 5 : 4);
+   if (any && fixedWidth > sciWidth)
+   {
+      format.scientific = true;
+      format.digits = maxSig;
+   }
+   else
+   {
+      format.digits = maxDecimals;
+   }
+   return format;
+}
 
-      // calculate columns to display
-      const int kMaxColumns = 100;
-      int displayedColumns = std::min(columnCount, kMaxColumns);
+std::string formatNumber(double value, const NumberFormat& format)
+{
+   if (ISNA(value))
+      return "NA";
+   else if (ISNAN(value))
+      return "NaN";
+   else if (!R_FINITE(value))
+      return value > 0 ? "Inf" : "-Inf";
+
+   char buffer[512];
+   if (format.scientific)
+      ::snprintf(buffer, sizeof(buffer), "%.*e", format.digits - 1, value);
+   else
+      ::snprintf(buffer, sizeof(buffer), "%.*f", format.digits, value);
+   return buffer;
+}
 
-      // extract title and column names
-      std::string title = r::sexp::asString(titleSEXP);
-      std::vector<std::string> columnNames;
-      Error error = r::sexp::extract(namesSEXP, &columnNames);
-      if (error)
-         throw r::exec::RErrorException("invalid names: " +
-                                        error.code().message());
+// columns we format ourselves (plain numbers, logicals and strings). the
+// values of other columns (e.g. factors and dates) are converted to
+// strings by R as they are needed
+bool isPlainColumn(SEXP columnSEXP)
+{
+   switch(TYPEOF(columnSEXP))
+   {
+      case REALSXP:
+      case INTSXP:
+      case LGLSXP:
+      case STRSXP:
+         return Rf_getAttrib(columnSEXP, R_ClassSymbol) == R_NilValue;
+      default:
+         return false;
+   }
+}
 
-      // truncate columns names to displayedColumns
-      columnNames.resize(displayedColumns);
+// convert the given rows of a column (all of them if pRows is null) to
+// strings, in the order of the rows
+Error asCharacter(SEXP columnSEXP,
+                  const std::vector<int>* pRows,
+                  SEXP* pResultSEXP,
+                  r::sexp::Protect* pProtect)
+{
+   r::exec::RFunction formatColumn(".rs.formatDataColumn");
+   formatColumn.addParam(columnSEXP);
+   if (pRows)
+   {
+      std::vector<int> indexes(pRows->size());
+      for (std::size_t i = 0; i < pRows->size(); i++)
+         indexes[i] = (*pRows)[i] + 1;
+      formatColumn.addParam(r::sexp::create(indexes, pProtect));
+   }
+   else
+   {
+      formatColumn.addParam(R_NilValue);
+   }
+
+   Error error = formatColumn.call(pResultSEXP, pProtect);
+   if (error)
+      return error;
+   if (TYPEOF(*pResultSEXP) != STRSXP)
+      return Error(json::errc::ParamTypeMismatch, ERROR_LOCATION);
+   return Success();
+}
+
+// orders rows by the values of a (plain) column (missing values always last)
+class RowComparator
+{
+public:
+   RowComparator(SEXP columnSEXP, bool descending)
+      : columnSEXP_(columnSEXP),
+        length_(r::sexp::length(columnSEXP)),
+        descending_(descending)
+   {
+   }
+
+   bool operator()(int a, int b) const
+   {
+      bool aMissing = isMissing(a), bMissing = isMissing(b);
+      if (aMissing || bMissing)
+         return !aMissing && bMissing;
 
-      // get column lenghts and then calculate # of rows based on the maximum #
-      // of elements in single column (technically R can pass columns which have
-      // a disparate # of rows to this method)
-      int rowCount = 0;
-      std::vector<int> columnLengths;
-      for (int i=0; i<displayedColumns; i++)
+      int result;
+      switch(TYPEOF(columnSEXP_))
       {
-          // get the column and record its length (updating rowCount)
-          SEXP columnSEXP = VECTOR_ELT(dataSEXP, i);
-          int columnLength = r::sexp::length(columnSEXP);
-          columnLengths.push_back(columnLength);
-          rowCount = std::max(columnLength, rowCount);
-
-          // validate data type (R converts all inbound vectors to REAL or STR)
-          if (TYPEOF(columnSEXP) != REALSXP && TYPEOF(columnSEXP) != STRSXP)
-          {
-             throw r::exec::RErrorException("Unexpected type for column: "
-                                            + r::sexp::typeAsString(columnSEXP));
-          }
+         case REALSXP:
+            result = compare(REAL(columnSEXP_)[a], REAL(columnSEXP_)[b]);
+            break;
+         case INTSXP:
+            result = compare(INTEGER(columnSEXP_)[a], INTEGER(columnSEXP_)[b]);
+            break;
+         case LGLSXP:
+            result = compare(LOGICAL(columnSEXP_)[a], LOGICAL(columnSEXP_)[b]);
+            break;
+         default:
+            result = std::strcmp(CHAR(STRING_ELT(columnSEXP_, a)),
+                                 CHAR(STRING_ELT(columnSEXP_, b)));
+            break;
       }
 
-      // calculate rows to display
-      const int kMaxRows = 1000;
-      int displayedRows = std::min(rowCount, kMaxRows);
+      return descending_ ? result > 0 : result < 0;
+   }
+
+private:
+   template <typename T>
+   static int compare(T a, T b)
+   {
+      return a < b ? -1 : (a > b ? 1 : 0);
+   }
+
+   bool isMissing(int row) const
+   {
+      if (row >= length_)
+         return true;
+
+      switch(TYPEOF(columnSEXP_))
+      {
+         case REALSXP:
+            return ISNAN(REAL(columnSEXP_)[row]);
+         case INTSXP:
+            return INTEGER(columnSEXP_)[row] == NA_INTEGER;
+         case LGLSXP:
+            return LOGICAL(columnSEXP_)[row] == NA_LOGICAL;
+         default:
+            return STRING_ELT(columnSEXP_, row) == NA_STRING;
+      }
+   }
+
+private:
+   SEXP columnSEXP_;
+   int length_;
+   bool descending_;
+};
+
+typedef boost::shared_ptr<const std::vector<int> > RowOrder;
+
+// a formatted value (missing values have no text)
+struct Cell
+{
+   Cell() : missing(true) {}
+   bool missing;
+   std::string text;
+};
+
+// data shown in a data viewer. the columns being viewed are kept as they
+// are and only the rows the client asks for are formatted. sorting or
+// filtering the data produces a row order (the indexes of the rows to
+// show) which is cached so the client can page through it. note that
+// strings are sorted by their bytes rather than collated
+class DataViewer : boost::noncopyable
+{
+public:
+   // rowNamesSEXP is R_NilValue if the rows aren't named, otherwise the
+   // names are shown as the first column. numbers are shown with up to
+   // digits significant digits
+   DataViewer(SEXP dataSEXP,
+              SEXP rowNamesSEXP,
+              const std::string& title,
+              const std::vector<std::string>& columnNames,
+              int digits)
+      : data_(dataSEXP),
+        rowNames_(rowNamesSEXP),
+        title_(title),
+        columnNames_(columnNames),
+        digits_(digits),
+        rowCount_(0),
+        numberFormats_(columnNames.size())
+   {
+      for (std::size_t i = 0; i < columnNames_.size(); i++)
+         rowCount_ = std::max(rowCount_, r::sexp::length(column(i)));
+   }
+
+   // COPYING: boost::noncopyable
+
+   const std::string& title() const { return title_; }
+   int rowCount() const { return rowCount_; }
+   int columnCount() const { return static_cast<int>(columnNames_.size()); }
+   const std::string& columnName(int col) const { return columnNames_[col]; }
+
+   // formatted values of the given rows of a column
+   void formatColumn(int col,
+                     const std::vector<int>& rows,
+                     std::vector<Cell>* pCells)
+   {
+      pCells->assign(rows.size(), Cell());
+
+      SEXP columnSEXP = column(col);
+      if (isPlainColumn(columnSEXP))
+      {
+         for (std::size_t i = 0; i < rows.size(); i++)
+            formatValue(col, columnSEXP, rows[i], &(*pCells)[i]);
+         return;
+      }
 
-      // format the data for presentation
       r::sexp::Protect rProtect;
-      SEXP formattedDataSEXP = Rf_allocVector(VECSXP, displayedColumns);
-      rProtect.add(formattedDataSEXP);
-      for (int i=0; i<displayedColumns; i++)
+      SEXP stringsSEXP;
+      Error error = asCharacter(columnSEXP, &rows, &stringsSEXP, &rProtect);
+      if (error)
       {
-         SEXP columnSEXP = VECTOR_ELT(dataSEXP, i);
-         SEXP formattedColumnSEXP;
-         r::exec::RFunction formatFx(".rs.formatDataColumn");
-         formatFx.addParam(columnSEXP);
-         formatFx.addParam(displayedRows);
-         Error error = formatFx.call(&formattedColumnSEXP, &rProtect);
-         if (error)
-            throw r::exec::RErrorException(error.summary());
-         SET_VECTOR_ELT(formattedDataSEXP, i, formattedColumnSEXP);
-       }
-
-      // write html header
-      boost::format headerFmt(
-         "<html>\n"
-         "  <head>\n"
-         "     <title>%1%</title>\n"
-         "     <meta charset=\"utf-8\"/>\n"
-         "     <link rel=\"stylesheet\" type=\"text/css\" href=\"css/data.css\"/>\n"
-         "  </head>\n"
-         "  <body>\n");
-      std::string html = boost::str(headerFmt % title);
-
-      // output begin table & header
-      html += "<table>\n";
-      html += "<thead><tr>\n";
-      html += "<td id=\"origin\">&nbsp;</td>"; // above row numbers
-      std::for_each(columnNames.begin(),
-                    columnNames.end(),
-                    boost::bind(appendTH, &html, _1));
-      html += "\n</tr></thead>\n";
-
-      html += "<tbody>\n";
-      // output rows
-      for (int row=0; row<displayedRows; row++)
+         LOG_ERROR(error);
+         return;
+      }
+      for (std::size_t i = 0; i < rows.size(); i++)
+         formatValue(col, stringsSEXP, static_cast<int>(i), &(*pCells)[i]);
+   }
+
+   // order of the rows for a sort (sortColumn is -1 for none) and filter
+   // (rows which contain the filter text, ignoring case, in filterColumn
+   // or in any column if it is -1). null if the rows are in their
+   // original order
+   RowOrder rowOrder(int sortColumn,
+                     bool descending,
+                     int filterColumn,
+                     const std::string& filter)
+   {
+      if (sortColumn < 0 && filter.empty())
+         return RowOrder();
+
+      std::string key = safe_convert::numberToString(sortColumn) + " " +
+                        safe_convert::numberToString(descending) + " " +
+                        safe_convert::numberToString(filterColumn) + " " +
+                        filter;
+      for (RowOrders::iterator it = rowOrders_.begin();
+           it != rowOrders_.end();
+           ++it)
       {
-         html += "<tr>\n";
+         if (it->first == key)
+         {
+            rowOrders_.splice(rowOrders_.begin(), rowOrders_, it);
+            return it->second;
+         }
+      }
 
-         // row number
-         appendTD(&html, safe_convert::numberToString(row+1), "rn");
+      boost::shared_ptr<std::vector<int> > pRows(new std::vector<int>());
+      if (!filter.empty())
+      {
+         // filter the sorted rows (which we usually have already)
+         RowOrder pSorted = rowOrder(sortColumn, descending, -1, "");
+         std::vector<int> rows;
+         if (pSorted)
+            rows = *pSorted;
+         else
+            rows = allRows();
+         filterRows(rows, filterColumn, filter, pRows.get());
+      }
+      else
+      {
+         *pRows = allRows();
 
-         // output a data element from each column where this row is available
-         for (int col=0; col<Rf_length(formattedDataSEXP); col++)
+         // (columns which we don't format ourselves are sorted by their
+         // values as strings)
+         r::sexp::Protect rProtect;
+         SEXP columnSEXP = column(sortColumn);
+         if (!isPlainColumn(columnSEXP))
          {
-            if (columnLengths[col] > row)
-            {
-               SEXP columnSEXP = VECTOR_ELT(formattedDataSEXP, col);
-               SEXP stringSEXP = STRING_ELT(columnSEXP, row);
-               if (stringSEXP != NULL &&
-                   stringSEXP != NA_STRING &&
-                   r::sexp::length(stringSEXP) > 0)
-               {
-                  std::string text(Rf_translateChar(stringSEXP));
-                  appendTD(&html, text);
-               }
-               else
-               {
-                  html += "<td>&nbsp;</td>";
-               }
-            }
-            else
+            Error error = asCharacter(columnSEXP,
+                                      NULL,
+                                      &columnSEXP,
+                                      &rProtect);
+            if (error)
+               LOG_ERROR(error);
+         }
+
+         if (isPlainColumn(columnSEXP))
+         {
+            std::stable_sort(pRows->begin(),
+                             pRows->end(),
+                             RowComparator(columnSEXP, descending));
+         }
+      }
+
+      rowOrders_.push_front(std::make_pair(key, RowOrder(pRows)));
+      if (rowOrders_.size() > kMaxRowOrders)
+         rowOrders_.pop_back();
+
+      return pRows;
+   }
+
+private:
+   bool hasRowNames() const
+   {
+      return rowNames_.get() != R_NilValue;
+   }
+
+   SEXP column(int col) const
+   {
+      if (hasRowNames())
+      {
+         if (col == 0)
+            return rowNames_.get();
+         col--;
+      }
+      return VECTOR_ELT(data_.get(), col);
+   }
+
+   std::vector<int> allRows() const
+   {
+      std::vector<int> rows(rowCount_);
+      for (int i = 0; i < rowCount_; i++)
+         rows[i] = i;
+      return rows;
+   }
+
+   // format a value of a plain column (or of the strings R converted a
+   // column to)
+   void formatValue(int col, SEXP columnSEXP, int index, Cell* pCell)
+   {
+      if (index >= r::sexp::length(columnSEXP))
+         return;
+
+      switch(TYPEOF(columnSEXP))
+      {
+         case REALSXP:
+            pCell->text = formatNumber(REAL(columnSEXP)[index],
+                                       numberFormatOf(col));
+            break;
+         case INTSXP:
+         {
+            int value = INTEGER(columnSEXP)[index];
+            pCell->text = value == NA_INTEGER ?
+                                 "NA" : safe_convert::numberToString(value);
+            break;
+         }
+         case LGLSXP:
+         {
+            int value = LOGICAL(columnSEXP)[index];
+            if (value == NA_LOGICAL)
+               return;
+            pCell->text = value ? "TRUE" : "FALSE";
+            break;
+         }
+         default:
+         {
+            SEXP stringSEXP = STRING_ELT(columnSEXP, index);
+            if (stringSEXP == NA_STRING)
+               return;
+            pCell->text = Rf_translateChar(stringSEXP);
+            break;
+         }
+      }
+      pCell->missing = false;
+   }
+
+   const NumberFormat& numberFormatOf(int col)
+   {
+      // (computed for the whole column the first time we need it so that
+      // every chunk of the column is formatted the same way)
+      if (!numberFormats_[col])
+      {
+         SEXP columnSEXP = column(col);
+         numberFormats_[col].reset(new NumberFormat(
+               numberFormat(REAL(columnSEXP),
+                            r::sexp::length(columnSEXP),
+                            digits_)));
+      }
+      return *numberFormats_[col];
+   }
+
+   // the rows (in order) which contain the filter text
+   void filterRows(const std::vector<int>& rows,
+                   int filterColumn,
+                   const std::string& filter,
+                   std::vector<int>* pMatches)
+   {
+      std::vector<bool> matches(rows.size(), false);
+      std::vector<Cell> cells;
+      int first = filterColumn >= 0 ? filterColumn : 0;
+      int last = filterColumn >= 0 ? filterColumn : columnCount() - 1;
+      for (int col = first; col <= last; col++)
+      {
+         formatColumn(col, rows, &cells);
+         for (std::size_t i = 0; i < rows.size(); i++)
+         {
+            if (!matches[i] && !cells[i].missing &&
+                boost::algorithm::icontains(cells[i].text, filter))
             {
-               html += "<td>&nbsp;</td>";
+               matches[i] = true;
             }
          }
+      }
 
-         html += "\n</tr>\n";
+      for (std::size_t i = 0; i < rows.size(); i++)
+      {
+         if (matches[i])
+            pMatches->push_back(rows[i]);
       }
-      html += "</tbody>\n";
+   }
+
+private:
+   typedef std::list<std::pair<std::string, RowOrder> > RowOrders;
+
+   r::sexp::PreservedSEXP data_;
+   r::sexp::PreservedSEXP rowNames_;
+   std::string title_;
+   std::vector<std::string> columnNames_;
+   int digits_;
+   int rowCount_;
+   std::vector<boost::shared_ptr<NumberFormat> > numberFormats_;
+   RowOrders rowOrders_; // most recently used first
+};
+
+// data viewers by id (most recently created first)
+typedef std::list<std::pair<std::string, boost::shared_ptr<DataViewer> > >
+                                                                  DataViewers;
+DataViewers s_dataViewers;
+
+boost::shared_ptr<DataViewer> dataViewer(const std::string& id)
+{
+   for (DataViewers::const_iterator it = s_dataViewers.begin();
+        it != s_dataViewers.end();
+        ++it)
+   {
+      if (it->first == id)
+         return it->second;
+   }
+   return boost::shared_ptr<DataViewer>();
+}
+
+std::string addDataViewer(const boost::shared_ptr<DataViewer>& pViewer)
+{
+   std::string id = core::system::generateShortenedUuid();
+   s_dataViewers.push_front(std::make_pair(id, pViewer));
+   if (s_dataViewers.size() > kMaxDataViewers)
+      s_dataViewers.pop_back();
+   return id;
+}
+
+std::string dataViewerHTML(DataViewer* pViewer,
+                           int displayedRows,
+                           int displayedColumns)
+{
+   // write html header
+   boost::format headerFmt(
+      "<html>\n"
+      "  <head>\n"
+      "     <title>%1%</title>\n"
+      "     <meta charset=\"utf-8\"/>\n"
+      "     <link rel=\"stylesheet\" type=\"text/css\" href=\"css/data.css\"/>\n"
+      "  </head>\n"
+      "  <body>\n");
+   std::string html = boost::str(headerFmt % pViewer->title());
+   html.reserve(html.size() + (displayedRows * (displayedColumns + 1) * 16));
+
+   // output begin table & header
+   html.append("<table>\n");
+   html.append("<thead><tr>\n");
+   html.append("<td id=\"origin\">&nbsp;</td>"); // above row numbers
+   for (int col=0; col<displayedColumns; col++)
+      appendTH(&html, pViewer->columnName(col));
+   html.append("\n</tr></thead>\n");
+
+   // format the displayed rows of each column
+   std::vector<int> rows(displayedRows);
+   for (int row=0; row<displayedRows; row++)
+      rows[row] = row;
+   std::vector<std::vector<Cell> > columns(displayedColumns);
+   for (int col=0; col<displayedColumns; col++)
+      pViewer->formatColumn(col, rows, &columns[col]);
+
+   html.append("<tbody>\n");
+   // output rows
+   for (int row=0; row<displayedRows; row++)
+   {
+      html.append("<tr>\n");
+
+      // row number
+      appendTD(&html, safe_convert::numberToString(row+1), "rn");
+
+      // output a data element from each column where this row is available
+      for (int col=0; col<displayedColumns; col++)
+      {
+         const Cell& cell = columns[col][row];
+         if (!cell.missing && !cell.text.empty())
+            appendTD(&html, cell.text);
+         else
+            html.append("<td>&nbsp;</td>");
+      }
+
+      html.append("\n</tr>\n");
+   }
+   html.append("</tbody>\n");
+
+   // append table footer
+   html.append("\n</table>\n");
+
+   // append document footer
+   html.append("</body></html>\n");
 
-      // append table footer
-      html += "\n</table>\n";
+   return html;
+}
 
-      // append document footer
-      html += "</body></html>\n";
 
+SEXP rs_viewData(SEXP dataSEXP, SEXP rowNamesSEXP, SEXP titleSEXP)
+{
+   try
+   {
+      // validate title
+      if (!Rf_isString(titleSEXP) || Rf_length(titleSEXP) != 1)
+         throw r::exec::RErrorException("invalid title argument");
+
+      // validate data
+      if (TYPEOF(dataSEXP) != VECSXP)
+         throw r::exec::RErrorException("invalid data argument (not a list)");
+
+      // validate names (View ensures that length(names) == length(data))
+      SEXP namesSEXP = Rf_getAttrib(dataSEXP, R_NamesSymbol);
+      if (TYPEOF(namesSEXP) != STRSXP ||
+          Rf_length(namesSEXP) != Rf_length(dataSEXP))
+      {
+         throw r::exec::RErrorException(
+                              "invalid data argument (names not specified)");
+      }
+
+      // validate row names
+      if (rowNamesSEXP != R_NilValue && !Rf_isVectorAtomic(rowNamesSEXP))
+         throw r::exec::RErrorException("invalid row names argument");
+
+      // extract title and column names (row names are the first column)
+      std::string title = r::sexp::asString(titleSEXP);
+      std::vector<std::string> columnNames;
+      Error error = r::sexp::extract(namesSEXP, &columnNames);
+      if (error)
+         throw r::exec::RErrorException("invalid names: " +
+                                        error.code().message());
+      if (rowNamesSEXP != R_NilValue)
+         columnNames.insert(columnNames.begin(), "row.names");
+      int columnCount = static_cast<int>(columnNames.size());
+
+      // keep the data for the viewer (technically R can pass columns which
+      // have a disparate # of rows to this method so the # of rows is the
+      // maximum # of elements in a single column)
+      // (format only allows 1 to 22 digits, we stop at the 17 which
+      // are needed to tell any two doubles apart)
+      int digits = r::options::getOption<int>("digits", 7);
+      digits = std::max(1, std::min(digits, 17));
+      boost::shared_ptr<DataViewer> pViewer(new DataViewer(dataSEXP,
+                                                           rowNamesSEXP,
+                                                           title,
+                                                           columnNames,
+                                                           digits));
+      std::string viewerId = addDataViewer(pViewer);
+      int rowCount = pViewer->rowCount();
+
+      // calculate rows and columns to display initially
+      int displayedColumns = std::min(columnCount, kMaxColumns);
+      int displayedRows = std::min(rowCount, kMaxRows);
+      std::string html = dataViewerHTML(pViewer.get(),
+                                        displayedRows,
+                                        displayedColumns);
 
       // compute variables based on presence of row.names
       int variables = columnCount;
-      if (columnNames.size() > 0 && columnNames[0] == "row.names")
+      if (rowNamesSEXP != R_NilValue)
          variables--;
 
       // fire show data event
       json::Object dataItem;
       dataItem["title"] = title;
+      dataItem["viewerId"] = viewerId;
       dataItem["totalObservations"] = rowCount;
       dataItem["displayedObservations"] = displayedRows;
       dataItem["variables"] = variables;
+      dataItem["totalColumns"] = columnCount;
       dataItem["displayedVariables"] = displayedColumns;
       dataItem["contentUrl"] = content_urls::provision(title, html, ".htm");
       ClientEvent event(client_events::kShowData, dataItem);
@@ -245,11 +738,125 @@ SEXP rs_viewData(SEXP dataSEXP, SEXP titleSEXP)
       r::exec::error(e.message());
    }
    CATCH_UNEXPECTED_EXCEPTION
-   
+
    // keep compiler happy
    return R_NilValue;
 }
-  
+
+// return a window of the data (in the order given by the sort and filter)
+Error getDataChunk(const json::JsonRpcRequest& request,
+                   json::JsonRpcResponse* pResponse)
+{
+   std::string viewerId, filter;
+   int startRow, rowCount, startColumn, columnCount, sortColumn, filterColumn;
+   bool sortDescending;
+   Error error = json::readParams(request.params,
+                                  &viewerId,
+                                  &startRow,
+                                  &rowCount,
+                                  &startColumn,
+                                  &columnCount,
+                                  &sortColumn,
+                                  &sortDescending,
+                                  &filterColumn,
+                                  &filter);
+   if (error)
+      return error;
+
+   // the viewer may have been released (or the session restarted)
+   boost::shared_ptr<DataViewer> pViewer = dataViewer(viewerId);
+   if (!pViewer)
+   {
+      Error error(json::errc::ParamInvalid, ERROR_LOCATION);
+      pResponse->setError(error,
+                          json::Value("The data is no longer available"));
+      return Success();
+   }
+
+   if (sortColumn >= pViewer->columnCount())
+      sortColumn = -1;
+   if (filterColumn >= pViewer->columnCount())
+      filterColumn = -1;
+   RowOrder pRows = pViewer->rowOrder(sortColumn,
+                                      sortDescending,
+                                      filterColumn,
+                                      filter);
+   int totalRows = pRows ? static_cast<int>(pRows->size())
+                         : pViewer->rowCount();
+
+   // clip the window to the data
+   startRow = std::max(0, std::min(startRow, totalRows));
+   int endRow = startRow + std::max(0, std::min(rowCount, kMaxChunkRows));
+   endRow = std::min(endRow, totalRows);
+   startColumn = std::max(0, std::min(startColumn, pViewer->columnCount()));
+   int endColumn = startColumn +
+                   std::max(0, std::min(columnCount, kMaxChunkColumns));
+   endColumn = std::min(endColumn, pViewer->columnCount());
+
+   json::Array columnsJson;
+   for (int col = startColumn; col < endColumn; col++)
+      columnsJson.push_back(pViewer->columnName(col));
+
+   // format the window a column at a time
+   std::vector<int> rows;
+   for (int i = startRow; i < endRow; i++)
+      rows.push_back(pRows ? (*pRows)[i] : i);
+   std::vector<std::vector<Cell> > columns(endColumn - startColumn);
+   for (int col = startColumn; col < endColumn; col++)
+      pViewer->formatColumn(col, rows, &columns[col - startColumn]);
+
+   // each row is its (1-based) row number followed by its values (null
+   // for missing values)
+   json::Array rowsJson;
+   for (std::size_t i = 0; i < rows.size(); i++)
+   {
+      json::Array rowJson;
+      rowJson.push_back(rows[i] + 1);
+      for (std::size_t col = 0; col < columns.size(); col++)
+      {
+         const Cell& cell = columns[col][i];
+         if (!cell.missing)
+            rowJson.push_back(cell.text);
+         else
+            rowJson.push_back(json::Value());
+      }
+      rowsJson.push_back(rowJson);
+   }
+
+   json::Object chunkJson;
+   chunkJson["viewerId"] = viewerId;
+   chunkJson["totalRows"] = totalRows;
+   chunkJson["totalColumns"] = pViewer->columnCount();
+   chunkJson["startRow"] = startRow;
+   chunkJson["startColumn"] = startColumn;
+   chunkJson["columns"] = columnsJson;
+   chunkJson["rows"] = rowsJson;
+   pResponse->setResult(chunkJson);
+
+   return Success();
+}
+
+Error removeDataViewer(const json::JsonRpcRequest& request,
+                       json::JsonRpcResponse* pResponse)
+{
+   std::string viewerId;
+   Error error = json::readParams(request.params, &viewerId);
+   if (error)
+      return error;
+
+   for (DataViewers::iterator it = s_dataViewers.begin();
+        it != s_dataViewers.end();
+        ++it)
+   {
+      if (it->first == viewerId)
+      {
+         s_dataViewers.erase(it);
+         break;
+      }
+   }
+
+   return Success();
+}
 
 } // anonymous namespace
    
@@ -259,7 +866,7 @@ Error initialize()
    R_CallMethodDef methodDef ;
    methodDef.name = "rs_viewData" ;
    methodDef.fun = (DL_FUNC) rs_viewData ;
-   methodDef.numArgs = 2;
+   methodDef.numArgs = 3;
    r::routines::addCallMethod(methodDef);
 
    using boost::bind;
@@ -267,6 +874,8 @@ Error initialize()
    using namespace session::module_context;
    ExecBlock initBlock ;
    initBlock.addFunctions()
+      (bind(registerRpcMethod, "get_data_chunk", getDataChunk))
+      (bind(registerRpcMethod, "remove_data_viewer", removeDataViewer))
       (bind(sourceModuleRFile, "SessionData.R"));
    
    return initBlock.execute();
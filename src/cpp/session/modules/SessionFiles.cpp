@@ -714,7 +714,15 @@ void setAttachmentResponse(const http::Request& request,
                         "attachment; filename*=UTF-8''"
                         + http::util::urlEncode(filename, false));
    pResponse->setHeader("Content-Type", "application/octet-stream");
-   pResponse->setBody(attachmentPath);
+
+   // stream the file rather than reading it into memory (exports can be
+   // arbitrarily large)
+   Error error = pResponse->setStreamFile(attachmentPath);
+   if (error)
+   {
+      LOG_ERROR(error);
+      pResponse->setError(error);
+   }
 }
    
 void handleMultipleFileExportRequest(const http::Request& request, 
@@ -890,9 +898,9 @@ Error initialize()
    using boost::bind;
    ExecBlock initBlock ;
    initBlock.addFunctions()
-      (bind(registerRpcMethod, "stat", stat))
-      (bind(registerRpcMethod, "is_text_file", isTextFile))
-      (bind(registerRpcMethod, "list_files", listFiles))
+      (bind(registerRFreeRpcMethod, "stat", stat))
+      (bind(registerRFreeRpcMethod, "is_text_file", isTextFile))
+      (bind(registerRFreeRpcMethod, "list_files", listFiles))
       (bind(registerRpcMethod, "create_folder", createFolder))
       (bind(registerRpcMethod, "delete_files", deleteFiles))
       (bind(registerRpcMethod, "copy_file", copyFile))
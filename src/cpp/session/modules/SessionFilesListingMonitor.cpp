@@ -22,6 +22,7 @@
 #include <core/Log.hpp>
 #include <core/FileInfo.hpp>
 #include <core/FilePath.hpp>
+#include <core/Thread.hpp>
 
 #include <core/json/JsonRpc.hpp>
 
@@ -76,17 +77,28 @@ Error FilesListingMonitor::start(const FilePath& filePath, json::Array* pJsonFil
 void FilesListingMonitor::stop()
 {
    // reset monitored path and unregister any existing handle
-   currentPath_ = FilePath();
-   if (!currentHandle_.empty())
+   LOCK_MUTEX(mutex_)
    {
-      core::system::file_monitor::unregisterMonitor(currentHandle_);
-      currentHandle_ = core::system::file_monitor::Handle();
+      currentPath_ = FilePath();
+      if (!currentHandle_.empty())
+      {
+         core::system::file_monitor::unregisterMonitor(currentHandle_);
+         currentHandle_ = core::system::file_monitor::Handle();
+      }
    }
+   END_LOCK_MUTEX
 }
 
-const FilePath& FilesListingMonitor::currentMonitoredPath() const
+FilePath FilesListingMonitor::currentMonitoredPath() const
 {
-   return currentPath_;
+   LOCK_MUTEX(mutex_)
+   {
+      return currentPath_;
+   }
+   END_LOCK_MUTEX
+
+   // keep compiler happy
+   return FilePath();
 }
 
 namespace {
@@ -125,18 +137,26 @@ FileInfo normalizeFileScannerPath(const FileInfo& fileInfo)
 void FilesListingMonitor::onRegistered(core::system::file_monitor::Handle handle,
                                        const FilePath& filePath,
                                        const std::vector<FileInfo>& prevFiles,
-                                       const tree<core::FileInfo>& files)
+                                       const core::CompactFileTree& files)
 {
    // set path and current handle
-   currentPath_ = filePath;
-   currentHandle_ = handle;
+   LOCK_MUTEX(mutex_)
+   {
+      currentPath_ = filePath;
+      currentHandle_ = handle;
+   }
+   END_LOCK_MUTEX
 
    // normalize scanned file paths (see comment above for explanation)
+   // (children of the tree aren't ordered so sort them as scanFiles does)
    std::vector<FileInfo> currFiles;
-   std::transform(files.begin(files.begin()),
-                  files.end(files.begin()),
-                  std::back_inserter(currFiles),
-                  normalizeFileScannerPath);
+   for (core::CompactFileTree::NodeId id = files.firstChild(files.root());
+        id != core::CompactFileTree::kNoNode;
+        id = files.nextSibling(id))
+   {
+      currFiles.push_back(normalizeFileScannerPath(files.fileInfo(id)));
+   }
+   std::sort(currFiles.begin(), currFiles.end(), core::fileInfoPathLessThan);
 
    // compare the previously returned listing with the initial scan to see if any
    // file changes occurred between listings
@@ -159,11 +179,15 @@ void FilesListingMonitor::onUnregistered(core::system::file_monitor::Handle hand
    // comes in. however, it is possible that our monitor could be unregistered
    // as a result of an error which occurs during monitoring. in this case
    // we clear our state explicitly here as well
-   if (currentHandle_ == handle)
+   LOCK_MUTEX(mutex_)
    {
-      currentPath_ = FilePath();
-      currentHandle_ = core::system::file_monitor::Handle();
+      if (currentHandle_ == handle)
+      {
+         currentPath_ = FilePath();
+         currentHandle_ = core::system::file_monitor::Handle();
+      }
    }
+   END_LOCK_MUTEX
 }
 
 Error FilesListingMonitor::listFiles(const FilePath& rootPath,
@@ -19,7 +19,9 @@
 
 #include <boost/utility.hpp>
 
-#include <core/collection/Tree.hpp>
+#include <core/BoostThread.hpp>
+
+#include <core/CompactFileTree.hpp>
 
 #include <core/json/Json.hpp>
 #include <core/system/FileMonitor.hpp>
@@ -51,7 +53,7 @@ public:
    void stop();
 
    // what path are we currently monitoring?
-   const core::FilePath& currentMonitoredPath() const;
+   core::FilePath currentMonitoredPath() const;
 
    // convenience method which is also called by listFiles for requests that
    // don't specify monitoring (e.g. file dialog listing)
@@ -67,7 +69,7 @@ private:
    void onRegistered(core::system::file_monitor::Handle handle,
                      const core::FilePath& filePath,
                      const std::vector<core::FileInfo>& prevFiles,
-                     const tree<core::FileInfo>& files);
+                     const core::CompactFileTree& files);
 
    void onUnregistered(core::system::file_monitor::Handle handle);
 
@@ -77,6 +79,9 @@ private:
                                 core::json::Array* pJsonFiles);
 
 private:
+   // listings may be requested from rpc worker threads while the monitor
+   // callbacks run on the main thread
+   mutable boost::mutex mutex_;
    core::FilePath currentPath_;
    core::system::file_monitor::Handle currentHandle_;
 };
@@ -15,22 +15,18 @@
 
 #include <algorithm>
 
-#include <boost/algorithm/string.hpp>
 #include <boost/bind.hpp>
-#include <boost/enable_shared_from_this.hpp>
+#include <boost/foreach.hpp>
 
 #include <core/Exec.hpp>
-#include <core/StringUtils.hpp>
-#include <core/system/Environment.hpp>
-#include <core/system/Process.hpp>
-#include <core/system/ShellUtils.hpp>
-
-#include <r/RUtil.hpp>
+#include <core/system/System.hpp>
 
 #include <session/SessionModuleContext.hpp>
 #include <session/SessionUserSettings.hpp>
 #include <session/projects/SessionProjects.hpp>
 
+#include "SessionFindInFiles.hpp"
+
 using namespace core;
 
 namespace session {
@@ -188,220 +184,92 @@ FindInFilesState& findResults()
    return s_findResults;
 }
 
-class GrepOperation : public boost::enable_shared_from_this<GrepOperation>
+void onFindComplete(const std::string& handle)
 {
-public:
-   static boost::shared_ptr<GrepOperation> create(const std::string& encoding,
-                                                  const FilePath& tempFile)
-   {
-      return boost::shared_ptr<GrepOperation>(new GrepOperation(encoding,
-                                                                tempFile));
-   }
-
-private:
-   GrepOperation(const std::string& encoding,
-                 const FilePath& tempFile)
-      : firstDecodeError_(true), encoding_(encoding), tempFile_(tempFile)
-   {
-      handle_ = core::system::generateUuid(false);
-   }
-
-public:
-   std::string handle() const
-   {
-      return handle_;
-   }
-
-   core::system::ProcessCallbacks createProcessCallbacks()
-   {
-      core::system::ProcessCallbacks callbacks;
-      callbacks.onContinue = boost::bind(&GrepOperation::onContinue,
-                                         shared_from_this(),
-                                         _1);
-      callbacks.onStdout = boost::bind(&GrepOperation::onStdout,
-                                       shared_from_this(),
-                                       _1, _2);
-      callbacks.onStderr = boost::bind(&GrepOperation::onStderr,
-                                       shared_from_this(),
-                                       _1, _2);
-      callbacks.onExit = boost::bind(&GrepOperation::onExit,
-                                     shared_from_this(),
-                                     _1);
-      return callbacks;
-   }
+   findResults().onFindEnd(handle);
+   module_context::enqueClientEvent(
+         ClientEvent(client_events::kFindOperationEnded, handle));
+}
 
-private:
-   bool onContinue(const core::system::ProcessOperations& ops) const
+// periodically move results from the search to the client
+bool onFindProgress(boost::shared_ptr<FindInFilesSearch> pSearch,
+                    const std::string& handle)
+{
+   // stop if the find was stopped or superseded
+   if (!findResults().isRunning() || findResults().handle() != handle)
    {
-      return findResults().isRunning() && findResults().handle() == handle();
+      pSearch->stop();
+      onFindComplete(handle);
+      return false;
    }
 
-   std::string decode(const std::string& encoded)
-   {
-      if (encoded.empty())
-         return encoded;
+   // take the latest results
+   std::vector<FindInFilesResult> results;
+   bool searching = pSearch->takeResults(&results);
 
-      std::string decoded;
-      Error error = r::util::iconvstr(encoded, encoding_, "UTF-8", true,
-                                      &decoded);
+   json::Array files;
+   json::Array lineNums;
+   json::Array contents;
+   json::Array matchOns;
+   json::Array matchOffs;
 
-      // Log error, but only once per grep operation
-      if (error && firstDecodeError_)
-      {
-         firstDecodeError_ = false;
-         LOG_ERROR(error);
-      }
+   int recordsToProcess = MAX_COUNT + 1 - findResults().resultCount();
+   if (recordsToProcess < 0)
+      recordsToProcess = 0;
 
-      return decoded;
-   }
-
-   void processContents(std::string* pContent,
-                        json::Array* pMatchOn,
-                        json::Array* pMatchOff)
+   BOOST_FOREACH(const FindInFilesResult& result, results)
    {
-      using namespace boost;
-
-      std::string decodedLine;
-
-      std::string::iterator inputPos = pContent->begin();
-
-      smatch match;
-      while (regex_search(std::string(inputPos, pContent->end()), match,
-                          regex("\x1B\\[(\\d\\d)?m(\x1B\\[K)?")))
-      {
-         std::string match1 = match[1];
-
-         decodedLine.append(decode(
-               std::string(inputPos, inputPos + match.position())));
-
-         inputPos += match.position() + match.length();
-
-         size_t charSize;
-         Error error = string_utils::utf8Distance(decodedLine.begin(),
-                                                  decodedLine.end(),
-                                                  &charSize);
-         if (error)
-            charSize = decodedLine.size();
+      if (recordsToProcess <= 0)
+         break;
 
-         if (match1 == "01")
-            pMatchOn->push_back(static_cast<int>(charSize));
-         else
-            pMatchOff->push_back(static_cast<int>(charSize));
-      }
-      if (inputPos != pContent->end())
-         decodedLine.append(decode(std::string(inputPos, pContent->end())));
+      json::Array matchOn, matchOff;
+      std::copy(result.matchOns.begin(), result.matchOns.end(),
+                std::back_inserter(matchOn));
+      std::copy(result.matchOffs.begin(), result.matchOffs.end(),
+                std::back_inserter(matchOff));
 
-      if (decodedLine.size() > 300)
-      {
-         decodedLine = decodedLine.erase(300);
-         decodedLine.append("...");
-      }
+      files.push_back(module_context::createAliasedPath(result.file));
+      lineNums.push_back(result.lineNum);
+      contents.push_back(result.lineValue);
+      matchOns.push_back(matchOn);
+      matchOffs.push_back(matchOff);
 
-      *pContent = decodedLine;
+      recordsToProcess--;
    }
 
-   void onStdout(const core::system::ProcessOperations& ops, const std::string& data)
+   if (files.size() > 0)
    {
-      json::Array files;
-      json::Array lineNums;
-      json::Array contents;
-      json::Array matchOns;
-      json::Array matchOffs;
-
-      int recordsToProcess = MAX_COUNT + 1 - findResults().resultCount();
-      if (recordsToProcess < 0)
-         recordsToProcess = 0;
-
-      stdOutBuf_.append(data);
-      size_t nextLineStart = 0;
-      size_t pos = -1;
-      while (recordsToProcess &&
-             std::string::npos != (pos = stdOutBuf_.find('\n', pos + 1)))
-      {
-         std::string line = stdOutBuf_.substr(nextLineStart, pos - nextLineStart);
-         nextLineStart = pos + 1;
-
-         boost::smatch match;
-         if (boost::regex_match(line, match, boost::regex("^((?:[a-zA-Z]:)?[^:]+):(\\d+):(.*)")))
-         {
-            std::string file = module_context::createAliasedPath(
-                  FilePath(string_utils::systemToUtf8(match[1])));
-
-            if (file.find("/.Rproj.user/") != std::string::npos)
-               continue;
-            if (file.find("/.git/") != std::string::npos)
-               continue;
-            if (file.find("/.svn/") != std::string::npos)
-               continue;
-
-            int lineNum = safe_convert::stringTo<int>(std::string(match[2]), -1);
-            std::string lineContents = match[3];
-            boost::algorithm::trim(lineContents);
-            json::Array matchOn, matchOff;
-            processContents(&lineContents, &matchOn, &matchOff);
-
-            files.push_back(file);
-            lineNums.push_back(lineNum);
-            contents.push_back(lineContents);
-            matchOns.push_back(matchOn);
-            matchOffs.push_back(matchOff);
-
-            recordsToProcess--;
-         }
-      }
-
-      if (nextLineStart)
-      {
-         stdOutBuf_.erase(0, nextLineStart);
-      }
-
-      if (files.size() > 0)
-      {
-         json::Object result;
-         result["handle"] = handle();
-         json::Object results;
-         results["file"] = files;
-         results["line"] = lineNums;
-         results["lineValue"] = contents;
-         results["matchOn"] = matchOns;
-         results["matchOff"] = matchOffs;
-         result["results"] = results;
-
-         findResults().addResult(handle(),
-                                 files,
-                                 lineNums,
-                                 contents,
-                                 matchOns,
-                                 matchOffs);
-
-         module_context::enqueClientEvent(
-                  ClientEvent(client_events::kFindResult, result));
-      }
-
-      if (recordsToProcess <= 0)
-         findResults().onFindEnd(handle());
-   }
+      json::Object result;
+      result["handle"] = handle;
+      json::Object results;
+      results["file"] = files;
+      results["line"] = lineNums;
+      results["lineValue"] = contents;
+      results["matchOn"] = matchOns;
+      results["matchOff"] = matchOffs;
+      result["results"] = results;
+
+      findResults().addResult(handle,
+                              files,
+                              lineNums,
+                              contents,
+                              matchOns,
+                              matchOffs);
 
-   void onStderr(const core::system::ProcessOperations& ops, const std::string& data)
-   {
-      LOG_ERROR_MESSAGE("grep: " + data);
+      module_context::enqueClientEvent(
+               ClientEvent(client_events::kFindResult, result));
    }
 
-   void onExit(int exitCode)
+   // done if we have all the results we can show or the search is complete
+   if (recordsToProcess <= 0 || !searching)
    {
-      findResults().onFindEnd(handle());
-      module_context::enqueClientEvent(
-            ClientEvent(client_events::kFindOperationEnded, handle()));
-      if (!tempFile_.empty())
-         tempFile_.removeIfExists();
+      pSearch->stop();
+      onFindComplete(handle);
+      return false;
    }
 
-   bool firstDecodeError_;
-   std::string encoding_;
-   FilePath tempFile_;
-   std::string stdOutBuf_;
-   std::string handle_;
-};
+   return true;
+}
 
 } // namespace
 
@@ -422,91 +290,41 @@ core::Error beginFind(const json::JsonRpcRequest& request,
    if (error)
       return error;
 
-   core::system::ProcessOptions options;
-
-   core::system::Options childEnv;
-   core::system::environment(&childEnv);
-   core::system::setenv(&childEnv, "GREP_COLOR", "01");
-   core::system::setenv(&childEnv, "GREP_COLORS", "ne:fn=:ln=:se=:mt=01");
-#ifdef _WIN32
-   FilePath gnuGrepPath = session::options().gnugrepPath();
-   core::system::addToPath(
-            &childEnv,
-            string_utils::utf8ToSystem(gnuGrepPath.absolutePath()));
-#endif
-   options.environment = childEnv;
-
-   // Put the grep pattern in a file
-   FilePath tempFile = module_context::tempFile("rs_grep", "txt");
-   boost::shared_ptr<std::ostream> pStream;
-   error = tempFile.open_w(&pStream);
-   if (error)
-      return error;
-   std::string encoding = projects::projectContext().hasProject() ?
-                          projects::projectContext().defaultEncoding() :
-                          userSettings().defaultEncoding();
-   std::string encodedString;
-   error = r::util::iconvstr(searchString,
-                             "UTF-8",
-                             encoding,
-                             false,
-                             &encodedString);
-   if (error)
-   {
-      LOG_ERROR(error);
-      encodedString = searchString;
-   }
-
-   *pStream << encodedString << std::endl;
-   pStream.reset(); // release file handle
-
-   boost::shared_ptr<GrepOperation> ptrGrepOp = GrepOperation::create(encoding,
-                                                                      tempFile);
-   core::system::ProcessCallbacks callbacks =
-                                       ptrGrepOp->createProcessCallbacks();
-
-#ifdef _WIN32
-   shell_utils::ShellCommand cmd(gnuGrepPath.complete("grep"));
-#else
-   shell_utils::ShellCommand cmd("grep");
-#endif
-   cmd << "-rHn" << "--binary-files=without-match" << "--color=always";
-#ifndef _WIN32
-   cmd << "--devices=skip";
-#endif
-
-   if (ignoreCase)
-      cmd << "-i";
-
-   // Use -f to pass pattern via file, so we don't have to worry about
-   // escaping double quotes, etc.
-   cmd << "-f";
-   cmd << tempFile;
-   if (!asRegex)
-      cmd << "-F";
-
+   FindInFilesOptions options;
+   options.searchString = searchString;
+   options.asRegex = asRegex;
+   options.ignoreCase = ignoreCase;
+   options.directory = module_context::resolveAliasedPath(directory);
    BOOST_FOREACH(json::Value filePattern, filePatterns)
    {
-      cmd << "--include=" + filePattern.get_str();
+      options.filePatterns.push_back(filePattern.get_str());
    }
+   options.encoding = projects::projectContext().hasProject() ?
+                      projects::projectContext().defaultEncoding() :
+                      userSettings().defaultEncoding();
+   options.maxResults = MAX_COUNT + 1;
 
-   cmd << shell_utils::EscapeFilesOnly << "--" << shell_utils::EscapeAll;
-   cmd << module_context::resolveAliasedPath(directory);
+   boost::shared_ptr<FindInFilesSearch> pSearch;
+   error = FindInFilesSearch::create(options, &pSearch);
+   if (error)
+      return error;
 
    // Clear existing results
    findResults().clear();
 
-   error = module_context::processSupervisor().runCommand(cmd,
-                                                          options,
-                                                          callbacks);
-   if (error)
-      return error;
+   // start searching and poll for results
+   std::string handle = core::system::generateUuid(false);
+   pSearch->start();
+   module_context::schedulePeriodicWork(
+                        boost::posix_time::milliseconds(50),
+                        boost::bind(onFindProgress, pSearch, handle),
+                        false);
 
-   findResults().onFindBegin(ptrGrepOp->handle(),
+   findResults().onFindBegin(handle,
                              searchString,
                              directory,
                              asRegex);
-   pResponse->setResult(ptrGrepOp->handle());
+   pResponse->setResult(handle);
 
    return Success();
 }
@@ -0,0 +1,661 @@
+/*
+ * SessionFindInFiles.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include "SessionFindInFiles.hpp"
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/foreach.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#ifndef _WIN32
+#include <iconv.h>
+#else
+#include <R_ext/Riconv.h>
+#endif
+
+#include <core/Log.hpp>
+#include <core/Thread.hpp>
+#include <core/RegexUtils.hpp>
+#include <core/StringUtils.hpp>
+#include <core/json/JsonRpc.hpp>
+#include <core/system/FileScanner.hpp>
+
+#include <r/RUtil.hpp>
+
+using namespace core;
+
+namespace session {
+namespace modules {   
+namespace find {
+
+namespace {
+
+// files with a null byte in this many leading bytes are considered
+// binary and skipped (as with grep --binary-files=without-match)
+const std::size_t kBinaryCheckBytes = 32768;
+
+// maximum bytes of a matching line returned
+const std::size_t kMaxLineValue = 300;
+
+// maximum number of threads searching files
+const unsigned int kMaxSearchThreads = 8;
+
+bool isTrimmable(char ch)
+{
+   return std::isspace(static_cast<unsigned char>(ch)) != 0;
+}
+
+int utf8Length(const std::string& str)
+{
+   size_t charSize;
+   Error error = string_utils::utf8Distance(str.begin(), str.end(), &charSize);
+   if (error)
+      charSize = str.size();
+   return static_cast<int>(charSize);
+}
+
+} // anonymous namespace
+
+namespace {
+
+// (the decoder's handle is an iconv_t, which is a pointer on all of the
+// platforms we build for)
+void* invalidHandle() { return reinterpret_cast<void*>(-1); }
+
+#ifndef _WIN32
+void* openHandle(const char* to, const char* from)
+{
+   return ::iconv_open(to, from);
+}
+std::size_t convert(void* handle, const char** ppIn, std::size_t* pInBytes,
+                    char** ppOut, std::size_t* pOutBytes)
+{
+   return ::iconv(static_cast<iconv_t>(handle), const_cast<char**>(ppIn),
+                  pInBytes, ppOut, pOutBytes);
+}
+void closeHandle(void* handle)
+{
+   ::iconv_close(static_cast<iconv_t>(handle));
+}
+#else
+void* openHandle(const char* to, const char* from)
+{
+   return ::Riconv_open(to, from);
+}
+std::size_t convert(void* handle, const char** ppIn, std::size_t* pInBytes,
+                    char** ppOut, std::size_t* pOutBytes)
+{
+   return ::Riconv(handle, ppIn, pInBytes, ppOut, pOutBytes);
+}
+void closeHandle(void* handle) { ::Riconv_close(handle); }
+#endif
+
+} // anonymous namespace
+
+LineDecoder::LineDecoder(const std::string& encoding)
+   : encoding_(encoding),
+     identity_(encoding.empty() ||
+               boost::algorithm::iequals(encoding, "UTF-8")),
+     handle_(invalidHandle())
+{
+   if (!identity_)
+   {
+      handle_ = openHandle("UTF-8", encoding.c_str());
+      if (handle_ == invalidHandle())
+         openError_ = systemError(errno, ERROR_LOCATION);
+   }
+}
+
+LineDecoder::~LineDecoder()
+{
+   if (handle_ != invalidHandle())
+      closeHandle(handle_);
+}
+
+Error LineDecoder::decode(const char* begin,
+                          const char* end,
+                          std::string* pDecoded)
+{
+   pDecoded->clear();
+   if (identity_)
+   {
+      pDecoded->assign(begin, end);
+      return Success();
+   }
+   else if (openError_)
+   {
+      pDecoded->assign(begin, end);
+      return openError_;
+   }
+
+   const char* pIn = begin;
+   std::size_t inBytes = end - begin;
+   char buffer[256];
+   while (inBytes > 0)
+   {
+      const char* pInOrig = pIn;
+      char* pOut = buffer;
+      std::size_t outBytes = sizeof(buffer);
+      std::size_t result = convert(handle_, &pIn, &inBytes,
+                                   &pOut, &outBytes);
+      pDecoded->append(buffer, pOut);
+
+      if (result == static_cast<std::size_t>(-1))
+      {
+         if (errno == EILSEQ || errno == EINVAL)
+         {
+            pDecoded->push_back('?');
+            pIn++;
+            inBytes--;
+         }
+         else if (errno != E2BIG || pInOrig == pIn)
+         {
+            Error error = systemError(errno, ERROR_LOCATION);
+            pDecoded->assign(begin, end);
+            return error;
+         }
+      }
+   }
+
+   // reset the shift state for the next line
+   convert(handle_, NULL, NULL, NULL, NULL);
+   return Success();
+}
+
+Error FindInFilesSearch::create(const FindInFilesOptions& options,
+                                boost::shared_ptr<FindInFilesSearch>* pSearch)
+{
+   boost::shared_ptr<FindInFilesSearch> pNewSearch(
+                                          new FindInFilesSearch(options));
+
+   // files are searched in their own encoding so the search
+   // string needs to be in that encoding as well
+   std::string pattern;
+   Error error = r::util::iconvstr(options.searchString,
+                                   "UTF-8",
+                                   options.encoding,
+                                   false,
+                                   &pattern);
+   if (error)
+   {
+      LOG_ERROR(error);
+      pattern = options.searchString;
+   }
+
+   try
+   {
+      // case sensitive literals are matched directly, everything
+      // else is compiled to a regex up front
+      if (options.asRegex)
+      {
+         boost::regex::flag_type flags = boost::regex::basic;
+         if (options.ignoreCase)
+            flags |= boost::regex::icase;
+         pNewSearch->regex_.assign(pattern, flags);
+         pNewSearch->useRegex_ = true;
+      }
+      else if (options.ignoreCase)
+      {
+         pNewSearch->regex_.assign(pattern,
+                                   boost::regex::literal | boost::regex::icase);
+         pNewSearch->useRegex_ = true;
+      }
+      else
+      {
+         pNewSearch->literal_ = pattern;
+         pNewSearch->useRegex_ = false;
+      }
+
+      BOOST_FOREACH(const std::string& filePattern, options.filePatterns)
+      {
+         pNewSearch->filePatterns_.push_back(
+                        regex_utils::wildcardPatternToRegex(filePattern));
+      }
+   }
+   catch(const boost::regex_error& e)
+   {
+      Error error(json::errc::ParamInvalid, ERROR_LOCATION);
+      error.addProperty("pattern", options.searchString);
+      error.addProperty("what", e.what());
+      return error;
+   }
+
+   *pSearch = pNewSearch;
+   return Success();
+}
+
+FindInFilesSearch::FindInFilesSearch(const FindInFilesOptions& options)
+   : options_(options),
+     useRegex_(false),
+     nextFile_(0),
+     resultCount_(0),
+     nextPublishFile_(0),
+     stopped_(false),
+     complete_(false),
+     loggedDecodeError_(false)
+{
+}
+
+void FindInFilesSearch::start()
+{
+   core::thread::safeLaunchThread(
+            boost::bind(&FindInFilesSearch::searchMain, shared_from_this()));
+}
+
+void FindInFilesSearch::stop()
+{
+   LOCK_MUTEX(mutex_)
+   {
+      stopped_ = true;
+   }
+   END_LOCK_MUTEX
+}
+
+bool FindInFilesSearch::isStopped()
+{
+   LOCK_MUTEX(mutex_)
+   {
+      return stopped_;
+   }
+   END_LOCK_MUTEX
+
+   // keep compiler happy
+   return true;
+}
+
+bool FindInFilesSearch::takeResults(std::vector<FindInFilesResult>* pResults)
+{
+   LOCK_MUTEX(mutex_)
+   {
+      bool complete = complete_;
+      pResults->insert(pResults->end(), results_.begin(), results_.end());
+      results_.clear();
+      return !complete;
+   }
+   END_LOCK_MUTEX
+
+   // keep compiler happy
+   return false;
+}
+
+void FindInFilesSearch::searchMain()
+{
+   try
+   {
+      // enumerate the files to search
+      core::system::FileScannerOptions scanOptions;
+      scanOptions.recursive = true;
+      scanOptions.parallel = true;
+      scanOptions.filter = boost::bind(&FindInFilesSearch::scanFilter,
+                                       this, _1);
+      tree<FileInfo> fileTree;
+      Error error = core::system::scanFiles(FileInfo(options_.directory),
+                                            scanOptions,
+                                            &fileTree);
+      if (error)
+         LOG_ERROR(error);
+
+      std::vector<FilePath> files;
+      for (tree<FileInfo>::leaf_iterator it = fileTree.begin_leaf();
+           it != fileTree.end_leaf();
+           ++it)
+      {
+         if (!it->isDirectory())
+            files.push_back(FilePath(it->absolutePath()));
+      }
+
+      LOCK_MUTEX(mutex_)
+      {
+         files_.swap(files);
+         nextFile_ = 0;
+         nextPublishFile_ = 0;
+      }
+      END_LOCK_MUTEX
+
+      // search them in parallel
+      unsigned int threads = std::min(kMaxSearchThreads,
+                                      boost::thread::hardware_concurrency());
+      boost::thread_group workers;
+      for (unsigned int i = 0; i < threads; i++)
+      {
+         try
+         {
+            workers.create_thread(
+                     boost::bind(&FindInFilesSearch::workerMain, this));
+         }
+         catch(const boost::thread_resource_error& e)
+         {
+            LOG_ERROR(Error(boost::thread_error::ec_from_exception(e),
+                            ERROR_LOCATION));
+            break;
+         }
+      }
+
+      // search on this thread if we couldn't create any workers
+      if (workers.size() == 0)
+         workerMain();
+
+      workers.join_all();
+   }
+   CATCH_UNEXPECTED_EXCEPTION
+
+   LOCK_MUTEX(mutex_)
+   {
+      complete_ = true;
+   }
+   END_LOCK_MUTEX
+}
+
+void FindInFilesSearch::workerMain()
+{
+   try
+   {
+      LineDecoder decoder(options_.encoding);
+      std::vector<FindInFilesResult> results;
+      while (true)
+      {
+         // take the next file
+         std::size_t fileIndex = 0;
+         FilePath filePath;
+         LOCK_MUTEX(mutex_)
+         {
+            if (stopped_ || nextFile_ >= files_.size())
+               return;
+            fileIndex = nextFile_++;
+            filePath = files_[fileIndex];
+         }
+         END_LOCK_MUTEX
+
+         // search it
+         results.clear();
+         searchFile(filePath, &decoder, &results);
+         publishResults(fileIndex, &results);
+      }
+   }
+   CATCH_UNEXPECTED_EXCEPTION
+}
+
+void FindInFilesSearch::publishResults(
+                              std::size_t fileIndex,
+                              std::vector<FindInFilesResult>* pResults)
+{
+   LOCK_MUTEX(mutex_)
+   {
+      // hold on to the results until all of the files before this one
+      // have been searched
+      searchedFiles_[fileIndex].swap(*pResults);
+
+      // then publish as many files as are now in order
+      std::map<std::size_t, std::vector<FindInFilesResult> >::iterator it;
+      while (!stopped_ &&
+             (it = searchedFiles_.find(nextPublishFile_)) !=
+                                                      searchedFiles_.end())
+      {
+         results_.insert(results_.end(), it->second.begin(), it->second.end());
+         resultCount_ += it->second.size();
+         searchedFiles_.erase(it);
+         nextPublishFile_++;
+
+         if (options_.maxResults > 0 && resultCount_ >= options_.maxResults)
+            stopped_ = true;
+      }
+   }
+   END_LOCK_MUTEX
+}
+
+bool FindInFilesSearch::scanFilter(const FileInfo& fileInfo)
+{
+   // excluding everything once we are stopped cuts the scan short
+   return !isStopped() && includeFile(fileInfo);
+}
+
+bool FindInFilesSearch::includeFile(const FileInfo& fileInfo) const
+{
+   std::string name = FilePath(fileInfo.absolutePath()).filename();
+
+   // skip scratch and version control directories
+   if (fileInfo.isDirectory())
+      return name != ".Rproj.user" && name != ".git" && name != ".svn";
+
+   // skip links and empty files
+   if (fileInfo.isSymlink() || fileInfo.size() == 0)
+      return false;
+
+   // apply file patterns
+   if (filePatterns_.empty())
+      return true;
+
+   BOOST_FOREACH(const boost::regex& pattern, filePatterns_)
+   {
+      if (boost::regex_match(name, pattern))
+         return true;
+   }
+
+   return false;
+}
+
+void FindInFilesSearch::searchFile(const FilePath& filePath,
+                                   LineDecoder* pDecoder,
+                                   std::vector<FindInFilesResult>* pResults)
+{
+   // map the file (files we can't read are skipped)
+   boost::iostreams::mapped_file_source file;
+   try
+   {
+      file.open(filePath.absolutePath());
+   }
+   catch(const std::exception&)
+   {
+      return;
+   }
+
+   if (!file.is_open() || file.size() == 0)
+      return;
+
+   const char* begin = file.data();
+   const char* end = begin + file.size();
+
+   // skip binary files
+   std::size_t checkBytes = std::min(kBinaryCheckBytes, file.size());
+   if (std::memchr(begin, '\0', checkBytes) != NULL)
+      return;
+
+   // find matching lines
+   std::vector<std::pair<const char*, const char*> > matches;
+   const char* lineBegin = begin;
+   int lineNum = 1;
+   while (lineBegin < end)
+   {
+      // literals are found by scanning the whole file (so lines without
+      // a match needn't be examined individually)
+      if (!useRegex_)
+      {
+         const char* matchBegin;
+         const char* matchEnd;
+         if (!findLiteral(lineBegin, end, &matchBegin, &matchEnd))
+            break;
+
+         // advance to the line containing the match
+         while (const char* newline = static_cast<const char*>(
+                     std::memchr(lineBegin, '\n', matchBegin - lineBegin)))
+         {
+            lineBegin = newline + 1;
+            lineNum++;
+         }
+      }
+
+      // find the end of the line
+      const char* lineEnd = static_cast<const char*>(
+                        std::memchr(lineBegin, '\n', end - lineBegin));
+      if (lineEnd == NULL)
+         lineEnd = end;
+
+      // find matches within the line
+      matches.clear();
+      searchLine(lineBegin, lineEnd, &matches);
+      if (!matches.empty())
+      {
+         // trim the line (match positions are relative to the trimmed line)
+         const char* trimBegin = lineBegin;
+         const char* trimEnd = lineEnd;
+         while (trimBegin < trimEnd && isTrimmable(*trimBegin))
+            trimBegin++;
+         while (trimEnd > trimBegin && isTrimmable(*(trimEnd - 1)))
+            trimEnd--;
+
+         FindInFilesResult result;
+         result.file = filePath;
+         result.lineNum = lineNum;
+
+         // decode the line, recording match positions as we go
+         const char* pos = trimBegin;
+         typedef std::pair<const char*, const char*> Match;
+         BOOST_FOREACH(const Match& match, matches)
+         {
+            const char* matchBegin = std::min(std::max(match.first, pos),
+                                              trimEnd);
+            const char* matchEnd = std::min(std::max(match.second, matchBegin),
+                                            trimEnd);
+            if (matchBegin == matchEnd)
+               continue;
+
+            result.lineValue.append(decode(pDecoder, pos, matchBegin));
+            result.matchOns.push_back(utf8Length(result.lineValue));
+            result.lineValue.append(decode(pDecoder, matchBegin, matchEnd));
+            result.matchOffs.push_back(utf8Length(result.lineValue));
+            pos = matchEnd;
+         }
+         result.lineValue.append(decode(pDecoder, pos, trimEnd));
+
+         if (result.lineValue.size() > kMaxLineValue)
+         {
+            result.lineValue.erase(kMaxLineValue);
+            result.lineValue.append("...");
+         }
+
+         pResults->push_back(result);
+
+         // don't bother continuing if we've already got enough matches
+         if (options_.maxResults > 0 &&
+             pResults->size() >= options_.maxResults)
+         {
+            break;
+         }
+      }
+
+      // next line
+      lineBegin = lineEnd + 1;
+      lineNum++;
+   }
+}
+
+void FindInFilesSearch::searchLine(
+                  const char* begin,
+                  const char* end,
+                  std::vector<std::pair<const char*, const char*> >* pMatches)
+{
+   if (useRegex_)
+   {
+      boost::cregex_iterator it(begin, end, regex_);
+      boost::cregex_iterator itEnd;
+      for ( ; it != itEnd; ++it)
+         pMatches->push_back(std::make_pair((*it)[0].first, (*it)[0].second));
+   }
+   else if (literal_.empty())
+   {
+      pMatches->push_back(std::make_pair(begin, begin));
+   }
+   else
+   {
+      const char* matchBegin;
+      const char* matchEnd;
+      const char* pos = begin;
+      while (findLiteral(pos, end, &matchBegin, &matchEnd))
+      {
+         pMatches->push_back(std::make_pair(matchBegin, matchEnd));
+         pos = matchEnd;
+      }
+   }
+}
+
+bool FindInFilesSearch::findLiteral(const char* begin,
+                                    const char* end,
+                                    const char** pMatchBegin,
+                                    const char** pMatchEnd) const
+{
+   std::size_t length = literal_.length();
+   if (length == 0)
+   {
+      *pMatchBegin = *pMatchEnd = begin;
+      return true;
+   }
+
+   // find candidates using the first character then compare the rest
+   const char* pos = begin;
+   while (static_cast<std::size_t>(end - pos) >= length)
+   {
+      pos = static_cast<const char*>(
+                  std::memchr(pos, literal_[0], (end - pos) - length + 1));
+      if (pos == NULL)
+         return false;
+
+      if (std::memcmp(pos + 1, literal_.data() + 1, length - 1) == 0)
+      {
+         *pMatchBegin = pos;
+         *pMatchEnd = pos + length;
+         return true;
+      }
+
+      pos++;
+   }
+
+   return false;
+}
+
+std::string FindInFilesSearch::decode(LineDecoder* pDecoder,
+                                      const char* begin,
+                                      const char* end)
+{
+   if (begin == end)
+      return std::string();
+
+   std::string decoded;
+   Error error = pDecoder->decode(begin, end, &decoded);
+
+   // log error, but only once per search
+   if (error)
+   {
+      bool logError = false;
+      LOCK_MUTEX(mutex_)
+      {
+         logError = !loggedDecodeError_;
+         loggedDecodeError_ = true;
+      }
+      END_LOCK_MUTEX
+
+      if (logError)
+         LOG_ERROR(error);
+   }
+
+   return decoded;
+}
+
+} // namespace find
+} // namespace modules
+} // namespace session
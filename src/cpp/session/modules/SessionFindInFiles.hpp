@@ -0,0 +1,185 @@
+/*
+ * SessionFindInFiles.hpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#ifndef SESSION_FIND_IN_FILES_HPP
+#define SESSION_FIND_IN_FILES_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/utility.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/regex.hpp>
+
+#include <core/Error.hpp>
+#include <core/FilePath.hpp>
+#include <core/FileInfo.hpp>
+#include <core/BoostThread.hpp>
+
+namespace session {
+namespace modules {
+namespace find {
+
+struct FindInFilesOptions
+{
+   FindInFilesOptions()
+      : asRegex(false), ignoreCase(false), maxResults(0)
+   {
+   }
+
+   // search string (UTF-8) and how to interpret it (regular expressions
+   // use POSIX basic syntax, as with grep)
+   std::string searchString;
+   bool asRegex;
+   bool ignoreCase;
+
+   // directory to search recursively and the file name wildcard patterns
+   // to restrict the search to (all files are searched if none)
+   core::FilePath directory;
+   std::vector<std::string> filePatterns;
+
+   // encoding of the files
+   std::string encoding;
+
+   // stop searching once this many lines have matched (0 for no limit)
+   std::size_t maxResults;
+};
+
+// a line which matched (content is UTF-8, trimmed and truncated, match
+// positions are character offsets into the content)
+struct FindInFilesResult
+{
+   FindInFilesResult() : lineNum(0) {}
+   core::FilePath file;
+   int lineNum;
+   std::string lineValue;
+   std::vector<int> matchOns;
+   std::vector<int> matchOffs;
+};
+
+// converts lines (or any text) from an encoding to UTF-8, substituting '?'
+// for invalid input. we use the system's iconv directly rather than R's so
+// that decoding can happen off the main thread without touching R (on
+// windows R's iconv is the only one available, its conversions don't touch
+// the interpreter). conversion descriptors are stateful so each thread
+// needs its own decoder
+class LineDecoder : boost::noncopyable
+{
+public:
+   explicit LineDecoder(const std::string& encoding);
+   ~LineDecoder();
+
+   // COPYING: boost::noncopyable
+
+   const std::string& encoding() const { return encoding_; }
+
+   // on error the text is returned undecoded
+   core::Error decode(const char* begin,
+                      const char* end,
+                      std::string* pDecoded);
+
+private:
+   std::string encoding_;
+   bool identity_;
+   void* handle_; // iconv_t
+   core::Error openError_;
+};
+
+// searches files in-process on a pool of background threads. results
+// are collected by the caller (typically on the main thread) by
+// calling takeResults periodically. results are always delivered in the
+// order of the files searched
+class FindInFilesSearch
+   : boost::noncopyable,
+     public boost::enable_shared_from_this<FindInFilesSearch>
+{
+public:
+   static core::Error create(const FindInFilesOptions& options,
+                             boost::shared_ptr<FindInFilesSearch>* pSearch);
+
+private:
+   explicit FindInFilesSearch(const FindInFilesOptions& options);
+
+public:
+   // COPYING: boost::noncopyable
+
+   // start searching
+   void start();
+
+   // request that searching stop as soon as possible
+   void stop();
+
+   // take the results found since the last call. returns false once the
+   // search is complete (the results taken are then the final results)
+   bool takeResults(std::vector<FindInFilesResult>* pResults);
+
+private:
+   void searchMain();
+   void workerMain();
+   bool isStopped();
+   bool scanFilter(const core::FileInfo& fileInfo);
+   bool includeFile(const core::FileInfo& fileInfo) const;
+
+   void searchFile(const core::FilePath& filePath,
+                   LineDecoder* pDecoder,
+                   std::vector<FindInFilesResult>* pResults);
+
+   void publishResults(std::size_t fileIndex,
+                       std::vector<FindInFilesResult>* pResults);
+
+   void searchLine(const char* begin,
+                   const char* end,
+                   std::vector<std::pair<const char*, const char*> >* pMatches);
+
+   bool findLiteral(const char* begin,
+                    const char* end,
+                    const char** pMatchBegin,
+                    const char** pMatchEnd) const;
+
+   std::string decode(LineDecoder* pDecoder,
+                      const char* begin,
+                      const char* end);
+
+private:
+   FindInFilesOptions options_;
+
+   // compiled search (literal case sensitive searches don't need a regex)
+   std::string literal_;
+   bool useRegex_;
+   boost::regex regex_;
+   std::vector<boost::regex> filePatterns_;
+
+   // shared state (protected by mutex_)
+   boost::mutex mutex_;
+   std::vector<core::FilePath> files_;
+   std::size_t nextFile_;
+   std::vector<FindInFilesResult> results_;
+   std::size_t resultCount_;
+
+   // results of files searched ahead of the next file to publish
+   // (keyed by index into files_)
+   std::map<std::size_t, std::vector<FindInFilesResult> > searchedFiles_;
+   std::size_t nextPublishFile_;
+
+   bool stopped_;
+   bool complete_;
+   bool loggedDecodeError_;
+};
+
+} // namespace find
+} // namespace modules
+} // namespace session
+
+#endif // SESSION_FIND_IN_FILES_HPP
@@ -14,6 +14,11 @@
 
 #include <signal.h>
 
+#include <ctime>
+#include <limits>
+#include <map>
+#include <set>
+
 #ifdef _WIN32
 #include <windows.h>
 #include <shlobj.h>
@@ -27,9 +32,12 @@
 #include <boost/foreach.hpp>
 #include <boost/format.hpp>
 #include <boost/function.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/optional.hpp>
 #include <boost/regex.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <core/BoostLamda.hpp>
 
 #include <core/json/JsonRpc.hpp>
@@ -43,6 +51,7 @@
 #include <core/GitGraph.hpp>
 #include <core/Scope.hpp>
 #include <core/StringUtils.hpp>
+#include <core/Thread.hpp>
 
 
 #include <r/RExec.hpp>
@@ -56,6 +65,7 @@
 #include "SessionAskPass.hpp"
 
 #include "SessionVCS.hpp"
+#include "SessionGitHistory.hpp"
 
 #include "vcs/SessionVCSCore.hpp"
 #include "vcs/SessionVCSUtils.hpp"
@@ -86,8 +96,53 @@ const uint64_t GIT_1_7_2 = ((uint64_t)1 << 48) |
                            ((uint64_t)7 << 32) |
                            ((uint64_t)2 << 16);
 
+// history of the most recently viewed revision (see Git::history)
+std::string s_historyKey;
+boost::shared_ptr<CommitHistory> s_pHistory;
+
+// the R-free rpc methods (status and branch listing) run git on worker
+// threads. those threads can't read the environment, project context, or
+// git exe path (the main thread writes them) so they use a snapshot which
+// the main thread refreshes whenever these might have changed
+boost::thread::id s_mainThreadId;
+boost::mutex s_snapshotMutex;
+std::string s_gitExePathSnapshot;
+core::system::ProcessOptions s_procOptionsSnapshot;
+
+bool isMainThread()
+{
+   // calls made before we are initialized are always on the main thread
+   return s_mainThreadId == boost::thread::id() ||
+          s_mainThreadId == boost::this_thread::get_id();
+}
+
+std::string gitExePath()
+{
+   if (isMainThread())
+      return s_gitExePath;
+
+   LOCK_MUTEX(s_snapshotMutex)
+   {
+      return s_gitExePathSnapshot;
+   }
+   END_LOCK_MUTEX
+
+   return std::string();
+}
+
 core::system::ProcessOptions procOptions()
 {
+   if (!isMainThread())
+   {
+      LOCK_MUTEX(s_snapshotMutex)
+      {
+         return s_procOptionsSnapshot;
+      }
+      END_LOCK_MUTEX
+
+      return core::system::ProcessOptions();
+   }
+
    core::system::ProcessOptions options;
 
    // detach the session so there is no terminal
@@ -122,25 +177,24 @@ core::system::ProcessOptions procOptions()
    return options;
 }
 
+void refreshSnapshot()
+{
+   core::system::ProcessOptions options = procOptions();
+
+   LOCK_MUTEX(s_snapshotMutex)
+   {
+      s_gitExePathSnapshot = s_gitExePath;
+      s_procOptionsSnapshot = options;
+   }
+   END_LOCK_MUTEX
+}
+
 enum PatchMode
 {
    PatchModeWorking = 0,
    PatchModeStage = 1
 };
 
-struct CommitInfo
-{
-   std::string id;
-   std::string author;
-   std::string subject;
-   std::string description;
-   std::string parent;
-   boost::int64_t date; // millis since epoch, UTC
-   std::vector<std::string> refs;
-   std::vector<std::string> tags;
-   std::string graph;
-};
-
 struct RemoteBranchInfo
 {
    RemoteBranchInfo() : commitsBehind(0) {}
@@ -177,9 +231,10 @@ std::vector<PidType> s_pidsToTerminate_;
 
 ShellCommand git()
 {
-   if (!s_gitExePath.empty())
+   std::string gitExe = gitExePath();
+   if (!gitExe.empty())
    {
-      FilePath fullPath(s_gitExePath);
+      FilePath fullPath(gitExe);
       return ShellCommand(fullPath);
    }
    else
@@ -190,9 +245,10 @@ ShellCommand git()
 #ifdef _WIN32
 std::string gitBin()
 {
-   if (!s_gitExePath.empty())
+   std::string gitExe = gitExePath();
+   if (!gitExe.empty())
    {
-      return FilePath(s_gitExePath).absolutePathNative();
+      return FilePath(gitExe).absolutePathNative();
    }
    else
       return "git.exe";
@@ -386,13 +442,24 @@ public:
    core::Error status(const FilePath& dir,
                       StatusResult* pStatusResult)
    {
-      using namespace boost;
-
       std::vector<FileWithStatus> files;
+      Error error = status(std::vector<FilePath>(1, dir), &files);
+      if (error)
+         return error;
+
+      *pStatusResult = StatusResult(files);
+
+      return Success();
+   }
+
+   core::Error status(const std::vector<FilePath>& paths,
+                      std::vector<FileWithStatus>* pFiles)
+   {
+      using namespace boost;
 
       std::vector<std::string> lines;
       std::string output;
-      Error error = runGit(ShellArgs() << "status" << "--porcelain" << "--" << dir,
+      Error error = runGit(ShellArgs() << "status" << "--porcelain" << "--" << paths,
                            &output);
       if (error)
          return error;
@@ -414,11 +481,9 @@ public:
             filePath = filePath.substr(0, filePath.size() - 1);
          file.path = root_.childPath(string_utils::systemToUtf8(filePath));
 
-         files.push_back(file);
+         pFiles->push_back(file);
       }
 
-      *pStatusResult = StatusResult(files);
-
       return Success();
    }
 
@@ -858,6 +923,25 @@ public:
                          const std::string &searchText,
                          int *pLength)
    {
+      if (fileFilter.empty())
+      {
+         boost::shared_ptr<CommitHistory> pHistory;
+         Error error = history(rev, &pHistory);
+         if (error)
+            LOG_ERROR(error);
+
+         if (pHistory)
+         {
+            boost::function<bool(CommitInfo)> filter =
+                                       createSearchTextPredicate(searchText);
+            *pLength = static_cast<int>(
+                         std::count_if(pHistory->commits().begin(),
+                                       pHistory->commits().end(),
+                                       filter));
+            return Success();
+         }
+      }
+
       if (searchText.empty())
       {
          ShellArgs args = ShellArgs() << "log";
@@ -887,6 +971,288 @@ public:
       }
    }
 
+   // parse the output of git log --pretty=raw (note that the parent
+   // field of the commits holds the full ids of their parents)
+   void parseRawLog(const std::string& output,
+                    std::vector<CommitInfo>* pCommits)
+   {
+      boost::regex kvregex("^(\\w+) (.*)$");
+      boost::regex authTimeRegex("^(.*?) (\\d+) ([+\\-]?\\d+)$");
+
+      std::vector<std::string> lines = split(output);
+      for (std::vector<std::string>::const_iterator it = lines.begin();
+           it != lines.end();
+           it++)
+      {
+         boost::smatch smatch;
+         if (boost::regex_search(*it, smatch, kvregex))
+         {
+            std::string key = smatch[1];
+            std::string value = smatch[2];
+            if (key == "commit")
+            {
+               pCommits->push_back(CommitInfo());
+               parseCommitValue(value, &pCommits->back());
+               continue;
+            }
+            else if (pCommits->empty())
+            {
+               LOG_ERROR_MESSAGE("Unexpected git-log output");
+               continue;
+            }
+
+            CommitInfo& currentCommit = pCommits->back();
+            if (key == "author" || key == "committer")
+            {
+               boost::smatch authTimeMatch;
+               if (boost::regex_search(value, authTimeMatch, authTimeRegex))
+               {
+                  std::string author = authTimeMatch[1];
+                  std::string time = authTimeMatch[2];
+                  std::string tz = authTimeMatch[3];
+
+                  if (key == "author")
+                     currentCommit.author = author;
+                  else // if (key == "committer")
+                  {
+                     currentCommit.date = convertGitRawDate(time, tz);
+                     currentCommit.commitTime =
+                           safe_convert::stringTo<boost::int64_t>(time, 0);
+                  }
+               }
+            }
+            else if (key == "parent")
+            {
+               if (!currentCommit.parent.empty())
+                  currentCommit.parent.push_back(' ');
+               currentCommit.parent.append(value);
+            }
+         }
+         else if (boost::starts_with(*it, "    ") && !pCommits->empty())
+         {
+            CommitInfo& currentCommit = pCommits->back();
+            if (currentCommit.subject.empty())
+               currentCommit.subject = it->substr(4);
+
+            if (!currentCommit.description.empty())
+               currentCommit.description.append("\n");
+            currentCommit.description.append(it->substr(4));
+         }
+         else if (it->length() == 0)
+         {
+         }
+         else
+         {
+            LOG_ERROR_MESSAGE("Unexpected git-log output");
+         }
+      }
+   }
+
+   core::Error rawLog(const ShellArgs& revArgs,
+                      std::vector<CommitInfo>* pCommits)
+   {
+      ShellArgs args = ShellArgs() << "log" << "--encoding=UTF-8"
+                       << "--pretty=raw" << "--date-order" << revArgs.args();
+
+      std::string output;
+      Error error = runGit(args, &output);
+      if (error)
+         return error;
+
+      parseRawLog(output, pCommits);
+      return Success();
+   }
+
+   std::string abbreviateParents(const std::string& parents)
+   {
+      std::vector<std::string> ids;
+      boost::algorithm::split(ids, parents, boost::algorithm::is_any_of(" "));
+
+      std::string abbreviated;
+      BOOST_FOREACH(const std::string& id, ids)
+      {
+         if (!abbreviated.empty())
+            abbreviated.push_back(' ');
+         abbreviated.append(id, 0, 8);
+      }
+      return abbreviated;
+   }
+
+   // commit which rev refers to (empty if there isn't one)
+   core::Error resolveCommit(const std::string& rev, std::string* pId)
+   {
+      std::string output;
+      int exitCode;
+      Error error = runGit(ShellArgs() << "rev-list" << "--max-count=1" << rev,
+                           &output, NULL, &exitCode);
+      if (error)
+         return error;
+
+      if (exitCode == EXIT_SUCCESS)
+         *pId = boost::algorithm::trim_copy(output);
+      else
+         pId->clear();
+
+      return Success();
+   }
+
+   // refs and tags of all decorated commits
+   core::Error decorations(std::map<std::string, CommitInfo>* pDecorations)
+   {
+      std::string output;
+      Error error = runGit(ShellArgs() << "log" << "--no-walk" << "--all"
+                           << "--pretty=raw" << "--decorate=full", &output);
+      if (error)
+         return error;
+
+      std::vector<std::string> lines = split(output);
+      BOOST_FOREACH(const std::string& line, lines)
+      {
+         if (boost::algorithm::starts_with(line, "commit "))
+         {
+            CommitInfo commit;
+            parseCommitValue(line.substr(7), &commit);
+            (*pDecorations)[commit.id] = commit;
+         }
+      }
+
+      return Success();
+   }
+
+   // history of rev, which is cached on disk and only updated when the tip
+   // of rev changes. when that happens we try to add the new commits on
+   // top of the cached history and otherwise (e.g. when history has been
+   // rewritten) read it again. *ppHistory is left empty if rev doesn't
+   // refer to a commit (e.g. in a new repository)
+   core::Error history(const std::string& rev,
+                       boost::shared_ptr<CommitHistory>* ppHistory)
+   {
+      if (boost::algorithm::starts_with(rev, "-"))
+         return Success();
+
+      std::string tip;
+      Error error = resolveCommit(rev.empty() ? "HEAD" : rev, &tip);
+      if (error || tip.empty())
+         return error;
+
+      std::string key = root_.absolutePath() + "\n" + rev;
+      FilePath historyDir = module_context::scopedScratchPath()
+                                                   .complete("git_history");
+      error = historyDir.ensureDirectory();
+      if (error)
+         return error;
+      FilePath historyPath = historyDir.complete(
+            "history-" +
+            safe_convert::numberToString(boost::hash<std::string>()(key)));
+
+      if (key != s_historyKey || !s_pHistory)
+      {
+         boost::shared_ptr<CommitHistory> pHistory(new CommitHistory());
+         error = pHistory->read(historyPath, key);
+         if (error)
+            LOG_ERROR(error);
+
+         s_historyKey = key;
+         s_pHistory = pHistory;
+      }
+
+      if (s_pHistory->tip() != tip)
+      {
+         bool extended = false;
+         if (!s_pHistory->tip().empty())
+         {
+            std::string mergeBase;
+            error = runGit(ShellArgs() << "merge-base" << s_pHistory->tip()
+                                       << tip,
+                           &mergeBase);
+            if (error)
+               return error;
+
+            if (boost::algorithm::trim_copy(mergeBase) == s_pHistory->tip())
+            {
+               std::vector<CommitInfo> commits;
+               error = rawLog(ShellArgs() << tip << "--not"
+                                          << s_pHistory->tip(),
+                              &commits);
+               if (error)
+                  return error;
+
+               extended = s_pHistory->prepend(tip, commits);
+            }
+         }
+
+         if (!extended)
+         {
+            std::vector<CommitInfo> commits;
+            error = rawLog(ShellArgs() << tip, &commits);
+            if (error)
+               return error;
+
+            s_pHistory->assign(tip, commits);
+         }
+
+         error = s_pHistory->write(historyPath, key);
+         if (error)
+            LOG_ERROR(error);
+      }
+
+      *ppHistory = s_pHistory;
+      return Success();
+   }
+
+   core::Error pageHistory(const CommitHistory& history,
+                           int skip,
+                           int maxentries,
+                           const std::string& searchText,
+                           std::vector<CommitInfo>* pOutput)
+   {
+      std::map<std::string, CommitInfo> decorated;
+      Error error = decorations(&decorated);
+      if (error)
+         return error;
+
+      if (maxentries < 0)
+         maxentries = std::numeric_limits<int>::max();
+
+      boost::function<bool(CommitInfo)> filter =
+                                       createSearchTextPredicate(searchText);
+
+      int skipped = 0;
+      BOOST_FOREACH(const CommitInfo& commit, history.commits())
+      {
+         if (pOutput->size() >= static_cast<size_t>(maxentries))
+            break;
+
+         if (!searchText.empty() && !filter(commit))
+            continue;
+
+         if (skipped < skip)
+         {
+            skipped++;
+            continue;
+         }
+
+         CommitInfo info = commit;
+         info.parent = abbreviateParents(commit.parent);
+
+         // the graph isn't meaningful for a subset of the commits
+         if (!searchText.empty())
+            info.graph.clear();
+
+         std::map<std::string, CommitInfo>::const_iterator it =
+                                                   decorated.find(commit.id);
+         if (it != decorated.end())
+         {
+            info.refs = it->second.refs;
+            info.tags = it->second.tags;
+         }
+
+         pOutput->push_back(info);
+      }
+
+      return Success();
+   }
+
    core::Error log(const std::string& rev,
                    const FilePath& fileFilter,
                    int skip,
@@ -894,6 +1260,18 @@ public:
                    const std::string& searchText,
                    std::vector<CommitInfo>* pOutput)
    {
+      // the history of a whole revision is served from the cache
+      if (fileFilter.empty())
+      {
+         boost::shared_ptr<CommitHistory> pHistory;
+         Error error = history(rev, &pHistory);
+         if (error)
+            LOG_ERROR(error);
+
+         if (pHistory)
+            return pageHistory(*pHistory, skip, maxentries, searchText, pOutput);
+      }
+
       ShellArgs args = ShellArgs() << "log" << "--encoding=UTF-8"
                        << "--pretty=raw" << "--decorate=full"
                        << "--date-order";
@@ -939,12 +1317,12 @@ public:
       if (maxentries < 0)
          maxentries = std::numeric_limits<int>::max();
 
-      std::vector<std::string> outLines;
+      std::vector<CommitInfo> commits;
       std::string output;
       Error error = runGit(args, &output);
       if (error)
          return error;
-      outLines = split(output);
+      parseRawLog(output, &commits);
       output.clear();
 
       std::vector<std::string> graphLines;
@@ -979,93 +1357,27 @@ public:
 
       boost::function<bool(CommitInfo)> filter = createSearchTextPredicate(searchText);
 
-      boost::regex kvregex("^(\\w+) (.*)$");
-      boost::regex authTimeRegex("^(.*?) (\\d+) ([+\\-]?\\d+)$");
-
       size_t graphLineIndex = 0;
       int skipped = 0;
-      CommitInfo currentCommit;
 
-      for (std::vector<std::string>::const_iterator it = outLines.begin();
-           it != outLines.end() && pOutput->size() < static_cast<size_t>(maxentries);
-           it++)
+      BOOST_FOREACH(CommitInfo& commit, commits)
       {
-         boost::smatch smatch;
-         if (boost::regex_search(*it, smatch, kvregex))
-         {
-            std::string key = smatch[1];
-            std::string value = smatch[2];
-            if (key == "commit")
-            {
-               if (!currentCommit.id.empty() && filter(currentCommit))
-               {
-                  if (skipped < skip)
-                     skipped++;
-                  else
-                  {
-                     if (graphLineIndex < graphLines.size())
-                        currentCommit.graph = graphLines[graphLineIndex];
-                     pOutput->push_back(currentCommit);
-                  }
-
-                  graphLineIndex++;
-               }
-
-               currentCommit = CommitInfo();
-               parseCommitValue(value, &currentCommit);
-            }
-            else if (key == "author" || key == "committer")
-            {
-               boost::smatch authTimeMatch;
-               if (boost::regex_search(value, authTimeMatch, authTimeRegex))
-               {
-                  std::string author = authTimeMatch[1];
-                  std::string time = authTimeMatch[2];
-                  std::string tz = authTimeMatch[3];
-
-                  if (key == "author")
-                     currentCommit.author = author;
-                  else // if (key == "committer")
-                     currentCommit.date = convertGitRawDate(time, tz);
-               }
-            }
-            else if (key == "parent")
-            {
-               if (!currentCommit.parent.empty())
-                  currentCommit.parent.push_back(' ');
-               currentCommit.parent.append(value, 0, 8);
-            }
-         }
-         else if (boost::starts_with(*it, "    "))
-         {
-            if (currentCommit.subject.empty())
-               currentCommit.subject = it->substr(4);
+         if (pOutput->size() >= static_cast<size_t>(maxentries))
+            break;
 
-            if (!currentCommit.description.empty())
-               currentCommit.description.append("\n");
-            currentCommit.description.append(it->substr(4));
-         }
-         else if (it->length() == 0)
-         {
-         }
-         else
-         {
-            LOG_ERROR_MESSAGE("Unexpected git-log output");
-         }
-      }
+         if (!filter(commit))
+            continue;
 
-      if (pOutput->size() < static_cast<size_t>(maxentries)
-          && !currentCommit.id.empty()
-          && filter(currentCommit))
-      {
          if (skipped < skip)
             skipped++;
          else
          {
             if (graphLineIndex < graphLines.size())
-               currentCommit.graph = graphLines[graphLineIndex];
-            pOutput->push_back(currentCommit);
+               commit.graph = graphLines[graphLineIndex];
+            commit.parent = abbreviateParents(commit.parent);
+            pOutput->push_back(commit);
          }
+
          graphLineIndex++;
       }
 
@@ -1207,15 +1519,335 @@ FilePath detectGitDir(const FilePath& workingDir)
                       string_utils::systemToUtf8(result.stdOut)));
 }
 
+// model of the status of the whole working tree which is kept up to date
+// by the project file monitor. changed paths are re-queried individually
+// and the rest of the model is left as is. we do a full refresh whenever
+// the signals we have are ambiguous: the index or HEAD has changed (staging,
+// commits, checkouts, etc.), a .gitignore has changed, there are too many
+// changed paths, the model contains renames (which are reported as pairs),
+// or the model is old enough that changes to files the monitor doesn't
+// report (e.g. hidden files) may have accumulated
+class StatusCache : boost::noncopyable
+{
+public:
+   StatusCache()
+      : valid_(false),
+        fullRefreshRequired_(false),
+        hasRenames_(false),
+        refreshTime_(0),
+        indexTime_(0),
+        headTime_(0),
+        generation_(0),
+        pStatus_(new StatusResult())
+   {
+   }
+
+   // COPYING: boost::noncopyable
+
+   void onMonitoringEnabled(const FilePath& monitoredDir)
+   {
+      LOCK_MUTEX(mutex_)
+      {
+         monitoredDir_ = monitoredDir;
+         valid_ = false;
+         generation_++;
+      }
+      END_LOCK_MUTEX
+   }
+
+   void onMonitoringDisabled()
+   {
+      LOCK_MUTEX(mutex_)
+      {
+         monitoredDir_ = FilePath();
+         valid_ = false;
+         generation_++;
+      }
+      END_LOCK_MUTEX
+   }
+
+   void onFilesChanged(const std::vector<core::system::FileChangeEvent>& events)
+   {
+      LOCK_MUTEX(mutex_)
+      {
+         BOOST_FOREACH(const core::system::FileChangeEvent& event, events)
+         {
+            FilePath filePath(event.fileInfo().absolutePath());
+            if (filePath.filename() == ".gitignore")
+               fullRefreshRequired_ = true;
+            else
+               changedPaths_.insert(filePath.absolutePath());
+         }
+      }
+      END_LOCK_MUTEX
+   }
+
+   // status of the files within dir. if the model is being maintained this
+   // is the status of the whole working tree, otherwise git is run
+   // for just the requested directory
+   Error status(const FilePath& dir,
+                boost::shared_ptr<const StatusResult>* ppStatus)
+   {
+      FilePath root = s_git_.root();
+      bool maintained = false;
+      LOCK_MUTEX(mutex_)
+      {
+         maintained = isMaintained(root);
+      }
+      END_LOCK_MUTEX
+
+      if (!maintained)
+      {
+         StatusResult* pStatus = new StatusResult();
+         ppStatus->reset(pStatus);
+         return s_git_.status(dir, pStatus);
+      }
+
+      // mutex_ is never held while git runs (so file change notifications
+      // don't wait on it) however updates themselves run one at a time
+      LOCK_MUTEX(updateMutex_)
+      {
+         Error error = update(root);
+         if (error)
+            return error;
+
+         LOCK_MUTEX(mutex_)
+         {
+            *ppStatus = pStatus_;
+         }
+         END_LOCK_MUTEX
+
+         return Success();
+      }
+      END_LOCK_MUTEX
+
+      // keep compiler happy
+      return Success();
+   }
+
+private:
+
+   bool isMaintained(const FilePath& root) const
+   {
+      // we need the file monitor to cover the whole working tree and
+      // an ordinary .git directory (to check the index and HEAD)
+      return !root.empty() &&
+             !monitoredDir_.empty() &&
+             root.isWithin(monitoredDir_) &&
+             root.childPath(".git").isDirectory();
+   }
+
+   Error update(const FilePath& root)
+   {
+      // note the index and HEAD times before running git so that changes
+      // which happen while it runs are picked up next time. note also that
+      // these times have a resolution of one second so we can't trust
+      // them if they are within the second in which we last refreshed
+      FilePath gitDir = root.childPath(".git");
+      std::time_t indexTime = gitDir.childPath("index").lastWriteTime();
+      std::time_t headTime = gitDir.childPath("HEAD").lastWriteTime();
+      std::time_t refreshTime = std::time(NULL);
+
+      // decide what to query and take the changed paths (any changes
+      // reported while git runs are left for the next update)
+      bool fullRefresh = false;
+      std::vector<FilePath> paths;
+      unsigned int generation = 0;
+      LOCK_MUTEX(mutex_)
+      {
+         fullRefresh = !valid_ ||
+                       fullRefreshRequired_ ||
+                       root != root_ ||
+                       indexTime != indexTime_ ||
+                       headTime != headTime_ ||
+                       indexTime >= refreshTime_ ||
+                       headTime >= refreshTime_ ||
+                       refreshTime - refreshTime_ > kMaxAgeSeconds ||
+                       changedPaths_.size() > kMaxChangedPaths ||
+                       (hasRenames_ && !changedPaths_.empty());
+
+         // nothing has changed
+         if (!fullRefresh && changedPaths_.empty())
+            return Success();
+
+         if (fullRefresh)
+            fullRefreshRequired_ = false;
+         else
+            paths = pathsToQuery();
+         changedPaths_.clear();
+         generation = generation_;
+      }
+      END_LOCK_MUTEX
+
+      std::vector<FileWithStatus> files;
+      Error error;
+      if (fullRefresh)
+         error = s_git_.status(std::vector<FilePath>(1, root), &files);
+      else if (!paths.empty())
+         error = s_git_.status(paths, &files);
+
+      LOCK_MUTEX(mutex_)
+      {
+         // the changes we took are lost so start again next time
+         if (error)
+         {
+            valid_ = false;
+            return error;
+         }
+
+         if (fullRefresh)
+         {
+            files_.clear();
+            BOOST_FOREACH(const FileWithStatus& file, files)
+            {
+               files_[file.path.absolutePath()] = file;
+            }
+
+            root_ = root;
+            refreshTime_ = refreshTime;
+            indexTime_ = indexTime;
+            headTime_ = headTime;
+
+            // if monitoring restarted while git ran we may have missed
+            // changes so the model isn't valid until the next refresh
+            valid_ = (generation == generation_);
+         }
+         else
+         {
+            // replace the entries for the paths (and anything within them)
+            BOOST_FOREACH(const FilePath& path, paths)
+            {
+               std::string absolutePath = path.absolutePath();
+               files_.erase(absolutePath);
+
+               // ('0' sorts immediately after '/')
+               files_.erase(files_.lower_bound(absolutePath + "/"),
+                            files_.lower_bound(absolutePath + "0"));
+            }
+            BOOST_FOREACH(const FileWithStatus& file, files)
+            {
+               files_[file.path.absolutePath()] = file;
+            }
+         }
+
+         updateStatus();
+      }
+      END_LOCK_MUTEX
+
+      return Success();
+   }
+
+   std::vector<FilePath> pathsToQuery() const
+   {
+      std::vector<FilePath> paths;
+      BOOST_FOREACH(const std::string& changedPath, changedPaths_)
+      {
+         FilePath path(changedPath);
+         if (!path.isWithin(root_) || path == root_)
+            continue;
+
+         // skip paths which are within another changed path (they will
+         // be covered by its query) or within an untracked directory
+         // (they are covered by its status, which git doesn't break down)
+         bool covered = false;
+         for (FilePath parent = path.parent();
+              parent != root_ && !parent.empty();
+              parent = parent.parent())
+         {
+            std::string parentPath = parent.absolutePath();
+            if (changedPaths_.count(parentPath))
+               covered = true;
+            else if (files_.count(parentPath) &&
+                     files_.find(parentPath)->second.status.status() == "??")
+               covered = true;
+
+            if (covered || parent == parent.parent())
+               break;
+         }
+
+         if (!covered)
+            paths.push_back(path);
+      }
+      return paths;
+   }
+
+   void updateStatus()
+   {
+      std::vector<FileWithStatus> files;
+      files.reserve(files_.size());
+      hasRenames_ = false;
+      for (std::map<std::string, FileWithStatus>::const_iterator it =
+                                                          files_.begin();
+           it != files_.end();
+           ++it)
+      {
+         files.push_back(it->second);
+
+         std::string status = it->second.status.status();
+         if (!status.empty() && (status[0] == 'R' || status[0] == 'C'))
+            hasRenames_ = true;
+      }
+
+      // readers hold on to the previous result so we always replace it
+      pStatus_.reset(new StatusResult(files));
+   }
+
+private:
+   static const std::size_t kMaxChangedPaths = 100;
+   static const int kMaxAgeSeconds = 60;
+
+   boost::mutex mutex_;
+   boost::mutex updateMutex_;
+
+   FilePath monitoredDir_;
+   FilePath root_;
+
+   bool valid_;
+   bool fullRefreshRequired_;
+   bool hasRenames_;
+   std::time_t refreshTime_;
+   std::time_t indexTime_;
+   std::time_t headTime_;
+   unsigned int generation_;
+
+   std::set<std::string> changedPaths_;
+   std::map<std::string, FileWithStatus> files_;
+   boost::shared_ptr<const StatusResult> pStatus_;
+};
+
+StatusCache& statusCache()
+{
+   static StatusCache* pCache = new StatusCache();
+   return *pCache;
+}
+
+void onFileMonitorEnabled(const core::CompactFileTree&)
+{
+   statusCache().onMonitoringEnabled(projects::projectContext().directory());
+}
+
+void onFilesChanged(const std::vector<core::system::FileChangeEvent>& events)
+{
+   statusCache().onFilesChanged(events);
+}
+
+void onFileMonitorDisabled()
+{
+   statusCache().onMonitoringDisabled();
+}
+
 } // anonymous namespace
 
 GitFileDecorationContext::GitFileDecorationContext(const FilePath& rootDir)
-   : fullRefreshRequired_(false)
+   : fullRefreshRequired_(false), pStatus_(new StatusResult())
 {
    // get source control status (merely log errors doing this)
-   Error error = git::status(rootDir, &vcsStatus_);
-   if (error)
-      LOG_ERROR(error);
+   if (!s_git_.root().empty())
+   {
+      Error error = statusCache().status(rootDir, &pStatus_);
+      if (error)
+         LOG_ERROR(error);
+   }
 }
 
 GitFileDecorationContext::~GitFileDecorationContext()
@@ -1227,7 +1859,7 @@ GitFileDecorationContext::~GitFileDecorationContext()
 void GitFileDecorationContext::decorateFile(const FilePath &filePath,
                                             json::Object *pFileObject)
 {
-   VCSStatus status = vcsStatus_.getStatus(filePath);
+   VCSStatus status = pStatus_->getStatus(filePath);
 
    if (status.status().empty() && !fullRefreshRequired_)
    {
@@ -1242,7 +1874,7 @@ void GitFileDecorationContext::decorateFile(const FilePath &filePath,
             break;
 
          parent = parent.parent();
-         if (vcsStatus_.getStatus(parent).status() == "??")
+         if (pStatus_->getStatus(parent).status() == "??")
          {
             fullRefreshRequired_ = true;
             break;
@@ -1413,12 +2045,12 @@ Error vcsCheckout(const json::JsonRpcRequest& request,
 Error vcsFullStatus(const json::JsonRpcRequest&,
                     json::JsonRpcResponse* pResponse)
 {
-   StatusResult statusResult;
-   Error error = s_git_.status(s_git_.root(), &statusResult);
+   boost::shared_ptr<const StatusResult> pStatusResult;
+   Error error = statusCache().status(s_git_.root(), &pStatusResult);
    if (error)
       return error;
 
-   std::vector<FileWithStatus> files = statusResult.files();
+   std::vector<FileWithStatus> files = pStatusResult->files();
    json::Array result;
    for (std::vector<FileWithStatus>::const_iterator it = files.begin();
         it != files.end();
@@ -2431,8 +3063,9 @@ FilePath detectedGitExePath()
 
 std::string nonPathGitBinDir()
 {
-   if (!s_gitExePath.empty())
-      return FilePath(s_gitExePath).parent().absolutePath();
+   std::string gitExe = gitExePath();
+   if (!gitExe.empty())
+      return FilePath(gitExe).parent().absolutePath();
    else
       return std::string();
 }
@@ -2457,6 +3090,14 @@ void onUserSettingsChanged()
       s_gitExePath = "";
 #endif
    }
+
+   refreshSnapshot();
+}
+
+void onDetectChanges(module_context::ChangeSource)
+{
+   // R code may have changed the environment
+   refreshSnapshot();
 }
 
 Error statusToJson(const core::FilePath &path,
@@ -2591,6 +3232,8 @@ core::Error initialize()
 
    Error error;
 
+   s_mainThreadId = boost::this_thread::get_id();
+
    module_context::events().onShutdown.connect(onShutdown);
 
    initGitBin();
@@ -2629,12 +3272,25 @@ core::Error initialize()
       core::system::setenv("SSH_ASKPASS", "rpostback-askpass");
    }
 
+   // snapshot the environment for git commands run on worker threads
+   // (and refresh it when it might change)
+   refreshSnapshot();
+   module_context::events().onDetectChanges.connect(onDetectChanges);
+
    // add suspend/resume handler
    addSuspendHandler(SuspendHandler(onSuspend, onResume));
 
    // add settings changed handler
    userSettings().onChanged.connect(onUserSettingsChanged);
 
+   // keep the status model up to date using the project file monitor
+   // (note that if there is no project this will no-op)
+   projects::FileMonitorCallbacks cb;
+   cb.onMonitoringEnabled = onFileMonitorEnabled;
+   cb.onFilesChanged = onFilesChanged;
+   cb.onMonitoringDisabled = onFileMonitorDisabled;
+   projects::projectContext().subscribeToFileMonitor("", cb);
+
    // install rpc methods
    using boost::bind;
    using namespace module_context;
@@ -2646,10 +3302,10 @@ core::Error initialize()
       (bind(registerRpcMethod, "git_revert", vcsRevert))
       (bind(registerRpcMethod, "git_stage", vcsStage))
       (bind(registerRpcMethod, "git_unstage", vcsUnstage))
-      (bind(registerRpcMethod, "git_list_branches", vcsListBranches))
+      (bind(registerRFreeRpcMethod, "git_list_branches", vcsListBranches))
       (bind(registerRpcMethod, "git_checkout", vcsCheckout))
-      (bind(registerRpcMethod, "git_full_status", vcsFullStatus))
-      (bind(registerRpcMethod, "git_all_status", vcsAllStatus))
+      (bind(registerRFreeRpcMethod, "git_full_status", vcsFullStatus))
+      (bind(registerRFreeRpcMethod, "git_all_status", vcsAllStatus))
       (bind(registerRpcMethod, "git_commit", vcsCommit))
       (bind(registerRpcMethod, "git_push", vcsPush))
       (bind(registerRpcMethod, "git_pull", vcsPull))
@@ -16,6 +16,8 @@
 
 #include <map>
 
+#include <boost/shared_ptr.hpp>
+
 #include <core/Error.hpp>
 #include <core/FilePath.hpp>
 #include <core/json/Json.hpp>
@@ -43,8 +45,8 @@ public:
                              core::json::Object *pFileObject);
 
 private:
-   source_control::StatusResult vcsStatus_;
    bool fullRefreshRequired_;
+   boost::shared_ptr<const source_control::StatusResult> pStatus_;
 };
 
 bool isGitInstalled();
@@ -0,0 +1,337 @@
+/*
+ * SessionGitHistory.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include "SessionGitHistory.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#include <boost/foreach.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/algorithm/string/join.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/classification.hpp>
+
+#include <core/Log.hpp>
+#include <core/GitGraph.hpp>
+#include <core/FileSerializer.hpp>
+#include <core/SafeConvert.hpp>
+
+using namespace core;
+
+namespace session {
+namespace modules {
+namespace git {
+
+namespace {
+
+// file format: header followed by the key and tip records and then seven
+// records per commit (id, parents, author, date, commit time, description
+// and graph). each record is
+//
+//    <length:uint32> <value:length bytes>
+//
+// (in native byte order, the file is local to the user)
+const char kFileHeader[] = "RSGITH01";
+const std::size_t kFileHeaderSize = sizeof(kFileHeader) - 1;
+const std::size_t kCommitRecords = 7;
+
+void appendRecord(const std::string& value, std::string* pRecords)
+{
+   boost::uint32_t length = static_cast<boost::uint32_t>(value.length());
+   pRecords->append(reinterpret_cast<const char*>(&length), sizeof(length));
+   pRecords->append(value);
+}
+
+bool readRecord(const char** ppPos, const char* end, std::string* pValue)
+{
+   boost::uint32_t length;
+   if (static_cast<std::size_t>(end - *ppPos) < sizeof(length))
+      return false;
+   std::memcpy(&length, *ppPos, sizeof(length));
+   *ppPos += sizeof(length);
+
+   if (static_cast<std::size_t>(end - *ppPos) < length)
+      return false;
+   pValue->assign(*ppPos, *ppPos + length);
+   *ppPos += length;
+   return true;
+}
+
+std::string subjectOf(const std::string& description)
+{
+   return description.substr(0, description.find('\n'));
+}
+
+void layoutGraph(gitgraph::GitGraph* pGraph,
+                 std::vector<CommitInfo>* pCommits)
+{
+   std::vector<std::string> parents;
+   BOOST_FOREACH(CommitInfo& commit, *pCommits)
+   {
+      parents.clear();
+      if (!commit.parent.empty())
+      {
+         boost::algorithm::split(parents, commit.parent,
+                                 boost::algorithm::is_any_of(" "));
+      }
+      commit.graph = pGraph->addCommit(commit.id, parents).string();
+   }
+}
+
+// graph lines are space separated column ids, each of which may be
+// preceded by markers (see gitgraph::Line::string)
+const char kColumnMarkers[] = "*+-";
+
+int columnId(const std::string& column)
+{
+   std::string::size_type pos = column.find_first_not_of(kColumnMarkers);
+   if (pos == std::string::npos)
+      return -1;
+   return safe_convert::stringTo<int>(column.substr(pos), -1);
+}
+
+std::string renumberColumn(const std::string& graph, int from, int to)
+{
+   std::vector<std::string> columns;
+   boost::algorithm::split(columns, graph, boost::algorithm::is_any_of(" "));
+   BOOST_FOREACH(std::string& column, columns)
+   {
+      if (columnId(column) == from)
+      {
+         column = column.substr(0, column.find_first_not_of(kColumnMarkers)) +
+                  safe_convert::numberToString(to);
+      }
+   }
+   return boost::algorithm::join(columns, " ");
+}
+
+int nextColumnIdOf(const std::vector<CommitInfo>& commits)
+{
+   int nextColumnId = 0;
+   std::vector<std::string> columns;
+   BOOST_FOREACH(const CommitInfo& commit, commits)
+   {
+      columns.clear();
+      boost::algorithm::split(columns, commit.graph,
+                              boost::algorithm::is_any_of(" "));
+      BOOST_FOREACH(const std::string& column, columns)
+      {
+         nextColumnId = std::max(nextColumnId, columnId(column) + 1);
+      }
+   }
+   return nextColumnId;
+}
+
+} // anonymous namespace
+
+void CommitHistory::assign(const std::string& tip,
+                           const std::vector<CommitInfo>& commits)
+{
+   tip_ = tip;
+   commits_ = commits;
+
+   maxCommitTime_ = 0;
+   BOOST_FOREACH(const CommitInfo& commit, commits_)
+   {
+      maxCommitTime_ = std::max(maxCommitTime_, commit.commitTime);
+   }
+
+   updateGraph();
+}
+
+bool CommitHistory::prepend(const std::string& tip,
+                            const std::vector<CommitInfo>& commits)
+{
+   // (when they are all newer git lists them first and then lists the
+   // existing commits just as it did before)
+   boost::int64_t maxCommitTime = maxCommitTime_;
+   BOOST_FOREACH(const CommitInfo& commit, commits)
+   {
+      if (commit.commitTime <= maxCommitTime_)
+         return false;
+      maxCommitTime = std::max(maxCommitTime, commit.commitTime);
+   }
+
+   // the layout of the graph flows down from the newest commit so adding
+   // commits on top of it can move every line. usually though the new
+   // commits lead straight into the previous newest commit and only they
+   // need to be laid out (otherwise we lay out everything again, which
+   // only requires the parents we already have, not another trip to git)
+   std::vector<CommitInfo> newCommits(commits);
+   bool extended = extendGraph(&newCommits);
+
+   tip_ = tip;
+   commits_.insert(commits_.begin(), newCommits.begin(), newCommits.end());
+   maxCommitTime_ = maxCommitTime;
+
+   if (!extended)
+      updateGraph();
+
+   return true;
+}
+
+void CommitHistory::updateGraph()
+{
+   gitgraph::GitGraph graph;
+   layoutGraph(&graph, &commits_);
+   nextColumnId_ = graph.nextColumnId();
+}
+
+// lay out the graph for commits which are going on top of the existing
+// ones. no columns lead into the top line of the graph (it is laid out
+// first) so if the new commits end in a single column leading into the
+// current top commit then the existing lines still apply: the column
+// continues as the first column of the top line (which no longer starts
+// there). returns false (leaving the graph alone) if that isn't the case
+bool CommitHistory::extendGraph(std::vector<CommitInfo>* pCommits)
+{
+   if (commits_.empty())
+      return false;
+
+   CommitInfo& top = commits_.front();
+   if (!boost::algorithm::starts_with(top.graph, "*+"))
+      return false;
+
+   // number the new columns after the existing ones
+   gitgraph::GitGraph graph(nextColumnId_);
+   layoutGraph(&graph, pCommits);
+   const gitgraph::Line& pending = graph.pendingLine();
+   if (pending.size() != 1 || pending.front().preCommit != top.id)
+      return false;
+
+   int topColumnId = columnId(top.graph.substr(0, top.graph.find(' ')));
+   BOOST_FOREACH(CommitInfo& commit, *pCommits)
+   {
+      commit.graph = renumberColumn(commit.graph,
+                                    pending.front().id,
+                                    topColumnId);
+   }
+   top.graph.erase(1, 1);
+   nextColumnId_ = graph.nextColumnId();
+
+   return true;
+}
+
+Error CommitHistory::read(const FilePath& filePath, const std::string& key)
+{
+   tip_.clear();
+   commits_.clear();
+   maxCommitTime_ = 0;
+   nextColumnId_ = 0;
+
+   if (!filePath.exists())
+      return Success();
+
+   try
+   {
+      boost::iostreams::mapped_file_source file(filePath.absolutePath());
+      const char* pos = file.data();
+      const char* end = pos + file.size();
+
+      bool valid = file.size() >= kFileHeaderSize &&
+                   std::memcmp(pos, kFileHeader, kFileHeaderSize) == 0;
+      pos += kFileHeaderSize;
+
+      // the file may have been written for a different key with the same
+      // hash, in which case we start over
+      std::string fileKey, tip;
+      valid = valid && readRecord(&pos, end, &fileKey) &&
+                       readRecord(&pos, end, &tip);
+      if (valid && fileKey != key)
+         return Success();
+
+      std::vector<CommitInfo> commits;
+      std::string fields[kCommitRecords];
+      while (valid && pos < end)
+      {
+         for (std::size_t i = 0; valid && i < kCommitRecords; i++)
+            valid = readRecord(&pos, end, &fields[i]);
+         if (!valid)
+            break;
+
+         CommitInfo commit;
+         commit.id = fields[0];
+         commit.parent = fields[1];
+         commit.author = fields[2];
+         commit.date = safe_convert::stringTo<boost::int64_t>(fields[3], 0);
+         commit.commitTime = safe_convert::stringTo<boost::int64_t>(fields[4],
+                                                                    0);
+         commit.description = fields[5];
+         commit.subject = subjectOf(commit.description);
+         commit.graph = fields[6];
+         maxCommitTime_ = std::max(maxCommitTime_, commit.commitTime);
+         commits.push_back(commit);
+      }
+
+      if (!valid)
+      {
+         Error error = systemError(boost::system::errc::invalid_argument,
+                                   ERROR_LOCATION);
+         error.addProperty("path", filePath.absolutePath());
+         return error;
+      }
+
+      tip_ = tip;
+      commits_.swap(commits);
+      nextColumnId_ = nextColumnIdOf(commits_);
+   }
+   catch(const std::exception& e)
+   {
+      Error error = systemError(boost::system::errc::io_error,
+                                ERROR_LOCATION);
+      error.addProperty("what", e.what());
+      error.addProperty("path", filePath.absolutePath());
+      return error;
+   }
+
+   return Success();
+}
+
+Error CommitHistory::write(const FilePath& filePath,
+                           const std::string& key) const
+{
+   std::string contents(kFileHeader, kFileHeaderSize);
+   appendRecord(key, &contents);
+   appendRecord(tip_, &contents);
+   BOOST_FOREACH(const CommitInfo& commit, commits_)
+   {
+      appendRecord(commit.id, &contents);
+      appendRecord(commit.parent, &contents);
+      appendRecord(commit.author, &contents);
+      appendRecord(safe_convert::numberToString(commit.date), &contents);
+      appendRecord(safe_convert::numberToString(commit.commitTime), &contents);
+      appendRecord(commit.description, &contents);
+      appendRecord(commit.graph, &contents);
+   }
+
+   // write to a temporary file which is then renamed over the history (so
+   // an interrupted write never leaves a truncated history behind)
+   FilePath tempPath = filePath.parent().complete(filePath.filename() +
+                                                  ".tmp");
+   Error error = writeStringToFile(tempPath, contents);
+   if (!error)
+      error = tempPath.move(filePath);
+   if (error)
+   {
+      Error removeError = tempPath.removeIfExists();
+      if (removeError)
+         LOG_ERROR(removeError);
+   }
+   return error;
+}
+
+} // namespace git
+} // namespace modules
+} // namespace session
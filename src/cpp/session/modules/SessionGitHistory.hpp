@@ -0,0 +1,87 @@
+/*
+ * SessionGitHistory.hpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#ifndef SESSION_GIT_HISTORY_HPP
+#define SESSION_GIT_HISTORY_HPP
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/utility.hpp>
+
+#include <core/Error.hpp>
+#include <core/FilePath.hpp>
+
+namespace session {
+namespace modules {
+namespace git {
+
+struct CommitInfo
+{
+   std::string id;
+   std::string author;
+   std::string subject;
+   std::string description;
+   std::string parent;
+   boost::int64_t date; // millis since epoch, UTC
+   boost::int64_t commitTime; // as recorded by git (orders the history)
+   std::vector<std::string> refs;
+   std::vector<std::string> tags;
+   std::string graph;
+};
+
+// history of a revision (newest first, in date order) along with the
+// lines of its commit graph. the history is saved to disk so that it can
+// be paged and searched without running git log, and is extended in place
+// when new commits are added on top of it. note that the parent field of
+// the commits holds the full ids of their parents and that refs and tags
+// aren't recorded (they change independently of the history)
+class CommitHistory : boost::noncopyable
+{
+public:
+   CommitHistory() : maxCommitTime_(0), nextColumnId_(0) {}
+
+   // COPYING: boost::noncopyable
+
+   const std::string& tip() const { return tip_; }
+   const std::vector<CommitInfo>& commits() const { return commits_; }
+
+   // replace the history
+   void assign(const std::string& tip, const std::vector<CommitInfo>& commits);
+
+   // add the commits which lead from the current tip to a new tip. this is
+   // only possible if all of them are newer than the existing commits (as
+   // otherwise they would be interleaved with them), returns false if not
+   bool prepend(const std::string& tip, const std::vector<CommitInfo>& commits);
+
+   core::Error read(const core::FilePath& filePath, const std::string& key);
+   core::Error write(const core::FilePath& filePath,
+                     const std::string& key) const;
+
+private:
+   void updateGraph();
+   bool extendGraph(std::vector<CommitInfo>* pCommits);
+
+private:
+   std::string tip_;
+   std::vector<CommitInfo> commits_;
+   boost::int64_t maxCommitTime_;
+   int nextColumnId_;
+};
+
+} // namespace git
+} // namespace modules
+} // namespace session
+
+#endif // SESSION_GIT_HISTORY_HPP
@@ -0,0 +1,274 @@
+/*
+ * SessionGitHistoryTests.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include "SessionGitHistory.hpp"
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <boost/assert.hpp>
+#include <boost/format.hpp>
+#include <boost/foreach.hpp>
+#include <boost/algorithm/string/join.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+
+#include <core/SafeConvert.hpp>
+
+using namespace core;
+
+namespace session {
+namespace modules {
+namespace git {
+
+namespace {
+
+const int kRepositories = 200;
+const int kCommitsPerRepository = 120;
+const int kSnapshotsPerRepository = 8;
+
+// small deterministic generator (so a failure can be reproduced)
+class Random
+{
+public:
+   explicit Random(unsigned long seed) : state_(seed) {}
+
+   int next(int n)
+   {
+      state_ = (state_ * 1103515245UL + 12345UL) & 0x7fffffffUL;
+      return static_cast<int>((state_ >> 8) % n);
+   }
+
+private:
+   unsigned long state_;
+};
+
+std::string commitId(int i)
+{
+   return "c" + safe_convert::numberToString(i);
+}
+
+// a repository whose commits (oldest first) branch from and merge into
+// each other at random. every commit is newer than those before it
+struct Repository
+{
+   std::vector<std::vector<int> > parents;
+   std::vector<int> heads;
+};
+
+int addCommit(const std::vector<int>& parents, Repository* pRepo)
+{
+   pRepo->parents.push_back(parents);
+   return static_cast<int>(pRepo->parents.size()) - 1;
+}
+
+void growRepository(Random* pRandom, Repository* pRepo)
+{
+   std::vector<int>& heads = pRepo->heads;
+   if (heads.empty())
+   {
+      heads.push_back(addCommit(std::vector<int>(), pRepo));
+      return;
+   }
+
+   int action = pRandom->next(10);
+   std::size_t head = pRandom->next(static_cast<int>(heads.size()));
+   if (action < 2)
+   {
+      // branch from an earlier commit
+      int from = pRandom->next(static_cast<int>(pRepo->parents.size()));
+      heads.push_back(addCommit(std::vector<int>(1, from), pRepo));
+   }
+   else if (action < 5 && heads.size() > 1)
+   {
+      // merge another branch (or, now and then, two) into this one
+      std::vector<int> parents(1, heads[head]);
+      for (int merges = 1 + (action == 4 ? 1 : 0);
+           merges > 0 && heads.size() > 1;
+           merges--)
+      {
+         std::size_t other = (head + 1 +
+            pRandom->next(static_cast<int>(heads.size()) - 1)) % heads.size();
+         parents.push_back(heads[other]);
+         heads.erase(heads.begin() + other);
+         if (other < head)
+            head--;
+      }
+      heads[head] = addCommit(parents, pRepo);
+   }
+   else
+   {
+      heads[head] = addCommit(std::vector<int>(1, heads[head]), pRepo);
+   }
+}
+
+// the commits reachable from tip which aren't reachable from base (-1 for
+// none), newest first (as git log lists them)
+std::vector<CommitInfo> commitsBetween(const Repository& repo,
+                                       int base,
+                                       int tip)
+{
+   std::set<int> excluded;
+   std::vector<int> stack;
+   if (base >= 0)
+      stack.push_back(base);
+   while (!stack.empty())
+   {
+      int commit = stack.back();
+      stack.pop_back();
+      if (excluded.insert(commit).second)
+         stack.insert(stack.end(),
+                      repo.parents[commit].begin(),
+                      repo.parents[commit].end());
+   }
+
+   std::set<int> reachable;
+   stack.push_back(tip);
+   while (!stack.empty())
+   {
+      int commit = stack.back();
+      stack.pop_back();
+      if (excluded.count(commit) == 0 && reachable.insert(commit).second)
+         stack.insert(stack.end(),
+                      repo.parents[commit].begin(),
+                      repo.parents[commit].end());
+   }
+
+   std::vector<CommitInfo> commits;
+   for (std::set<int>::const_reverse_iterator it = reachable.rbegin();
+        it != reachable.rend();
+        ++it)
+   {
+      CommitInfo commit;
+      commit.id = commitId(*it);
+      commit.commitTime = *it + 1;
+      commit.date = commit.commitTime * 1000;
+      std::vector<std::string> parents;
+      BOOST_FOREACH(int parent, repo.parents[*it])
+      {
+         parents.push_back(commitId(parent));
+      }
+      commit.parent = boost::algorithm::join(parents, " ");
+      commits.push_back(commit);
+   }
+   return commits;
+}
+
+bool isAncestor(const Repository& repo, int ancestor, int commit)
+{
+   std::vector<CommitInfo> commits = commitsBetween(repo, -1, commit);
+   BOOST_FOREACH(const CommitInfo& info, commits)
+   {
+      if (info.id == commitId(ancestor))
+         return true;
+   }
+   return false;
+}
+
+// the graph lines with their columns numbered in order of appearance (an
+// extended graph numbers new columns after the existing ones, so only the
+// shape of the lines can be compared with a full layout)
+std::vector<std::string> canonicalGraph(const std::vector<CommitInfo>& commits)
+{
+   std::map<std::string,std::string> ids;
+   std::vector<std::string> graph;
+   BOOST_FOREACH(const CommitInfo& commit, commits)
+   {
+      std::vector<std::string> columns;
+      boost::algorithm::split(columns, commit.graph,
+                              boost::algorithm::is_any_of(" "));
+      BOOST_FOREACH(std::string& column, columns)
+      {
+         std::string::size_type pos = column.find_first_not_of("*+-");
+         if (pos == std::string::npos)
+            continue;
+         std::string id = column.substr(pos);
+         if (ids.find(id) == ids.end())
+            ids[id] = safe_convert::numberToString(ids.size());
+         column = column.substr(0, pos) + ids[id];
+      }
+      graph.push_back(boost::algorithm::join(columns, " "));
+   }
+   return graph;
+}
+
+// grow random repositories, following each one's history from a series of
+// tips (prepending where possible, as the git module does) and check that
+// the graph always matches a full layout of the same commits
+bool verifyPrependedLayout(int* pPrepended)
+{
+   Random random(20121018);
+   for (int r = 0; r < kRepositories; r++)
+   {
+      Repository repo;
+      CommitHistory history;
+      int tip = -1;
+      for (int snapshot = 0; snapshot < kSnapshotsPerRepository; snapshot++)
+      {
+         int commits = kCommitsPerRepository / kSnapshotsPerRepository;
+         for (int i = 0; i < commits; i++)
+            growRepository(&random, &repo);
+
+         int previousTip = tip;
+         tip = repo.heads[random.next(static_cast<int>(repo.heads.size()))];
+         if (tip == previousTip)
+            continue;
+
+         std::vector<CommitInfo> all = commitsBetween(repo, -1, tip);
+         if (previousTip >= 0 &&
+             isAncestor(repo, previousTip, tip) &&
+             history.prepend(commitId(tip),
+                             commitsBetween(repo, previousTip, tip)))
+         {
+            (*pPrepended)++;
+         }
+         else
+         {
+            history.assign(commitId(tip), all);
+         }
+
+         CommitHistory expected;
+         expected.assign(commitId(tip), all);
+         if (history.commits().size() != all.size() ||
+             canonicalGraph(history.commits()) !=
+                                       canonicalGraph(expected.commits()))
+         {
+            std::cerr << boost::format("repository %1% differs at tip %2%")
+                           % r % commitId(tip)
+                      << std::endl;
+            return false;
+         }
+      }
+   }
+   return true;
+}
+
+} // anonymous namespace
+
+void runGitHistoryTests()
+{
+   int prepended = 0;
+   bool layout = verifyPrependedLayout(&prepended);
+   BOOST_ASSERT(layout);
+
+   std::cout << boost::format("prepended layout %1% (%2% histories "
+                              "prepended to)")
+                  % (layout ? "ok" : "FAILED") % prepended
+             << std::endl;
+}
+
+} // namespace git
+} // namespace modules
+} // namespace session
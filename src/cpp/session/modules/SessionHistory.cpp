@@ -12,6 +12,7 @@
  */
 
 #include "SessionHistory.hpp"
+#include "SessionHistoryArchive.hpp"
 
 #include <iostream>
 #include <sstream>
@@ -27,6 +28,7 @@
 
 #include <core/Error.hpp>
 #include <core/Exec.hpp>
+#include <core/Thread.hpp>
 #include <core/FilePath.hpp>
 #include <core/FileSerializer.hpp>
 #include <core/DateTime.hpp>
@@ -45,18 +47,6 @@ namespace history {
 
 namespace {   
 
-struct HistoryEntry
-{
-   HistoryEntry() : index(0), timestamp(0) {}
-   HistoryEntry(int index, double timestamp, const std::string& command)
-      : index(index), timestamp(timestamp), command(command)
-   {
-   }
-   int index;
-   double timestamp;
-   std::string command;
-};
-
 void historyEntriesAsJson(const std::vector<HistoryEntry>& entries,
                           json::Object* pEntriesJson)
 {
@@ -115,112 +105,156 @@ private:
 };
    
    
+// NOTE: the archive is searched from rpc worker threads as well as
+// being added to from the main thread so all access is synchronized
 class History : boost::noncopyable
 {
 private:
-   History() : entryCacheLastWriteTime_(-1) {}
+   History() : archive_(historyArchiveFilePath()) {}
    friend History& historyArchive();
    
 public:
    
    Error add(const std::string& command)
    {
-      // reset the cache (since this write will invalidate the current one,
-      // no sense in keeping our cache around in memory)
-      entries_.clear();
-      entryCacheLastWriteTime_ = -1;
-
-      // write the entry to the file
-      std::ostringstream ostrEntry ;
-      double currentTime = core::date_time::millisecondsSinceEpoch();
-      writeEntry(currentTime, command, &ostrEntry);
-      ostrEntry << std::endl;
-      return appendToFile(historyDatabaseFilePath(), ostrEntry.str());
+      LOCK_MUTEX(mutex_)
+      {
+         return archive_.add(command);
+      }
+      END_LOCK_MUTEX
+
+      return Success();
    }
 
-   const std::vector<HistoryEntry>& entries() const
+   int size()
    {
-      // calculate path to history db
-      FilePath historyDBPath = historyDatabaseFilePath();
-
-      // if the file doesn't exist then clear the collection
-      if (!historyDBPath.exists())
+      LOCK_MUTEX(mutex_)
       {
-         entries_.clear();
+         return archive_.entries().size();
       }
+      END_LOCK_MUTEX
 
-      // otherwise check for divergent lastWriteTime and read the file
-      // if our internal list isn't up to date
-      else if (historyDBPath.lastWriteTime() != entryCacheLastWriteTime_)
+      return 0;
+   }
+
+   void entries(int startIndex,
+                int endIndex,
+                std::vector<HistoryEntry>* pEntries)
+   {
+      LOCK_MUTEX(mutex_)
       {
-         entries_.clear();
-         Error error = readCollectionFromFile<std::vector<HistoryEntry> >(
-                                                      historyDBPath,
-                                                      &entries_,
-                                                      HistoryEntryReader());
-         if (error)
+         // (the archive may have been reloaded since the indexes were
+         // validated so clamp them again)
+         const std::vector<HistoryEntry>& allEntries = archive_.entries();
+         int historySize = allEntries.size();
+         startIndex = std::min(startIndex, historySize);
+         endIndex = std::min(endIndex, historySize);
+         if (startIndex < endIndex)
          {
-            LOG_ERROR(error);
-         }
-         else
-         {
-            entryCacheLastWriteTime_ = historyDBPath.lastWriteTime();
+            std::copy(allEntries.begin() + startIndex,
+                      allEntries.begin() + endIndex,
+                      std::back_inserter(*pEntries));
          }
+      }
+      END_LOCK_MUTEX
+   }
 
+   void search(const std::vector<std::string>& searchTerms,
+               std::size_t maxEntries,
+               std::vector<HistoryEntry>* pMatches)
+   {
+      LOCK_MUTEX(mutex_)
+      {
+         archive_.search(searchTerms, maxEntries, pMatches);
       }
-      
-      // return entries
-      return entries_;
+      END_LOCK_MUTEX
    }
 
-   static void migrateRhistoryIfNecessary()
+   void searchByPrefix(const std::string& prefix,
+                       std::size_t maxEntries,
+                       bool uniqueOnly,
+                       std::vector<HistoryEntry>* pMatches)
    {
-      // if the history database doesn't exist see if we can migrate the
-      // old .Rhistory file
-      FilePath historyDBPath = historyDatabaseFilePath();
-      if (!historyDBPath.exists())
-         attemptRhistoryMigration() ;
+      LOCK_MUTEX(mutex_)
+      {
+         archive_.searchByPrefix(prefix, maxEntries, uniqueOnly, pMatches);
+      }
+      END_LOCK_MUTEX
+   }
+
+   static void migrateHistoryIfNecessary()
+   {
+      // if the history archive doesn't exist see if we can migrate the
+      // text history database or (failing that) the old .Rhistory file
+      FilePath archivePath = historyArchiveFilePath();
+      if (!archivePath.exists())
+      {
+         if (historyDatabaseFilePath().exists())
+            attemptHistoryDatabaseMigration();
+         else
+            attemptRhistoryMigration();
+      }
    }
 
    
 private:
 
-   static void writeEntry(double timestamp, 
-                          const std::string& command, 
-                          std::ostream* pOS) 
+   static void migrateEntries(const std::vector<HistoryEntry>& entries)
    {
-      *pOS << std::fixed << std::setprecision(0) 
-           << timestamp << ":" << command;
+      HistoryArchive archive(historyArchiveFilePath());
+      Error error = archive.add(entries);
+      if (error)
+         LOG_ERROR(error);
    }
-   
-   static std::string migratedHistoryEntry(const std::string& command)
+
+   static void attemptHistoryDatabaseMigration()
    {
-      std::ostringstream ostr ;
-      writeEntry(0, command, &ostr);
-      return ostr.str();
+      std::vector<HistoryEntry> entries;
+      Error error = readCollectionFromFile<std::vector<HistoryEntry> >(
+                                                   historyDatabaseFilePath(),
+                                                   &entries,
+                                                   HistoryEntryReader());
+      if (error)
+      {
+         LOG_ERROR(error);
+         return;
+      }
+
+      migrateEntries(entries);
    }
    
    static void attemptRhistoryMigration() 
    {
-      Error error = writeCollectionToFile<r::session::ConsoleHistory>(
-                                                   historyDatabaseFilePath(),
-                                                   r::session::consoleHistory(),
-                                                   migratedHistoryEntry);  
-      
-      // log any error which occurs
-      if (error)
-         LOG_ERROR(error);
+      std::vector<HistoryEntry> entries;
+      const r::session::ConsoleHistory& consoleHistory =
+                                             r::session::consoleHistory();
+      for (r::session::ConsoleHistory::const_iterator
+           it = consoleHistory.begin();
+           it != consoleHistory.end();
+           ++it)
+      {
+         entries.push_back(HistoryEntry(entries.size(), 0, *it));
+      }
+
+      if (!entries.empty())
+         migrateEntries(entries);
    }
    
+   // text history database (used by previous versions)
    static FilePath historyDatabaseFilePath()
    {
       return module_context::userScratchPath().complete("history_database");
    }
+
+   static FilePath historyArchiveFilePath()
+   {
+      return module_context::userScratchPath().complete("history_archive");
+   }
    
    
 private:
-   mutable std::time_t entryCacheLastWriteTime_;
-   mutable std::vector<HistoryEntry> entries_;
+   boost::mutex mutex_;
+   HistoryArchive archive_;
 };
    
 History& historyArchive()
@@ -233,11 +267,8 @@ Error setJsonResultFromHistory(int startIndex,
                                int endIndex,
                                json::JsonRpcResponse* pResponse)
 {
-   // get all entries
-   const std::vector<HistoryEntry>& allEntries = historyArchive().entries();
-
    // validate indexes
-   int historySize = allEntries.size();
+   int historySize = historyArchive().size();
    if ( (startIndex < 0)               ||
         (startIndex > historySize)     ||
         (endIndex < 0)                 ||
@@ -248,32 +279,13 @@ Error setJsonResultFromHistory(int startIndex,
    
    // return the entries
    std::vector<HistoryEntry> entries;
-   std::copy(allEntries.begin() + startIndex,
-             allEntries.begin() + endIndex,
-             std::back_inserter(entries));
+   historyArchive().entries(startIndex, endIndex, &entries);
    json::Object entriesJson;
    historyEntriesAsJson(entries, &entriesJson);
    pResponse->setResult(entriesJson);
    return Success();
 }
    
-bool matches(const HistoryEntry& entry,
-             const std::vector<std::string>& searchTerms)
-{   
-   // look for each search term in the input
-   for (std::vector<std::string>::const_iterator it = searchTerms.begin();
-        it != searchTerms.end();
-        ++it)
-   {
-      if (!boost::algorithm::contains(entry.command, *it))
-         return false;
-   }
-   
-   // had all of the search terms, return true
-   return true;
-}
-
-
 void historyRangeAsJson(int startIndex,
                         int endIndex,
                         json::Object* pHistoryJson)
@@ -402,7 +414,7 @@ Error getHistoryArchiveItems(const json::JsonRpcRequest& request,
       return error;
    
    // truncate indexes if necessary
-   int historySize = historyArchive().entries().size();
+   int historySize = historyArchive().size();
    startIndex = std::min(startIndex, historySize);
    endIndex = std::min(endIndex, historySize);
    
@@ -426,25 +438,11 @@ Error searchHistoryArchive(const json::JsonRpcRequest& request,
    boost::tokenizer<boost::char_separator<char> > tok(query, sep);
    std::copy(tok.begin(), tok.end(), std::back_inserter(searchTerms));
    
-   // examine the items in the history for matches
-   const std::vector<HistoryEntry>& allEntries =  historyArchive().entries();
+   // find the most recent matches
    std::vector<HistoryEntry> matchingEntries;
-   for (std::vector<HistoryEntry>::const_reverse_iterator 
-            it = allEntries.rbegin();
-            it != allEntries.rend();
-            ++it)
-   {
-      // check limit
-      if (matchingEntries.size() >= static_cast<std::size_t>(maxEntries))
-         break;
-
-      // look for match
-      if (matches(*it, searchTerms))
-      {
-         // add entry
-         matchingEntries.push_back(*it);
-      }
-   }
+   historyArchive().search(searchTerms,
+                           std::max(maxEntries, 0),
+                           &matchingEntries);
 
    // return json
    json::Object entriesJson;
@@ -468,29 +466,12 @@ Error searchHistoryArchiveByPrefix(const json::JsonRpcRequest& request,
    // trim the prefix
    boost::algorithm::trim(prefix);
    
-   // examine the items in the history for matches
-   const std::vector<HistoryEntry>& allEntries = historyArchive().entries();
-   std::set<std::string> matchedCommands;
+   // find the most recent matches
    std::vector<HistoryEntry> matchingEntries;
-   for (std::vector<HistoryEntry>::const_reverse_iterator 
-        it = allEntries.rbegin();
-        it != allEntries.rend();
-        ++it)
-   {
-      // check limit
-      if (matchingEntries.size() >= static_cast<std::size_t>(maxEntries))
-         break;
-      
-      // look for match 
-      if (boost::algorithm::starts_with(it->command, prefix))
-      {
-         if (!uniqueOnly || (matchedCommands.count(it->command) == 0))
-         {
-            matchingEntries.push_back(*it);
-            matchedCommands.insert(it->command);
-         }
-      }
-   }
+   historyArchive().searchByPrefix(prefix,
+                                   std::max(maxEntries, 0),
+                                   uniqueOnly,
+                                   &matchingEntries);
    
    // return json
    json::Object entriesJson;
@@ -521,8 +502,8 @@ void onHistoryAdd(const std::string& command)
    
 Error initialize()
 {
-   // migrate .Rhistory if necessary
-   History::migrateRhistoryIfNecessary();
+   // migrate history database or .Rhistory if necessary
+   History::migrateHistoryIfNecessary();
    
    // connect to console history add event
    r::session::consoleHistory().connectOnAdd(onHistoryAdd);   
@@ -536,9 +517,9 @@ Error initialize()
       (bind(registerRpcMethod, "get_history_items", getHistoryItems))
       (bind(registerRpcMethod, "remove_history_items", removeHistoryItems))
       (bind(registerRpcMethod, "clear_history", clearHistory))
-      (bind(registerRpcMethod, "get_history_archive_items", getHistoryArchiveItems))
-      (bind(registerRpcMethod, "search_history_archive", searchHistoryArchive))
-      (bind(registerRpcMethod, "search_history_archive_by_prefix", searchHistoryArchiveByPrefix));
+      (bind(registerRFreeRpcMethod, "get_history_archive_items", getHistoryArchiveItems))
+      (bind(registerRFreeRpcMethod, "search_history_archive", searchHistoryArchive))
+      (bind(registerRFreeRpcMethod, "search_history_archive_by_prefix", searchHistoryArchiveByPrefix));
    return initBlock.execute();
 }
 
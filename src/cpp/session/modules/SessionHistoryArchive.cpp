@@ -0,0 +1,478 @@
+/*
+ * SessionHistoryArchive.cpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#include "SessionHistoryArchive.hpp"
+
+#include <cstring>
+#include <queue>
+#include <algorithm>
+
+#include <boost/foreach.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <core/Log.hpp>
+#include <core/DateTime.hpp>
+#include <core/FileSerializer.hpp>
+
+using namespace core;
+
+namespace session {
+namespace modules {
+namespace history {
+
+// node of the command trie. nodes are labeled with the characters which
+// lead to them from their parent and record the most recent entry index
+// within their subtree (so the most recent matches can be found without
+// visiting the whole subtree)
+struct HistoryTrieNode
+{
+   HistoryTrieNode() : latest(-1), commandId(-1) {}
+   std::string label;
+   std::vector<boost::shared_ptr<HistoryTrieNode> > children;
+   int latest;
+
+   // for nodes which end a command, the command's id and the indexes
+   // of its entries (oldest first)
+   int commandId;
+   std::vector<int> entries;
+};
+
+namespace {
+
+// database format: header followed by records of
+//
+//    <length:uint32> <timestamp:double> <command:length bytes>
+//
+// (in native byte order, the database is local to the user)
+const char kDatabaseHeader[] = "RSHIST01";
+const std::size_t kDatabaseHeaderSize = sizeof(kDatabaseHeader) - 1;
+const std::size_t kRecordHeaderSize = sizeof(boost::uint32_t) + sizeof(double);
+
+void appendRecord(double timestamp,
+                  const std::string& command,
+                  std::string* pRecords)
+{
+   boost::uint32_t length = static_cast<boost::uint32_t>(command.length());
+   pRecords->append(reinterpret_cast<const char*>(&length), sizeof(length));
+   pRecords->append(reinterpret_cast<const char*>(&timestamp),
+                    sizeof(timestamp));
+   pRecords->append(command);
+}
+
+boost::uint32_t trigramKey(const std::string& str, std::size_t pos)
+{
+   const unsigned char* chars =
+               reinterpret_cast<const unsigned char*>(str.data() + pos);
+   return (static_cast<boost::uint32_t>(chars[0]) << 16) |
+          (static_cast<boost::uint32_t>(chars[1]) << 8) |
+           static_cast<boost::uint32_t>(chars[2]);
+}
+
+bool containsAll(const std::string& command,
+                 const std::vector<std::string>& terms)
+{
+   BOOST_FOREACH(const std::string& term, terms)
+   {
+      if (!boost::algorithm::contains(command, term))
+         return false;
+   }
+   return true;
+}
+
+std::size_t commonPrefixLength(const std::string& label,
+                               const std::string& str,
+                               std::size_t pos)
+{
+   std::size_t length = 0;
+   while (length < label.length() &&
+          (pos + length) < str.length() &&
+          label[length] == str[pos + length])
+   {
+      length++;
+   }
+   return length;
+}
+
+HistoryTrieNode* findChild(const HistoryTrieNode& node, char ch)
+{
+   BOOST_FOREACH(const boost::shared_ptr<HistoryTrieNode>& pChild,
+                 node.children)
+   {
+      if (pChild->label[0] == ch)
+         return pChild.get();
+   }
+   return NULL;
+}
+
+// candidate for the next most recent match: either a node whose subtree
+// is yet to be expanded (pos < 0) or one of a node's entries
+struct Candidate
+{
+   Candidate(int index, const HistoryTrieNode* pNode, int pos)
+      : index(index), pNode(pNode), pos(pos)
+   {
+   }
+   int index;
+   const HistoryTrieNode* pNode;
+   int pos;
+
+   bool operator<(const Candidate& other) const
+   {
+      return index < other.index;
+   }
+};
+
+} // anonymous namespace
+
+HistoryArchive::HistoryArchive(const FilePath& databasePath)
+   : databasePath_(databasePath), loadedSize_(0)
+{
+   reset();
+}
+
+Error HistoryArchive::add(const std::string& command)
+{
+   std::string record;
+   appendRecord(core::date_time::millisecondsSinceEpoch(), command, &record);
+   return append(record);
+}
+
+Error HistoryArchive::add(const std::vector<HistoryEntry>& entries)
+{
+   std::string records;
+   BOOST_FOREACH(const HistoryEntry& entry, entries)
+   {
+      appendRecord(entry.timestamp, entry.command, &records);
+   }
+   return append(records);
+}
+
+const std::vector<HistoryEntry>& HistoryArchive::entries()
+{
+   refresh();
+   return entries_;
+}
+
+void HistoryArchive::search(const std::vector<std::string>& terms,
+                            std::size_t maxEntries,
+                            std::vector<HistoryEntry>* pMatches)
+{
+   refresh();
+
+   // find the least common trigram among the terms (if any term has a
+   // trigram no command contains then nothing matches)
+   const std::vector<int>* pCandidates = NULL;
+   BOOST_FOREACH(const std::string& term, terms)
+   {
+      for (std::size_t i = 0; i + 3 <= term.length(); i++)
+      {
+         TrigramMap::const_iterator it = trigrams_.find(trigramKey(term, i));
+         if (it == trigrams_.end())
+            return;
+
+         if (pCandidates == NULL || it->second.size() < pCandidates->size())
+            pCandidates = &(it->second);
+      }
+   }
+
+   // without a trigram to narrow the search check the entries most
+   // recent first (short terms are common so this finishes quickly)
+   if (pCandidates == NULL)
+   {
+      for (std::vector<HistoryEntry>::const_reverse_iterator
+           it = entries_.rbegin();
+           it != entries_.rend() && pMatches->size() < maxEntries;
+           ++it)
+      {
+         if (containsAll(it->command, terms))
+            pMatches->push_back(*it);
+      }
+      return;
+   }
+
+   // check the distinct commands containing the trigram then take the
+   // most recent entries of those which match
+   std::vector<const HistoryTrieNode*> nodes;
+   BOOST_FOREACH(int commandId, *pCandidates)
+   {
+      const HistoryTrieNode* pNode = commands_[commandId];
+      if (containsAll(entries_[pNode->entries.front()].command, terms))
+         nodes.push_back(pNode);
+   }
+   collectRecent(nodes, false, maxEntries, false, pMatches);
+}
+
+void HistoryArchive::searchByPrefix(const std::string& prefix,
+                                    std::size_t maxEntries,
+                                    bool uniqueOnly,
+                                    std::vector<HistoryEntry>* pMatches)
+{
+   refresh();
+
+   // find the node for the prefix (the prefix may end part way through
+   // its label)
+   const HistoryTrieNode* pNode = pTrieRoot_.get();
+   std::size_t pos = 0;
+   while (pos < prefix.length())
+   {
+      pNode = findChild(*pNode, prefix[pos]);
+      if (pNode == NULL)
+         return;
+
+      std::size_t length = commonPrefixLength(pNode->label, prefix, pos);
+      if (length < pNode->label.length() && (pos + length) < prefix.length())
+         return;
+
+      pos += length;
+   }
+
+   std::vector<const HistoryTrieNode*> nodes;
+   nodes.push_back(pNode);
+   collectRecent(nodes, true, maxEntries, uniqueOnly, pMatches);
+}
+
+Error HistoryArchive::append(const std::string& records)
+{
+   std::string content;
+   if (!databasePath_.exists() || databasePath_.size() == 0)
+      content.append(kDatabaseHeader, kDatabaseHeaderSize);
+   content.append(records);
+
+   Error error = appendToFile(databasePath_, content);
+   if (error)
+      return error;
+
+   // read back what we've written (along with anything other
+   // sessions have written since we last read)
+   refresh();
+
+   return Success();
+}
+
+void HistoryArchive::refresh()
+{
+   // if the database doesn't exist then clear the archive
+   if (!databasePath_.exists())
+   {
+      if (loadedSize_ > 0)
+         reset();
+      return;
+   }
+
+   // check for new records (the database is append only so if it
+   // has shrunk it was replaced and we need to read it again)
+   uintmax_t size = databasePath_.size();
+   if (size == loadedSize_)
+      return;
+   else if (size < loadedSize_)
+      reset();
+
+   try
+   {
+      boost::iostreams::mapped_file_source file(databasePath_.absolutePath());
+      const char* begin = file.data();
+      const char* end = begin + file.size();
+      const char* pos = begin + loadedSize_;
+
+      // verify the header
+      if (loadedSize_ == 0)
+      {
+         if (file.size() < kDatabaseHeaderSize ||
+             std::memcmp(begin, kDatabaseHeader, kDatabaseHeaderSize) != 0)
+         {
+            LOG_WARNING_MESSAGE("Invalid history database " +
+                                databasePath_.absolutePath());
+            return;
+         }
+         pos += kDatabaseHeaderSize;
+      }
+
+      // read complete records (a partial record is one which is still
+      // being written, we'll read it next time)
+      while (static_cast<std::size_t>(end - pos) >= kRecordHeaderSize)
+      {
+         boost::uint32_t length;
+         double timestamp;
+         std::memcpy(&length, pos, sizeof(length));
+         std::memcpy(&timestamp, pos + sizeof(length), sizeof(timestamp));
+         if (static_cast<std::size_t>(end - pos) - kRecordHeaderSize < length)
+            break;
+
+         const char* command = pos + kRecordHeaderSize;
+         addEntry(timestamp, std::string(command, command + length));
+         pos = command + length;
+      }
+
+      loadedSize_ = pos - begin;
+   }
+   catch(const std::exception& e)
+   {
+      Error error = systemError(boost::system::errc::io_error,
+                                ERROR_LOCATION);
+      error.addProperty("what", e.what());
+      error.addProperty("path", databasePath_.absolutePath());
+      LOG_ERROR(error);
+   }
+}
+
+void HistoryArchive::reset()
+{
+   loadedSize_ = 0;
+   entries_.clear();
+   pTrieRoot_.reset(new HistoryTrieNode());
+   commands_.clear();
+   trigrams_.clear();
+}
+
+void HistoryArchive::addEntry(double timestamp, const std::string& command)
+{
+   int index = static_cast<int>(entries_.size());
+   entries_.push_back(HistoryEntry(index, timestamp, command));
+
+   // find (or insert) the command's node. the new entry is the most
+   // recent so it's the latest entry of every node along the way
+   HistoryTrieNode* pNode = pTrieRoot_.get();
+   pNode->latest = index;
+   std::size_t pos = 0;
+   while (pos < command.length())
+   {
+      // find the child sharing the next character
+      std::size_t i = 0;
+      for ( ; i < pNode->children.size(); i++)
+      {
+         if (pNode->children[i]->label[0] == command[pos])
+            break;
+      }
+
+      // none, add the rest of the command as a new child
+      if (i == pNode->children.size())
+      {
+         boost::shared_ptr<HistoryTrieNode> pChild(new HistoryTrieNode());
+         pChild->label = command.substr(pos);
+         pNode->children.push_back(pChild);
+         pNode = pChild.get();
+         pNode->latest = index;
+         break;
+      }
+
+      // split the child if the command diverges part way through its label
+      boost::shared_ptr<HistoryTrieNode> pChild = pNode->children[i];
+      std::size_t length = commonPrefixLength(pChild->label, command, pos);
+      if (length < pChild->label.length())
+      {
+         boost::shared_ptr<HistoryTrieNode> pSplit(new HistoryTrieNode());
+         pSplit->label = pChild->label.substr(0, length);
+         pSplit->latest = pChild->latest;
+         pChild->label.erase(0, length);
+         pSplit->children.push_back(pChild);
+         pNode->children[i] = pSplit;
+         pChild = pSplit;
+      }
+
+      pNode = pChild.get();
+      pNode->latest = index;
+      pos += length;
+   }
+
+   // record the entry (indexing the command the first time we see it)
+   pNode->entries.push_back(index);
+   if (pNode->commandId < 0)
+   {
+      pNode->commandId = static_cast<int>(commands_.size());
+      commands_.push_back(pNode);
+      addTrigrams(command, pNode->commandId);
+   }
+}
+
+void HistoryArchive::addTrigrams(const std::string& command, int commandId)
+{
+   if (command.length() < 3)
+      return;
+
+   std::vector<boost::uint32_t> keys;
+   keys.reserve(command.length() - 2);
+   for (std::size_t i = 0; i + 3 <= command.length(); i++)
+      keys.push_back(trigramKey(command, i));
+   std::sort(keys.begin(), keys.end());
+   keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+   BOOST_FOREACH(boost::uint32_t key, keys)
+   {
+      trigrams_[key].push_back(commandId);
+   }
+}
+
+// collect the most recent entries of the passed nodes' commands (and
+// optionally those of their subtrees). candidates are visited most
+// recent first so only as much of the trie as is needed to find
+// maxEntries matches is visited
+void HistoryArchive::collectRecent(
+                           const std::vector<const HistoryTrieNode*>& nodes,
+                           bool includeSubtrees,
+                           std::size_t maxEntries,
+                           bool uniqueOnly,
+                           std::vector<HistoryEntry>* pMatches) const
+{
+   std::priority_queue<Candidate> candidates;
+   BOOST_FOREACH(const HistoryTrieNode* pNode, nodes)
+   {
+      if (includeSubtrees)
+      {
+         if (pNode->latest >= 0)
+            candidates.push(Candidate(pNode->latest, pNode, -1));
+      }
+      else if (!pNode->entries.empty())
+      {
+         int pos = static_cast<int>(pNode->entries.size()) - 1;
+         candidates.push(Candidate(pNode->entries[pos], pNode, pos));
+      }
+   }
+
+   while (!candidates.empty() && pMatches->size() < maxEntries)
+   {
+      Candidate candidate = candidates.top();
+      candidates.pop();
+      const HistoryTrieNode* pNode = candidate.pNode;
+
+      // expand a node into its most recent entry and its children
+      if (candidate.pos < 0)
+      {
+         if (!pNode->entries.empty())
+         {
+            int pos = static_cast<int>(pNode->entries.size()) - 1;
+            candidates.push(Candidate(pNode->entries[pos], pNode, pos));
+         }
+         BOOST_FOREACH(const boost::shared_ptr<HistoryTrieNode>& pChild,
+                       pNode->children)
+         {
+            candidates.push(Candidate(pChild->latest, pChild.get(), -1));
+         }
+      }
+
+      // take an entry (and queue the command's previous entry)
+      else
+      {
+         pMatches->push_back(entries_[candidate.index]);
+         if (!uniqueOnly && candidate.pos > 0)
+         {
+            int pos = candidate.pos - 1;
+            candidates.push(Candidate(pNode->entries[pos], pNode, pos));
+         }
+      }
+   }
+}
+
+} // namespace history
+} // namespace modules
+} // namespace session
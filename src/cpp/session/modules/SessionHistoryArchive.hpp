@@ -0,0 +1,114 @@
+/*
+ * SessionHistoryArchive.hpp
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+
+#ifndef SESSION_HISTORY_ARCHIVE_HPP
+#define SESSION_HISTORY_ARCHIVE_HPP
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/utility.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <core/Error.hpp>
+#include <core/FilePath.hpp>
+
+namespace session {
+namespace modules {
+namespace history {
+
+struct HistoryEntry
+{
+   HistoryEntry() : index(0), timestamp(0) {}
+   HistoryEntry(int index, double timestamp, const std::string& command)
+      : index(index), timestamp(timestamp), command(command)
+   {
+   }
+   int index;
+   double timestamp;
+   std::string command;
+};
+
+struct HistoryTrieNode;
+
+// archive of all commands ever entered. the archive is stored in an
+// append-only binary file (which may also be appended to by other
+// sessions) and is held in memory along with the structures used to
+// search it. new entries (including those appended by other sessions)
+// are read and indexed incrementally
+class HistoryArchive : boost::noncopyable
+{
+public:
+   explicit HistoryArchive(const core::FilePath& databasePath);
+
+   // COPYING: boost::noncopyable
+
+   // append a command (timestamped with the current time)
+   core::Error add(const std::string& command);
+
+   // append entries (e.g. migrated from another history)
+   core::Error add(const std::vector<HistoryEntry>& entries);
+
+   // all entries (oldest first)
+   const std::vector<HistoryEntry>& entries();
+
+   // most recent entries (newest first) which contain all of the terms
+   void search(const std::vector<std::string>& terms,
+               std::size_t maxEntries,
+               std::vector<HistoryEntry>* pMatches);
+
+   // most recent entries (newest first) which begin with the prefix
+   void searchByPrefix(const std::string& prefix,
+                       std::size_t maxEntries,
+                       bool uniqueOnly,
+                       std::vector<HistoryEntry>* pMatches);
+
+private:
+   core::Error append(const std::string& records);
+   void refresh();
+   void reset();
+   void addEntry(double timestamp, const std::string& command);
+   void addTrigrams(const std::string& command, int commandId);
+
+   void collectRecent(const std::vector<const HistoryTrieNode*>& nodes,
+                      bool includeSubtrees,
+                      std::size_t maxEntries,
+                      bool uniqueOnly,
+                      std::vector<HistoryEntry>* pMatches) const;
+
+private:
+   core::FilePath databasePath_;
+
+   // bytes of the database read so far
+   uintmax_t loadedSize_;
+
+   std::vector<HistoryEntry> entries_;
+
+   // radix trie of commands (each distinct command has a node which
+   // records the indexes of its entries)
+   boost::shared_ptr<HistoryTrieNode> pTrieRoot_;
+
+   // distinct commands (by id) and the ids of the commands
+   // containing each trigram
+   std::vector<const HistoryTrieNode*> commands_;
+   typedef boost::unordered_map<boost::uint32_t, std::vector<int> > TrigramMap;
+   TrigramMap trigrams_;
+};
+
+} // namespace history
+} // namespace modules
+} // namespace session
+
+#endif // SESSION_HISTORY_ARCHIVE_HPP
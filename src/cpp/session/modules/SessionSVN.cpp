@@ -23,6 +23,7 @@
 #include <boost/bind.hpp>
 #include <boost/date_time.hpp>
 #include <boost/regex.hpp>
+#include <boost/thread/mutex.hpp>
 #include <core/BoostLamda.hpp>
 
 #include <core/FileSerializer.hpp>
@@ -31,6 +32,7 @@
 #include <core/system/Process.hpp>
 #include <core/system/ShellUtils.hpp>
 #include <core/Exec.hpp>
+#include <core/Thread.hpp>
 #include <core/http/Header.hpp>
 
 #include <session/projects/SessionProjects.hpp>
@@ -98,8 +100,52 @@ std::vector<FilePath> resolveAliasedPaths(const json::Array& paths,
    return results;
 }
 
+// the R-free rpc methods (e.g. list_files, which decorates files with
+// their svn status) run svn on worker threads. as with git those threads
+// can't read the environment, project context or svn exe path (the main
+// thread writes them) so they use a snapshot which the main thread
+// refreshes whenever these might have changed
+boost::thread::id s_mainThreadId;
+boost::mutex s_snapshotMutex;
+std::string s_svnExePathSnapshot;
+core::system::ProcessOptions s_procOptionsSnapshot;
+core::system::ProcessOptions s_sshProcOptionsSnapshot;
+
+bool isMainThread()
+{
+   // calls made before we are initialized are always on the main thread
+   return s_mainThreadId == boost::thread::id() ||
+          s_mainThreadId == boost::this_thread::get_id();
+}
+
+std::string svnExePath()
+{
+   if (isMainThread())
+      return s_svnExePath;
+
+   LOCK_MUTEX(s_snapshotMutex)
+   {
+      return s_svnExePathSnapshot;
+   }
+   END_LOCK_MUTEX
+
+   return std::string();
+}
+
 core::system::ProcessOptions procOptions(bool requiresSsh)
 {
+   if (!isMainThread())
+   {
+      LOCK_MUTEX(s_snapshotMutex)
+      {
+         return requiresSsh ? s_sshProcOptionsSnapshot
+                            : s_procOptionsSnapshot;
+      }
+      END_LOCK_MUTEX
+
+      return core::system::ProcessOptions();
+   }
+
    core::system::ProcessOptions options;
 
    // detach the session so there is no terminal
@@ -157,6 +203,20 @@ core::system::ProcessOptions procOptions()
    return procOptions(s_isSvnSshRepository);
 }
 
+void refreshSnapshot()
+{
+   core::system::ProcessOptions options = procOptions(false);
+   core::system::ProcessOptions sshOptions = procOptions(true);
+
+   LOCK_MUTEX(s_snapshotMutex)
+   {
+      s_svnExePathSnapshot = s_svnExePath;
+      s_procOptionsSnapshot = options;
+      s_sshProcOptionsSnapshot = sshOptions;
+   }
+   END_LOCK_MUTEX
+}
+
 void maybeAttachPasswordManager(boost::shared_ptr<ConsoleProcess> pCP)
 {
    if (s_isSvnSshRepository)
@@ -165,7 +225,7 @@ void maybeAttachPasswordManager(boost::shared_ptr<ConsoleProcess> pCP)
 
 ShellCommand svn()
 {
-   FilePath exePath(s_svnExePath);
+   FilePath exePath(svnExePath());
    return ShellCommand(exePath);
 }
 
@@ -540,6 +600,13 @@ std::string nonPathSvnBinDir()
 void onUserSettingsChanged()
 {
    initSvnBin();
+   refreshSnapshot();
+}
+
+void onDetectChanges(module_context::ChangeSource)
+{
+   // R code may have changed the environment
+   refreshSnapshot();
 }
 
 std::string translateItemStatus(const std::string& status)
@@ -1760,8 +1827,15 @@ Error augmentSvnIgnore()
 
 Error initialize()
 {
+   s_mainThreadId = boost::this_thread::get_id();
+
    initSvnBin();
 
+   // snapshot the environment for svn commands run on worker threads
+   // (and refresh it when it might change)
+   refreshSnapshot();
+   module_context::events().onDetectChanges.connect(onDetectChanges);
+
    // initialize password manager
    s_pPasswordManager.reset(new PasswordManager(
                          boost::regex("^(.+): $"),
@@ -1806,6 +1880,7 @@ Error initializeSvn(const core::FilePath& workingDir)
 
    std::string repoURL = repositoryRoot(s_workingDir);
    s_isSvnSshRepository = boost::algorithm::starts_with(repoURL, "svn+ssh");
+   refreshSnapshot();
 
    userSettings().onChanged.connect(onUserSettingsChanged);
 
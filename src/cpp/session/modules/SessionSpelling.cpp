@@ -17,6 +17,7 @@
 
 #include <core/Error.hpp>
 #include <core/Exec.hpp>
+#include <core/Thread.hpp>
 
 #include <core/spelling/HunspellSpellingEngine.hpp>
 
@@ -36,16 +37,23 @@ namespace spelling {
 
 namespace {
 
-// underlying spelling engine
+// underlying spelling engine (checks are made from rpc worker threads
+// as well as the main thread so access is synchronized)
 boost::scoped_ptr<core::spelling::SpellingEngine> s_pSpellingEngine;
+boost::mutex s_spellingEngineMutex;
 
 // R function for testing & debugging
 SEXP rs_checkSpelling(SEXP wordSEXP)
 {
-   bool isCorrect;
+   bool isCorrect = true;
    std::string word = r::sexp::asString(wordSEXP);
 
-   Error error = s_pSpellingEngine->checkSpelling(word, &isCorrect);
+   Error error;
+   LOCK_MUTEX(s_spellingEngineMutex)
+   {
+      error = s_pSpellingEngine->checkSpelling(word, &isCorrect);
+   }
+   END_LOCK_MUTEX
 
    // We'll return true here so as not to tie up the front end.
    if (error)
@@ -75,7 +83,12 @@ FilePath userDictionariesDir()
 
 void syncSpellingEngineDictionaries()
 {
-   s_pSpellingEngine->useDictionary(userSettings().spellingLanguage());
+   std::string langId = userSettings().spellingLanguage();
+   LOCK_MUTEX(s_spellingEngineMutex)
+   {
+      s_pSpellingEngine->useDictionary(langId);
+   }
+   END_LOCK_MUTEX
 }
 
 
@@ -87,6 +100,16 @@ core::spelling::HunspellDictionaryManager hunspellDictionaryManager()
    return dictManager;
 }
 
+// compiled dictionaries are shared by all of the user's sessions unless
+// a location shared with other users is configured
+FilePath compiledDictionariesDir()
+{
+   FilePath compiledDir = options().compiledDictionariesPath();
+   if (compiledDir.empty())
+      compiledDir = userDictionariesDir().childPath("compiled");
+   return compiledDir;
+}
+
 FilePath allLanguagesDir()
 {
    return module_context::userScratchPath().childPath(
@@ -102,7 +125,8 @@ Error checkSpelling(const json::JsonRpcRequest& request,
    if (error)
       return error;
 
-   json::Array misspelledIndexes;
+   std::vector<std::string> wordsVector;
+   std::vector<std::size_t> indexes;
    for (std::size_t i=0; i<words.size(); i++)
    {
       if (!json::isType<std::string>(words[i]))
@@ -111,14 +135,24 @@ Error checkSpelling(const json::JsonRpcRequest& request,
          continue;
       }
 
-      std::string word = words[i].get_str();
-      bool isCorrect = true;
-      error = s_pSpellingEngine->checkSpelling(word, &isCorrect);
-      if (error)
-         return error;
+      wordsVector.push_back(words[i].get_str());
+      indexes.push_back(i);
+   }
 
-      if (!isCorrect)
-         misspelledIndexes.push_back(static_cast<int>(i));
+   std::vector<bool> isCorrect;
+   LOCK_MUTEX(s_spellingEngineMutex)
+   {
+      error = s_pSpellingEngine->checkSpelling(wordsVector, &isCorrect);
+   }
+   END_LOCK_MUTEX
+   if (error)
+      return error;
+
+   json::Array misspelledIndexes;
+   for (std::size_t i=0; i<isCorrect.size(); i++)
+   {
+      if (!isCorrect[i])
+         misspelledIndexes.push_back(static_cast<int>(indexes[i]));
    }
 
    pResponse->setResult(misspelledIndexes);
@@ -135,7 +169,11 @@ Error suggestionList(const json::JsonRpcRequest& request,
       return error;
 
    std::vector<std::string> sugs;
-   error = s_pSpellingEngine->suggestionList(word, &sugs);
+   LOCK_MUTEX(s_spellingEngineMutex)
+   {
+      error = s_pSpellingEngine->suggestionList(word, &sugs);
+   }
+   END_LOCK_MUTEX
    if (error)
       return error;
 
@@ -153,7 +191,12 @@ Error getWordChars(const json::JsonRpcRequest& request,
                    json::JsonRpcResponse* pResponse)
 {
    std::wstring wordChars;
-   Error error = s_pSpellingEngine->wordChars(&wordChars);
+   Error error;
+   LOCK_MUTEX(s_spellingEngineMutex)
+   {
+      error = s_pSpellingEngine->wordChars(&wordChars);
+   }
+   END_LOCK_MUTEX
    if (error)
       return error;
 
@@ -299,7 +342,8 @@ Error initialize()
    HunspellSpellingEngine* pHunspell = new HunspellSpellingEngine(
                                              userSettings().spellingLanguage(),
                                              hunspellDictionaryManager(),
-                                             &r::util::iconvstr);
+                                             &r::util::iconvstr,
+                                             compiledDictionariesDir());
    s_pSpellingEngine.reset(pHunspell);
 
    // connect to user settings changed
@@ -310,9 +354,9 @@ Error initialize()
    using namespace module_context;
    ExecBlock initBlock ;
    initBlock.addFunctions()
-      (bind(registerRpcMethod, "check_spelling", checkSpelling))
-      (bind(registerRpcMethod, "suggestion_list", suggestionList))
-      (bind(registerRpcMethod, "get_word_chars", getWordChars))
+      (bind(registerRFreeRpcMethod, "check_spelling", checkSpelling))
+      (bind(registerRFreeRpcMethod, "suggestion_list", suggestionList))
+      (bind(registerRFreeRpcMethod, "get_word_chars", getWordChars))
       (bind(registerRpcMethod, "add_custom_dictionary", addCustomDictionary))
       (bind(registerRpcMethod, "remove_custom_dictionary", removeCustomDictionary))
       (bind(registerRpcMethod, "install_all_dictionaries", installAllDictionaries))
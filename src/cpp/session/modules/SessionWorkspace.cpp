@@ -16,8 +16,10 @@
 #include <algorithm>
 
 #include <boost/bind.hpp>
+#include <boost/foreach.hpp>
 #include <boost/format.hpp>
 #include <boost/utility.hpp>
+#include <boost/unordered_map.hpp>
 
 #include <core/Error.hpp>
 #include <core/Log.hpp>
@@ -57,109 +59,21 @@ bool handleRBrowseEnv(const core::FilePath& filePath)
    }
 }
 
-json::Value classOfGlobalVar(SEXP globalVar)
-{
-   std::string value;
-   Error error = r::exec::RFunction(".rs.getSingleClass",
-                                    globalVar).call(&value);
-   if (error)
-   {
-      LOG_ERROR(error);
-      return json::Value(); // return null
-   }
-   else
-   {
-      return value;
-   }
-}
-
-json::Value valueOfGlobalVar(SEXP globalVar)
-{
-   std::string value;
-   Error error = r::exec::RFunction(".rs.valueAsString",
-                                    globalVar).call(&value);
-   if (error)
-   {
-      LOG_ERROR(error);
-      return json::Value(); // return null
-   }
-   else
-   {
-      return value;
-   }
-}
-
-json::Value descriptionOfGlobalVar(SEXP globalVar)
-{
-   std::string value;
-   Error error = r::exec::RFunction(".rs.valueDescription",
-                                    globalVar).call(&value);
-   if (error)
-   {
-      LOG_ERROR(error);
-      return json::Value(); // return null
-   }
-   else
-   {
-      return value;
-   }
-}
-
-json::Value jsonValueForGlobalVar(const std::string& name)
-{
-   json::Object jsonObject ;
-   jsonObject["name"] = name;
-   
-   // get R alias to object and get its type and lengt
-   //
-   // NOTE: check for isLanguage is a temporary fix for error messages
-   // that were printed at the console for a <- bquote(test()) -- this
-   // was the result of errors being thrown from the .rs.valueDescription, etc.
-   // calls above used to probe for object info. interestingly when these
-   // same calls are made from .rs.rpc.list_objects no errors are thrown.
-   // the practical impact of this workaround is that immediately after
-   // assignment language expressions show up as "(unknown)" but then are
-   // correctly displayed in refreshed listings of the workspace.
-   //
-   SEXP globalVar = findVar(name);
-   if ((globalVar != R_UnboundValue) && !r::sexp::isLanguage(globalVar))
-   {
-      Protect rProtect(globalVar);
-      jsonObject["type"] = classOfGlobalVar(globalVar);
-      jsonObject["len"] = length(globalVar);
-      jsonObject["value"] = valueOfGlobalVar(globalVar);
-      jsonObject["extra"] = descriptionOfGlobalVar(globalVar);
-   }
-   else
-   {
-      jsonObject["type"] = std::string("<unknown>");
-      jsonObject["len"] = (int)0;
-      jsonObject["value"] = json::Value(); // null
-      jsonObject["extra"] = json::Value(); // null
-   }
-   
-   return jsonObject;
-}
-
 void enqueRefreshEvent()
 {
    ClientEvent refreshEvent(client_events::kWorkspaceRefresh);
    module_context::enqueClientEvent(refreshEvent);
 }
 
-void enqueRemovedEvent(const r::sexp::Variable& variable)   
+void enqueRemovedEvent(const std::string& name)
 {
-   ClientEvent removedEvent(client_events::kWorkspaceRemove, variable.first);
+   ClientEvent removedEvent(client_events::kWorkspaceRemove, name);
    module_context::enqueClientEvent(removedEvent);
 }
 
-void enqueAssignedEvent(const r::sexp::Variable& variable)
-{   
-   // get object info
-   json::Value objInfo = jsonValueForGlobalVar(variable.first);
-   
-   // enque event
-   ClientEvent assignedEvent(client_events::kWorkspaceAssign, objInfo);
+void enqueAssignedEvent(const json::Object& objectInfo)
+{
+   ClientEvent assignedEvent(client_events::kWorkspaceAssign, objectInfo);
    module_context::enqueClientEvent(assignedEvent);
 }
 
@@ -215,29 +129,41 @@ void onResume(const Settings& settings)
 }
 
 
-// detect changes in the environment by inspecting the list of variable
-// names as well as the SEXP pointers (a new pointer implies a mutation of
-// an object)
+// changes beyond which we send a single refresh event rather than an event
+// for each change
+const std::size_t kMaxChangeEvents = 100;
+
+// snapshot of the bindings of the global environment. changes are detected
+// by comparing the SEXP bound to each name with the one we saw last time (a
+// new pointer implies a mutation of an object). the info shown for objects
+// in the workspace pane is computed when it's first needed (in a single
+// call to R for all of the objects which need it) and is kept until their
+// binding changes. objects can also be modified in place (environments
+// always are, and R modifies vectors in place when it can) so listing the
+// objects (which the client does to refresh the pane) describes all of
+// them again
 class GlobalEnvironmentMonitor : boost::noncopyable
 {
 public:
    GlobalEnvironmentMonitor() 
-      : initialized_(false) 
+      : initialized_(false),
+        generation_(0)
    {
    }
    
    void reset()
    {
       initialized_ = false;
-      lastEnv_.clear();
+      bindings_.clear();
+      names_.clear();
    }
    
    void checkForChanges()
    {
-      // get the current environment
-      std::vector<r::sexp::Variable> currentEnv ;
-      listEnvironment(&currentEnv);
-      
+      bool wasEmpty = bindings_.empty();
+      std::vector<std::string> assigned, removed;
+      update(&assigned, &removed);
+
       // force refresh event the first time
       if (!initialized_)
       {
@@ -246,73 +172,201 @@ public:
       }
       
       // if there are changes
-      else if (currentEnv != lastEnv_)
+      else if (!assigned.empty() || !removed.empty())
       {      
-         // optimize for empty currentEnv (user reset workspace) or empty 
-         // lastEnv_ (startup) by just sending a single WorkspaceRefresh event
-         if (currentEnv.empty() || lastEnv_.empty())
+         // optimize for an empty environment (user reset workspace), a
+         // previously empty one (startup) or lots of changes (e.g. load) by
+         // just sending a single WorkspaceRefresh event
+         if (bindings_.empty() || wasEmpty ||
+             (assigned.size() + removed.size()) > kMaxChangeEvents)
          {
             enqueRefreshEvent();
          }
          else
          {
-            // find deletes (all variable names in the previous environment but
-            // NOT in the current environment)
-            std::vector<Variable> removedVars ;
-            std::set_difference(lastEnv_.begin(), lastEnv_.end(),
-                                currentEnv.begin(), currentEnv.end(),
-                                std::back_inserter(removedVars),
-                                boost::bind(
-                                  &GlobalEnvironmentMonitor::compareVarName,
-                                  this, _1, _2));
-                                
             // fire removed event for deletes
-            std::for_each(removedVars.begin(), 
-                          removedVars.end(), 
-                          enqueRemovedEvent);
-            
-            // find adds & assigns (all variable name/value combinations in the 
-            // current environment but NOT in the previous environment)
-            std::vector<Variable> addedVars ;
-            std::set_difference(currentEnv.begin(), currentEnv.end(),
-                                lastEnv_.begin(), lastEnv_.end(),
-                                std::back_inserter(addedVars));
-                                
+            std::for_each(removed.begin(), removed.end(), enqueRemovedEvent);
+
             // fire assigned event for adds & assigns
-            std::for_each(addedVars.begin(), 
-                          addedVars.end(), 
-                          enqueAssignedEvent);
+            describeObjects(assigned);
+            BOOST_FOREACH(const std::string& name, assigned)
+            {
+               enqueAssignedEvent(objectInfo(name));
+            }
          }
       }
-      
-      // set the "last environment" list to the current env
-      // note that the SEXP values within the currentEnv are not protected
-      // beyond the scope of this call. this is OK because we only reference
-      // the pointer values not the underlying R objects. if we want to be
-      // able to manipulate the SEXPs directly we'll need a static protection
-      // context so the objects are guaranteed to survive until the next call
-      lastEnv_ = currentEnv;
+   }
+
+   // info for all of the objects (as parallel arrays)
+   json::Object listObjects()
+   {
+      std::vector<std::string> assigned, removed;
+      update(&assigned, &removed);
+      invalidateObjectInfo();
+      describeObjects(names_);
+
+      json::Array names, types, lengths, values, extras;
+      BOOST_FOREACH(const std::string& name, names_)
+      {
+         json::Object info = objectInfo(name);
+         names.push_back(name);
+         types.push_back(info["type"]);
+         lengths.push_back(info["len"]);
+         values.push_back(info["value"]);
+         extras.push_back(info["extra"]);
+      }
+
+      json::Object objectsJson;
+      objectsJson["name"] = names;
+      objectsJson["type"] = types;
+      objectsJson["len"] = lengths;
+      objectsJson["value"] = values;
+      objectsJson["extra"] = extras;
+      return objectsJson;
    }
    
 private:
-   
-   void listEnvironment(std::vector<r::sexp::Variable>* pEnvironment)
+
+   struct Binding
+   {
+      Binding() : value(NULL), generation(0), hasInfo(false) {}
+
+      // note that the SEXP isn't protected beyond the scope of the call
+      // which found it. this is OK because we only reference the pointer
+      // value (other than while it is still bound)
+      SEXP value;
+      unsigned int generation;
+      bool hasInfo;
+      json::Object info;
+   };
+
+   // update the snapshot, returning the names which were added or assigned
+   // and the names which were removed
+   void update(std::vector<std::string>* pAssigned,
+               std::vector<std::string>* pRemoved)
    {
       // get the variables currently in the global environment (note this list
       // is guaranteed to be sorted based on the behavior of R_lsInternal)
+      std::vector<r::sexp::Variable> variables;
+      r::sexp::listEnvironment(R_GlobalEnv, false, NULL, &variables);
+
+      generation_++;
+      names_.clear();
+      names_.reserve(variables.size());
+      BOOST_FOREACH(const r::sexp::Variable& variable, variables)
+      {
+         names_.push_back(variable.first);
+
+         Binding& binding = bindings_[variable.first];
+         if (binding.value != variable.second)
+         {
+            binding.value = variable.second;
+            binding.hasInfo = false;
+            binding.info = json::Object();
+            pAssigned->push_back(variable.first);
+         }
+         binding.generation = generation_;
+      }
+
+      // find deletes (all the bindings we didn't see this time)
+      for (Bindings::iterator it = bindings_.begin(); it != bindings_.end(); )
+      {
+         if (it->second.generation != generation_)
+         {
+            pRemoved->push_back(it->first);
+            it = bindings_.erase(it);
+         }
+         else
+         {
+            ++it;
+         }
+      }
+      std::sort(pRemoved->begin(), pRemoved->end());
+   }
+
+   void invalidateObjectInfo()
+   {
+      for (Bindings::iterator it = bindings_.begin(); it != bindings_.end(); ++it)
+      {
+         it->second.hasInfo = false;
+         it->second.info = json::Object();
+      }
+   }
+
+   // compute the info for the objects which don't already have it
+   void describeObjects(const std::vector<std::string>& names)
+   {
+      std::vector<std::string> pending;
+      BOOST_FOREACH(const std::string& name, names)
+      {
+         Bindings::const_iterator it = bindings_.find(name);
+         if (it != bindings_.end() && !it->second.hasInfo)
+            pending.push_back(name);
+      }
+      if (pending.empty())
+         return;
+
       r::sexp::Protect rProtect;
-      r::sexp::listEnvironment(R_GlobalEnv, false, &rProtect, pEnvironment);   
+      SEXP infoSEXP;
+      Error error = r::exec::RFunction(".rs.describeObjects",
+                                       pending).call(&infoSEXP, &rProtect);
+      std::vector<std::string> types, values, extras;
+      std::vector<int> lengths;
+      if (!error)
+         error = getNamedListElement(infoSEXP, "type", &types);
+      if (!error)
+         error = getNamedListElement(infoSEXP, "len", &lengths);
+      if (!error)
+         error = getNamedListElement(infoSEXP, "value", &values);
+      if (!error)
+         error = getNamedListElement(infoSEXP, "extra", &extras);
+      if (!error && (types.size() != pending.size() ||
+                     lengths.size() != pending.size() ||
+                     values.size() != pending.size() ||
+                     extras.size() != pending.size()))
+      {
+         error = Error(r::errc::UnexpectedDataTypeError, ERROR_LOCATION);
+      }
+      if (error)
+      {
+         LOG_ERROR(error);
+         return;
+      }
+
+      for (std::size_t i = 0; i < pending.size(); i++)
+      {
+         Binding& binding = bindings_[pending[i]];
+         binding.info["name"] = pending[i];
+         binding.info["type"] = types[i];
+         binding.info["len"] = lengths[i];
+         binding.info["value"] = values[i];
+         binding.info["extra"] = extras[i];
+         binding.hasInfo = true;
+      }
    }
-   
-   // helper to deterine whether two variables have the same name
-   bool compareVarName(const Variable& var1, const Variable& var2)
+
+   json::Object objectInfo(const std::string& name)
    {
-      return var1.first < var2.first ;
+      Bindings::const_iterator it = bindings_.find(name);
+      if (it != bindings_.end() && it->second.hasInfo)
+         return it->second.info;
+
+      json::Object info;
+      info["name"] = name;
+      info["type"] = std::string("<unknown>");
+      info["len"] = (int)0;
+      info["value"] = json::Value(); // null
+      info["extra"] = json::Value(); // null
+      return info;
    }
    
 private:
-   std::vector<r::sexp::Variable> lastEnv_; 
-   bool initialized_ ;
+   typedef boost::unordered_map<std::string, Binding> Bindings;
+
+   bool initialized_;
+   unsigned int generation_;
+   Bindings bindings_;
+   std::vector<std::string> names_; // sorted
 };
 
 // global environment monitor
@@ -337,6 +391,13 @@ void onDetectChanges(module_context::ChangeSource source)
    checkForSaveActionChanged();
 }
 
+Error listObjects(const json::JsonRpcRequest& request,
+                  json::JsonRpcResponse* pResponse)
+{
+   pResponse->setResult(s_globalEnvironmentMonitor.listObjects());
+   return Success();
+}
+
 } // anonymous namespace
  
 Error initialize()
@@ -354,6 +415,7 @@ Error initialize()
    ExecBlock initBlock ;
    initBlock.addFunctions()
       (bind(registerRBrowseFileHandler, handleRBrowseEnv))
+      (bind(registerRpcMethod, "list_objects", listObjects))
       (bind(sourceModuleRFile, "SessionWorkspace.R"));
    return initBlock.execute();
 }
@@ -377,7 +377,7 @@ void ProjectContext::onDeferredInit(bool newSession)
 
 void ProjectContext::fileMonitorRegistered(
                               core::system::file_monitor::Handle handle,
-                              const tree<core::FileInfo>& files)
+                              const core::CompactFileTree& files)
 {
    // update state
    hasFileMonitor_ = true;
@@ -389,11 +389,12 @@ void ProjectContext::fileMonitorRegistered(
 void ProjectContext::fileMonitorFilesChanged(
                    const std::vector<core::system::FileChangeEvent>& events)
 {
+   // notify subscribers (do this first so that the vcs status used to
+   // decorate the events for the client reflects the changes)
+   onFilesChanged_(events);
+
    // notify client (gwt)
    module_context::enqueFileChangedEvents(directory(), events);
-
-   // notify subscribers
-   onFilesChanged_(events);
 }
 
 void ProjectContext::fileMonitorTermination(const Error& error)
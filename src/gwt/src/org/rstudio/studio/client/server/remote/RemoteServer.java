@@ -73,6 +73,7 @@ import org.rstudio.studio.client.workbench.views.plots.model.Point;
 import org.rstudio.studio.client.workbench.views.plots.model.SavePlotAsImageContext;
 import org.rstudio.studio.client.workbench.views.source.editors.text.IconvListResult;
 import org.rstudio.studio.client.workbench.views.source.model.CheckForExternalEditResult;
+import org.rstudio.studio.client.workbench.views.source.model.DataChunk;
 import org.rstudio.studio.client.workbench.views.source.model.RdShellResult;
 import org.rstudio.studio.client.workbench.views.source.model.RnwChunkOptions;
 import org.rstudio.studio.client.workbench.views.source.model.SourceDocument;
@@ -1210,6 +1211,36 @@ public class RemoteServer implements Server
       sendRequest(RPC_SCOPE, REMOVE_CONTENT_URL, contentUrl, requestCallback);
    }
 
+   public void removeDataViewer(String viewerId,
+                                ServerRequestCallback<Void> requestCallback)
+   {
+      sendRequest(RPC_SCOPE, REMOVE_DATA_VIEWER, viewerId, requestCallback);
+   }
+
+   public void getDataChunk(String viewerId,
+                            int startRow,
+                            int rowCount,
+                            int startColumn,
+                            int columnCount,
+                            int sortColumn,
+                            boolean sortDescending,
+                            int filterColumn,
+                            String filter,
+                            ServerRequestCallback<DataChunk> requestCallback)
+   {
+      JSONArray params = new JSONArray();
+      params.set(0, new JSONString(viewerId));
+      params.set(1, new JSONNumber(startRow));
+      params.set(2, new JSONNumber(rowCount));
+      params.set(3, new JSONNumber(startColumn));
+      params.set(4, new JSONNumber(columnCount));
+      params.set(5, new JSONNumber(sortColumn));
+      params.set(6, JSONBoolean.getInstance(sortDescending));
+      params.set(7, new JSONNumber(filterColumn));
+      params.set(8, new JSONString(StringUtil.notNull(filter)));
+      sendRequest(RPC_SCOPE, GET_DATA_CHUNK, params, requestCallback);
+   }
+
    public void detectFreeVars(String code,
                               ServerRequestCallback<JsArrayString> requestCallback)
    {
@@ -2802,6 +2833,8 @@ public class RemoteServer implements Server
    private static final String REVERT_DOCUMENT = "revert_document";
    private static final String REOPEN_WITH_ENCODING = "reopen_with_encoding";
    private static final String REMOVE_CONTENT_URL = "remove_content_url";
+   private static final String REMOVE_DATA_VIEWER = "remove_data_viewer";
+   private static final String GET_DATA_CHUNK = "get_data_chunk";
    private static final String DETECT_FREE_VARS = "detect_free_vars";
    private static final String ICONVLIST = "iconvlist";
    private static final String GET_TEX_CAPABILITIES = "get_tex_capabilities";
@@ -71,6 +71,7 @@ public class DataEditingTarget extends UrlContentEditingTarget
    {
       DataEditingTargetWidget view = new DataEditingTargetWidget(
             commands_,
+            server_,
             getDataItem());
       view.setSize("100%", "100%");
       progressPanel_.setWidget(view);
@@ -115,6 +116,7 @@ public class DataEditingTarget extends UrlContentEditingTarget
       clearDisplay();
       
       final String oldContentUrl = getContentUrl();
+      final String oldViewerId = getDataItem().getViewerId();
 
       HashMap<String, String> props = new HashMap<String, String>();
       data.fillProperties(props);
@@ -136,6 +138,7 @@ public class DataEditingTarget extends UrlContentEditingTarget
                               Debug.logError(error);
                            }
                         });
+                  removeDataViewer(oldViewerId);
 
                   data.fillProperties(doc_.getProperties());
                   reloadDisplay();
@@ -150,5 +153,28 @@ public class DataEditingTarget extends UrlContentEditingTarget
             });
    }
 
+   @Override
+   public void onDismiss()
+   {
+      super.onDismiss();
+      removeDataViewer(getDataItem().getViewerId());
+   }
+
+   private void removeDataViewer(String viewerId)
+   {
+      if (viewerId == null)
+         return;
+
+      server_.removeDataViewer(viewerId,
+                               new ServerRequestCallback<Void>() {
+
+                                  @Override
+                                  public void onError(ServerError error)
+                                  {
+                                     Debug.logError(error);
+                                  }
+                               });
+   }
+
    private SimplePanelWithProgress progressPanel_;
 }
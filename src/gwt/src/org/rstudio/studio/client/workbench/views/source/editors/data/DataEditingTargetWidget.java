@@ -13,19 +13,33 @@
 package org.rstudio.studio.client.workbench.views.source.editors.data;
 
 import com.google.gwt.core.client.GWT;
+import com.google.gwt.dom.client.Document;
+import com.google.gwt.dom.client.Element;
+import com.google.gwt.dom.client.NodeList;
+import com.google.gwt.dom.client.TableCellElement;
+import com.google.gwt.dom.client.TableElement;
+import com.google.gwt.dom.client.TableRowElement;
+import com.google.gwt.dom.client.TableSectionElement;
 import com.google.gwt.dom.client.Style.Unit;
+import com.google.gwt.event.dom.client.ClickEvent;
+import com.google.gwt.event.dom.client.ClickHandler;
 import com.google.gwt.resources.client.ClientBundle;
 import com.google.gwt.resources.client.CssResource;
 import com.google.gwt.user.client.ui.*;
 
 import org.rstudio.core.client.StringUtil;
 import org.rstudio.core.client.dom.IFrameElementEx;
+import org.rstudio.core.client.widget.HyperlinkLabel;
 import org.rstudio.core.client.widget.Toolbar;
+import org.rstudio.studio.client.server.ServerError;
+import org.rstudio.studio.client.server.ServerRequestCallback;
 import org.rstudio.studio.client.workbench.commands.Commands;
 import org.rstudio.studio.client.workbench.views.source.PanelWithToolbars;
 import org.rstudio.studio.client.workbench.views.source.editors.EditingTargetToolbar;
 import org.rstudio.studio.client.workbench.views.source.editors.urlcontent.UrlContentEditingTarget;
+import org.rstudio.studio.client.workbench.views.source.model.DataChunk;
 import org.rstudio.studio.client.workbench.views.source.model.DataItem;
+import org.rstudio.studio.client.workbench.views.source.model.SourceServerOperations;
 
 public class DataEditingTargetWidget extends Composite
    implements UrlContentEditingTarget.Display
@@ -44,6 +58,7 @@ public class DataEditingTargetWidget extends Composite
       String statusBar();
       String statusBarDisplayed();
       String statusBarOmitted();
+      String statusBarPage();
    }
 
    static
@@ -51,22 +66,39 @@ public class DataEditingTargetWidget extends Composite
       resources.styles().ensureInjected();
    }
 
-   public DataEditingTargetWidget(Commands commands, DataItem dataItem)
+   public DataEditingTargetWidget(Commands commands,
+                                  SourceServerOperations server,
+                                  DataItem dataItem)
    {
       Styles styles = resources.styles();
 
       commands_ = commands;
+      server_ = server;
+      viewerId_ = dataItem.getViewerId();
 
       frame_ = new Frame(dataItem.getContentUrl());
       frame_.setSize("100%", "100%");
 
       Widget mainWidget = frame_;
 
-      if (dataItem.getDisplayedObservations() != dataItem.getTotalObservations())
+      // the initial page holds the first rows and columns, the rest of the
+      // data is paged through (the data of an older session can't be)
+      totalRows_ = dataItem.getTotalObservations();
+      pageRows_ = Math.max(dataItem.getDisplayedObservations(), 1);
+      totalColumns_ = dataItem.getTotalColumns();
+      pageColumns_ = Math.max(dataItem.getDisplayedColumns(), 1);
+      boolean pageable = viewerId_ != null &&
+                         (totalRows_ > pageRows_ ||
+                          totalColumns_ > pageColumns_);
+
+      FlowPanel statusBar = null;
+      if (pageable)
       {
-         FlowPanel statusBar = new FlowPanel();
-         statusBar.setStylePrimaryName(styles.statusBar());
-         statusBar.setSize("100%", "100%");
+         statusBar = createPagingStatusBar(styles);
+      }
+      else if (dataItem.getDisplayedObservations() != dataItem.getTotalObservations())
+      {
+         statusBar = new FlowPanel();
          Label label1 = new Label(
                "Displayed "
                + StringUtil.formatGeneralNumber(dataItem.getDisplayedObservations())
@@ -83,6 +115,12 @@ public class DataEditingTargetWidget extends Composite
 
          statusBar.add(label1);
          statusBar.add(label2);
+      }
+
+      if (statusBar != null)
+      {
+         statusBar.setStylePrimaryName(styles.statusBar());
+         statusBar.setSize("100%", "100%");
 
          DockLayoutPanel dockPanel = new DockLayoutPanel(Unit.PX);
          dockPanel.addSouth(statusBar, 20);
@@ -99,6 +137,173 @@ public class DataEditingTargetWidget extends Composite
 
    }
 
+   private FlowPanel createPagingStatusBar(Styles styles)
+   {
+      FlowPanel statusBar = new FlowPanel();
+
+      rowsLabel_ = new Label();
+      rowsLabel_.addStyleName(styles.statusBarDisplayed());
+      previousRows_ = createPageLink("Previous", styles, -pageRows_, 0);
+      nextRows_ = createPageLink("Next", styles, pageRows_, 0);
+      statusBar.add(rowsLabel_);
+      statusBar.add(previousRows_);
+      statusBar.add(nextRows_);
+
+      columnsLabel_ = new Label();
+      columnsLabel_.addStyleName(styles.statusBarDisplayed());
+      columnsLabel_.addStyleName(styles.statusBarPage());
+      previousColumns_ = createPageLink("Previous", styles, 0, -pageColumns_);
+      nextColumns_ = createPageLink("Next", styles, 0, pageColumns_);
+      statusBar.add(columnsLabel_);
+      statusBar.add(previousColumns_);
+      statusBar.add(nextColumns_);
+
+      errorLabel_ = new Label();
+      errorLabel_.addStyleName(styles.statusBarOmitted());
+      statusBar.add(errorLabel_);
+
+      updatePagingStatus();
+      return statusBar;
+   }
+
+   private HyperlinkLabel createPageLink(String caption,
+                                         Styles styles,
+                                         final int rowOffset,
+                                         final int columnOffset)
+   {
+      HyperlinkLabel link = new HyperlinkLabel(caption, new ClickHandler()
+      {
+         public void onClick(ClickEvent event)
+         {
+            showPage(startRow_ + rowOffset, startColumn_ + columnOffset);
+         }
+      });
+      link.addStyleName(styles.statusBarOmitted());
+      return link;
+   }
+
+   private void showPage(int startRow, int startColumn)
+   {
+      // ignore clicks while a page is being fetched
+      if (loading_)
+         return;
+      loading_ = true;
+
+      server_.getDataChunk(
+            viewerId_,
+            Math.max(startRow, 0),
+            pageRows_,
+            Math.max(startColumn, 0),
+            pageColumns_,
+            -1,
+            false,
+            -1,
+            "",
+            new ServerRequestCallback<DataChunk>()
+            {
+               @Override
+               public void onResponseReceived(DataChunk chunk)
+               {
+                  loading_ = false;
+                  if (showChunk(chunk))
+                  {
+                     startRow_ = chunk.getStartRow();
+                     startColumn_ = chunk.getStartColumn();
+                     totalRows_ = chunk.getTotalRows();
+                     totalColumns_ = chunk.getTotalColumns();
+                     errorLabel_.setText("");
+                     updatePagingStatus();
+                  }
+               }
+
+               @Override
+               public void onError(ServerError error)
+               {
+                  loading_ = false;
+                  errorLabel_.setText(error.getUserMessage());
+               }
+            });
+   }
+
+   private void updatePagingStatus()
+   {
+      int endRow = Math.min(startRow_ + pageRows_, totalRows_);
+      rowsLabel_.setText("Rows "
+                         + StringUtil.formatGeneralNumber(startRow_ + 1)
+                         + "-"
+                         + StringUtil.formatGeneralNumber(endRow)
+                         + " of "
+                         + StringUtil.formatGeneralNumber(totalRows_));
+      previousRows_.setVisible(startRow_ > 0);
+      nextRows_.setVisible(endRow < totalRows_);
+
+      // columns are only paged when they don't all fit
+      boolean pageColumns = totalColumns_ > pageColumns_;
+      int endColumn = Math.min(startColumn_ + pageColumns_, totalColumns_);
+      columnsLabel_.setText("Columns "
+                            + StringUtil.formatGeneralNumber(startColumn_ + 1)
+                            + "-"
+                            + StringUtil.formatGeneralNumber(endColumn)
+                            + " of "
+                            + StringUtil.formatGeneralNumber(totalColumns_));
+      columnsLabel_.setVisible(pageColumns);
+      previousColumns_.setVisible(pageColumns && startColumn_ > 0);
+      nextColumns_.setVisible(pageColumns && endColumn < totalColumns_);
+   }
+
+   // replace the contents of the table in the frame with a chunk (in the
+   // same form as the initial page). returns false if there's no table
+   private boolean showChunk(DataChunk chunk)
+   {
+      IFrameElementEx frameEl = (IFrameElementEx) frame_.getElement().cast();
+      Document doc = frameEl.getContentWindow().getDocument();
+      NodeList<Element> tables = doc.getElementsByTagName("table");
+      if (tables.getLength() == 0)
+         return false;
+      TableElement table = tables.getItem(0).cast();
+
+      TableSectionElement thead = doc.createTHeadElement();
+      TableRowElement headerRow = doc.createTRElement();
+      TableCellElement origin = doc.createTDElement();
+      origin.setId("origin");
+      origin.setInnerText(NBSP);
+      headerRow.appendChild(origin);
+      for (int col = 0; col < chunk.getColumns().length(); col++)
+      {
+         TableCellElement th = doc.createTHElement();
+         th.setInnerText(chunk.getColumns().get(col));
+         headerRow.appendChild(th);
+      }
+      thead.appendChild(headerRow);
+
+      TableSectionElement tbody = doc.createTBodyElement();
+      for (int row = 0; row < chunk.getRowCount(); row++)
+      {
+         TableRowElement tr = doc.createTRElement();
+         TableCellElement rowNumber = doc.createTDElement();
+         rowNumber.setClassName("rn");
+         rowNumber.setInnerText(chunk.getRowNumber(row) + "");
+         tr.appendChild(rowNumber);
+         for (int col = 0; col < chunk.getColumns().length(); col++)
+         {
+            TableCellElement td = doc.createTDElement();
+            String value = chunk.getValue(row, col);
+            td.setInnerText(StringUtil.isNullOrEmpty(value) ? NBSP : value);
+            tr.appendChild(td);
+         }
+         tbody.appendChild(tr);
+      }
+
+      while (table.getFirstChild() != null)
+         table.removeChild(table.getFirstChild());
+      table.appendChild(thead);
+      table.appendChild(tbody);
+
+      doc.setScrollTop(0);
+      doc.setScrollLeft(0);
+      return true;
+   }
+
    private Toolbar createToolbar(DataItem dataItem, Styles styles)
    {
       Label description = new Label(
@@ -128,5 +333,25 @@ public class DataEditingTargetWidget extends Composite
    }
 
    private final Commands commands_;
+   private final SourceServerOperations server_;
+   private final String viewerId_;
    private Frame frame_;
+
+   // paging state (the page sizes are those of the initial page)
+   private final int pageRows_;
+   private final int pageColumns_;
+   private int totalRows_;
+   private int totalColumns_;
+   private int startRow_ = 0;
+   private int startColumn_ = 0;
+   private boolean loading_ = false;
+   private Label rowsLabel_;
+   private HyperlinkLabel previousRows_;
+   private HyperlinkLabel nextRows_;
+   private Label columnsLabel_;
+   private HyperlinkLabel previousColumns_;
+   private HyperlinkLabel nextColumns_;
+   private Label errorLabel_;
+
+   private static final String NBSP = "\u00A0";
 }
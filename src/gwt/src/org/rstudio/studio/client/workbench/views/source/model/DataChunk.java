@@ -0,0 +1,59 @@
+/*
+ * DataChunk.java
+ *
+ * Copyright (C) 2009-12 by RStudio, Inc.
+ *
+ * This program is licensed to you under the terms of version 3 of the
+ * GNU Affero General Public License. This program is distributed WITHOUT
+ * ANY EXPRESS OR IMPLIED WARRANTY, INCLUDING THOSE OF NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE. Please refer to the
+ * AGPL (http://www.gnu.org/licenses/agpl-3.0.txt) for more details.
+ *
+ */
+package org.rstudio.studio.client.workbench.views.source.model;
+
+import com.google.gwt.core.client.JavaScriptObject;
+import com.google.gwt.core.client.JsArrayString;
+
+// a window of the rows and columns of a data viewer (as returned by
+// get_data_chunk)
+public class DataChunk extends JavaScriptObject
+{
+   protected DataChunk()
+   {
+   }
+
+   public native final int getTotalRows() /*-{
+      return this.totalRows;
+   }-*/;
+
+   public native final int getTotalColumns() /*-{
+      return this.totalColumns;
+   }-*/;
+
+   public native final int getStartRow() /*-{
+      return this.startRow;
+   }-*/;
+
+   public native final int getStartColumn() /*-{
+      return this.startColumn;
+   }-*/;
+
+   public native final JsArrayString getColumns() /*-{
+      return this.columns;
+   }-*/;
+
+   public native final int getRowCount() /*-{
+      return this.rows.length;
+   }-*/;
+
+   // the (1-based) number of the row within the data
+   public native final int getRowNumber(int row) /*-{
+      return this.rows[row][0];
+   }-*/;
+
+   // null for missing values
+   public native final String getValue(int row, int column) /*-{
+      return this.rows[row][column + 1];
+   }-*/;
+}
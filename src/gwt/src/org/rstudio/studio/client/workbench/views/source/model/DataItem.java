@@ -67,6 +67,21 @@ public class DataItem extends JavaScriptObject
       return this.contentUrl;
    }-*/;
 
+   // columns of the table (the variables along with any row names) and
+   // how many of them the initial page shows
+   public native final int getTotalColumns() /*-{
+      return (this.totalColumns || this.variables) - 0;
+   }-*/;
+
+   public native final int getDisplayedColumns() /*-{
+      return (this.displayedVariables || this.variables) - 0;
+   }-*/;
+
+   // null for data shown by an older session
+   public native final String getViewerId() /*-{
+      return this.viewerId || null;
+   }-*/;
+
    public final void fillProperties(HashMap<String, String> properties)
    {
       // This has the unfortunate side-effect of converting the numeric values
@@ -78,6 +93,9 @@ public class DataItem extends JavaScriptObject
       properties.put("displayedObservations", getDisplayedObservations() + "");
       properties.put("variables", getVariables() + "");
       properties.put("contentUrl", getContentUrl());
+      properties.put("totalColumns", getTotalColumns() + "");
+      properties.put("displayedVariables", getDisplayedColumns() + "");
+      properties.put("viewerId", getViewerId());
    }
 
    public final void fillProperties(JsObject properties)
@@ -87,5 +105,8 @@ public class DataItem extends JavaScriptObject
       properties.setInteger("displayedObservations", getDisplayedObservations());
       properties.setInteger("variables", getVariables());
       properties.setString("contentUrl", getContentUrl());
+      properties.setInteger("totalColumns", getTotalColumns());
+      properties.setInteger("displayedVariables", getDisplayedColumns());
+      properties.setString("viewerId", getViewerId());
    }
 }
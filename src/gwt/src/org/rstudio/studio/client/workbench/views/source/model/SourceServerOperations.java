@@ -156,6 +156,29 @@ public interface SourceServerOperations extends FilesServerOperations,
    void removeContentUrl(String contentUrl,
                          ServerRequestCallback<Void> requestCallback);
 
+   /**
+    * Releases the data kept by the session for a data viewer (the data
+    * can no longer be paged through once its tab is closed).
+    */
+   void removeDataViewer(String viewerId,
+                         ServerRequestCallback<Void> requestCallback);
+
+   /**
+    * Gets a window of the rows and columns of a data viewer, in the order
+    * given by the sort column (-1 for none) and filter (a filter column of
+    * -1 matches the filter against all columns).
+    */
+   void getDataChunk(String viewerId,
+                     int startRow,
+                     int rowCount,
+                     int startColumn,
+                     int columnCount,
+                     int sortColumn,
+                     boolean sortDescending,
+                     int filterColumn,
+                     String filter,
+                     ServerRequestCallback<DataChunk> requestCallback);
+
    void detectFreeVars(String code,
                        ServerRequestCallback<JsArrayString> requestCallback);
 